@@ -0,0 +1,48 @@
+#ifndef ActuatorStore_h
+#define ActuatorStore_h
+
+#include <Arduino.h>
+#include "ControlService.h"
+
+#define ACTUATOR_STORE_MAX 16
+
+struct ActuatorSnapshot
+{
+    uint8_t formatVersion;
+    uint8_t count;
+    OutputAction outputs[ACTUATOR_STORE_MAX];
+};
+
+// Keeps LED and fan outputs across reboots.
+// Output changes are coalesced: the snapshot is written to NVS only once outputs have
+// been quiet for coalesceMs, and only if it differs from what is already stored, so
+// rapid toggling costs at most one flash write per burst.
+class ActuatorStore
+{
+private:
+    ControlService *cs;
+    const uint32_t coalesceMs = 2000;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    bool dirty = false;
+    uint32_t lastChangeMs = 0;
+
+    ActuatorSnapshot stored;     // What NVS currently holds
+    uint32_t writeCount = 0;
+    uint32_t skippedCount = 0;   // Flushes that found nothing new to write
+
+    void capture(ActuatorSnapshot &snapshot);
+    void onDeviceChange(const DeviceEntry &device);
+    void onTick(uint32_t nowMs);
+
+public:
+    ActuatorStore(ControlService *cs);
+
+    void restore();   // Re-apply the saved outputs, in setup() right after ControlService::configureOutputs()
+    void begin();     // Start tracking changes (after restore)
+
+    uint32_t getWriteCount() const { return writeCount; }
+    uint32_t getSkippedCount() const { return skippedCount; }
+};
+
+#endif // ActuatorStore_h
@@ -0,0 +1,75 @@
+#ifndef AdmissionController_h
+#define AdmissionController_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Admission control for the REST server.
+// AsyncWebServer accepts every connection and allocates for it (request, headers,
+// body, response) until the heap runs out and the device resets. Each request is
+// admitted here before its handler allocates. A request is refused with 503 and
+// Retry-After when too many of its class are in flight, or when the free heap or the
+// largest free block, less the memory reserved by requests already admitted, would
+// fall below the class's floor.
+//
+// Actuator commands win over telemetry reads: the read floor sits above the command
+// floor by the reservation of a full set of concurrent commands, so a read burst
+// sheds itself while commands still fit.
+//
+// A slot and its reservation are held until the request is freed (onDisconnect).
+// Diagnostics endpoints are not gated, so an overloaded node can still be inspected.
+// GET /api/diagnostics/admission reports the counters.
+
+enum AdmissionClass
+{
+    ADMISSION_COMMAND, // Changes outputs: commands, scenes, rules, thermostat
+    ADMISSION_READ,    // Telemetry and configuration reads
+    ADMISSION_CLASS_COUNT
+};
+
+enum AdmissionVerdict
+{
+    ADMIT,
+    REJECT_CONCURRENCY, // Class at its in-flight cap
+    REJECT_HEAP,        // Free heap below the class floor
+    REJECT_FRAGMENTED,  // Largest free block too small for the reservation
+    ADMISSION_VERDICT_COUNT
+};
+
+struct AdmissionLimits
+{
+    uint8_t maxInFlight;
+    uint32_t minFreeHeap;      // Bytes that must remain free after the reservation
+    uint32_t minLargestBlock;  // Largest free block needed, besides the reservation
+    uint32_t reserveBytes;     // Estimated allocation of a request, added to its body size
+    uint8_t retryAfterS;
+};
+
+class AdmissionController
+{
+private:
+    AdmissionLimits limits[ADMISSION_CLASS_COUNT];
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    uint8_t inFlight[ADMISSION_CLASS_COUNT] = {};
+    uint8_t peakInFlight[ADMISSION_CLASS_COUNT] = {};
+    uint32_t reservedBytes = 0; // Held by every request in flight
+    uint32_t verdicts[ADMISSION_CLASS_COUNT][ADMISSION_VERDICT_COUNT] = {};
+
+    AdmissionVerdict decide(AdmissionClass cls, uint32_t reserve, uint32_t freeHeap, uint32_t largestBlock);
+    void release(AdmissionClass cls, uint32_t reserve);
+    void reject(AsyncWebServerRequest *request, AdmissionClass cls, AdmissionVerdict verdict);
+
+public:
+    AdmissionController();
+
+    void setLimits(AdmissionClass cls, const AdmissionLimits &classLimits);
+
+    // Call before the handler allocates; on false a 503 was already sent
+    bool admit(AsyncWebServerRequest *request, AdmissionClass cls, size_t bodyBytes = 0);
+
+    static const char *className(AdmissionClass cls);
+    static const char *verdictName(AdmissionVerdict verdict);
+    String toJson();
+};
+
+#endif // AdmissionController_h
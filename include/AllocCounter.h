@@ -0,0 +1,22 @@
+#ifndef AllocCounter_h
+#define AllocCounter_h
+
+#include <stdint.h>
+
+// Counts heap allocations (malloc, calloc, realloc and everything built on them,
+// including operator new and String) per FreeRTOS task.
+// Enabled by -DALLOC_TRACKING and the linker wraps of env:esp32dev-diag; the default
+// images leave them out, enabled() is false and every count reads 0.
+//
+//   uint32_t before = AllocCounter::taskCount();
+//   ... handle request ...
+//   uint32_t allocations = AllocCounter::taskCount() - before;
+class AllocCounter
+{
+public:
+    static uint32_t taskCount(); // Allocations made so far by the calling task
+    static uint32_t total();     // Allocations made by all tasks
+    static bool enabled();
+};
+
+#endif // AllocCounter_h
@@ -0,0 +1,46 @@
+#ifndef BootTrace_h
+#define BootTrace_h
+
+#include <Arduino.h>
+
+// Boot timeline recorder.
+// Each init phase is timestamped with esp_timer (microseconds since startup). The
+// timeline lives in RTC memory that is not cleared on a warm reset, so the previous
+// boot's timeline can still be inspected after a watchdog or software restart.
+
+#define BOOT_TRACE_MAX_PHASES 24
+#define BOOT_TRACE_NAME_LEN 20
+
+struct BootPhase
+{
+    char name[BOOT_TRACE_NAME_LEN];
+    uint32_t startUs;
+    uint32_t endUs; // 0 while the phase is still open, equal to startUs for instant events
+};
+
+struct BootTimeline
+{
+    uint32_t magic;
+    uint32_t bootCount;   // Warm boots since the last power-on
+    uint8_t resetReason;  // esp_reset_reason() of this boot
+    uint8_t count;
+    BootPhase phases[BOOT_TRACE_MAX_PHASES];
+};
+
+class BootTrace
+{
+private:
+    static void init();
+
+public:
+    static int begin(const char *phase);   // Open a phase, returns its handle
+    static void end(int handle);           // Close a phase opened with begin()
+    static void mark(const char *event);   // Record an instant event (e.g. "wifi.connected")
+
+    static const BootTimeline &current();
+    static const BootTimeline *previous(); // nullptr after a cold boot
+
+    static String toJson();                // Current and previous timelines
+};
+
+#endif // BootTrace_h
@@ -0,0 +1,75 @@
+#ifndef CommandTrace_h
+#define CommandTrace_h
+
+#include <Arduino.h>
+
+// Per-request latency traces for /api/command/send.
+// Every stage of a request is stamped with esp_timer as an offset from its first body
+// byte, so a slow command can be attributed to receiving, parsing, device lookup, the
+// GPIO write or building the response. The last COMMAND_TRACE_SLOTS traces are kept in
+// a ring; each slot carries a sequence number that is odd while the slot is written,
+// so readers copy records without taking a lock and drop any copy that was torn.
+// A stamp is one esp_timer read and a store, cheap enough to stay on in production.
+
+#define COMMAND_TRACE_SLOTS 16
+#define COMMAND_TRACE_MAX_DEVICES 8
+#define COMMAND_TRACE_ID_LEN 40
+#define COMMAND_TRACE_NOT_REACHED UINT32_MAX
+
+enum CommandTraceStage
+{
+    TRACE_BODY_COMPLETE,  // Last body segment received
+    TRACE_PARSED,         // JSON deserialized
+    TRACE_COMMAND_START,  // handleCommand entered
+    TRACE_COMMIT_START,   // Devices resolved and staged, writing GPIO
+    TRACE_GPIO_WRITTEN,   // Outputs applied
+    TRACE_COMMIT_END,     // Change listeners notified
+    TRACE_COMMAND_END,    // handleCommand returned
+    TRACE_RESPONSE_READY, // Response serialized
+    TRACE_RESPONSE_SENT,  // Response handed to the TCP stack
+    TRACE_STAGE_COUNT
+};
+
+struct CommandTraceRecord
+{
+    volatile uint32_t sequence;             // Odd while the record is being written
+    uint32_t traceId;
+    const void *owner;                      // Request being traced, matches later body segments
+    uint32_t startMs;                       // millis() at the first body byte
+    uint32_t startUs;                       // esp_timer at the first body byte
+    uint32_t bodyBytes;
+    uint16_t status;                        // HTTP status sent
+    uint8_t deviceCount;                    // Devices seen, only the first COMMAND_TRACE_MAX_DEVICES have spans
+    uint32_t stageUs[TRACE_STAGE_COUNT];    // Offsets from startUs, COMMAND_TRACE_NOT_REACHED if skipped
+    uint32_t deviceStartUs[COMMAND_TRACE_MAX_DEVICES]; // Lookup, validation and staging of each device
+    uint32_t deviceEndUs[COMMAND_TRACE_MAX_DEVICES];
+    char requestId[COMMAND_TRACE_ID_LEN];   // X-Request-ID, or generated
+};
+
+class CommandTrace
+{
+public:
+    static CommandTraceRecord *open(const void *owner, const char *requestId, uint32_t bodyBytes); // At the first body byte
+    static CommandTraceRecord *find(const void *owner);  // Open trace of a request, nullptr if none
+    static void activate(CommandTraceRecord *record);    // Stages from deeper code (ControlService) go to this trace
+    static CommandTraceRecord *current();                // Active trace of the calling task
+    static void close(CommandTraceRecord *record, int status); // Publish to readers, deactivate
+
+    static void stage(CommandTraceStage stage);          // Stamp the calling task's active trace, no-op if none
+    static void deviceBegin();
+    static void deviceEnd();
+
+    static bool read(size_t newest, CommandTraceRecord &out); // Copy of the n-th newest finished trace
+    static size_t formatServerTiming(const CommandTraceRecord &record, char *out, size_t size);
+    static const char *stageName(CommandTraceStage stage);
+};
+
+// Times one device of a command, including every early exit from the loop body
+class CommandTraceDeviceScope
+{
+public:
+    CommandTraceDeviceScope() { CommandTrace::deviceBegin(); }
+    ~CommandTraceDeviceScope() { CommandTrace::deviceEnd(); }
+};
+
+#endif // CommandTrace_h
@@ -2,22 +2,18 @@
 #define ControlService_h
 
 #include <Arduino.h>
-#include <map>
-#include <string>
-#include <DHT.h> // Include DHT library
+#include <functional>
+#include <string.h>
 #include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "DeviceTable.h"
+#include "DhtRmtReader.h"
+#include "FanTachometer.h"
+#include "GpioBatch.h"
 
 class SerialService; // Forward declaration
-
-// Define device types enum
-enum DeviceType
-{
-    PIN_TYPE_LED,
-    PIN_TYPE_FAN,
-    PIN_TYPE_DHT11, // DHT11 Temperature/Humidity Sensor
-    PIN_TYPE_PIR,   // PIR Motion Sensor
-    PIN_TYPE_OTHER
-};
+class PowerManager;
 
 // Structure to hold device information
 struct DeviceEntry
@@ -26,43 +22,163 @@ struct DeviceEntry
     int value;
     int mode;
     DeviceType type;
+    const char *areaId;
+    uint32_t version; // State version at this device's last change, see getStateVersion()
+    const DeviceConfig *config; // Row of the generated device table (channels, tach, parsed UUID)
+};
+
+// Every device in table order (config/devices.json); iterates like the vector it replaced
+class DeviceList
+{
+private:
+    DeviceEntry *const *entries;
+    size_t count;
+
+public:
+    DeviceList(DeviceEntry *const *entries, size_t count) : entries(entries), count(count) {}
+    DeviceEntry *const *begin() const { return entries; }
+    DeviceEntry *const *end() const { return entries + count; }
+    size_t size() const { return count; }
+    DeviceEntry *operator[](size_t index) const { return entries[index]; }
+};
+
+// A precompiled output change with the device already resolved to its pin.
+// Used wherever commands are stored and replayed later (scenes, rules).
+struct OutputAction
+{
+    uint8_t pin;
+    uint8_t kind;  // OUTPUT_ACTION_DIGITAL or OUTPUT_ACTION_FAN
+    uint8_t value; // Level (LOW/HIGH) or fan speed percentage
+};
+
+enum OutputActionKind
+{
+    OUTPUT_ACTION_DIGITAL,
+    OUTPUT_ACTION_FAN
 };
 
+// Result codes of compact command responses ("c"), 0 is success
+enum CommandCode
+{
+    CMD_OK = 0,
+    CMD_ERR_BAD_REQUEST = 1,       // Missing areaId, devices, deviceId or function
+    CMD_ERR_UNKNOWN_AREA = 2,
+    CMD_ERR_UNKNOWN_DEVICE = 3,
+    CMD_ERR_MISSING_PARAMETER = 4,
+    CMD_ERR_INVALID_PARAMETER = 5, // e.g. fan speed outside 0-100
+    CMD_ERR_UNKNOWN_FUNCTION = 6,
+    CMD_ERR_NOT_SUPPORTED = 7,     // Function does not apply to this device type
+    CMD_ERR_OUTPUT = 8,            // Output could not be staged
+    CMD_ERR_SENSOR = 9             // Sensor has no valid reading yet
+};
+
+// Called after an actuator changes state or a sensor reports a new value.
+// Runs on the task that caused the change, so listeners must return quickly.
+typedef std::function<void(const DeviceEntry &device)> DeviceChangeListener;
+
+// Called on the sampler task every sampler tick (100 ms) for time-based logic.
+// In low-power mode ticks come only with each sample, PIR edge or fan change.
+typedef std::function<void(uint32_t nowMs)> SamplerTickListener;
+
 class ControlService
 {
 private:
     SerialService *ss; // Pointer to SerialService
 
     // Device Management
-    std::map<std::string, std::map<std::string, DeviceEntry>> areaDevicesMap;
-    std::map<int, int> digitalPinStates; // Store digital pin states
-    std::map<int, int> fanSpeeds;        // Store fan speeds (percentage)
+    // Built in the constructor from the generated table (include/generated/SiteDevices.h),
+    // fixed arrays only, so static initialization allocates nothing and touches no driver
+    // (pins are set up in configureOutputs())
+    DeviceEntry devices[DEVICE_MAX];       // Runtime entries in table order
+    DeviceEntry *deviceRefs[DEVICE_MAX];   // Backs getDevices()
+    size_t deviceCount = 0;
+    int8_t pinDevice[DEVICE_GPIO_COUNT];   // Index into devices per GPIO, -1 if none
 
-    // PWM Configuration - ESP32 LEDC
-    const int pwmChannel = 0;         // LEDC channel (0-15)
+    // Cached state per GPIO
+    int digitalPinStates[DEVICE_GPIO_COUNT] = {}; // LED levels
+    int fanSpeeds[DEVICE_GPIO_COUNT] = {};        // Fan speeds (percentage)
+    bool pirStates[DEVICE_GPIO_COUNT] = {};       // Last sampled motion state
+
+    // PWM Configuration - ESP32 LEDC, one channel per fan assigned by tools/gen_devices.py
     const int pwmFrequencyHz = 25000; // PWM frequency (e.g., 25 kHz for fans)
     const int pwmResolutionBits = 8;  // PWM resolution (8 bits = 0-255)
 
-    // DHT Sensor Management
-    std::map<int, DHT *> dhtSensors; // Map of DHT sensor objects, key is pin number
+    // Sensor drivers per GPIO, created in begin() on the RMT channel / PCNT unit of the table
+    DhtRmtReader *dhtSensors[DEVICE_GPIO_COUNT] = {};
+    FanTachometer *fanTachs[DEVICE_GPIO_COUNT] = {}; // Key is the fan's PWM pin
+
+    // Sensor Sampling
+    const int samplerTickMs = 100;      // PIR polling period
+    const int dhtIntervalMs = 2000;     // DHT11 cannot be read more often than once per second
+    TaskHandle_t samplerTaskHandle = NULL;
+    PowerManager *volatile power = nullptr; // Set in low-power mode, the sampler then wakes on its schedule
+
+    // Sampler cost per tick, for /sensors
+    uint32_t pollPassUs = 0, pollPassMaxUs = 0;           // PIR and tach reads
+    uint32_t dhtPassUs = 0, dhtPassMaxUs = 0;             // Ticks that also read the DHTs (wall time, the task sleeps during capture)
+    uint32_t listenersPassUs = 0, listenersPassMaxUs = 0; // Tick listeners
+
+    // Change notification (append-only, filled during setup)
+    static const int maxChangeListeners = 8;
+    DeviceChangeListener changeListeners[maxChangeListeners];
+    volatile int changeListenerCount = 0;
+    static const int maxTickListeners = 4;
+    SamplerTickListener tickListeners[maxTickListeners];
+    volatile int tickListenerCount = 0;
+
+    // State versioning, bumped on every change so readers can cache serialized state
+    portMUX_TYPE versionLock = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t stateVersion = 0;
 
     void setupPWM(); // Configure PWM
-    void configurePins(); // Configure pin modes from device map
+    void configurePins(); // Configure pin modes from the device table
+    static void samplerTask(void *pvParameters); // Periodically refreshes cached sensor readings
+    void runSamplerPass(bool readDht);
+    void sampleSensors(bool readDht);
+    void notifyChange(DeviceEntry &device);
+    DeviceEntry *findDevice(const char *areaId, const char *deviceId); // nullptr if undeclared
+    size_t firstInArea(const char *areaId); // deviceCount if the area is unknown
+    int fanChannel(int pin); // LEDC channel of the fan on a GPIO, -1 if none
+    void buildSensorData(JsonDocument &responseDoc);
+    void stageAreaCommand(JsonObject command, JsonObject response, GpioBatch &batch, bool compact); // Validate one area's devices into the batch
+    void writeCompactState(const DeviceEntry &device, JsonObject out);
+    void printSensorDiagnostics();
 
 public:
     ControlService(SerialService *ss); // Constructor
     ~ControlService();                 // Destructor
 
-    void declarePin(const char *areaId, const char *deviceId, int value, int mode, DeviceType type); // Declare a device pin
+    void configureOutputs(); // Pin modes and fan PWM channels; first in setup(), before ActuatorStore::restore()
+    void begin(); // Start sensor drivers and the sampler task (call from setup())
     int getPinValue(const char *areaId, const char *deviceId);                                       // Get pin value for a device
     DeviceType getDeviceType(const char *areaId, const char *deviceId);                              // Get device type
-    void handleCommand(JsonDocument doc, JsonDocument &response);                                    // Handle JSON commands
+    void handleCommand(JsonDocument &doc, JsonDocument &response, bool compact = false);             // Handle JSON commands (single area or batch)
+    void commitBatch(GpioBatch &batch);                                                              // Apply staged outputs and update cached state
+    bool stageFanSpeed(GpioBatch &batch, int pin, int speedPercentage);                              // Stage a 0-100% fan speed into a batch
+    bool compileAction(const char *areaId, JsonObject device, OutputAction &action, String &error);  // Resolve a toggle/setspeed device command
+    bool stageAction(GpioBatch &batch, const OutputAction &action);                                  // Stage a precompiled action
     String getAllSensorDataJson();
+    size_t writeAllSensorDataJson(char *out, size_t size, ArduinoJson::Allocator *allocator); // Same document, no String or heap document
+
+    void addChangeListener(DeviceChangeListener listener);     // Subscribe to state and reading changes
+    void addTickListener(SamplerTickListener listener);        // Run periodic work on the sampler task
+    void setPowerManager(PowerManager *power) { this->power = power; } // Low-power mode: ticks follow its schedule
+    TaskHandle_t getSamplerTask() { return samplerTaskHandle; }
+    DeviceEntry *findDeviceByPin(int pin);                      // Lookup by GPIO, nullptr if undeclared
+    DeviceList getDevices() { return DeviceList(deviceRefs, deviceCount); }
+    void writeDeviceState(const DeviceEntry &device, JsonObject out); // Cached state/readings, no hardware access
+    static const char *deviceTypeName(DeviceType type);
+    uint32_t getStateVersion();                                  // Increases whenever any device changes
+    uint32_t getDeviceVersion(const DeviceEntry &device);        // Version of a device's last change
 
     bool toggle(int pin, int state);                                     // Toggle digital pin state
     bool controlFanSpeed(int pin, int speedPercentage);                  // Control fan speed using PWM
-    bool getDHT11Readings(int pin, float &temperature, float &humidity); // Read DHT11 sensor data
-    bool getPIRState(int pin, bool &motionDetected);                     // Read PIR sensor state
+    bool getDHT11Readings(int pin, float &temperature, float &humidity); // Last sampled DHT11 data (no sensor access)
+    unsigned long getDHT11SampleTime(int pin);                           // millis() of the last good DHT11 sample, 0 if none
+    bool getPIRState(int pin, bool &motionDetected);                     // Last sampled PIR sensor state
+    bool getDigitalState(int pin, int &level);                           // Cached output level of a declared LED
+    bool getFanSpeed(int pin, int &speedPercentage);                     // Cached speed of a declared fan
+    bool getFanRpm(int pin, uint32_t &rpm, bool &stalled);               // Measured speed, false if the fan has no tach input
 };
 
 #endif // ControlService_h
\ No newline at end of file
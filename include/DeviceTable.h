@@ -0,0 +1,136 @@
+#ifndef DeviceTable_h
+#define DeviceTable_h
+
+// Row type of the device table and the ESP32 pin rules it is checked against.
+//
+// The table itself is generated before every build by tools/gen_devices.py from
+// the site's config/devices.json into include/generated/SiteDevices.h: a
+// constexpr array kept in flash, with the UUIDs already parsed to bytes and the
+// LEDC/RMT/PCNT channels assigned. Every row is checked by the static_asserts
+// of DEVICE_TABLE_CHECK, so a config that cannot work on this chip stops the
+// build instead of misbehaving at boot.
+//
+// The checks are single-return constexpr functions so they also hold under C++11.
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEVICE_MAX 32           // Table rows ControlService has room for
+#define DEVICE_GPIO_COUNT 40    // GPIO 0-39
+#define DEVICE_UUID_BYTES 16
+#define DEVICE_LEDC_CHANNELS 16 // Fan PWM
+#define DEVICE_RMT_CHANNELS 8   // DHT11 capture
+#define DEVICE_PCNT_UNITS 8     // Fan tach counting
+
+enum DeviceType
+{
+    PIN_TYPE_LED,
+    PIN_TYPE_FAN,
+    PIN_TYPE_DHT11, // DHT11 Temperature/Humidity Sensor
+    PIN_TYPE_PIR,   // PIR Motion Sensor
+    PIN_TYPE_OTHER
+};
+
+struct DeviceConfig
+{
+    const char *areaId;                    // Ids as the JSON APIs use them
+    const char *deviceId;
+    uint8_t deviceUuid[DEVICE_UUID_BYTES]; // deviceId parsed at build time
+    DeviceType type;
+    int8_t pin;
+    uint8_t mode;                          // pinMode() mode
+    bool allowStrapping;                   // Pin or tach pin is a strapping pin, and the circuit keeps its boot level
+    int8_t ledcChannel;                    // FAN: PWM channel, -1 otherwise
+    int8_t rmtChannel;                     // DHT11: capture channel, -1 otherwise
+    int8_t tachPin;                        // FAN with a tach input, -1 otherwise
+    int8_t pcntUnit;                       // Counter unit of the tach input, -1 without one
+    uint8_t pulsesPerRev;                  // Tach pulses per revolution
+};
+
+// ESP32 GPIO capabilities
+constexpr bool gpioExists(int pin)
+{
+    return (pin >= 0 && pin <= 19) || (pin >= 21 && pin <= 23) || (pin >= 25 && pin <= 27) || (pin >= 32 && pin <= 39);
+}
+constexpr bool gpioIsFlash(int pin) { return pin >= 6 && pin <= 11; }            // Wired to the module's SPI flash
+constexpr bool gpioIsConsole(int pin) { return pin == 1 || pin == 3; }           // UART0, the serial console
+constexpr bool gpioIsInputOnly(int pin) { return pin >= 34 && pin <= 39; }       // No output driver, no pull resistors
+constexpr bool gpioIsStrapping(int pin)                                          // Sampled at reset to pick the boot mode
+{
+    return pin == 0 || pin == 2 || pin == 5 || pin == 12 || pin == 15;
+}
+constexpr bool gpioUsable(int pin) { return gpioExists(pin) && !gpioIsFlash(pin) && !gpioIsConsole(pin); }
+
+constexpr bool modeDrives(uint8_t mode) { return (mode & OUTPUT) == OUTPUT; }
+constexpr bool modePulls(uint8_t mode) { return (mode & (PULLUP | PULLDOWN)) != 0; }
+
+constexpr bool deviceModeFitsType(const DeviceConfig &device)
+{
+    return (device.type == PIN_TYPE_LED || device.type == PIN_TYPE_FAN) == modeDrives(device.mode);
+}
+
+constexpr bool deviceChannelsFitType(const DeviceConfig &device)
+{
+    return (device.type == PIN_TYPE_FAN) == (device.ledcChannel >= 0 && device.ledcChannel < DEVICE_LEDC_CHANNELS) &&
+           (device.type == PIN_TYPE_DHT11) == (device.rmtChannel >= 0 && device.rmtChannel < DEVICE_RMT_CHANNELS);
+}
+
+constexpr bool deviceTachValid(const DeviceConfig &device)
+{
+    return device.tachPin < 0 ? device.pcntUnit < 0
+                              : device.type == PIN_TYPE_FAN && gpioUsable(device.tachPin) && device.pulsesPerRev > 0 &&
+                                    device.pcntUnit >= 0 && device.pcntUnit < DEVICE_PCNT_UNITS &&
+                                    (!gpioIsStrapping(device.tachPin) || device.allowStrapping);
+}
+
+// Uniqueness across the table, counted from row i on
+constexpr int gpioUses(const DeviceConfig *table, size_t count, int pin, size_t i = 0)
+{
+    return i == count ? 0 : (table[i].pin == pin) + (table[i].tachPin == pin) + gpioUses(table, count, pin, i + 1);
+}
+
+constexpr int channelUses(const DeviceConfig *table, size_t count, const DeviceConfig &device, size_t i = 0)
+{
+    return i == count ? 0
+                      : (device.ledcChannel >= 0 && table[i].ledcChannel == device.ledcChannel) +
+                            (device.rmtChannel >= 0 && table[i].rmtChannel == device.rmtChannel) +
+                            (device.pcntUnit >= 0 && table[i].pcntUnit == device.pcntUnit) +
+                            channelUses(table, count, device, i + 1);
+}
+
+constexpr bool uuidEqual(const uint8_t *a, const uint8_t *b, size_t i = 0)
+{
+    return i == DEVICE_UUID_BYTES || (a[i] == b[i] && uuidEqual(a, b, i + 1));
+}
+
+constexpr int uuidUses(const DeviceConfig *table, size_t count, const uint8_t *uuid, size_t i = 0)
+{
+    return i == count ? 0 : uuidEqual(table[i].deviceUuid, uuid) + uuidUses(table, count, uuid, i + 1);
+}
+
+constexpr int channelsOf(const DeviceConfig &device)
+{
+    return (device.ledcChannel >= 0) + (device.rmtChannel >= 0) + (device.pcntUnit >= 0);
+}
+
+// Checks row i of a generated table; where names the row in the error message
+#define DEVICE_TABLE_CHECK(table, count, i, where)                                                                    \
+    static_assert(gpioExists(table[i].pin), where ": the ESP32 has no such GPIO");                                    \
+    static_assert(!gpioIsFlash(table[i].pin), where ": GPIO 6-11 are wired to the SPI flash");                        \
+    static_assert(!gpioIsConsole(table[i].pin), where ": GPIO 1 and 3 are the serial console");                       \
+    static_assert(deviceModeFitsType(table[i]), where ": LED and FAN need an output mode, sensors an input mode");     \
+    static_assert(!gpioIsInputOnly(table[i].pin) || !modeDrives(table[i].mode), where ": GPIO 34-39 are input only"); \
+    static_assert(!gpioIsInputOnly(table[i].pin) || !modePulls(table[i].mode),                                        \
+                  where ": GPIO 34-39 have no internal pull resistors, fit an external one");                         \
+    static_assert(!gpioIsStrapping(table[i].pin) || table[i].allowStrapping,                                          \
+                  where ": strapping pin, set allowStrapping if the circuit keeps its boot level");                   \
+    static_assert(deviceChannelsFitType(table[i]), where ": LEDC/RMT channel missing, out of range or not expected"); \
+    static_assert(deviceTachValid(table[i]), where ": tach pin unusable, or its counter unit is missing");            \
+    static_assert(gpioUses(table, count, table[i].pin) == 1, where ": GPIO already used by another device");          \
+    static_assert(table[i].tachPin < 0 || gpioUses(table, count, table[i].tachPin) == 1,                              \
+                  where ": tach GPIO already used by another device");                                                \
+    static_assert(channelUses(table, count, table[i]) == channelsOf(table[i]), where ": channel assigned twice");     \
+    static_assert(uuidUses(table, count, table[i].deviceUuid) == 1, where ": deviceId used twice");
+
+#endif // DeviceTable_h
@@ -0,0 +1,34 @@
+#ifndef DhtDecoder_h
+#define DhtDecoder_h
+
+// Pure DHT11/DHT22 pulse-train decoder.
+// Has no Arduino or ESP-IDF dependencies so recorded traces can be replayed on a host.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A single level/duration pair as captured by the RMT receiver
+struct DhtPulse
+{
+    uint8_t level;       // Line level during the pulse (0 = low, 1 = high)
+    uint16_t durationUs; // Pulse length in microseconds
+};
+
+enum DhtDecodeStatus
+{
+    DHT_DECODE_OK,
+    DHT_DECODE_NO_RESPONSE,  // Empty trace, the sensor never pulled the line low
+    DHT_DECODE_TOO_FEW_BITS, // Fewer than 40 data bits in the trace
+    DHT_DECODE_BAD_TIMING,   // A bit pulse was outside the protocol tolerances
+    DHT_DECODE_CHECKSUM      // Bytes decoded but the checksum did not match
+};
+
+// Decodes the 40 data bits of a DHT frame into 5 bytes (humidity, temperature, checksum)
+DhtDecodeStatus dhtDecodePulses(const DhtPulse *pulses, size_t count, uint8_t bytes[5]);
+
+// Converts a decoded DHT11 frame into degrees Celsius and relative humidity
+void dht11ConvertBytes(const uint8_t bytes[5], float &temperature, float &humidity);
+
+const char *dhtDecodeStatusName(DhtDecodeStatus status);
+
+#endif // DhtDecoder_h
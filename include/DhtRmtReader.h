@@ -0,0 +1,45 @@
+#ifndef DhtRmtReader_h
+#define DhtRmtReader_h
+
+#include <Arduino.h>
+#include <driver/rmt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include "DhtDecoder.h"
+
+// DHT11 reader that captures the sensor's pulse train with the RMT peripheral.
+// Unlike the Adafruit DHT library it never disables interrupts: the calling task
+// sleeps while the RMT hardware records the frame and is woken when it completes.
+class DhtRmtReader
+{
+private:
+    int pin;
+    rmt_channel_t channel;
+    RingbufHandle_t ringBuffer;
+    bool installed;
+
+    portMUX_TYPE lock;             // Guards the cached reading below
+    float temperature;
+    float humidity;
+    bool hasReading;
+    unsigned long lastReadMs;      // millis() of the last successful read
+    uint32_t lastDecodeUs;         // CPU time spent converting and decoding the last frame
+    uint32_t failureCount;         // Consecutive failed reads
+    DhtDecodeStatus lastStatus;
+
+public:
+    DhtRmtReader(int pin, int channel);
+    ~DhtRmtReader();
+
+    bool begin();                                            // Install the RMT receiver on the pin
+    DhtDecodeStatus read(uint32_t timeoutMs = 50);           // Trigger a read and wait for the capture to complete
+    bool getLastReading(float &temperature, float &humidity); // Last good reading, no sensor access
+
+    int getPin() const { return pin; }
+    unsigned long getLastReadMs();
+    uint32_t getLastDecodeUs();
+    uint32_t getFailureCount();
+    DhtDecodeStatus getLastStatus();
+};
+
+#endif // DhtRmtReader_h
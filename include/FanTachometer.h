@@ -0,0 +1,37 @@
+#ifndef FanTachometer_h
+#define FanTachometer_h
+
+#include <Arduino.h>
+#include <driver/pcnt.h>
+#include "TachWindow.h"
+
+// Fan tach input counted by a PCNT unit.
+// The hardware counts every pulse, the CPU only reads the counter once per sampler
+// tick, so the cost is the same regardless of fan speed or the number of fans.
+class FanTachometer
+{
+private:
+    int tachPin;
+    pcnt_unit_t unit;
+    bool installed;
+    int16_t lastCount;
+    unsigned long lastSampleMs;
+
+    portMUX_TYPE lock;           // Guards the window and published values
+    TachWindow window;
+    uint32_t publishedRpm;       // Last value reported through a change notification
+    bool publishedStalled;
+    unsigned long lastPublishMs;
+
+public:
+    FanTachometer(int tachPin, int unit, uint8_t pulsesPerRev);
+    ~FanTachometer();
+
+    bool begin();                                   // Configure the PCNT unit on the tach pin
+    bool sample(unsigned long nowMs, bool driven);  // Read the counter, true when RPM or stall state should be published
+    void getState(uint32_t &rpm, bool &stalled);
+
+    int getTachPin() const { return tachPin; }
+};
+
+#endif // FanTachometer_h
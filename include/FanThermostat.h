@@ -0,0 +1,67 @@
+#ifndef FanThermostat_h
+#define FanThermostat_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "ControlService.h"
+#include "PidController.h"
+
+#define THERMOSTAT_MAX_LOOPS 4
+
+// Persisted thermostat settings for one fan
+struct ThermostatConfig
+{
+    uint8_t formatVersion;
+    uint8_t enabled;
+    uint8_t fanPin;
+    uint8_t sensorPin;  // DHT11 providing the temperature
+    float targetCelsius;
+    float kp;
+    float ki;
+    float kd;
+    uint8_t minDuty;    // Lowest duty the fan runs reliably at, below it the fan is off
+    uint8_t maxDuty;
+    uint8_t spinUpDuty; // Kick applied for one sample when starting from standstill
+};
+
+// Closed-loop fan control: holds a temperature by driving a fan from a DHT11 reading.
+// The loop runs on the sampler task once per new DHT sample (every 2 s), so no setpoint
+// traffic is needed from the server. Setting the fan speed by any other means (REST,
+// MQTT, scenes, rules) takes the fan out of thermostat mode.
+//
+// {"areaId", "deviceId", "sensor": {"areaId", "deviceId"}, "target": 28.5,
+//  "kp": 8, "ki": 0.05, "kd": 0, "minDuty": 20, "maxDuty": 100, "spinUpDuty": 60}
+class FanThermostat
+{
+private:
+    struct Loop
+    {
+        ThermostatConfig config;
+        PidController pid;
+        unsigned long lastSampleMs; // DHT sample the loop last ran on
+        float lastTemperature;
+        uint8_t duty;               // Last duty written by the loop
+    };
+
+    ControlService *cs;
+    SemaphoreHandle_t mutex;
+    Loop loops[THERMOSTAT_MAX_LOOPS];
+    uint8_t loopCount = 0;
+
+    Loop *findLoop(uint8_t fanPin);
+    static void applyConfig(Loop &loop);
+    void persist(uint8_t index);
+    void onTick(uint32_t nowMs);
+    void onDeviceChange(const DeviceEntry &device);
+
+public:
+    FanThermostat(ControlService *cs);
+    ~FanThermostat();
+
+    void begin();                                       // Load saved loops and subscribe to the sampler
+    bool configure(JsonObject definition, String &error); // Create or update a fan's loop and engage it
+    bool disable(uint8_t fanPin);
+    void describe(JsonArray out);                       // Configuration and PID internals per loop
+};
+
+#endif // FanThermostat_h
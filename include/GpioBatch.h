@@ -0,0 +1,55 @@
+#ifndef GpioBatch_h
+#define GpioBatch_h
+
+#include <Arduino.h>
+
+// Collects digital and PWM output changes and applies them in one step.
+// Digital levels are folded into set/clear masks and committed with a single write to
+// each of the GPIO W1TS/W1TC registers, so every output in a batch switches at the same
+// instant instead of one digitalWrite() after another. PWM duties are written right after.
+// Builds without ESP-IDF register access (host builds) fall back to per-pin HAL calls.
+class GpioBatch
+{
+public:
+    struct DigitalWrite
+    {
+        uint8_t pin;
+        uint8_t level;
+    };
+
+    struct PwmWrite
+    {
+        uint8_t pin;
+        uint8_t channel;
+        uint32_t duty;
+        int tag; // Caller-defined value carried along (e.g. speed percentage)
+    };
+
+    static const size_t maxDigital = 40; // One entry per GPIO at most
+    static const size_t maxPwm = 16;     // One entry per LEDC channel at most
+
+private:
+    uint32_t setMaskLow = 0;   // GPIO 0-31
+    uint32_t clearMaskLow = 0;
+    uint32_t setMaskHigh = 0;  // GPIO 32-39, bit 0 = GPIO32
+    uint32_t clearMaskHigh = 0;
+
+    DigitalWrite digital[maxDigital];
+    size_t digitalCount = 0;
+    PwmWrite pwm[maxPwm];
+    size_t pwmCount = 0;
+
+public:
+    bool stageDigital(int pin, int level);                       // false if the pin cannot drive an output
+    bool stagePwm(int pin, int channel, uint32_t duty, int tag); // false if the channel is out of range
+    void commit();                                               // Apply everything staged, in one step
+    void clear();
+
+    bool empty() const { return digitalCount == 0 && pwmCount == 0; }
+    size_t getDigitalCount() const { return digitalCount; }
+    const DigitalWrite &getDigital(size_t index) const { return digital[index]; }
+    size_t getPwmCount() const { return pwmCount; }
+    const PwmWrite &getPwm(size_t index) const { return pwm[index]; }
+};
+
+#endif // GpioBatch_h
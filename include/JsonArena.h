@@ -0,0 +1,55 @@
+#ifndef JsonArena_h
+#define JsonArena_h
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for ArduinoJson documents.
+// The buffer is allocated once; documents built on it only move an offset forward and
+// reset() returns all of it in O(1), so per-request JSON work never touches the heap
+// and cannot fragment it. Requests that outgrow the arena fall back to the heap and are
+// counted in getOverflowCount() so the arena can be sized from field data.
+//
+// Not thread safe: give each task (or each long-lived owner) its own arena.
+class JsonArena : public ArduinoJson::Allocator
+{
+private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t offset = 0;
+    size_t lastBlock = SIZE_MAX; // Offset of the most recent block's header, it can grow in place
+    size_t highWater = 0;
+    uint32_t overflowCount = 0;
+
+    bool owns(void *ptr) const;
+
+public:
+    explicit JsonArena(size_t capacity);
+    ~JsonArena();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t newSize) override;
+
+    void reset(); // Release everything; documents using the arena must be gone
+
+    size_t used() const { return offset; }
+    size_t getCapacity() const { return capacity; }
+    size_t getHighWater() const { return highWater; }
+    uint32_t getOverflowCount() const { return overflowCount; }
+};
+
+// Resets an arena when it goes out of scope. Declare it before the documents that use
+// the arena so they are destroyed first.
+class JsonArenaScope
+{
+private:
+    JsonArena &arena;
+
+public:
+    explicit JsonArenaScope(JsonArena &arena) : arena(arena) {}
+    ~JsonArenaScope() { arena.reset(); }
+};
+
+#endif // JsonArena_h
@@ -3,36 +3,65 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "ControlService.h"
+#include "MqttTransport.h"
+
+class PowerManager;
 
 class MessageQueueService
 {
 private:
     ControlService *controlService;
     SerialService *serialService;
-    WiFiClient espClient;
-    PubSubClient mqttClient;
+    MqttTransport *mqttClient;    // Non-blocking, created in the constructor
+    uint8_t publishQos = 1;       // Sensor data is published at least once
     int publishIntervalMs;
     const char *mqttTopic;
-    const char *mqttBroker;
+    const char *mqttBroker;       // IPv4 address, the transport does not resolve names
     int mqttPort;
     const char *mqttUsername;
     const char *mqttPassword;
     TaskHandle_t taskHandle;
     bool isRunning;
-    std::function<String()> dataProviderFunction;
+    bool hasConnected = false; // First connect is recorded in the boot timeline
+    std::function<size_t(char *buffer, size_t size)> dataProviderFunction; // Writes the payload, returns its length (0 = skip)
+    char payloadBuffer[2048];
+
+    // Inbound subscriptions (registered during setup, subscribed on every connect)
+    struct Subscription
+    {
+        const char *topic;
+        std::function<void(const uint8_t *payload, unsigned int length)> handler;
+    };
+    static const int maxSubscriptions = 4;
+    Subscription subscriptions[maxSubscriptions];
+    int subscriptionCount = 0;
+    const int pollIntervalMs = 50; // How often the transport reads, writes and keeps the session alive
+
+    // Low-power mode: the task sleeps until the sampler opens a publish window
+    PowerManager *volatile power = nullptr;
+    const uint32_t radioWindowMs = 1000;    // Longest a publish window waits for PUBACKs
+    const uint32_t connectWindowMs = 5000;  // Window while the session is (re)connecting
+    const uint32_t keepAliveWakeMs = 5000;  // Idle wake for keep-alive pings and watchdog check-in
 
     static void taskFunction(void *pvParameters);
     void publishMessage();
-    void reconnect();
+    void runPublishWindow();
+    void onMessage(const char *topic, const uint8_t *payload, size_t length);
+    void printDiagnostics();
 
 public:
-    MessageQueueService(ControlService *cs, SerialService *ss, int intervalMs, const char *broker, int port, const char *topic, const char *username, const char *password, std::function<String()> dataProvider);
+    MessageQueueService(ControlService *cs, SerialService *ss, int intervalMs, const char *broker, int port, const char *topic, const char *username, const char *password, std::function<size_t(char *buffer, size_t size)> dataProvider);
     void start();
     void stop();
+    void subscribe(const char *topic, std::function<void(const uint8_t *payload, unsigned int length)> handler); // Call before start()
+    const MqttTransport::Stats &getStats() { return mqttClient->getStats(); }
+    bool isConnected() { return mqttClient->connected(); }
+    int getPublishIntervalMs() { return publishIntervalMs; }
+    void setPowerManager(PowerManager *power) { this->power = power; } // Publish only in windows opened by the sampler
+    void openPublishWindow();                                         // Wakes the task to publish now
     ~MessageQueueService();
 };
 
@@ -0,0 +1,49 @@
+#ifndef MqttCodec_h
+#define MqttCodec_h
+
+// Pure MQTT 3.1.1 packet encoder/decoder.
+// Has no Arduino, lwIP or POSIX dependencies; encoders write into caller buffers and
+// return the packet length, or 0 when the buffer is too small.
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum MqttPacketType
+{
+    MQTT_CONNECT = 1,
+    MQTT_CONNACK = 2,
+    MQTT_PUBLISH = 3,
+    MQTT_PUBACK = 4,
+    MQTT_SUBSCRIBE = 8,
+    MQTT_SUBACK = 9,
+    MQTT_PINGREQ = 12,
+    MQTT_PINGRESP = 13,
+    MQTT_DISCONNECT = 14
+};
+
+// Bit in the first byte of a PUBLISH marking a retransmission
+#define MQTT_PUBLISH_DUP 0x08
+
+size_t mqttConnectSize(const char *clientId, const char *username, const char *password);
+size_t mqttEncodeConnect(uint8_t *out, size_t size, const char *clientId, const char *username,
+                         const char *password, uint16_t keepAliveSec, bool cleanSession);
+
+size_t mqttPublishSize(const char *topic, size_t payloadLength, uint8_t qos);
+size_t mqttEncodePublish(uint8_t *out, size_t size, const char *topic, const uint8_t *payload,
+                         size_t payloadLength, uint8_t qos, uint16_t packetId);
+
+size_t mqttEncodePuback(uint8_t *out, size_t size, uint16_t packetId);
+size_t mqttEncodeSubscribe(uint8_t *out, size_t size, uint16_t packetId, const char *topic, uint8_t qos);
+size_t mqttEncodePingreq(uint8_t *out, size_t size);
+size_t mqttEncodeDisconnect(uint8_t *out, size_t size);
+
+// Reads a fixed header: 1 when complete, 0 when more bytes are needed, -1 when malformed
+int mqttParseFixedHeader(const uint8_t *data, size_t length, uint8_t &firstByte,
+                         uint32_t &remainingLength, size_t &headerSize);
+
+// Splits a PUBLISH body (after the fixed header) into topic, packet id and payload
+bool mqttParsePublish(uint8_t firstByte, const uint8_t *body, size_t bodyLength,
+                      const char *&topic, size_t &topicLength, uint16_t &packetId,
+                      const uint8_t *&payload, size_t &payloadLength);
+
+#endif // MqttCodec_h
@@ -0,0 +1,175 @@
+#ifndef MqttTransport_h
+#define MqttTransport_h
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+// Non-blocking MQTT 3.1.1 client over plain BSD sockets (lwIP on the ESP32, the host
+// stack on Linux), so it can be run against mosquitto or a fake broker on a PC.
+//
+// - publish() only encodes the packet into a bounded queue and never blocks
+// - loop() drives connect/reconnect, reads, keep-alive and writes; queued packets are
+//   packed into one segment-sized buffer so several small publishes leave in one TCP
+//   segment, larger ones are streamed straight from the queue
+// - QoS 1 publishes stay queued until PUBACK, with at most inflightWindow unacknowledged;
+//   they are resent with DUP after retryMs or a reconnect
+// - the broker is an IPv4 address: resolving a name (getaddrinfo) blocks for up to the
+//   DNS timeout, which loop() must never do
+//
+// Not thread safe: call everything from one task. Time is passed in by the caller.
+
+#define MQTT_QUEUE_BYTES 6144   // Encoded outgoing packets, QoS 1 ones until acknowledged
+#define MQTT_SEGMENT_BYTES 1436 // One TCP segment at lwIP's default MSS
+#define MQTT_CONTROL_BYTES 512  // CONNECT, SUBSCRIBE, PUBACK, PINGREQ waiting to be sent
+#define MQTT_RX_BYTES 512       // Largest inbound packet, bigger ones are skipped
+#define MQTT_MAX_SUBSCRIPTIONS 4
+#define MQTT_TOPIC_LEN 64
+
+class MqttTransport
+{
+public:
+    enum State
+    {
+        MQTT_STATE_DISCONNECTED,
+        MQTT_STATE_CONNECTING, // TCP connect in progress
+        MQTT_STATE_HANDSHAKE,  // CONNECT sent, waiting for CONNACK
+        MQTT_STATE_CONNECTED
+    };
+
+    struct Options
+    {
+        const char *host;        // Dotted IPv4 address, host names are not resolved
+        uint16_t port;
+        const char *clientId;
+        const char *username;
+        const char *password;
+        uint16_t keepAliveSec;
+        uint8_t inflightWindow;  // Unacknowledged QoS 1 publishes allowed at once
+        uint32_t retryMs;        // Resend an unacknowledged QoS 1 publish after this long
+        uint32_t reconnectMs;    // Delay between connection attempts
+        uint32_t connectTimeoutMs;
+    };
+
+    struct Stats
+    {
+        uint32_t queued;
+        uint32_t dropped;        // Queue full or packet larger than the queue
+        uint32_t acked;
+        uint32_t retransmits;
+        uint32_t segments;       // send() calls that completed a segment
+        uint32_t packetsSent;
+        uint32_t received;
+        uint32_t oversized;      // Inbound packets skipped because they exceed MQTT_RX_BYTES
+        uint32_t reconnects;
+        uint32_t latencyLastMs;  // publish() to PUBACK (QoS 1) or to the socket (QoS 0)
+        uint32_t latencyMaxMs;
+        uint32_t latencyTotalMs; // Over latencySamples, for the mean
+        uint32_t latencySamples;
+    };
+
+    typedef std::function<void(const char *topic, const uint8_t *payload, size_t length)> MessageHandler;
+    typedef std::function<void()> ConnectHandler;
+
+    MqttTransport(const Options &options);
+    ~MqttTransport();
+
+    bool publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint32_t nowMs); // false if dropped
+    bool subscribe(const char *topic);        // Kept and (re)subscribed on every connect, topic must outlive the transport
+    void onMessage(MessageHandler handler) { messageHandler = handler; }
+    void onConnect(ConnectHandler handler) { connectHandler = handler; }
+
+    void loop(uint32_t nowMs);                // Call often (every few tens of ms)
+    void disconnect();
+
+    State getState() const { return state; }
+    bool connected() const { return state == MQTT_STATE_CONNECTED; }
+    const Stats &getStats() const { return stats; }
+    size_t queuedBytes() const { return queueUsed; }
+    uint16_t queuedPackets() const { return recordCount; }
+    uint8_t inflight() const { return inflightCount; }
+    int lastError() const { return error; }   // errno or CONNACK return code of the last failure
+
+private:
+    // Queue record, followed by the encoded packet
+    struct Record
+    {
+        uint16_t length;
+        uint16_t packetId;
+        uint8_t qos;
+        uint8_t status;
+        uint16_t reserved;
+        uint32_t sentMs;
+        uint32_t queuedMs;
+    };
+
+    enum RecordStatus
+    {
+        RECORD_QUEUED,
+        RECORD_SENT, // QoS 1 waiting for PUBACK
+        RECORD_DONE
+    };
+
+    Options options;
+    State state = MQTT_STATE_DISCONNECTED;
+    int fd = -1;
+    int error = 0;
+    uint32_t stateSinceMs = 0;
+    uint32_t lastAttemptMs = 0;
+    bool attempted = false;
+    uint32_t lastTxMs = 0;
+    uint32_t lastRxMs = 0;
+    uint16_t nextPacketId = 1;
+
+    // Outgoing queue: records packed back to back, wrapping to the start when the tail
+    // does not fit (bip buffer), released in order from the head
+    alignas(4) uint8_t queue[MQTT_QUEUE_BYTES];
+    size_t queueHead = 0;
+    size_t queueTail = 0;
+    size_t queueWrapAt = SIZE_MAX; // End of data before the tail wrapped
+    size_t queueUsed = 0;
+    uint16_t recordCount = 0;
+    uint8_t inflightCount = 0;
+    size_t streamRecord = SIZE_MAX; // Record larger than a segment being written directly
+    size_t streamOffset = 0;
+
+    uint8_t control[MQTT_CONTROL_BYTES];
+    size_t controlLength = 0;
+
+    uint8_t segment[MQTT_SEGMENT_BYTES];
+    size_t segmentLength = 0;
+    size_t segmentSent = 0;
+
+    uint8_t rx[MQTT_RX_BYTES];
+    size_t rxLength = 0;
+    size_t rxSkip = 0; // Bytes left of an oversized packet
+
+    const char *subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+    uint8_t subscriptionCount = 0;
+
+    MessageHandler messageHandler;
+    ConnectHandler connectHandler;
+    Stats stats = {};
+
+    uint16_t takePacketId();
+    static size_t recordSize(size_t packetLength);
+    Record *recordAt(size_t offset) { return (Record *)(queue + offset); }
+    size_t nextRecord(size_t offset);
+    uint8_t *reserve(size_t packetLength, size_t &offset);
+    void releaseDone();
+    bool queueControl(const uint8_t *packet, size_t length);
+
+    void startConnect(uint32_t nowMs);
+    void checkConnect(uint32_t nowMs);
+    void closeSocket(int reason);
+    bool writeOut(uint32_t nowMs);
+    void fillSegment(uint32_t nowMs);
+    void markSent(Record *record, uint32_t nowMs);
+    void recordLatency(const Record *record, uint32_t nowMs);
+    bool readIn(uint32_t nowMs);
+    void handlePacket(uint8_t firstByte, const uint8_t *body, size_t length, uint32_t nowMs);
+    void handlePuback(uint16_t packetId, uint32_t nowMs);
+    void retransmitExpired(uint32_t nowMs);
+};
+
+#endif // MqttTransport_h
@@ -0,0 +1,86 @@
+#ifndef OtaStreamWriter_h
+#define OtaStreamWriter_h
+
+#include <Arduino.h>
+#include <mbedtls/md.h>
+
+// Streams a firmware image into the OTA partition.
+// - gzip images (detected by magic bytes) are inflated on the fly through the ROM
+//   inflater with one fixed 32 KB window, so the transfer stays compressed end to end
+// - a SHA-256 of the decompressed image is computed while writing and compared with
+//   the manifest before the new partition is marked bootable
+// - the manifest (size + digest) is verified against OTA_SIGNING_PUBKEY_PEM when that
+//   key is compiled in, and the declared size is checked against the partition up front
+//
+// Manifest headers sent with the upload:
+//   X-OTA-Size       decompressed image size in bytes
+//   X-OTA-SHA256     hex SHA-256 of the decompressed image
+//   X-OTA-Signature  base64 DER ECDSA/RSA signature over "<size>:<sha256 hex>"
+
+enum OtaError
+{
+    OTA_OK,
+    OTA_ERR_BAD_MANIFEST,  // Malformed size/digest/signature header
+    OTA_ERR_SIGNATURE,     // Missing or invalid manifest signature
+    OTA_ERR_TOO_LARGE,     // Declared size does not fit the OTA partition
+    OTA_ERR_NO_MEMORY,     // Could not allocate the inflate window
+    OTA_ERR_BEGIN,         // Update.begin() failed
+    OTA_ERR_DECOMPRESS,    // Corrupt gzip stream
+    OTA_ERR_WRITE,         // Flash write failed
+    OTA_ERR_SIZE_MISMATCH, // Decompressed size differs from the manifest
+    OTA_ERR_HASH_MISMATCH, // Decompressed SHA-256 differs from the manifest
+    OTA_ERR_COMMIT         // Update.end() failed
+};
+
+class OtaStreamWriter
+{
+private:
+    enum Encoding { ENCODING_DETECT, ENCODING_RAW, ENCODING_GZIP };
+
+    Encoding encoding;
+    bool active;
+    size_t declaredSize;        // 0 when no manifest size was sent
+    bool hasDigest;
+    uint8_t expectedDigest[32];
+    mbedtls_md_context_t sha;
+
+    size_t receivedBytes;       // Bytes received over the wire
+    size_t writtenBytes;        // Decompressed bytes written to flash
+
+    // gzip state
+    uint8_t magicPending;       // First byte held back while detecting the encoding
+    bool hasMagicPending;
+    uint8_t headerState;
+    uint8_t headerFlags;
+    uint16_t headerRemaining;
+    bool inflateDone;
+    void *inflator;             // tinfl_decompressor
+    uint8_t *window;            // TINFL_LZ_DICT_SIZE circular output window
+    size_t windowOffset;
+
+    OtaError verifyManifestSignature(const char *sizeText, const char *digestHex, const char *signatureB64);
+    OtaError writeDecompressed(const uint8_t *data, size_t len);
+    OtaError writeGzip(const uint8_t *data, size_t len);
+    int consumeGzipHeader(const uint8_t *&data, size_t &len); // -1 corrupt, 0 needs more input, 1 done
+    void releaseBuffers();
+
+public:
+    OtaStreamWriter();
+    ~OtaStreamWriter();
+
+    // Validates the manifest and opens the OTA partition; any argument may be NULL or empty
+    OtaError begin(const char *sizeText, const char *digestHex, const char *signatureB64);
+    OtaError write(const uint8_t *data, size_t len); // Feed the next chunk of the upload
+    OtaError finish();                               // Verify size and digest, then commit
+    void abort();
+
+    size_t received() const { return receivedBytes; }
+    size_t written() const { return writtenBytes; }
+    size_t expectedSize() const { return declaredSize; }
+    bool isCompressed() const { return encoding == ENCODING_GZIP; }
+
+    static const char *errorMessage(OtaError error);
+    static int httpStatus(OtaError error);
+};
+
+#endif // OtaStreamWriter_h
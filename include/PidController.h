@@ -0,0 +1,62 @@
+#ifndef PidController_h
+#define PidController_h
+
+// Pure PID controller used by the fan thermostat.
+// Has no Arduino or ESP-IDF dependencies so it can be exercised on a host against a
+// simulated plant; the caller supplies the measurement and the elapsed time.
+
+#include <stdint.h>
+
+enum PidDirection
+{
+    PID_DIRECT,  // Output rises when the measurement is below the setpoint (heater)
+    PID_REVERSE  // Output rises when the measurement is above the setpoint (fan, cooler)
+};
+
+struct PidConfig
+{
+    float kp;
+    float ki;        // Per second
+    float kd;        // Seconds
+    float outputMin;
+    float outputMax;
+    PidDirection direction;
+};
+
+// Internal state, exposed for diagnostics
+struct PidState
+{
+    float integral;            // Accumulated I term, already in output units
+    float lastMeasurement;
+    bool hasLastMeasurement;
+    float error;
+    float proportional;
+    float derivative;
+    float output;
+    bool saturated;            // Output was clamped on the last update
+};
+
+class PidController
+{
+private:
+    PidConfig config;
+    PidState state;
+
+public:
+    PidController();
+
+    void configure(const PidConfig &config); // Keeps the integral, clamped to the new range
+    void reset();                            // Clear integral and derivative history
+    float update(float setpoint, float measurement, float dtSeconds);
+
+    const PidConfig &getConfig() const { return config; }
+    const PidState &getState() const { return state; }
+};
+
+// Shapes a PID output into a fan duty (percent):
+// - below minDuty the fan cannot run reliably, so it is switched off
+// - starting from standstill, spinUpDuty is applied for one sample to overcome stiction
+// - the result never exceeds maxDuty
+int fanDutyFromPid(float output, int minDuty, int maxDuty, int spinUpDuty, bool running);
+
+#endif // PidController_h
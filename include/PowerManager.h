@@ -0,0 +1,85 @@
+#ifndef PowerManager_h
+#define PowerManager_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "ControlService.h"
+#include "MessageQueueService.h"
+#include "PowerScheduler.h"
+
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+// Build with -DLOW_POWER_MODE=1 (env:esp32dev-lowpower) for battery-powered nodes
+#ifndef LOW_POWER_MODE
+#define LOW_POWER_MODE 0
+#endif
+
+#define POWER_MAX_PIR_PINS 4
+
+// Low-power mode for battery nodes.
+// The Wi-Fi modem sleeps between DTIM beacons and, when the core is built with
+// tickless idle, esp_pm enters light sleep whenever every task is blocked. The
+// sampler task then wakes only for PowerScheduler jobs or a PIR edge (a GPIO wake
+// source), and opens the MQTT publish window on the same wake as sampling.
+// A running fan keeps the node out of light sleep: LEDC PWM and the PCNT tach
+// stop while the APB clock is off.
+//
+// Trade-offs: readings refresh every sampleMs instead of every 2 s, and MQTT
+// messages (scene triggers) arrive only during publish windows. HTTP keeps
+// working, delayed by up to one DTIM interval.
+//
+// GET /api/diagnostics/power and /power report the duty cycle and the estimated charge.
+class PowerManager
+{
+private:
+    ControlService *cs;
+    MessageQueueService *mq;
+    SerialService *ss;
+    PowerScheduler scheduler;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    bool enabled = false;
+    bool lightSleep = false;  // esp_pm accepted light_sleep_enable
+    bool fansRunning = false;
+
+    uint8_t pirPins[POWER_MAX_PIR_PINS];
+    uint8_t pirCount = 0;
+
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t noSleepLock = nullptr; // Held while a fan runs
+#endif
+
+    static const uint32_t sampleMs = 5000; // DHT read and tick listeners, publish interval should be a multiple
+
+    static TaskHandle_t samplerTask;          // Notified by PIR edges
+    static volatile bool externalWake;
+    static void IRAM_ATTR pirEdgeIsr(void *arg);
+
+    void configurePowerManagement();
+    void configurePirWake();
+    void armPirWake();
+    void onDeviceChange(const DeviceEntry &device);
+    void updateFanHold();
+    void printDiagnostics();
+
+public:
+    PowerManager(ControlService *cs, MessageQueueService *mq, SerialService *ss);
+
+    // Registers diagnostics; with lowPower, configures sleep and hands the sampler and
+    // publisher over to the scheduler. Call after cs.begin() and before mq.start()
+    void begin(AsyncWebServer *server, bool lowPower = LOW_POWER_MODE);
+    bool isEnabled() const { return enabled; }
+
+    // Sampler task
+    uint32_t beginWake();              // POWER_JOB_* due now
+    void endWake(uint32_t jobs);       // Re-arms PIR wakes, opens the publish window
+    uint32_t sleepMs();
+
+    // MQTT task
+    void setRadio(bool on);
+
+    String toJson();
+};
+
+#endif // PowerManager_h
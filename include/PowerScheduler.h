@@ -0,0 +1,93 @@
+#ifndef PowerScheduler_h
+#define PowerScheduler_h
+
+#include <stdint.h>
+
+// Wake-up planning and energy accounting for low-power mode.
+// Decides which periodic jobs run on each wake of the sampler task and how long it
+// may sleep afterwards. Publishing never wakes the node by itself: it rides on the
+// first sample wake at or after its due time, so the radio comes up once per batch.
+// A job due within coalesceMs of a wake runs early with it. Jobs stay on a fixed
+// grid from begin(), so running one early or late does not drift its period.
+//
+// Time is tracked per state (working, radio, idle with light sleep held off,
+// light sleep) and multiplied by an estimated supply current per state to give a
+// charge counter; the figures are estimates from datasheet currents, not a meter.
+//
+// Pure logic, time is passed in by the caller. Not thread safe.
+
+#define POWER_JOB_POLL (1u << 0)    // PIR/tach poll at the fast rate, only while light sleep is held off
+#define POWER_JOB_SAMPLE (1u << 1)  // DHT read and tick listeners
+#define POWER_JOB_PUBLISH (1u << 2) // MQTT publish window
+
+struct PowerSchedulerConfig
+{
+    uint32_t pollMs;     // Fast poll period while held awake (e.g. a fan is running)
+    uint32_t sampleMs;
+    uint32_t publishMs;
+    uint32_t coalesceMs; // Jobs due this soon run with the current wake
+    uint32_t maxSleepMs; // Longest sleep, so supervised tasks still check in
+
+    // Estimated supply current per state, in microamps
+    uint32_t activeUa;   // CPU working on a wake
+    uint32_t radioUa;    // Publish window, radio transmitting or receiving
+    uint32_t idleUa;     // Idle with light sleep held off, modem sleeping between DTIM beacons
+    uint32_t sleepUa;    // Light sleep, averaged over the DTIM beacon wakes
+};
+
+struct PowerStats
+{
+    uint32_t wakeups;         // Wakes that ran at least one job
+    uint32_t batchedWakeups;  // Wakes that sampled and published together
+    uint32_t externalWakeups; // Woken early by a PIR edge or a state change
+    uint64_t activeMs;
+    uint64_t radioMs;
+    uint64_t idleMs;
+    uint64_t sleepMs;
+    uint64_t chargeUaMs;      // Estimated charge drawn, microamp milliseconds
+
+    uint64_t totalMs() const { return activeMs + radioMs + idleMs + sleepMs; }
+    uint32_t dutyPermille() const;   // Share of time working or transmitting
+    uint32_t averageUa() const;
+    uint32_t chargeUah() const { return (uint32_t)(chargeUaMs / 3600000); }
+};
+
+class PowerScheduler
+{
+public:
+    void begin(const PowerSchedulerConfig &config, uint32_t nowMs);
+
+    uint32_t beginWake(uint32_t nowMs, bool external); // Jobs due now (POWER_JOB_*), enters the working state
+    void endWake(uint32_t nowMs);
+    uint32_t sleepMs(uint32_t nowMs) const;             // Until the next job that may wake the node, capped
+
+    void setHoldAwake(bool hold, uint32_t nowMs);       // Light sleep impossible; polls at the fast rate
+    void setRadio(bool on, uint32_t nowMs);
+    bool holdingAwake() const { return holdAwake; }
+
+    PowerStats stats(uint32_t nowMs) const;             // Accounted up to nowMs
+
+private:
+    enum Job
+    {
+        JOB_POLL,
+        JOB_SAMPLE,
+        JOB_PUBLISH,
+        JOB_COUNT
+    };
+
+    PowerSchedulerConfig config = {};
+    uint32_t period[JOB_COUNT] = {};
+    uint32_t next[JOB_COUNT] = {};
+    bool working = false;
+    bool radio = false;
+    bool holdAwake = false;
+    uint32_t accountedMs = 0;
+    PowerStats totals = {};
+
+    bool wakes(int job) const;          // May this job wake the node on its own
+    void account(uint32_t nowMs);       // Charge the time since the last transition to the current state
+    void addTime(PowerStats &stats, uint32_t elapsedMs) const;
+};
+
+#endif // PowerScheduler_h
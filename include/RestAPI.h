@@ -17,6 +17,15 @@
 #ifndef RestAPI_h
 #define RestAPI_h
 
+#include <OtaStreamWriter.h>
+#include <JsonArena.h>
+#include <StateSnapshot.h>
+#include <SceneService.h>
+#include <RuleEngine.h>
+#include <FanThermostat.h>
+#include <TaskTopology.h>
+#include <AdmissionController.h>
+
 #ifndef LED_BUILTIN
 #define LED_BUILTIN 2  // Built in LED pin for ESP32
 #endif
@@ -30,9 +39,20 @@ private:
     AsyncWebServer *server;
     SerialService *ss;
     ControlService *cs;
+    StateSnapshot snapshot;
+    SceneService *scenes;
+    RuleEngine *rules;
+    FanThermostat *thermostat;
 
     JsonDocument jsonDocument;
-    char buffer[1024];
+    char buffer[2048];     // Serialized command responses (async_tcp task only)
+    JsonArena requestArena; // Backs command request/response documents, reset after every request
+
+    TaskCpuMeter taskMeter; // Usage in /api/diagnostics/tasks covers the time since the previous call
+    AdmissionController admission; // Sheds requests with 503 before the heap runs out
+
+    OtaStreamWriter ota;
+    static const size_t maxCommandBodySize = 8192; // Largest accepted command/scene body
 
     bool otaResponseSent = false;
     unsigned long ota_progress_millis = 0;
@@ -42,11 +62,19 @@ private:
     // void onOTAEnd(bool success);
 
     void handleOTAUpload(AsyncWebServerRequest* request, String filename, size_t index, uint8_t* data, size_t len, bool final);
+    static bool wantsCompact(AsyncWebServerRequest *request);
+    bool admitBody(AsyncWebServerRequest *request, size_t index, size_t total);
+    bool collectBody(AsyncWebServerRequest *request, uint8_t *&data, size_t &len, size_t index, size_t total);
+    void sceneOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    void thermostatOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    void rulesOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    void tracesOnRequest(AsyncWebServerRequest *request);
 
 public:
-    RestAPI(ControlService *cs, SerialService *ss, AsyncWebServer *server);
+    RestAPI(ControlService *cs, SerialService *ss, AsyncWebServer *server, SceneService *scenes, RuleEngine *rules, FanThermostat *thermostat);
     ~RestAPI();
     void setupApi();
+    AdmissionController *getAdmission() { return &admission; } // For routes registered by other services
     void commandOnRequest(AsyncWebServerRequest *request);
     void commandOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
 };
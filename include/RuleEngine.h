@@ -0,0 +1,104 @@
+#ifndef RuleEngine_h
+#define RuleEngine_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "ControlService.h"
+
+#define RULE_MAX_COUNT 16
+#define RULE_MAX_CHAIN_DEPTH 4 // Rule actions triggering rules, deeper changes wait for the next tick
+
+enum RuleMetric
+{
+    RULE_METRIC_TEMPERATURE, // DHT11 degrees Celsius
+    RULE_METRIC_HUMIDITY,    // DHT11 relative humidity
+    RULE_METRIC_MOTION,      // PIR, 1 while motion is detected
+    RULE_METRIC_STATE,       // LED output level (0/1)
+    RULE_METRIC_SPEED        // Fan speed percentage
+};
+
+enum RuleOp
+{
+    RULE_OP_GT,
+    RULE_OP_GE,
+    RULE_OP_LT,
+    RULE_OP_LE,
+    RULE_OP_EQ,
+    RULE_OP_NE
+};
+
+// Table form of one rule: everything is resolved to pins and enums at upload time
+struct CompiledRule
+{
+    uint8_t sourcePin;
+    uint8_t metric;       // RuleMetric
+    uint8_t op;           // RuleOp
+    uint8_t hasOtherwise; // Apply 'otherwise' when the rule releases
+    float threshold;
+    float hysteresis;     // Extra margin the value must cross before the rule releases
+    uint32_t holdMs;      // Keep 'then' applied this long after the condition clears
+    OutputAction then;
+    OutputAction otherwise;
+};
+
+struct RuleTable
+{
+    uint8_t formatVersion;
+    uint8_t count;
+    CompiledRule rules[RULE_MAX_COUNT];
+};
+
+// Local automation evaluated on the device.
+// Rules are uploaded as JSON, compiled into a RuleTable and stored in NVS. They are
+// evaluated when their source device changes (not by polling) and drive outputs
+// directly through ControlService, so they keep working without the network.
+//
+// A rule set whose actions feed back into their own conditions (A->B->A, or a rule
+// driving its own source) is rejected when loaded.
+//
+// {"rules": [{"when": {"areaId", "deviceId", "metric": "motion", "op": "==", "value": 1},
+//             "then": {"areaId", "deviceId", "function": "toggle", "parameters": {"state": true}},
+//             "otherwise": {...}, "holdSeconds": 300, "hysteresis": 0.5}]}
+class RuleEngine
+{
+private:
+    struct RuleState
+    {
+        bool conditionTrue;
+        bool active;          // 'then' has been applied and not yet released
+        uint32_t releaseAtMs; // Pending release time while holding, 0 if none
+    };
+
+    ControlService *cs;
+    SemaphoreHandle_t mutex;
+    RuleTable table;
+    RuleState states[RULE_MAX_COUNT];
+    bool evaluateAllPending = false;
+    uint64_t deferredPins = 0; // Sources changed deeper than RULE_MAX_CHAIN_DEPTH, evaluated on the next tick
+
+    uint32_t evaluationCount = 0;
+    uint32_t lastEvaluationUs = 0;
+    uint32_t deferredCount = 0;
+
+    bool compileRule(JsonObject definition, CompiledRule &rule, String &error);
+    bool readMetric(const CompiledRule &rule, float &value);
+    void evaluate(uint8_t index, uint32_t nowMs, GpioBatch &batch);
+    void evaluateSource(uint8_t pin, uint32_t nowMs, GpioBatch &batch);
+    void commit(GpioBatch &batch);
+    static int findCycle(const RuleTable &table); // Index of a rule that can retrigger itself, -1 if none
+    void release(uint8_t index, GpioBatch &batch);
+    void onDeviceChange(const DeviceEntry &device);
+    void onTick(uint32_t nowMs);
+    void persist();
+
+public:
+    RuleEngine(ControlService *cs);
+    ~RuleEngine();
+
+    void begin();                                      // Load rules from NVS and subscribe to changes
+    bool load(JsonObject definition, String &error);   // Replace the rule set
+    void clear();
+    void describe(JsonObject out);                     // Rules with their runtime state
+};
+
+#endif // RuleEngine_h
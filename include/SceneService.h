@@ -0,0 +1,49 @@
+#ifndef SceneService_h
+#define SceneService_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "ControlService.h"
+
+#define SCENE_MAX_COUNT 16
+#define SCENE_MAX_ACTIONS 24
+#define SCENE_NAME_LEN 24
+
+struct CompiledScene
+{
+    uint8_t formatVersion;
+    char name[SCENE_NAME_LEN];
+    uint8_t actionCount;
+    OutputAction actions[SCENE_MAX_ACTIONS];
+};
+
+// Named sets of device target states ("night", "away", ...).
+// Scenes are defined in the same format as batch commands, compiled to a flat list of
+// pin actions when saved, and stored in NVS. Triggering a scene by ID stages that list
+// straight into a GpioBatch: no JSON parsing and no device lookups on the hot path.
+class SceneService
+{
+private:
+    ControlService *cs;
+    SemaphoreHandle_t mutex;
+    CompiledScene scenes[SCENE_MAX_COUNT];
+    bool defined[SCENE_MAX_COUNT];
+
+    bool compile(JsonObject definition, CompiledScene &scene, String &error);
+    void persist(uint8_t sceneId);
+
+public:
+    SceneService(ControlService *cs);
+    ~SceneService();
+
+    void begin();                                                   // Load saved scenes from NVS
+    bool define(JsonObject definition, uint8_t &sceneId, String &error); // Compile, store and persist
+    bool remove(uint8_t sceneId);
+    bool trigger(uint8_t sceneId);                                  // Apply a scene in one batch
+    bool triggerFromPayload(const uint8_t *payload, size_t length); // Raw byte or ASCII decimal scene ID
+    void listScenes(JsonArray out);
+
+    static bool parseId(const char *text, uint8_t &sceneId); // ASCII decimal below SCENE_MAX_COUNT, nothing else
+};
+
+#endif // SceneService_h
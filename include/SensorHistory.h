@@ -0,0 +1,121 @@
+#ifndef SensorHistory_h
+#define SensorHistory_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "ControlService.h"
+#include "SeriesRing.h"
+#include "AdmissionController.h"
+
+#define HISTORY_MAX_CHANNELS 8
+#define HISTORY_RECORD_INTERVAL_MS 10000 // Raw sample period of every channel
+#define HISTORY_TIERS 3                  // Raw samples, 1-minute and 1-hour rollups
+
+enum HistoryMetric
+{
+    HISTORY_TEMPERATURE, // 0.1 degC
+    HISTORY_HUMIDITY,    // 0.1 %
+    HISTORY_MOTION,      // 1 if motion was seen during the sample period
+    HISTORY_FAN_RPM
+};
+
+// Sensor history for a single metric of one device
+struct HistoryChannel
+{
+    const DeviceEntry *device;
+    HistoryMetric metric;
+    SeriesRing *tiers[HISTORY_TIERS];
+    SeriesAggregate pending[HISTORY_TIERS - 1]; // Rollups still being accumulated
+    uint32_t pendingStart[HISTORY_TIERS - 1];
+    bool motionSeen;
+};
+
+class SensorHistory;
+
+// One streamed /api/history response; keeps a cursor per series so the range is
+// never materialized, and holds the history lock only while filling a chunk
+class HistoryQuery
+{
+private:
+    enum State
+    {
+        QUERY_HEADER,
+        QUERY_SERIES_OPEN,
+        QUERY_POINTS,
+        QUERY_SERIES_CLOSE,
+        QUERY_FOOTER,
+        QUERY_DONE
+    };
+
+    SensorHistory *history;
+    uint8_t channels[HISTORY_MAX_CHANNELS];
+    uint8_t channelCount;
+    uint8_t current = 0;
+    uint32_t now;
+    uint32_t from;
+    uint32_t requestedStep;
+    State state = QUERY_HEADER;
+
+    // Series being streamed
+    uint8_t tier;
+    uint32_t step;
+    SeriesRing::Cursor cursor;
+    SeriesAggregate bucket;
+    uint32_t bucketStart;
+    bool firstRow;
+    bool pendingAdded; // In-progress rollup appended after the stored points
+
+    char out[192];     // Next piece of JSON, copied into the response buffer
+    size_t outLength = 0;
+    size_t outOffset = 0;
+
+    void openSeries();
+    bool addPoint(uint32_t time, int32_t low, int32_t high, int32_t average); // true when a bucket row was written
+    void writeRow();
+    bool produce();
+
+public:
+    HistoryQuery(SensorHistory *history, const uint8_t *channels, uint8_t channelCount, uint32_t now, uint32_t from, uint32_t step);
+    size_t fill(uint8_t *buffer, size_t maxLen); // Chunked response callback, 0 when done
+};
+
+// Fixed-memory, compressed history of every sensor in ControlService.
+// Every channel is sampled every 10 s into a raw ring and folded into 1-minute and
+// 1-hour min/max/avg rollups, each kept in its own Gorilla-compressed ring: about
+// 6 h of raw samples, 24 h of minutes and 2 days of hours in ~3.6 KB per channel.
+// Timestamps are seconds since boot; history is lost on reboot.
+//
+// GET /api/history?device=<deviceId>[&areaId=][&metric=temperature|humidity|motion|rpm]
+//                  [&from=<uptime s, negative = seconds ago>][&step=<s>]
+// Streams [time, min, max, avg] rows per series, from the finest tier that reaches back
+// to 'from' and is no finer than 'step'.
+class SensorHistory
+{
+private:
+    friend class HistoryQuery;
+
+    ControlService *cs;
+    SemaphoreHandle_t mutex;
+    HistoryChannel channels[HISTORY_MAX_CHANNELS];
+    uint8_t channelCount = 0;
+    uint32_t nextRecordMs = 0;
+
+    void addChannel(const DeviceEntry *device, HistoryMetric metric);
+    bool sample(HistoryChannel &channel, int32_t &value);
+    void record(HistoryChannel &channel, uint32_t time, int32_t value);
+    void onTick(uint32_t nowMs);
+    void handleRequest(AsyncWebServerRequest *request);
+
+public:
+    static const uint32_t tierResolution[HISTORY_TIERS]; // Seconds per point
+    static const char *metricName(HistoryMetric metric);
+
+    SensorHistory(ControlService *cs);
+    ~SensorHistory();
+
+    // Creates channels for the declared sensors, registers /api/history (admitted as a read when given)
+    void begin(AsyncWebServer *server, AdmissionController *admission = nullptr);
+    size_t memoryBytes();
+};
+
+#endif // SensorHistory_h
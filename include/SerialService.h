@@ -6,22 +6,56 @@
 #define SerialService_h
 // SerialService
 
+#include <functional>
+#include <TaskTopology.h>
+
 class WifiManagerService;  // Forward declaration
 
+// Runs a shell command; argv holds the arguments after the command name
+typedef std::function<void(int argc, char **argv)> SerialCommandHandler;
+
+struct SerialCommand
+{
+    const char *name;        // One or more words, e.g. "/wifi reset"
+    const char *usage;       // Arguments, shown by /help
+    const char *description;
+    uint8_t minArgs;
+    uint8_t maxArgs;
+    SerialCommandHandler handler;
+};
+
 class SerialService
 {
 private:
     WifiManagerService *wm;
-    void commandHandler(String command);
+
+    // Command table (append-only, filled during setup)
+    static const int maxCommands = 24;
+    static const int maxTokens = 10; // Command name words plus arguments
+    static const size_t maxLineLength = 160;
+    SerialCommand commands[maxCommands];
+    int commandCount = 0;
+
+    TaskCpuMeter cpuMeter; // CPU % of /tasks covers the time since the previous /tasks
+
+    void registerBuiltinCommands();
+    void commandHandler(char *line);
     void recvMsg(uint8_t *data, size_t len);
+    void printHelp();
+    void printSystemInfo();
+    void printHeap();
+    void printTasks();
+
 public:
     SerialService(WifiManagerService *wm);
     ~SerialService();
     void Initialize(int baud, AsyncWebServer *server);
+    bool registerCommand(const char *name, const char *usage, const char *description,
+                         uint8_t minArgs, uint8_t maxArgs, SerialCommandHandler handler); // Call during setup
     void printToAll(const char *format, ...);
     void printToSerial(const char *format, ...);
     void printToWebSerial(const char *format, ...);
     void loop();
 };;
 
-#endif
\ No newline at end of file
+#endif
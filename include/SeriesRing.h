@@ -0,0 +1,102 @@
+#ifndef SeriesRing_h
+#define SeriesRing_h
+
+// Pure fixed-memory time-series store used by the sensor history.
+// Points are Gorilla-compressed: delta-of-delta timestamps and XOR-encoded values,
+// packed into a ring of fixed-size blocks. Each block starts with an uncompressed
+// point so it decodes on its own, and the oldest block is dropped when the ring wraps.
+// No Arduino or ESP-IDF dependencies: callers provide the locking and the clock.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERIES_MAX_FIELDS 3 // Values per point: 1 for samples, 3 (min, max, avg) for rollups
+
+struct SeriesPoint
+{
+    uint32_t time; // Seconds
+    int32_t values[SERIES_MAX_FIELDS];
+};
+
+// Running min/max/average, used for rollups and query downsampling
+struct SeriesAggregate
+{
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t count;
+
+    void reset() { count = 0; sum = 0; }
+    void add(int32_t low, int32_t high, int32_t average);
+    void add(int32_t value) { add(value, value, value); }
+    int32_t average() const;
+};
+
+class SeriesRing
+{
+private:
+    struct Block
+    {
+        uint32_t startTime;
+        uint32_t generation; // Changes whenever the block is reused, invalidates cursors
+        uint16_t bits;       // Bits written
+        uint16_t count;      // Points written
+    };
+
+    // Encoder state shared by the writer and each cursor
+    struct Codec
+    {
+        uint32_t time;
+        int32_t delta;
+        int32_t values[SERIES_MAX_FIELDS];
+        uint8_t leading[SERIES_MAX_FIELDS];  // XOR window of the last non-zero XOR
+        uint8_t trailing[SERIES_MAX_FIELDS];
+    };
+
+    uint8_t fields;
+    uint16_t blockBytes;
+    uint8_t blockCount;
+    uint8_t *data;
+    Block *blocks;
+    uint8_t head;       // Block being written
+    uint8_t used;       // Blocks holding data, head included
+    uint32_t nextGeneration;
+    Codec writer;
+
+    uint8_t slotAfter(uint8_t slot) const { return (uint8_t)((slot + 1) % blockCount); }
+    uint8_t oldestSlot() const { return (uint8_t)((head + blockCount - used + 1) % blockCount); }
+    void startBlock(uint8_t slot, uint32_t time);
+    uint16_t worstCaseBits() const;
+
+public:
+    // Read position; stays valid across appends and detects blocks evicted under it
+    struct Cursor
+    {
+        uint8_t slot;
+        uint32_t generation;
+        uint16_t index; // Next point within the block
+        uint16_t bit;
+        uint32_t from;  // Points before this are skipped
+        bool started;
+        Codec codec;
+    };
+
+    SeriesRing(uint8_t fields, uint16_t blockBytes, uint8_t blockCount);
+    ~SeriesRing();
+
+    void clear();
+    void append(uint32_t time, const int32_t *values); // Time must not go backwards
+    // Folds a sample into pending, the rollup of the period starting at pendingStart; a sample
+    // from a later period first appends the finished one here as (min, max, avg) at its start
+    void rollup(SeriesAggregate &pending, uint32_t &pendingStart, uint32_t resolution, uint32_t time, int32_t value);
+    bool empty() const { return used == 0 || (used == 1 && blocks[head].count == 0); }
+    uint32_t oldestTime() const;                       // Start of the oldest block, 0 if empty
+    uint32_t pointCount() const;
+    uint8_t fieldCount() const { return fields; }
+    size_t memoryBytes() const { return (size_t)blockBytes * blockCount + sizeof(Block) * blockCount; }
+
+    void seek(Cursor &cursor, uint32_t from) const;    // Position at the first point at or after from
+    bool next(Cursor &cursor, SeriesPoint &point) const; // false once the newest point was returned
+};
+
+#endif // SeriesRing_h
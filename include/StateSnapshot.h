@@ -0,0 +1,40 @@
+#ifndef StateSnapshot_h
+#define StateSnapshot_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <memory>
+#include "ControlService.h"
+
+// Pre-serialized, versioned snapshot of every device's state and last readings.
+// The JSON is rebuilt only when ControlService's state version moves, and served with
+// an ETag so pollers that already have the current version get an empty 304.
+//
+// GET /api/state              full snapshot (ETag / If-None-Match supported)
+// GET /api/state?since=<ver>[&boot=<bootId>]
+//                             only devices changed after <ver>; a full snapshot when
+//                             <bootId> (from a previous response) shows the device rebooted
+class StateSnapshot
+{
+private:
+    ControlService *cs;
+    SemaphoreHandle_t mutex;
+    std::shared_ptr<const String> body; // Immutable once built, shared with in-flight responses
+    uint32_t bodyVersion = 0;
+    uint32_t bootId;                    // Distinguishes versions across reboots
+    uint32_t rebuildCount = 0;
+
+    std::shared_ptr<const String> build(uint32_t since, uint32_t version);
+    void makeEtag(uint32_t version, char *out, size_t outLen);
+    void sendBody(AsyncWebServerRequest *request, std::shared_ptr<const String> json, const char *etag);
+
+public:
+    StateSnapshot(ControlService *cs);
+    ~StateSnapshot();
+
+    std::shared_ptr<const String> get(uint32_t &version); // Current full snapshot, rebuilt if stale
+    void handleRequest(AsyncWebServerRequest *request);
+    uint32_t getRebuildCount() { return rebuildCount; }
+};
+
+#endif // StateSnapshot_h
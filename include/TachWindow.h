@@ -0,0 +1,37 @@
+#ifndef TachWindow_h
+#define TachWindow_h
+
+// Pure sliding-window RPM estimator and stall detector for fan tachometers.
+// Fed with pulse counts per sampling interval, so it has no Arduino or ESP-IDF
+// dependencies and can be driven with synthetic pulse trains on a host.
+
+#include <stdint.h>
+
+#define TACH_WINDOW_SLOTS 10 // 1 s window at the 100 ms sampler tick
+
+class TachWindow
+{
+private:
+    uint16_t pulses[TACH_WINDOW_SLOTS];
+    uint16_t elapsedMs[TACH_WINDOW_SLOTS];
+    uint8_t head;
+    uint8_t filled;
+    uint32_t pulseSum;
+    uint32_t msSum;
+
+    uint8_t pulsesPerRev;
+    uint32_t stallRpm;     // Below this while driven counts as not turning
+    uint32_t stallDelayMs; // How long that must last, covers spin-up after a start
+    uint32_t lowForMs;
+    bool stalled;
+
+public:
+    TachWindow(uint8_t pulsesPerRev = 2, uint32_t stallRpm = 200, uint32_t stallDelayMs = 3000);
+
+    void reset();
+    void addSample(uint16_t pulseCount, uint16_t intervalMs, bool driven); // driven: duty > 0
+    uint32_t rpm() const;
+    bool isStalled() const { return stalled; }
+};
+
+#endif // TachWindow_h
@@ -0,0 +1,117 @@
+#ifndef TaskTopology_h
+#define TaskTopology_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Where every service task runs: core, priority, stack and whether the task
+// watchdog (TWDT) supervises it. Services create their tasks through spawn() and
+// check in once per loop, so placement is decided in one table per profile.
+//
+// TASK_PROFILE_BALANCED  the original layout: services share core 1 at low priority,
+//                        AsyncTCP floats at its library default (priority 10, any core).
+// TASK_PROFILE_ISOLATED  sensor sampling and the actuation it drives (rules, thermostat)
+//                        own core 1 at a priority nothing else there uses; networking
+//                        (AsyncTCP, MQTT, Wi-Fi connect) and the LCD stay on the Wi-Fi core.
+//
+// AsyncTCP creates its own task, so its placement can only be set with build flags
+// (CONFIG_ASYNC_TCP_RUNNING_CORE / _PRIORITY / _USE_WDT); the isolated profile refuses
+// to build unless those flags keep it on the Wi-Fi core. AsyncUDP's task is placed by
+// the prebuilt core's sdkconfig (CONFIG_ARDUINO_UDP_*) and is only reported.
+
+#define TASK_PROFILE_BALANCED 0
+#define TASK_PROFILE_ISOLATED 1
+
+#ifndef TASK_PROFILE
+#define TASK_PROFILE TASK_PROFILE_BALANCED
+#endif
+
+#ifndef TASK_WATCHDOG_TIMEOUT_S
+#define TASK_WATCHDOG_TIMEOUT_S 10 // Longest a supervised task may go without checkIn()
+#endif
+
+#if CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
+#define TASK_WIFI_CORE 1
+#else
+#define TASK_WIFI_CORE 0
+#endif
+
+#define TASK_NO_AFFINITY -1
+
+enum TaskRole
+{
+    TASK_ROLE_SAMPLER,        // ControlService sensor sampling, tick listeners
+    TASK_ROLE_MQTT,           // MessageQueueService transport and publishing
+    TASK_ROLE_WIFI_CONNECT,   // WifiManagerService connect and config portal
+    TASK_ROLE_LCD_SCROLL,     // IP and port on the LCD
+    TASK_ROLE_AP_CREDENTIALS, // Portal SSID and password on the LCD
+    TASK_ROLE_ASYNC_TCP,      // Library task, described here for reporting only
+    TASK_ROLE_ASYNC_UDP,      // Library task (UDP control endpoint), reporting only
+    TASK_ROLE_COUNT
+};
+
+struct TaskSpec
+{
+    const char *name;
+    int8_t core;        // TASK_NO_AFFINITY to let the scheduler pick
+    uint8_t priority;
+    uint32_t stackBytes;
+    bool watchdog;      // Subscribed to the TWDT; the task must checkIn() in time
+};
+
+// Per-task CPU share between two calls. FreeRTOS run-time stats give the share of
+// every task when the core is built with them; loops of managed tasks are timed
+// through checkIn() either way.
+class TaskCpuMeter
+{
+public:
+    struct Usage
+    {
+        TaskStatus_t status;
+        int16_t cpuPermille; // Share of one core since the last sample, -1 without run-time stats
+        int8_t role;         // TaskRole of a managed task, -1 otherwise
+    };
+
+    static bool runTimeStatsAvailable();
+
+    // Fills usage for every task, returns the count (0 if out of memory); the caller frees *usage
+    UBaseType_t sample(Usage **usage);
+    // Busy time a managed task reported through checkIn() since the last sample, per mille
+    uint16_t busyPermille(TaskRole role) const { return busy[role]; }
+
+private:
+    static const int maxTrackedTasks = 32;
+    struct TaskRunTime
+    {
+        void *handle;
+        uint32_t runTime;
+    };
+    TaskRunTime lastRunTimes[maxTrackedTasks];
+    int lastRunTimeCount = 0;
+    uint32_t lastTotalRunTime = 0;
+    uint64_t lastBusyUs[TASK_ROLE_COUNT] = {};
+    int64_t lastSampleUs = 0;
+    uint16_t busy[TASK_ROLE_COUNT] = {};
+};
+
+class TaskTopology
+{
+public:
+    static const char *profileName();
+    static const TaskSpec &spec(TaskRole role);
+
+    static void begin(); // Configure the TWDT, call early in setup()
+    static BaseType_t spawn(TaskRole role, TaskFunction_t function, void *parameter, TaskHandle_t *handle);
+    static void checkIn(TaskRole role, uint32_t busyUs); // Once per loop: feeds the TWDT, accounts busy time
+    static void retire(TaskHandle_t handle);             // Unsubscribe and delete, nullptr for the calling task
+    static void retireLoopTask();                        // Call from loop(): ends the idle Arduino loop task
+
+    static int roleOf(const char *taskName);             // TaskRole, -1 for tasks not in the table
+    static const char *roleName(TaskRole role);
+    static uint64_t busyUs(TaskRole role);
+    static bool isLibraryTask(TaskRole role) { return role == TASK_ROLE_ASYNC_TCP || role == TASK_ROLE_ASYNC_UDP; } // Never checks in
+    static String toJson(TaskCpuMeter &meter);           // Profile, table and per-task usage since the meter's last sample
+};
+
+#endif // TaskTopology_h
@@ -0,0 +1,40 @@
+#ifndef TelemetryStream_h
+#define TelemetryStream_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <vector>
+#include "ControlService.h"
+
+// Pushes device changes to dashboards over Server-Sent Events.
+// Every change is serialized once and broadcast to all subscribers, so the cost of
+// an extra dashboard is one more TCP write rather than one more sensor read.
+// Each client's outgoing queue is bounded; a client that falls behind is disconnected
+// and can reconnect (EventSource does so automatically) and resync from the snapshot.
+class TelemetryStream
+{
+private:
+    ControlService *cs;
+    AsyncEventSource events;
+    uint32_t eventId = 0;
+
+    std::vector<AsyncEventSourceClient *> clients; // Tracked to find and drop slow subscribers
+    SemaphoreHandle_t clientsMutex;
+
+    static const size_t maxPendingEvents = 6; // Per client, below SSE_MAX_QUEUED_MESSAGES
+    static const size_t maxClients = 8;
+    uint32_t droppedClients = 0;
+
+    void onDeviceChange(const DeviceEntry &device);
+    void dropSlowClients();
+
+public:
+    TelemetryStream(ControlService *cs);
+    ~TelemetryStream();
+
+    void begin(AsyncWebServer *server); // Registers /api/events and subscribes to ControlService
+    size_t clientCount();
+    uint32_t droppedClientCount() { return droppedClients; }
+};
+
+#endif // TelemetryStream_h
@@ -0,0 +1,97 @@
+#ifndef UdpControlCodec_h
+#define UdpControlCodec_h
+
+// Pure encoder/decoder for the binary UDP control protocol.
+// Only depends on mbedtls (HMAC-SHA256), so it builds on the host as well.
+// Multi-byte fields are big-endian.
+//
+// Request, 34 bytes (by index) or 48 bytes (by UUID):
+//    0  u8   version (UDP_CONTROL_VERSION)
+//    1  u8   opcode (UdpOpcode)
+//    2  u8   flags (UDP_FLAG_*)
+//    3  u8   argument: level 0/1, fan speed 0-100, ignored by INVERT/QUERY
+//    4  u32  client id, chosen by the client; sequences are tracked per client
+//    8  u32  sequence, increasing per client (wraps)
+//   12  u32  session nonce from the device's last ack, 0 before the first one
+//   16  u16  device index in config/devices.json order, or the 16 byte device UUID with UDP_FLAG_UUID
+//    .  16   HMAC-SHA256 of everything before it, truncated
+//
+// Ack, 36 bytes:
+//    0  u8   version
+//    1  u8   opcode | UDP_ACK_BIT
+//    2  u8   status (UdpStatus)
+//    3  u8   reserved, 0
+//    4  u32  client id (echoed)
+//    8  u32  sequence (echoed)
+//   12  u32  session nonce the client must send; with UDP_STATUS_RESYNC a new one
+//   16  u16  device index, UDP_NO_DEVICE when it did not resolve
+//   18  i16  device state after the command: level, fan speed, motion, or 0.1 degC
+//   20  16   HMAC-SHA256, truncated
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UDP_CONTROL_VERSION 1
+#define UDP_CONTROL_TAG_BYTES 16
+#define UDP_CONTROL_UUID_BYTES 16
+#define UDP_CONTROL_HEADER_BYTES 16
+#define UDP_CONTROL_MAX_REQUEST (UDP_CONTROL_HEADER_BYTES + UDP_CONTROL_UUID_BYTES + UDP_CONTROL_TAG_BYTES)
+#define UDP_CONTROL_ACK_BYTES 36
+
+#define UDP_FLAG_UUID 0x01 // Address the device by UUID instead of index
+#define UDP_ACK_BIT 0x80
+#define UDP_NO_DEVICE 0xFFFF
+
+enum UdpOpcode
+{
+    UDP_OP_SET = 1,       // Output to level (argument 0/1)
+    UDP_OP_INVERT = 2,    // Flip an output, or a fan between off and argument percent (100 when 0)
+    UDP_OP_FAN_SPEED = 3, // Fan to argument percent
+    UDP_OP_QUERY = 4      // Only report the state
+};
+
+enum UdpStatus
+{
+    UDP_STATUS_OK = 0,
+    UDP_STATUS_DUPLICATE = 1,      // Sequence already handled, not run again
+    UDP_STATUS_STALE = 2,          // Sequence older than the replay window
+    UDP_STATUS_UNKNOWN_DEVICE = 3,
+    UDP_STATUS_BAD_OPCODE = 4,
+    UDP_STATUS_INVALID_ARGUMENT = 5,
+    UDP_STATUS_NOT_SUPPORTED = 6,  // Opcode does not apply to this device type
+    UDP_STATUS_OUTPUT_ERROR = 7,   // Output could not be staged, or a sensor has no reading yet
+    UDP_STATUS_RESYNC = 8          // Nonce not current (new client, evicted, or device rebooted): not run, resend with the ack's nonce
+};
+
+struct UdpControlRequest
+{
+    uint8_t opcode;
+    uint8_t flags;
+    uint8_t argument;
+    uint32_t clientId;
+    uint32_t sequence;
+    uint32_t nonce;
+    uint16_t index;                             // Without UDP_FLAG_UUID
+    uint8_t uuid[UDP_CONTROL_UUID_BYTES];       // With UDP_FLAG_UUID
+};
+
+struct UdpControlAck
+{
+    uint8_t opcode;
+    uint8_t status;
+    uint32_t clientId;
+    uint32_t sequence;
+    uint32_t nonce;
+    uint16_t index;
+    int16_t state;
+};
+
+// Encoders write into caller buffers and return the frame length, 0 when it does not fit
+size_t udpEncodeRequest(uint8_t *out, size_t size, const UdpControlRequest &request, const uint8_t *key, size_t keyLength);
+size_t udpEncodeAck(uint8_t *out, size_t size, const UdpControlAck &ack, const uint8_t *key, size_t keyLength);
+
+// Decoders reject frames with a wrong length, version or tag (compared in constant time)
+bool udpDecodeRequest(const uint8_t *frame, size_t length, UdpControlRequest &request, const uint8_t *key, size_t keyLength);
+bool udpDecodeAck(const uint8_t *frame, size_t length, UdpControlAck &ack, const uint8_t *key, size_t keyLength);
+
+#endif // UdpControlCodec_h
@@ -0,0 +1,87 @@
+#ifndef UdpControlDispatcher_h
+#define UdpControlDispatcher_h
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include "UdpControlCodec.h"
+
+#define UDP_CONTROL_MAX_CLIENTS 8 // Sequence windows kept, the least recently heard client is replaced
+#define UDP_REPLAY_WINDOW 64      // Sequences behind the newest that are still told apart
+
+// Authenticates control frames, drops replays and runs each command at most once.
+// Every client id has a sliding window over its sequence numbers (as in IPsec): a
+// sequence newer than any seen runs, one inside the window that was seen is not run
+// again, and one behind the window is refused as stale. A retransmit of the newest
+// sequence gets the status of the original run, so a client whose ack was lost can
+// retry safely. Frames with a bad tag get no reply at all.
+//
+// Windows live in RAM and are lost on eviction or reboot, so a window is only
+// (re)started by a frame that proves it was made afterwards: every client slot holds
+// a random session nonce, and a frame carrying any other nonce is not run but
+// answered with UDP_STATUS_RESYNC and the current one. A client that is not in the
+// table (new, evicted, or the device rebooted) gets a slot with a fresh nonce, so
+// frames captured before can never start its new window.
+//
+// Pure logic, the device and the random source are reached through handlers. Not thread safe.
+class UdpControlDispatcher
+{
+public:
+    typedef std::function<uint16_t(const UdpControlRequest &request)> Resolver; // Device index, UDP_NO_DEVICE if unknown
+    typedef std::function<UdpStatus(uint16_t index, uint8_t opcode, uint8_t argument, int16_t &state)> Executor;
+    typedef std::function<uint32_t()> Random; // Unpredictable 32-bit values (esp_random() on the device)
+
+    struct Stats
+    {
+        uint32_t received;
+        uint32_t rejected;   // Malformed or bad tag, not answered
+        uint32_t executed;
+        uint32_t duplicates;
+        uint32_t stale;
+        uint32_t failed;     // Ran, but with an error status
+        uint32_t resyncs;    // Answered with a nonce instead of running
+        uint32_t evictions;  // Windows dropped to make room for another client
+    };
+
+    UdpControlDispatcher(const uint8_t *key, size_t keyLength, Resolver resolve, Executor execute, Random random);
+
+    // Handles one datagram; returns the ack length written to ack, 0 when nothing is to be sent
+    size_t handle(const uint8_t *frame, size_t length, uint8_t *ack, size_t ackSize);
+
+    const Stats &stats() const { return counters; }
+
+private:
+    enum Freshness
+    {
+        SEQUENCE_NEW,
+        SEQUENCE_SEEN,
+        SEQUENCE_STALE
+    };
+
+    struct Client
+    {
+        bool used;
+        bool synced;         // A frame with the nonce ran and started the window
+        uint32_t id;
+        uint32_t nonce;      // Never 0, which clients send before their first ack
+        uint32_t newest;     // Highest sequence run
+        uint64_t seen;       // Bit n: newest - n was run
+        uint8_t newestStatus;
+        uint32_t lastHeard;  // Frame counter value, for replacement
+    };
+
+    const uint8_t *key;
+    size_t keyLength;
+    Resolver resolve;
+    Executor execute;
+    Random random;
+    Client clients[UDP_CONTROL_MAX_CLIENTS] = {};
+    uint32_t frameCount = 0;
+    Stats counters = {};
+
+    Client &clientFor(uint32_t id);
+    static Freshness freshness(const Client &client, uint32_t sequence);
+    static void markRun(Client &client, uint32_t sequence, uint8_t status);
+};
+
+#endif // UdpControlDispatcher_h
@@ -0,0 +1,48 @@
+#ifndef UdpControlService_h
+#define UdpControlService_h
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <ESPAsyncWebServer.h>
+#include "ControlService.h"
+#include "UdpControlDispatcher.h"
+
+// Shared secret for the UDP control endpoint; without it the endpoint stays off.
+// Build with '-DUDP_CONTROL_KEY="<secret>"' (the same secret goes into every client).
+#ifndef UDP_CONTROL_KEY
+#define UDP_CONTROL_KEY ""
+#endif
+
+#ifndef UDP_CONTROL_PORT
+#define UDP_CONTROL_PORT 2827
+#endif
+
+// Binary UDP control endpoint for wall switches and other latency-sensitive LAN
+// clients (frame format in UdpControlCodec.h, tools/udp_control.py is a client).
+// A datagram is verified, deduplicated and applied on the AsyncUDP task straight
+// through a GpioBatch, with no connection, header or JSON parsing, and answered
+// with a binary ack carrying the device state.
+//
+// GET /api/diagnostics/udp reports frame counts and handling time.
+class UdpControlService
+{
+private:
+    ControlService *cs;
+    AsyncUDP udp;
+    UdpControlDispatcher dispatcher;
+    bool listening = false;
+
+    uint32_t lastHandleUs = 0, maxHandleUs = 0; // Datagram in to ack handed to lwIP
+
+    uint16_t resolve(const UdpControlRequest &request);
+    UdpStatus execute(uint16_t index, uint8_t opcode, uint8_t argument, int16_t &state);
+    void onPacket(AsyncUDPPacket &packet);
+
+public:
+    UdpControlService(ControlService *cs);
+
+    void begin(AsyncWebServer *server); // Listens only with a key
+    String toJson();
+};
+
+#endif // UdpControlService_h
@@ -0,0 +1,35 @@
+#ifndef WebDashboard_h
+#define WebDashboard_h
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "AdmissionController.h"
+
+// One gzip-compressed dashboard file, embedded by tools/embed_web.py
+struct WebAsset
+{
+    const char *path;        // "/" for index.html, content-hashed /assets/... for the rest
+    const char *contentType;
+    const uint8_t *gzip;     // In flash
+    size_t length;
+    const char *etag;        // Strong, hash of the gzip bytes
+    bool immutable;          // Hashed path: cache forever, a new build changes the URL
+};
+
+// Control dashboard served from flash at GET /.
+// web/ is gzipped at build time (extra_scripts = pre:tools/embed_web.py) into a
+// generated header, so nothing is compressed at runtime. Bodies are streamed from
+// flash in TCP-sized chunks with Content-Encoding: gzip; no request copies an asset.
+// The page reads /api/state, follows /api/events and sends /api/command/send.
+class WebDashboard
+{
+private:
+    AdmissionController *admission = nullptr;
+
+    void serve(AsyncWebServerRequest *request, const WebAsset &asset);
+
+public:
+    void begin(AsyncWebServer *server, AdmissionController *admission = nullptr);
+};
+
+#endif // WebDashboard_h
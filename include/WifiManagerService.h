@@ -10,8 +10,29 @@
 #define WifiManagerService_h
 
 #include <WiFiManager.h>
+#include <freertos/event_groups.h>
 #include "I2CLedScreen.h"
 
+/**
+ * @brief Last known good connection, kept in RTC memory and mirrored to NVS
+ *
+ * The RTC copy is not initialized at boot, so it survives esp_restart(), panics,
+ * watchdog resets and deep sleep; the CRC rejects whatever a power-on leaves there.
+ * NVS survives a power loss.
+ */
+struct WifiFastConnectCache
+{
+    uint32_t magic;    ///< Marks the struct as initialized
+    uint8_t bssid[6];  ///< Access point the device was last associated with
+    uint8_t reserved[2]; ///< Zero, keeps the CRC free of padding bytes
+    int32_t channel;   ///< Primary channel of that access point
+    uint32_t ip;       ///< Last DHCP lease, reused as static config when enabled
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t crc;      ///< CRC-32 of everything before it
+};
+
 /**
  * @class WifiManagerService
  * @brief Manages WiFi connectivity and configuration portal for ESP32 devices
@@ -29,10 +50,35 @@ private:
     I2CLedScreen* lcd; ///< LCD screen instance
     TaskHandle_t scrollTaskHandle = NULL;
     TaskHandle_t apCredentialsTaskHandle = NULL;
+    TaskHandle_t connectTaskHandle = NULL;
     SemaphoreHandle_t lcdMutex;
+    EventGroupHandle_t connectionEvents;
+    wifi_event_id_t stationEventId = 0; ///< WiFi.onEvent() registration that keeps WIFI_CONNECTED_BIT current
+
+    String apName;             ///< Configuration portal SSID
+    const char *apPassword;    ///< Configuration portal password
+    bool reuseLease = false;   ///< Reuse the cached DHCP lease as static config on the fast path
+    bool hasStaticIp = false;  ///< Explicit static configuration set through setStaticIp()
+    IPAddress staticIp, staticGateway, staticSubnet, staticDns;
+
+    static const uint8_t maxConnectFailures = 3;      ///< Failed attempts before falling back to the portal
+    static const uint32_t fastConnectTimeoutMs = 4000; ///< Direct BSSID/channel connect
+    static const uint32_t fullConnectTimeoutMs = 15000; ///< Connect with a full channel scan
+    static const uint16_t configPortalTimeoutSec = 180; ///< Restart if the portal is left unconfigured
 
     static void scrollTask(void *pvParameters); // FreeRTOS task function
     static void apCredentialsTask(void *pvParameters);
+    static void connectTask(void *pvParameters);
+
+    bool loadFastConnectCache(WifiFastConnectCache &cache);
+    void saveFastConnectCache();
+    uint8_t loadFailureCount();
+    void storeFailureCount(uint8_t failures);
+    bool connectWithCache(const WifiFastConnectCache &cache);
+    bool connectWithScan();
+    void runConfigPortal();
+    void onConnected();
+    void onStationEvent(arduino_event_id_t event);
 
     /**
      * @brief Stops both configuration and web portals
@@ -51,15 +97,48 @@ public:
      * @brief Initialize WiFi connection with fallback portal
      * @param apPassword Password for the configuration access point (minimum 8 characters)
      * 
+     * Returns as soon as the network stack is up; the connection itself runs in a
+     * background task so other services can start immediately.
+     *
      * Behavior flow:
-     * 1. Attempt connection using stored credentials
-     * 2. If no stored credentials or connection fails:
+     * 1. Reconnect directly to the cached BSSID/channel (optionally with the cached lease)
+     * 2. Fall back to a normal connect with a full scan
+     * 3. After repeated failures:
      *    - Launches password-protected configuration portal
      *    - Saves new credentials if configured via portal
-     * 3. Restarts ESP if portal times out without configuration
+     * 4. Restarts ESP if portal times out without configuration
      */
     void Initialize(const char* apPassword);
 
+    /**
+     * @brief Use a fixed address on every connect instead of DHCP
+     *
+     * Must be called before Initialize().
+     */
+    void setStaticIp(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns);
+
+    /**
+     * @brief Reuse the last DHCP lease as static config on the fast path
+     *
+     * Skips the DHCP exchange after a power blip. Only safe on networks where the
+     * DHCP server keeps leases stable. Must be called before Initialize().
+     */
+    void enableLeaseReuse(bool enabled);
+
+    /**
+     * @brief Whether the station is associated and has an IP address
+     *
+     * Cleared on every disconnect and set again when the core's automatic
+     * reconnect gets an address.
+     */
+    bool isConnected();
+
+    /**
+     * @brief Block the calling task until connected or the timeout expires
+     * @return true if connected; returns at once while the link is up
+     */
+    bool waitForConnection(TickType_t timeout);
+
     /**
      * @brief Reset all stored WiFi settings and restart device
      * 
@@ -0,0 +1,115 @@
+#include "ActuatorStore.h"
+#include <Preferences.h>
+
+static const uint8_t ACTUATOR_FORMAT_VERSION = 1;
+static const char *ACTUATOR_NAMESPACE = "actuators";
+
+ActuatorStore::ActuatorStore(ControlService *cs) : cs(cs)
+{
+    memset(&stored, 0, sizeof(stored));
+}
+
+/// @brief Applies the last saved LED levels and fan speeds in one batch
+/// @details Runs before Wi-Fi, so outputs are back within milliseconds of power-up
+void ActuatorStore::restore()
+{
+    Preferences prefs;
+    if (!prefs.begin(ACTUATOR_NAMESPACE, true)) {
+        return; // Nothing saved yet
+    }
+    ActuatorSnapshot snapshot;
+    size_t read = prefs.getBytes("outputs", &snapshot, sizeof(snapshot));
+    prefs.end();
+
+    if (read != sizeof(snapshot) || snapshot.formatVersion != ACTUATOR_FORMAT_VERSION ||
+        snapshot.count > ACTUATOR_STORE_MAX) {
+        return;
+    }
+
+    GpioBatch batch;
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        const OutputAction &output = snapshot.outputs[i];
+        DeviceEntry *device = cs->findDeviceByPin(output.pin);
+        if (device == nullptr) {
+            continue; // Device table changed since the snapshot was written
+        }
+        bool matches = (output.kind == OUTPUT_ACTION_DIGITAL && device->type == PIN_TYPE_LED) ||
+                       (output.kind == OUTPUT_ACTION_FAN && device->type == PIN_TYPE_FAN);
+        if (matches) {
+            cs->stageAction(batch, output);
+        }
+    }
+    cs->commitBatch(batch);
+    stored = snapshot;
+}
+
+/// @brief Subscribes to output changes and flushes them from the sampler task
+void ActuatorStore::begin()
+{
+    cs->addChangeListener([this](const DeviceEntry &device) { this->onDeviceChange(device); });
+    cs->addTickListener([this](uint32_t nowMs) { this->onTick(nowMs); });
+}
+
+/// @brief Builds a snapshot from ControlService's cached output state
+void ActuatorStore::capture(ActuatorSnapshot &snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.formatVersion = ACTUATOR_FORMAT_VERSION;
+
+    for (DeviceEntry *device : cs->getDevices()) {
+        if (snapshot.count >= ACTUATOR_STORE_MAX) {
+            break;
+        }
+        int value;
+        OutputAction &output = snapshot.outputs[snapshot.count];
+        if (device->type == PIN_TYPE_LED && cs->getDigitalState(device->value, value)) {
+            output = {(uint8_t)device->value, OUTPUT_ACTION_DIGITAL, (uint8_t)value};
+            snapshot.count++;
+        } else if (device->type == PIN_TYPE_FAN && cs->getFanSpeed(device->value, value)) {
+            output = {(uint8_t)device->value, OUTPUT_ACTION_FAN, (uint8_t)value};
+            snapshot.count++;
+        }
+    }
+}
+
+void ActuatorStore::onDeviceChange(const DeviceEntry &device)
+{
+    if (device.type != PIN_TYPE_LED && device.type != PIN_TYPE_FAN) {
+        return;
+    }
+    uint32_t now = millis();
+    portENTER_CRITICAL(&lock);
+    dirty = true;
+    lastChangeMs = now; // Each change pushes the flush out again
+    portEXIT_CRITICAL(&lock);
+}
+
+/// @brief Writes the snapshot once outputs have settled
+void ActuatorStore::onTick(uint32_t nowMs)
+{
+    portENTER_CRITICAL(&lock);
+    bool due = dirty && nowMs - lastChangeMs >= coalesceMs;
+    if (due) {
+        dirty = false;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (!due) {
+        return;
+    }
+
+    ActuatorSnapshot snapshot;
+    capture(snapshot);
+    if (memcmp(&snapshot, &stored, sizeof(snapshot)) == 0) {
+        skippedCount++; // Toggled back to the saved state
+        return;
+    }
+
+    Preferences prefs;
+    if (prefs.begin(ACTUATOR_NAMESPACE, false)) {
+        prefs.putBytes("outputs", &snapshot, sizeof(snapshot));
+        prefs.end();
+        stored = snapshot;
+        writeCount++;
+    }
+}
@@ -0,0 +1,137 @@
+#include "AdmissionController.h"
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+
+AdmissionController::AdmissionController()
+{
+    // A command holds its body, a JSON response copy and the response object
+    limits[ADMISSION_COMMAND] = {4, 16384, 4096, 3072, 1};
+    // Reads stop while the command floor plus four commands' reservations is still free
+    limits[ADMISSION_READ] = {4, 32768, 8192, 4096, 2};
+}
+
+void AdmissionController::setLimits(AdmissionClass cls, const AdmissionLimits &classLimits)
+{
+    portENTER_CRITICAL(&lock);
+    limits[cls] = classLimits;
+    portEXIT_CRITICAL(&lock);
+}
+
+/// @brief Decides and, when admitting, takes the slot and the reservation
+AdmissionVerdict AdmissionController::decide(AdmissionClass cls, uint32_t reserve, uint32_t freeHeap, uint32_t largestBlock)
+{
+    const AdmissionLimits &limit = limits[cls];
+    AdmissionVerdict verdict = ADMIT;
+    if (inFlight[cls] >= limit.maxInFlight) {
+        verdict = REJECT_CONCURRENCY;
+    } else if ((uint64_t)reservedBytes + reserve + limit.minFreeHeap > freeHeap) {
+        verdict = REJECT_HEAP;
+    } else if (largestBlock < limit.minLargestBlock || largestBlock < reserve) {
+        verdict = REJECT_FRAGMENTED;
+    }
+
+    verdicts[cls][verdict]++;
+    if (verdict == ADMIT) {
+        inFlight[cls]++;
+        if (inFlight[cls] > peakInFlight[cls]) {
+            peakInFlight[cls] = inFlight[cls];
+        }
+        reservedBytes += reserve;
+    }
+    return verdict;
+}
+
+void AdmissionController::release(AdmissionClass cls, uint32_t reserve)
+{
+    portENTER_CRITICAL(&lock);
+    inFlight[cls]--;
+    reservedBytes -= reserve;
+    portEXIT_CRITICAL(&lock);
+}
+
+/// @brief Admits a request or answers it with 503 and Retry-After
+/// @param bodyBytes body size announced by the client, reserved on top of the class estimate
+/// @return true when the handler may go on; the slot is released when the request is freed
+bool AdmissionController::admit(AsyncWebServerRequest *request, AdmissionClass cls, size_t bodyBytes)
+{
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    portENTER_CRITICAL(&lock);
+    uint32_t reserve = limits[cls].reserveBytes + (uint32_t)bodyBytes;
+    AdmissionVerdict verdict = decide(cls, reserve, freeHeap, largestBlock);
+    portEXIT_CRITICAL(&lock);
+
+    if (verdict != ADMIT) {
+        reject(request, cls, verdict);
+        return false;
+    }
+    request->onDisconnect([this, cls, reserve]() { this->release(cls, reserve); });
+    return true;
+}
+
+void AdmissionController::reject(AsyncWebServerRequest *request, AdmissionClass cls, AdmissionVerdict verdict)
+{
+    char retryAfter[4];
+    snprintf(retryAfter, sizeof(retryAfter), "%u", limits[cls].retryAfterS);
+    AsyncWebServerResponse *response = request->beginResponse(
+        503, "application/json", "{\"status\":\"error\",\"message\":\"Server busy, retry later\"}");
+    response->addHeader("Retry-After", retryAfter);
+    response->addHeader("X-Admission", verdictName(verdict)); // Why it was shed, for load tests
+    request->send(response);
+}
+
+const char *AdmissionController::className(AdmissionClass cls)
+{
+    switch (cls) {
+    case ADMISSION_COMMAND: return "command";
+    case ADMISSION_READ: return "read";
+    default: return "unknown";
+    }
+}
+
+const char *AdmissionController::verdictName(AdmissionVerdict verdict)
+{
+    switch (verdict) {
+    case ADMIT: return "admitted";
+    case REJECT_CONCURRENCY: return "concurrency";
+    case REJECT_HEAP: return "heap";
+    case REJECT_FRAGMENTED: return "fragmented";
+    default: return "unknown";
+    }
+}
+
+/// @brief In-flight requests, reservations and verdict counts per class since boot
+String AdmissionController::toJson()
+{
+    JsonDocument doc;
+    portENTER_CRITICAL(&lock);
+    uint32_t reserved = reservedBytes;
+    uint8_t current[ADMISSION_CLASS_COUNT];
+    uint8_t peak[ADMISSION_CLASS_COUNT];
+    uint32_t counts[ADMISSION_CLASS_COUNT][ADMISSION_VERDICT_COUNT];
+    memcpy(current, inFlight, sizeof(current));
+    memcpy(peak, peakInFlight, sizeof(peak));
+    memcpy(counts, verdicts, sizeof(counts));
+    portEXIT_CRITICAL(&lock);
+
+    doc["freeHeap"] = ESP.getFreeHeap();
+    doc["largestBlock"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    doc["reservedBytes"] = reserved;
+    JsonObject classes = doc["classes"].to<JsonObject>();
+    for (int cls = 0; cls < ADMISSION_CLASS_COUNT; cls++) {
+        JsonObject entry = classes[className((AdmissionClass)cls)].to<JsonObject>();
+        entry["inFlight"] = current[cls];
+        entry["peakInFlight"] = peak[cls];
+        entry["maxInFlight"] = limits[cls].maxInFlight;
+        entry["minFreeHeap"] = limits[cls].minFreeHeap;
+        entry["minLargestBlock"] = limits[cls].minLargestBlock;
+        for (int verdict = 0; verdict < ADMISSION_VERDICT_COUNT; verdict++) {
+            entry[verdictName((AdmissionVerdict)verdict)] = counts[cls][verdict];
+        }
+    }
+
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
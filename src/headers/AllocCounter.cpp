@@ -0,0 +1,81 @@
+#include "AllocCounter.h"
+#include <stddef.h>
+
+#ifdef ALLOC_TRACKING
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Thread-local storage is per FreeRTOS task on ESP-IDF
+static __thread uint32_t taskAllocations = 0;
+static volatile uint32_t totalAllocations = 0;
+static portMUX_TYPE totalLock = portMUX_INITIALIZER_UNLOCKED;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static inline void countAllocation()
+{
+    // Static constructors allocate before any task (and its TLS area) exists
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        taskAllocations++;
+    }
+    portENTER_CRITICAL_SAFE(&totalLock);
+    totalAllocations++;
+    portEXIT_CRITICAL_SAFE(&totalLock);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    countAllocation();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    countAllocation();
+    return __real_realloc(ptr, size);
+}
+}
+
+uint32_t AllocCounter::taskCount()
+{
+    return taskAllocations;
+}
+
+uint32_t AllocCounter::total()
+{
+    return totalAllocations;
+}
+
+bool AllocCounter::enabled()
+{
+    return true;
+}
+
+#else
+
+uint32_t AllocCounter::taskCount()
+{
+    return 0;
+}
+
+uint32_t AllocCounter::total()
+{
+    return 0;
+}
+
+bool AllocCounter::enabled()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "BootTrace.h"
+#include <ArduinoJson.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+static const uint32_t BOOT_TRACE_MAGIC = 0x42545231; // "BTR1"
+
+// Not zeroed by the startup code, so contents survive a warm reset
+RTC_NOINIT_ATTR static BootTimeline currentTimeline;
+RTC_NOINIT_ATTR static BootTimeline previousTimeline;
+
+static bool initialized = false;
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Rotates last boot's timeline into the previous slot, once per boot
+void BootTrace::init()
+{
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    // After a power-on or brownout RTC memory holds random data, which may match the magic
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool warm = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT;
+
+    uint32_t bootCount = 0;
+    if (warm && currentTimeline.magic == BOOT_TRACE_MAGIC && currentTimeline.count <= BOOT_TRACE_MAX_PHASES) {
+        previousTimeline = currentTimeline;
+        bootCount = currentTimeline.bootCount + 1;
+    } else {
+        previousTimeline.magic = 0; // Cold boot, nothing to keep
+    }
+
+    memset(&currentTimeline, 0, sizeof(currentTimeline));
+    currentTimeline.magic = BOOT_TRACE_MAGIC;
+    currentTimeline.bootCount = bootCount;
+    currentTimeline.resetReason = (uint8_t)reason;
+}
+
+/// @brief Opens a boot phase
+/// @param phase short name, truncated to BOOT_TRACE_NAME_LEN - 1 characters
+/// @return handle for end(), or -1 when the timeline is full
+int BootTrace::begin(const char *phase)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    int handle = -1;
+
+    portENTER_CRITICAL(&traceLock);
+    init();
+    if (currentTimeline.count < BOOT_TRACE_MAX_PHASES) {
+        handle = currentTimeline.count++;
+        BootPhase &entry = currentTimeline.phases[handle];
+        strncpy(entry.name, phase, BOOT_TRACE_NAME_LEN - 1);
+        entry.name[BOOT_TRACE_NAME_LEN - 1] = '\0';
+        entry.startUs = now;
+        entry.endUs = 0;
+    }
+    portEXIT_CRITICAL(&traceLock);
+
+    return handle;
+}
+
+/// @brief Closes a phase opened with begin()
+void BootTrace::end(int handle)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    portENTER_CRITICAL(&traceLock);
+    if (handle >= 0 && handle < currentTimeline.count) {
+        currentTimeline.phases[handle].endUs = now;
+    }
+    portEXIT_CRITICAL(&traceLock);
+}
+
+/// @brief Records an instant event such as the first MQTT connect
+void BootTrace::mark(const char *event)
+{
+    int handle = begin(event);
+    if (handle >= 0) {
+        portENTER_CRITICAL(&traceLock);
+        currentTimeline.phases[handle].endUs = currentTimeline.phases[handle].startUs;
+        portEXIT_CRITICAL(&traceLock);
+    }
+}
+
+const BootTimeline &BootTrace::current()
+{
+    portENTER_CRITICAL(&traceLock);
+    init();
+    portEXIT_CRITICAL(&traceLock);
+    return currentTimeline;
+}
+
+const BootTimeline *BootTrace::previous()
+{
+    portENTER_CRITICAL(&traceLock);
+    init();
+    portEXIT_CRITICAL(&traceLock);
+    return previousTimeline.magic == BOOT_TRACE_MAGIC ? &previousTimeline : nullptr;
+}
+
+static void timelineToJson(const BootTimeline &timeline, JsonObject object)
+{
+    object["bootCount"] = timeline.bootCount;
+    object["resetReason"] = timeline.resetReason;
+    JsonArray phases = object["phases"].to<JsonArray>();
+    for (uint8_t i = 0; i < timeline.count; i++) {
+        const BootPhase &entry = timeline.phases[i];
+        JsonObject phase = phases.add<JsonObject>();
+        phase["name"] = (const char *)entry.name;
+        phase["start_us"] = entry.startUs;
+        if (entry.endUs != 0) {
+            phase["duration_us"] = entry.endUs - entry.startUs;
+        } else {
+            phase["duration_us"] = nullptr; // Still open (or never closed before a reset)
+        }
+    }
+}
+
+/// @brief Serializes the current and (if available) previous boot timelines
+String BootTrace::toJson()
+{
+    BootTimeline current, previous;
+    bool hasPrevious;
+
+    portENTER_CRITICAL(&traceLock);
+    init();
+    current = currentTimeline;
+    previous = previousTimeline;
+    hasPrevious = previousTimeline.magic == BOOT_TRACE_MAGIC;
+    portEXIT_CRITICAL(&traceLock);
+
+    JsonDocument doc;
+    doc["status"] = "success";
+    doc["uptime_us"] = (uint32_t)esp_timer_get_time();
+    timelineToJson(current, doc["current"].to<JsonObject>());
+    if (hasPrevious) {
+        timelineToJson(previous, doc["previous"].to<JsonObject>());
+    } else {
+        doc["previous"] = nullptr;
+    }
+
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
@@ -0,0 +1,185 @@
+#include "CommandTrace.h"
+#include <esp_timer.h>
+
+static CommandTraceRecord traces[COMMAND_TRACE_SLOTS];
+static uint32_t nextTraceId = 0;
+
+// Thread-local storage is per FreeRTOS task on ESP-IDF
+static __thread CommandTraceRecord *active = nullptr;
+
+static inline uint32_t nowUs()
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+/// @brief Claims the oldest slot for a new request and marks it as being written
+/// @param requestId client supplied X-Request-ID, nullptr to generate one
+CommandTraceRecord *CommandTrace::open(const void *owner, const char *requestId, uint32_t bodyBytes)
+{
+    uint32_t id = __atomic_fetch_add(&nextTraceId, 1, __ATOMIC_RELAXED);
+    CommandTraceRecord *record = &traces[id % COMMAND_TRACE_SLOTS];
+
+    // Odd, and different from before even if the slot held an abandoned open trace
+    record->sequence = (record->sequence | 1) + 2;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->traceId = id + 1;
+    record->owner = owner;
+    record->startMs = millis();
+    record->startUs = nowUs();
+    record->bodyBytes = bodyBytes;
+    record->status = 0;
+    record->deviceCount = 0;
+    for (int i = 0; i < TRACE_STAGE_COUNT; i++) {
+        record->stageUs[i] = COMMAND_TRACE_NOT_REACHED;
+    }
+    if (requestId != nullptr && requestId[0] != '\0') {
+        strlcpy(record->requestId, requestId, sizeof(record->requestId));
+    } else {
+        snprintf(record->requestId, sizeof(record->requestId), "esp-%u", record->traceId);
+    }
+    return record;
+}
+
+/// @brief Finds the open trace of a request whose body arrives in several segments
+CommandTraceRecord *CommandTrace::find(const void *owner)
+{
+    uint32_t newest = __atomic_load_n(&nextTraceId, __ATOMIC_RELAXED) - 1;
+    for (uint32_t age = 0; age < COMMAND_TRACE_SLOTS; age++) {
+        CommandTraceRecord *record = &traces[(newest - age) % COMMAND_TRACE_SLOTS];
+        if ((record->sequence & 1) && record->owner == owner) {
+            return record;
+        }
+    }
+    return nullptr;
+}
+
+void CommandTrace::activate(CommandTraceRecord *record)
+{
+    active = record;
+}
+
+CommandTraceRecord *CommandTrace::current()
+{
+    return active;
+}
+
+/// @brief Makes a finished trace visible to readers
+void CommandTrace::close(CommandTraceRecord *record, int status)
+{
+    if (active == record) {
+        active = nullptr;
+    }
+    if (record == nullptr) {
+        return;
+    }
+    record->status = (uint16_t)status;
+    record->owner = nullptr;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->sequence = record->sequence + 1;
+}
+
+void CommandTrace::stage(CommandTraceStage stage)
+{
+    CommandTraceRecord *record = active;
+    if (record != nullptr) {
+        record->stageUs[stage] = nowUs() - record->startUs;
+    }
+}
+
+void CommandTrace::deviceBegin()
+{
+    CommandTraceRecord *record = active;
+    if (record != nullptr && record->deviceCount < COMMAND_TRACE_MAX_DEVICES) {
+        record->deviceStartUs[record->deviceCount] = nowUs() - record->startUs;
+        record->deviceEndUs[record->deviceCount] = COMMAND_TRACE_NOT_REACHED;
+    }
+}
+
+void CommandTrace::deviceEnd()
+{
+    CommandTraceRecord *record = active;
+    if (record == nullptr) {
+        return;
+    }
+    if (record->deviceCount < COMMAND_TRACE_MAX_DEVICES) {
+        record->deviceEndUs[record->deviceCount] = nowUs() - record->startUs;
+    }
+    if (record->deviceCount < UINT8_MAX) {
+        record->deviceCount++;
+    }
+}
+
+/// @brief Copies a finished trace without locking
+/// @param newest 0 for the most recently opened slot, up to COMMAND_TRACE_SLOTS - 1
+/// @return false if the slot is empty, still being written, or was rewritten during the copy
+bool CommandTrace::read(size_t newest, CommandTraceRecord &out)
+{
+    uint32_t opened = __atomic_load_n(&nextTraceId, __ATOMIC_RELAXED);
+    if (newest >= COMMAND_TRACE_SLOTS || newest >= opened) {
+        return false;
+    }
+    const CommandTraceRecord *record = &traces[(opened - 1 - newest) % COMMAND_TRACE_SLOTS];
+
+    uint32_t before = record->sequence;
+    if (before & 1) {
+        return false;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    memcpy((void *)&out, (const void *)record, sizeof(CommandTraceRecord));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return record->sequence == before;
+}
+
+const char *CommandTrace::stageName(CommandTraceStage stage)
+{
+    switch (stage) {
+    case TRACE_BODY_COMPLETE: return "bodyComplete";
+    case TRACE_PARSED: return "parsed";
+    case TRACE_COMMAND_START: return "commandStart";
+    case TRACE_COMMIT_START: return "commitStart";
+    case TRACE_GPIO_WRITTEN: return "gpioWritten";
+    case TRACE_COMMIT_END: return "commitEnd";
+    case TRACE_COMMAND_END: return "commandEnd";
+    case TRACE_RESPONSE_READY: return "responseReady";
+    case TRACE_RESPONSE_SENT: return "responseSent";
+    default: return "unknown";
+    }
+}
+
+/// @brief Writes a Server-Timing header value (durations in ms) for the stages reached so far
+size_t CommandTrace::formatServerTiming(const CommandTraceRecord &record, char *out, size_t size)
+{
+    struct Span
+    {
+        const char *name;
+        int from; // -1 = first body byte
+        CommandTraceStage to;
+    };
+    static const Span spans[] = {
+        {"recv", -1, TRACE_BODY_COMPLETE},
+        {"parse", TRACE_BODY_COMPLETE, TRACE_PARSED},
+        {"lookup", TRACE_COMMAND_START, TRACE_COMMIT_START},
+        {"gpio", TRACE_COMMIT_START, TRACE_GPIO_WRITTEN},
+        {"notify", TRACE_GPIO_WRITTEN, TRACE_COMMIT_END},
+        {"reply", TRACE_COMMAND_END, TRACE_RESPONSE_READY},
+        {"total", -1, TRACE_RESPONSE_READY},
+    };
+
+    size_t length = 0;
+    out[0] = '\0';
+    for (const Span &span : spans) {
+        uint32_t start = span.from < 0 ? 0 : record.stageUs[span.from];
+        uint32_t end = record.stageUs[span.to];
+        if (start == COMMAND_TRACE_NOT_REACHED || end == COMMAND_TRACE_NOT_REACHED || length >= size) {
+            continue;
+        }
+        uint32_t us = end - start;
+        int written = snprintf(out + length, size - length, "%s%s;dur=%u.%03u", length > 0 ? ", " : "", span.name,
+                               us / 1000, us % 1000);
+        if (written > 0) {
+            length += (size_t)written < size - length ? (size_t)written : size - length - 1;
+        }
+    }
+    return length;
+}
@@ -1,4 +1,11 @@
 #include "ControlService.h"
+#include "SerialService.h"
+#include "CommandTrace.h"
+#include "TaskTopology.h"
+#include "PowerManager.h"
+#include "generated/SiteDevices.h"
+#include <esp_timer.h>
+#include <stdarg.h>
 #include <cstring>
 
 #ifndef _PREFERENCES_H_
@@ -7,22 +14,36 @@
 
 #include <Arduino.h> // Make sure to include Arduino.h for ESP32 functions
 
-// Include DHT sensor library - Make sure you have installed the DHT sensor library in Arduino IDE Library Manager
-#include <DHT.h>
-
 using namespace std;
 
-/// @brief Sets up the PWM configuration using ESP32 LEDC (LED Control)
+static bool isGpio(int pin) {
+    return pin >= 0 && pin < DEVICE_GPIO_COUNT;
+}
+
+/// @brief Sets up a LEDC (LED Control) PWM channel per fan and attaches it to the fan's pin
 void ControlService::setupPWM() {
-    // Configure LEDC PWM parameters
-    ledcSetup(pwmChannel, pwmFrequencyHz, pwmResolutionBits); // Channel, Frequency, Resolution
+    for (size_t i = 0; i < deviceCount; i++) {
+        const DeviceConfig &config = *devices[i].config;
+        if (config.type == PIN_TYPE_FAN) {
+            ledcSetup(config.ledcChannel, pwmFrequencyHz, pwmResolutionBits); // Channel, Frequency, Resolution
+            ledcAttachPin(config.pin, config.ledcChannel);
+        }
+    }
 }
 
 /// @brief Toggles the state of a device pin (basic ON/OFF control - digitalWrite)
 bool ControlService::toggle(int pin, int state) {
+    if (!isGpio(pin)) {
+        return false;
+    }
     try {
         digitalWrite(pin, state);
+        bool changed = digitalPinStates[pin] != state;
         digitalPinStates[pin] = state; // Store the digital pin state
+        DeviceEntry *device = findDeviceByPin(pin);
+        if (changed && device != nullptr) {
+            notifyChange(*device);
+        }
         return true;
     } catch (const exception& e) {
         // ss->printToAll("Error while toggling device state: %S", e.what());
@@ -33,13 +54,19 @@ bool ControlService::toggle(int pin, int state) {
 /// @brief Controls fan speed using PWM with ESP32 LEDC (analogWrite replacement)
 bool ControlService::controlFanSpeed(int pin, int speedPercentage) {
     try {
-        if (speedPercentage >= 0 && speedPercentage <= 100) {
+        int channel = fanChannel(pin);
+        if (channel >= 0 && speedPercentage >= 0 && speedPercentage <= 100) {
             // Map the 0-100 speed percentage to the 0-255 PWM range
             int pwmValue = ::map(speedPercentage, 0, 100, 0, 255);
 
             // Use ledcWrite with the mapped PWM value
-            ledcWrite(pwmChannel, pwmValue);
+            ledcWrite(channel, pwmValue);
+            bool changed = fanSpeeds[pin] != speedPercentage;
             fanSpeeds[pin] = speedPercentage; // Store the fan speed
+            DeviceEntry *device = findDeviceByPin(pin);
+            if (changed && device != nullptr) {
+                notifyChange(*device);
+            }
             return true;
         } else {
             // ss->printToAll("Error: Invalid fan speed percentage. Must be between 0 and 100.");
@@ -51,151 +78,658 @@ bool ControlService::controlFanSpeed(int pin, int speedPercentage) {
     }
 }
 
-/// @brief Declares a pin for a device
-void ControlService::declarePin(const char *areaId, const char *deviceId, int value, int mode, DeviceType type) {
-    DeviceEntry entry = {deviceId, value, mode, type};
-    areaDevicesMap[areaId][deviceId] = entry;
+/// @brief Looks up a device without allocating
+DeviceEntry *ControlService::findDevice(const char *areaId, const char *deviceId) {
+    if (areaId == nullptr || deviceId == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < deviceCount; i++) {
+        if (strcmp(devices[i].deviceId, deviceId) == 0 && strcmp(devices[i].areaId, areaId) == 0) {
+            return &devices[i];
+        }
+    }
+    return nullptr;
+}
 
-    if (type == PIN_TYPE_DHT11) {
-        dhtSensors[value] = new DHT(value, DHT11); // Initialize DHT sensor for DHT11 type
-        dhtSensors[value]->begin(); // Start DHT sensor
-    } else if (type == PIN_TYPE_PIR) {
-        // For a PIR sensor, set up the pin mode (e.g., INPUT)
-        // Any additional PIR-specific initialization can be added here if needed.
-    } else if ( type == PIN_TYPE_FAN) {
-        
+/// @brief Index of the area's first device, deviceCount if no device is in that area
+size_t ControlService::firstInArea(const char *areaId) {
+    for (size_t i = 0; i < deviceCount; i++) {
+        if (strcmp(devices[i].areaId, areaId) == 0) {
+            return i;
+        }
     }
+    return deviceCount;
+}
+
+int ControlService::fanChannel(int pin) {
+    DeviceEntry *device = findDeviceByPin(pin);
+    return device != nullptr && device->type == PIN_TYPE_FAN ? device->config->ledcChannel : -1;
 }
 
 /// @brief Gets pin value for a device
 int ControlService::getPinValue(const char *areaId, const char *deviceId) {
-    if (areaDevicesMap.count(areaId)) {
-        if (areaDevicesMap[areaId].count(deviceId)) {
-            return areaDevicesMap[areaId][deviceId].value;
-        } 
-    }
-    return -1;
+    DeviceEntry *device = findDevice(areaId, deviceId);
+    return device != nullptr ? device->value : -1;
 }
 
 /// @brief Gets device type
 DeviceType ControlService::getDeviceType(const char *areaId, const char *deviceId) {
-    if (areaDevicesMap.count(areaId)) {
-        if (areaDevicesMap[areaId].count(deviceId)) {
-            return areaDevicesMap[areaId][deviceId].type;
-        }
-    }
-    return PIN_TYPE_OTHER; // Default to generic if not found
+    DeviceEntry *device = findDevice(areaId, deviceId);
+    return device != nullptr ? device->type : PIN_TYPE_OTHER; // Default to generic if not found
 }
 
-/// @brief Configures pin modes (same as before)
+/// @brief Configures pin modes from the device table
 void ControlService::configurePins() {
-    for (auto const& areaPair : areaDevicesMap) {
-        for (auto const& devicePair : areaPair.second) {
-            pinMode(devicePair.second.value, devicePair.second.mode);
-        }
+    for (size_t i = 0; i < deviceCount; i++) {
+        pinMode(devices[i].value, devices[i].mode);
     }
 }
 
-/// @brief Reads temperature and humidity from DHT11 sensor
+/// @brief Returns the last temperature and humidity sampled from a DHT11 sensor
+/// @details Readings are refreshed by the sampler task, so this never blocks on the sensor
 bool ControlService::getDHT11Readings(int pin, float &temperature, float &humidity) {
-    if (dhtSensors.count(pin)) {
-        float h = dhtSensors[pin]->readHumidity();
-        float t = dhtSensors[pin]->readTemperature();
-
-        if (isnan(h) || isnan(t)) {
-            // ss->printToAll("Failed to read from DHT sensor!");
-            return false;
-        }
+    if (isGpio(pin) && dhtSensors[pin] != nullptr) {
+        return dhtSensors[pin]->getLastReading(temperature, humidity);
+    }
+    return false; // Sensor not found or initialized
+}
 
-        temperature = t;
-        humidity = h;
+bool ControlService::getFanRpm(int pin, uint32_t &rpm, bool &stalled) {
+    if (isGpio(pin) && fanTachs[pin] != nullptr) {
+        fanTachs[pin]->getState(rpm, stalled);
         return true;
     }
-    return false; // Sensor not found or initialized
+    return false;
+}
+
+/// @brief Time of the last good sample, lets control loops run once per new reading
+unsigned long ControlService::getDHT11SampleTime(int pin) {
+    if (isGpio(pin) && dhtSensors[pin] != nullptr) {
+        return dhtSensors[pin]->getLastReadMs();
+    }
+    return 0;
 }
 
 bool ControlService::getPIRState(int pin, bool &motionDetected)
 {
+    DeviceEntry *device = findDeviceByPin(pin);
+    if (device != nullptr && device->type == PIN_TYPE_PIR) {
+        motionDetected = pirStates[pin]; // Sampled every tick by the sampler task
+        return true;
+    }
     // For a typical PIR sensor, HIGH indicates motion detected.
     motionDetected = (digitalRead(pin) == HIGH);
     return true;
 }
 
-/// @brief Constructor (Modified to call setupPWM and initialize DHT)
-ControlService::ControlService(SerialService *ss) : ss(ss) { // Use initializer list
-    // Initialize SerialService pointer
-    this->ss = ss; // No longer needed with initializer list
+bool ControlService::getDigitalState(int pin, int &level)
+{
+    DeviceEntry *device = findDeviceByPin(pin);
+    if (device == nullptr || device->type != PIN_TYPE_LED) {
+        return false;
+    }
+    level = digitalPinStates[pin];
+    return true;
+}
 
-    // Initialize PWM setup using LEDC
+bool ControlService::getFanSpeed(int pin, int &speedPercentage)
+{
+    if (fanChannel(pin) < 0) {
+        return false;
+    }
+    speedPercentage = fanSpeeds[pin];
+    return true;
+}
+
+/// @brief Builds the device entries from the generated table
+/// @details Runs during static initialization, so it only fills fixed arrays; the pins
+/// are left alone until configureOutputs()
+ControlService::ControlService(SerialService *ss) : ss(ss) {
+    memset(pinDevice, -1, sizeof(pinDevice));
+    for (size_t i = 0; i < deviceTableSize; i++) {
+        const DeviceConfig &config = deviceTable[i];
+        devices[i] = {config.deviceId, config.pin, config.mode, config.type, config.areaId, 0, &config};
+        deviceRefs[i] = &devices[i];
+        pinDevice[config.pin] = (int8_t)i;
+    }
+    deviceCount = deviceTableSize;
+}
+
+/// @brief Sets the pin modes and attaches the fan PWM channels
+void ControlService::configureOutputs() {
+    configurePins();
+    // Attach the PWM channels *after* configuring pin modes
     setupPWM();
+}
 
-    // Declare devices
-    declarePin("94c4dab3-19bf-448a-90d5-b9b00ec0cda0", "1bd59658-ba07-4520-b2c3-6cc7df314d4c", 18, OUTPUT, PIN_TYPE_LED);
-    declarePin("94c4dab3-19bf-448a-90d5-b9b00ec0cda0", "ee72372d-253b-4775-85e4-9ff851a343a0", 19, OUTPUT, PIN_TYPE_LED);
-    declarePin("8dca5204-a0ac-4ec6-83f7-c3b8acdf6e5b", "891647d0-e5a8-4f02-bfce-a17facfa6e5c", 5, OUTPUT, PIN_TYPE_FAN); // Fan on pin 5 (PWM)
-    // Declare DHT11 sensor - Example: DHT11 on pin 4
-    declarePin("8dca5204-a0ac-4ec6-83f7-c3b8acdf6e5b", "9e569c3f-afed-41de-9758-99a7be8ce3d7", 4, INPUT_PULLUP, PIN_TYPE_DHT11); // DHT11 on pin 4
-    // Declare PIR sensor - Example: PIR sensor on pin 34
-    declarePin("94c4dab3-19bf-448a-90d5-b9b00ec0cda0", "31d0f257-2fbc-443e-8fbb-f066de81debd", 34, INPUT, PIN_TYPE_PIR); // PIR sensor on pin 15
+/// @brief Creates and installs the sensor drivers, then starts the sampler task
+void ControlService::begin() {
+    for (size_t i = 0; i < deviceCount; i++) {
+        const DeviceConfig &config = *devices[i].config;
+        if (config.type == PIN_TYPE_DHT11 && dhtSensors[config.pin] == nullptr) {
+            DhtRmtReader *reader = new DhtRmtReader(config.pin, config.rmtChannel);
+            if (!reader->begin()) {
+                Serial.printf("Failed to install RMT receiver for DHT11 on pin %d\n", config.pin);
+            }
+            dhtSensors[config.pin] = reader;
+        } else if (config.tachPin >= 0 && fanTachs[config.pin] == nullptr) {
+            // Open-collector tach output, needs a pull-up to 3.3V
+            FanTachometer *tach = new FanTachometer(config.tachPin, config.pcntUnit, config.pulsesPerRev);
+            if (!tach->begin()) {
+                Serial.printf("Failed to configure PCNT for fan tach on pin %d\n", config.tachPin);
+            }
+            fanTachs[config.pin] = tach;
+        }
+    }
 
+    ss->registerCommand("/sensors", "", "Sensor readings, read age and sampler cost", 0, 0,
+                        [this](int argc, char **argv) { printSensorDiagnostics(); });
 
-    configurePins();
-    // Attach PWM channel to the fan pin *after* configuring pin modes
-    ledcAttachPin(getPinValue("8dca5204-a0ac-4ec6-83f7-c3b8acdf6e5b", "891647d0-e5a8-4f02-bfce-a17facfa6e5c"), pwmChannel); // Pin, Channel
+    if (samplerTaskHandle == NULL) {
+        // Change and tick listeners (telemetry, rules) run on this task, size its stack for them
+        TaskTopology::spawn(TASK_ROLE_SAMPLER, ControlService::samplerTask, this, &samplerTaskHandle);
+    }
+}
+
+/// @brief Prints every sensor's cached reading with its age, and what the sampler task costs
+void ControlService::printSensorDiagnostics() {
+    unsigned long now = millis();
+    ss->printToAll("Sampler: poll %u us (max %u), DHT tick %u us (max %u), listeners %u us (max %u)",
+                   pollPassUs, pollPassMaxUs, dhtPassUs, dhtPassMaxUs, listenersPassUs, listenersPassMaxUs);
+
+    for (size_t i = 0; i < deviceCount; i++) {
+        int pin = devices[i].value;
+        if (devices[i].type == PIN_TYPE_PIR) {
+            ss->printToAll("PIR pin %d: %s", pin, pirStates[pin] ? "motion" : "idle");
+        }
+        if (fanTachs[pin] != nullptr) {
+            uint32_t rpm;
+            bool stalled;
+            fanTachs[pin]->getState(rpm, stalled);
+            ss->printToAll("Fan pin %d (tach %d): %d%%, %u rpm%s", pin, fanTachs[pin]->getTachPin(), fanSpeeds[pin], rpm,
+                           stalled ? ", STALLED" : "");
+        }
+        DhtRmtReader *reader = dhtSensors[pin];
+        if (reader == nullptr) {
+            continue;
+        }
+        float temperature = 0, humidity = 0;
+        if (reader->getLastReading(temperature, humidity)) {
+            ss->printToAll("DHT11 pin %d: %.1f C %.1f %%, read %lu ms ago, decode %u us, last %s, %u failed in a row",
+                           pin, temperature, humidity, now - reader->getLastReadMs(), reader->getLastDecodeUs(),
+                           dhtDecodeStatusName(reader->getLastStatus()), reader->getFailureCount());
+        } else {
+            ss->printToAll("DHT11 pin %d: no reading yet, last %s, %u failed in a row",
+                           pin, dhtDecodeStatusName(reader->getLastStatus()), reader->getFailureCount());
+        }
+    }
+}
+
+void ControlService::samplerTask(void *pvParameters) {
+    ControlService *service = static_cast<ControlService *>(pvParameters);
+    TickType_t lastWake = xTaskGetTickCount();
+    const int dhtEveryTicks = service->dhtIntervalMs / service->samplerTickMs;
+    int tick = 0;
+    while (true) {
+        PowerManager *power = service->power;
+        if (power != nullptr) {
+            // Low-power mode: run only the jobs that are due, then block until the next one,
+            // a PIR edge or a fan change wakes the task
+            uint32_t jobs = power->beginWake();
+            service->runSamplerPass((jobs & POWER_JOB_SAMPLE) != 0);
+            power->endWake(jobs);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(power->sleepMs()));
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+
+        service->runSamplerPass(tick == 0);
+        tick = (tick + 1) % dhtEveryTicks;
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(service->samplerTickMs));
+    }
+}
+
+/// @brief Samples the sensors, runs the tick listeners and records what that cost
+void ControlService::runSamplerPass(bool readDht) {
+    int64_t start = esp_timer_get_time();
+    sampleSensors(readDht);
+    uint32_t sampleUs = (uint32_t)(esp_timer_get_time() - start);
+    if (readDht) {
+        dhtPassUs = sampleUs;
+        dhtPassMaxUs = max(dhtPassMaxUs, sampleUs);
+    } else {
+        pollPassUs = sampleUs;
+        pollPassMaxUs = max(pollPassMaxUs, sampleUs);
+    }
+
+    uint32_t now = millis();
+    start = esp_timer_get_time();
+    int listeners = tickListenerCount;
+    for (int i = 0; i < listeners; i++) {
+        tickListeners[i](now);
+    }
+    listenersPassUs = (uint32_t)(esp_timer_get_time() - start);
+    listenersPassMaxUs = max(listenersPassMaxUs, listenersPassUs);
+    TaskTopology::checkIn(TASK_ROLE_SAMPLER, sampleUs + listenersPassUs); // DHT passes count their wall time
+}
+
+/// @brief Polls PIR sensors and, when due, reads every DHT sensor
+/// @param readDht read the DHT sensors this tick; the task sleeps while the RMT captures each frame
+void ControlService::sampleSensors(bool readDht) {
+    unsigned long now = millis();
+    for (size_t i = 0; i < deviceCount; i++) {
+        DeviceEntry &device = devices[i];
+        int pin = device.value;
+        if (device.type == PIN_TYPE_PIR) {
+            bool detected = (digitalRead(pin) == HIGH);
+            if (detected != pirStates[pin]) {
+                pirStates[pin] = detected;
+                notifyChange(device);
+            }
+        } else if (fanTachs[pin] != nullptr && fanTachs[pin]->sample(now, fanSpeeds[pin] > 0)) {
+            notifyChange(device);
+        }
+    }
+
+    if (!readDht) {
+        return;
+    }
+
+    for (size_t i = 0; i < deviceCount; i++) {
+        DhtRmtReader *reader = dhtSensors[devices[i].value];
+        if (reader == nullptr) {
+            continue;
+        }
+        float oldTemperature = 0, oldHumidity = 0;
+        bool hadReading = reader->getLastReading(oldTemperature, oldHumidity);
+
+        if (reader->read() == DHT_DECODE_OK) {
+            float temperature, humidity;
+            reader->getLastReading(temperature, humidity);
+            if (!hadReading || temperature != oldTemperature || humidity != oldHumidity) {
+                notifyChange(devices[i]);
+            }
+        }
+    }
+}
+
+/// @brief Registers a listener for state and reading changes
+/// @details Call during setup; listeners cannot be removed
+void ControlService::addChangeListener(DeviceChangeListener listener) {
+    if (changeListenerCount >= maxChangeListeners) {
+        Serial.println("Too many change listeners, ignoring registration");
+        return;
+    }
+    changeListeners[changeListenerCount] = listener;
+    changeListenerCount = changeListenerCount + 1; // Publish only once the slot is filled
+}
+
+/// @brief Registers periodic work to run on the sampler task
+/// @details Call during setup; listeners cannot be removed
+void ControlService::addTickListener(SamplerTickListener listener) {
+    if (tickListenerCount >= maxTickListeners) {
+        Serial.println("Too many tick listeners, ignoring registration");
+        return;
+    }
+    tickListeners[tickListenerCount] = listener;
+    tickListenerCount = tickListenerCount + 1;
+}
+
+void ControlService::notifyChange(DeviceEntry &device) {
+    portENTER_CRITICAL(&versionLock);
+    device.version = ++stateVersion;
+    portEXIT_CRITICAL(&versionLock);
+
+    int count = changeListenerCount;
+    for (int i = 0; i < count; i++) {
+        changeListeners[i](device);
+    }
+}
+
+uint32_t ControlService::getStateVersion() {
+    portENTER_CRITICAL(&versionLock);
+    uint32_t version = stateVersion;
+    portEXIT_CRITICAL(&versionLock);
+    return version;
+}
+
+uint32_t ControlService::getDeviceVersion(const DeviceEntry &device) {
+    portENTER_CRITICAL(&versionLock);
+    uint32_t version = device.version;
+    portEXIT_CRITICAL(&versionLock);
+    return version;
+}
+
+/// @brief Finds the device declared on a GPIO
+DeviceEntry *ControlService::findDeviceByPin(int pin) {
+    if (!isGpio(pin) || pinDevice[pin] < 0) {
+        return nullptr;
+    }
+    return &devices[pinDevice[pin]];
+}
+
+const char *ControlService::deviceTypeName(DeviceType type) {
+    switch (type) {
+    case PIN_TYPE_LED:
+        return "LED";
+    case PIN_TYPE_FAN:
+        return "FAN";
+    case PIN_TYPE_DHT11:
+        return "DHT11";
+    case PIN_TYPE_PIR:
+        return "PIR";
+    default:
+        return "OTHER";
+    }
+}
+
+/// @brief Writes a device's cached state or last readings into a JSON object
+/// @details Only reads cached values, safe to call from any task at any rate
+void ControlService::writeDeviceState(const DeviceEntry &device, JsonObject out) {
+    out["areaId"] = device.areaId;
+    out["deviceId"] = device.deviceId;
+    out["type"] = deviceTypeName(device.type);
+
+    switch (device.type) {
+    case PIN_TYPE_LED:
+        out["power_state"] = digitalPinStates[device.value] == HIGH ? "on" : "off";
+        break;
+    case PIN_TYPE_FAN: {
+        int speed = fanSpeeds[device.value];
+        out["fan_speed"] = speed;
+        out["power_state"] = speed > 0 ? "on" : "off";
+        uint32_t rpm;
+        bool stalled;
+        if (getFanRpm(device.value, rpm, stalled)) {
+            out["rpm"] = rpm;
+            out["stalled"] = stalled;
+        }
+        break;
+    }
+    case PIN_TYPE_DHT11: {
+        float temperature = 0, humidity = 0;
+        if (getDHT11Readings(device.value, temperature, humidity)) {
+            out["temperature_celsius"] = temperature;
+            out["humidity_percent"] = humidity;
+        } else {
+            out["status"] = "error";
+        }
+        break;
+    }
+    case PIN_TYPE_PIR:
+        out["motion_detected"] = pirStates[device.value];
+        break;
+    default:
+        break;
+    }
 }
 
 /// @brief Destructor
 ControlService::~ControlService() {
-    // Clean up DHT sensor objects
-    for (auto const& [pin, dhtPtr] : dhtSensors) {
-        if (dhtPtr) {
-            delete dhtPtr;
-        }
+    if (samplerTaskHandle != NULL) {
+        TaskTopology::retire(samplerTaskHandle);
+        samplerTaskHandle = NULL;
+    }
+
+    // Clean up the sensor drivers created in begin()
+    for (int pin = 0; pin < DEVICE_GPIO_COUNT; pin++) {
+        delete dhtSensors[pin];
+        dhtSensors[pin] = nullptr;
+        delete fanTachs[pin];
+        fanTachs[pin] = nullptr;
     }
-    dhtSensors.clear();
 }
 
 
 /// @brief Handles JSON commands
-void ControlService::handleCommand(JsonDocument doc, JsonDocument &response) {
-    const char *areaId = doc["areaId"];
+/// @details Accepts either a single area ({"areaId", "devices"}) or a batch spanning
+/// several areas ({"commands": [{"areaId", "devices"}, ...]}). All outputs of a request
+/// are staged first and then switched together in one GPIO register write.
+/// @param compact answer with numeric codes (see CommandCode) instead of messages
+void ControlService::handleCommand(JsonDocument &doc, JsonDocument &response, bool compact) {
+    CommandTrace::stage(TRACE_COMMAND_START);
+    GpioBatch batch;
+
+    if (doc["commands"].is<JsonArray>()) {
+        JsonArray results;
+        if (compact) {
+            response["c"] = (int)CMD_OK;
+            results = response["r"].to<JsonArray>();
+        } else {
+            response["status"] = "success";
+            results = response["results"].to<JsonArray>();
+        }
+        for (JsonObject command : doc["commands"].as<JsonArray>()) {
+            stageAreaCommand(command, results.add<JsonObject>(), batch, compact);
+        }
+    } else {
+        stageAreaCommand(doc.as<JsonObject>(), response.to<JsonObject>(), batch, compact);
+    }
+
+    commitBatch(batch);
+    CommandTrace::stage(TRACE_COMMAND_END);
+}
+
+/// @brief Applies a staged batch and updates the cached actuator state
+void ControlService::commitBatch(GpioBatch &batch) {
+    if (batch.empty()) {
+        return;
+    }
+
+    CommandTrace::stage(TRACE_COMMIT_START);
+    batch.commit();
+    CommandTrace::stage(TRACE_GPIO_WRITTEN);
+
+    // Listeners may commit batches of their own (rules); keep those out of the command's trace
+    CommandTraceRecord *trace = CommandTrace::current();
+    CommandTrace::activate(nullptr);
+
+    for (size_t i = 0; i < batch.getDigitalCount(); i++) {
+        const GpioBatch::DigitalWrite &write = batch.getDigital(i);
+        if (!isGpio(write.pin)) {
+            continue;
+        }
+        bool changed = digitalPinStates[write.pin] != write.level;
+        digitalPinStates[write.pin] = write.level;
+        DeviceEntry *device = findDeviceByPin(write.pin);
+        if (changed && device != nullptr) {
+            notifyChange(*device);
+        }
+    }
+
+    for (size_t i = 0; i < batch.getPwmCount(); i++) {
+        const GpioBatch::PwmWrite &write = batch.getPwm(i);
+        if (!isGpio(write.pin)) {
+            continue;
+        }
+        bool changed = fanSpeeds[write.pin] != write.tag;
+        fanSpeeds[write.pin] = write.tag;
+        DeviceEntry *device = findDeviceByPin(write.pin);
+        if (changed && device != nullptr) {
+            notifyChange(*device);
+        }
+    }
+    CommandTrace::activate(trace);
+    CommandTrace::stage(TRACE_COMMIT_END);
+}
+
+/// @brief Stages a fan speed, mapping the 0-100 percentage to the PWM duty range
+bool ControlService::stageFanSpeed(GpioBatch &batch, int pin, int speedPercentage) {
+    int channel = fanChannel(pin);
+    if (channel < 0 || speedPercentage < 0 || speedPercentage > 100) {
+        return false;
+    }
+    return batch.stagePwm(pin, channel, ::map(speedPercentage, 0, 100, 0, 255), speedPercentage);
+}
+
+/// @brief Resolves a toggle/setspeed device command to a pin action for later replay
+/// @param areaId area the device belongs to
+/// @param device {"deviceId", "function", "parameters"}
+/// @param action receives the compiled action
+/// @param error receives a message on failure
+bool ControlService::compileAction(const char *areaId, JsonObject device, OutputAction &action, String &error) {
+    const char *deviceId = device["deviceId"];
+    const char *function = device["function"];
+    if (areaId == nullptr || deviceId == nullptr || function == nullptr) {
+        error = "Missing 'areaId', 'deviceId' or 'function'";
+        return false;
+    }
+
+    int pin = getPinValue(areaId, deviceId);
+    if (pin == -1) {
+        error = String("Invalid device ID '") + deviceId + "' or area '" + areaId + "'";
+        return false;
+    }
+
+    action.pin = (uint8_t)pin;
+    if (strcmp(function, "toggle") == 0 && device["parameters"]["state"].is<bool>()) {
+        action.kind = OUTPUT_ACTION_DIGITAL;
+        action.value = device["parameters"]["state"].as<bool>() ? HIGH : LOW;
+        return true;
+    }
+    if (strcmp(function, "setspeed") == 0 && device["parameters"]["speed"].is<int>()) {
+        int speed = device["parameters"]["speed"];
+        if (speed < 0 || speed > 100) {
+            error = "Fan speed must be between 0 and 100";
+            return false;
+        }
+        action.kind = OUTPUT_ACTION_FAN;
+        action.value = (uint8_t)speed;
+        return true;
+    }
+
+    error = String("Unsupported function or parameters for device '") + deviceId + "'";
+    return false;
+}
+
+bool ControlService::stageAction(GpioBatch &batch, const OutputAction &action) {
+    if (action.kind == OUTPUT_ACTION_DIGITAL) {
+        return batch.stageDigital(action.pin, action.value);
+    }
+    return stageFanSpeed(batch, action.pin, action.value);
+}
+
+// Writes one result in the verbose (status + message) or compact (numeric code) format.
+// Compact results skip message formatting entirely.
+class CommandReply
+{
+private:
+    JsonObject out;
+    bool compact;
+    char message[160];
+
+    void write(CommandCode code, const char *format, va_list args) {
+        if (compact) {
+            out["c"] = (int)code;
+            return;
+        }
+        out["status"] = code == CMD_OK ? "success" : "error";
+        vsnprintf(message, sizeof(message), format, args); // Never through temporary Strings
+        out["message"] = message;
+    }
+
+public:
+    CommandReply(JsonObject out, bool compact) : out(out), compact(compact) {}
+
+    void success(const char *format, ...) {
+        va_list args;
+        va_start(args, format);
+        write(CMD_OK, format, args);
+        va_end(args);
+    }
+
+    void error(CommandCode code, const char *format, ...) {
+        va_list args;
+        va_start(args, format);
+        write(code, format, args);
+        va_end(args);
+    }
+};
+
+/// @brief Writes a device's cached state with the short keys of the compact format
+void ControlService::writeCompactState(const DeviceEntry &device, JsonObject out) {
+    switch (device.type) {
+    case PIN_TYPE_LED:
+        out["s"] = digitalPinStates[device.value] == HIGH ? 1 : 0;
+        break;
+    case PIN_TYPE_FAN: {
+        out["v"] = fanSpeeds[device.value];
+        uint32_t rpm;
+        bool stalled;
+        if (getFanRpm(device.value, rpm, stalled)) {
+            out["r"] = rpm;
+            out["x"] = stalled ? 1 : 0;
+        }
+        break;
+    }
+    case PIN_TYPE_DHT11: {
+        float temperature, humidity;
+        if (getDHT11Readings(device.value, temperature, humidity)) {
+            out["t"] = temperature;
+            out["h"] = humidity;
+        }
+        break;
+    }
+    case PIN_TYPE_PIR:
+        out["m"] = pirStates[device.value] ? 1 : 0;
+        break;
+    default:
+        break;
+    }
+}
+
+/// @brief Validates one area's device commands and stages their outputs
+/// @param command {"areaId": ..., "devices": [...]}
+/// @param response object receiving the area's status and per-device results
+/// @param batch outputs are staged here and applied by the caller
+/// @param compact numeric codes and short keys instead of messages; device results
+/// keep the order of the request, so device ids are not echoed
+void ControlService::stageAreaCommand(JsonObject command, JsonObject response, GpioBatch &batch, bool compact) {
+    CommandReply areaReply(response, compact);
+    const char *areaId = command["areaId"];
     if (areaId == nullptr) {
-        response["status"] = "error";
-        response["message"] = "Missing 'areaId' in command";
+        areaReply.error(CMD_ERR_BAD_REQUEST, "Missing 'areaId' in command");
         return;
     }
 
-    if (!doc["devices"].is<JsonArray>()) {
-        response["status"] = "error";
-        response["message"] = "Missing or invalid 'devices' array in command";
+    if (!command["devices"].is<JsonArray>()) {
+        areaReply.error(CMD_ERR_BAD_REQUEST, "Missing or invalid 'devices' array in command");
         return;
     }
 
-    if (!areaDevicesMap.count(areaId)) {
-        response["status"] = "error";
-        response["message"] = String("Area '") + areaId + "' not found";
+    if (firstInArea(areaId) == deviceCount) {
+        areaReply.error(CMD_ERR_UNKNOWN_AREA, "Area '%s' not found", areaId);
         return;
     }
 
-    JsonArray devicesResponse = response.createNestedArray("devices"); // Create an array for device responses
+    JsonArray devicesResponse;
+    if (compact) {
+        response["c"] = (int)CMD_OK;
+        devicesResponse = response["d"].to<JsonArray>();
+    } else {
+        response["areaId"] = areaId;
+        devicesResponse = response["devices"].to<JsonArray>(); // Create an array for device responses
+    }
 
-    for (JsonObject device : doc["devices"].as<JsonArray>()) {
+    for (JsonObject device : command["devices"].as<JsonArray>()) {
+        CommandTraceDeviceScope deviceTrace; // Lookup, validation and staging of this device
         const char *device_id = device["deviceId"];
         const char *function_name = device["function"];
         JsonObject deviceResponse = devicesResponse.add<JsonObject>(); // Create response object for each device
-        deviceResponse["deviceId"] = device_id; // Add deviceId to device response
+        CommandReply reply(deviceResponse, compact);
+        if (!compact) {
+            deviceResponse["deviceId"] = device_id; // Add deviceId to device response
+        }
 
         if (device_id == nullptr || function_name == nullptr) {
-            deviceResponse["status"] = "error";
-            deviceResponse["message"] = "Missing 'deviceId' or 'function' in device command";
+            reply.error(CMD_ERR_BAD_REQUEST, "Missing 'deviceId' or 'function' in device command");
             continue;
         }
 
         if (strcmp(function_name, "toggle") == 0) {
             JsonObject parameters = device["parameters"];
             if (!parameters.containsKey("state")) {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = "Missing 'state' parameter for 'toggle' function";
+                reply.error(CMD_ERR_MISSING_PARAMETER, "Missing 'state' parameter for 'toggle' function");
                 continue;
             }
 
@@ -204,24 +738,24 @@ void ControlService::handleCommand(JsonDocument doc, JsonDocument &response) {
 
             int pin = getPinValue(areaId, device_id);
             if (pin == -1) {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Invalid device ID '") + device_id + "' or area '" + areaId + "'";
+                reply.error(CMD_ERR_UNKNOWN_DEVICE, "Invalid device ID '%s' or area '%s'", device_id, areaId);
                 continue;
             }
 
-            if (this->toggle(pin, level)) {
-                deviceResponse["status"] = "success";
-                deviceResponse["message"] = String("Toggled device '") + device_id + "' to state " + (state ? "on" : "off");
-                deviceResponse["power_state"] = (state ? "on" : "off"); // Add power_state to response
+            if (batch.stageDigital(pin, level)) {
+                reply.success("Toggled device '%s' to state %s", device_id, state ? "on" : "off");
+                if (compact) {
+                    deviceResponse["s"] = state ? 1 : 0;
+                } else {
+                    deviceResponse["power_state"] = (state ? "on" : "off"); // Add power_state to response
+                }
             } else {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Toggle failed for device '") + device_id + "'";
+                reply.error(CMD_ERR_OUTPUT, "Toggle failed for device '%s'", device_id);
             }
         } else if (strcmp(function_name, "setspeed") == 0) {
             JsonObject parameters = device["parameters"];
             if (!parameters.containsKey("speed")) {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = "Missing 'speed' parameter for 'setspeed' function";
+                reply.error(CMD_ERR_MISSING_PARAMETER, "Missing 'speed' parameter for 'setspeed' function");
                 continue;
             }
 
@@ -229,25 +763,40 @@ void ControlService::handleCommand(JsonDocument doc, JsonDocument &response) {
 
             int pin = getPinValue(areaId, device_id);
             if (pin == -1) {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Invalid device ID '") + device_id + "' or area '" + areaId + "' for fan speed control";
+                reply.error(CMD_ERR_UNKNOWN_DEVICE, "Invalid device ID '%s' or area '%s' for fan speed control", device_id, areaId);
                 continue;
             }
 
-            if (this->controlFanSpeed(pin, speedPercentage)) { // **Call controlFanSpeed with speedPercentage**
-                deviceResponse["status"] = "success";
-                deviceResponse["message"] = String("Set fan '") + device_id + "' speed to " + speedPercentage + "%"; // Update message to show percentage
-                deviceResponse["fan_speed"] = speedPercentage; // Add fan_speed to response
-                deviceResponse["power_state"] = (speedPercentage > 0) ? "on" : "off"; // Add power_state to response
+            if (stageFanSpeed(batch, pin, speedPercentage)) {
+                reply.success("Set fan '%s' speed to %d%%", device_id, speedPercentage);
+                if (compact) {
+                    deviceResponse["v"] = speedPercentage;
+                } else {
+                    deviceResponse["fan_speed"] = speedPercentage; // Add fan_speed to response
+                    deviceResponse["power_state"] = (speedPercentage > 0) ? "on" : "off"; // Add power_state to response
+                }
             } else {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Failed to set speed for fan '") + device_id + "'";
+                reply.error(CMD_ERR_INVALID_PARAMETER, "Failed to set speed for fan '%s'", device_id);
+            }
+        } else if (strcmp(function_name, "getState") == 0) { // Cached state, no hardware access
+            DeviceEntry *entry = findDevice(areaId, device_id);
+            if (entry == nullptr) {
+                reply.error(CMD_ERR_UNKNOWN_DEVICE, "Invalid device ID '%s' or area '%s'", device_id, areaId);
+                continue;
+            }
+            if (compact) {
+                deviceResponse["c"] = (int)CMD_OK;
+                writeCompactState(*entry, deviceResponse);
+                continue;
+            }
+            writeDeviceState(*entry, deviceResponse);
+            if (!deviceResponse["status"].is<const char *>()) {
+                deviceResponse["status"] = "success";
             }
         }  else if (strcmp(function_name, "getReadings") == 0) { // New function to get sensor readings
             int pin = getPinValue(areaId, device_id);
             if (pin == -1) {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Invalid device ID '") + device_id + "' or area '" + areaId + "' for sensor readings";
+                reply.error(CMD_ERR_UNKNOWN_DEVICE, "Invalid device ID '%s' or area '%s' for sensor readings", device_id, areaId);
                 continue;
             }
 
@@ -256,23 +805,33 @@ void ControlService::handleCommand(JsonDocument doc, JsonDocument &response) {
                 float temperature = 0.0;
                 float humidity = 0.0;
                 if (getDHT11Readings(pin, temperature, humidity)) {
-                    deviceResponse["status"] = "success";
-                    deviceResponse["message"] = String("Readings for DHT11 sensor '") + device_id + "'";
-                    deviceResponse["temperature_celsius"] = temperature;
-                    deviceResponse["humidity_percent"] = humidity;
+                    reply.success("Readings for DHT11 sensor '%s'", device_id);
+                    deviceResponse[compact ? "t" : "temperature_celsius"] = temperature;
+                    deviceResponse[compact ? "h" : "humidity_percent"] = humidity;
+                } else {
+                    reply.error(CMD_ERR_SENSOR, "Failed to read from DHT11 sensor '%s'", device_id);
+                }
+            } else if (type == PIN_TYPE_FAN && fanTachs[pin] != nullptr) {
+                uint32_t rpm;
+                bool stalled;
+                getFanRpm(pin, rpm, stalled);
+                reply.success("Readings for fan '%s'", device_id);
+                if (compact) {
+                    deviceResponse["r"] = rpm;
+                    deviceResponse["x"] = stalled ? 1 : 0;
+                    deviceResponse["v"] = fanSpeeds[pin];
                 } else {
-                    deviceResponse["status"] = "error";
-                    deviceResponse["message"] = String("Failed to read from DHT11 sensor '") + device_id + "'";
+                    deviceResponse["rpm"] = rpm;
+                    deviceResponse["stalled"] = stalled;
+                    deviceResponse["fan_speed"] = fanSpeeds[pin];
                 }
             } else {
-                deviceResponse["status"] = "error";
-                deviceResponse["message"] = String("Device '") + device_id + "' is not a sensor or not supported for readings";
+                reply.error(CMD_ERR_NOT_SUPPORTED, "Device '%s' is not a sensor or not supported for readings", device_id);
             }
         }
         else {
             // ss->printToAll("Unknown function '%s' for device '%s'", function_name, device_id);
-            deviceResponse["status"] = "error";
-            deviceResponse["message"] = "Unknown function!";
+            reply.error(CMD_ERR_UNKNOWN_FUNCTION, "Unknown function!");
         }
     }
 }
@@ -280,18 +839,46 @@ void ControlService::handleCommand(JsonDocument doc, JsonDocument &response) {
 /// @brief Gets all sensor data in JSON format for all areas
 /// @return A JSON string containing sensor data for all areas
 String ControlService::getAllSensorDataJson() {
-    DynamicJsonDocument responseDoc(2048);  // Adjust size as needed
+    JsonDocument responseDoc;
+    buildSensorData(responseDoc);
+
+    String jsonString;
+    serializeJson(responseDoc, jsonString);
+    return jsonString;
+}
+
+/// @brief Serializes the sensor data document into a caller-owned buffer
+/// @param allocator backs the temporary document (e.g. a JsonArena), so nothing touches the heap
+/// @return length written, 0 if the buffer is too small
+size_t ControlService::writeAllSensorDataJson(char *out, size_t size, ArduinoJson::Allocator *allocator) {
+    JsonDocument responseDoc(allocator);
+    buildSensorData(responseDoc);
+    if (measureJson(responseDoc) >= size) {
+        return 0;
+    }
+    return serializeJson(responseDoc, out, size);
+}
+
+/// @brief Fills a document with the readings of every sensor, grouped by area
+void ControlService::buildSensorData(JsonDocument &responseDoc) {
     responseDoc["status"] = "success";
     responseDoc["message"] = "Sensor data retrieved successfully for all areas";
     JsonArray areasArray = responseDoc.createNestedArray("areas");
 
-    for (const auto &areaPair : areaDevicesMap) {
+    for (size_t first = 0; first < deviceCount; first++) {
+        const char *areaId = devices[first].areaId;
+        if (firstInArea(areaId) != first) {
+            continue; // Area already written with its first device
+        }
         JsonObject areaObject = areasArray.createNestedObject();
-        areaObject["areaId"] = areaPair.first;
+        areaObject["areaId"] = areaId;
         JsonArray sensorsArray = areaObject.createNestedArray("sensors");
 
-        for (const auto &devicePair : areaPair.second) {
-            const DeviceEntry &deviceEntry = devicePair.second;
+        for (size_t i = first; i < deviceCount; i++) {
+            const DeviceEntry &deviceEntry = devices[i];
+            if (strcmp(deviceEntry.areaId, areaId) != 0) {
+                continue;
+            }
             // Handle DHT11 sensor data
             if (deviceEntry.type == PIN_TYPE_DHT11) {
                 JsonObject sensorObject = sensorsArray.createNestedObject();
@@ -321,11 +908,22 @@ String ControlService::getAllSensorDataJson() {
                     sensorObject["message"] = "Failed to read PIR sensor";
                 }
             }
+            // Handle fans with a tach input
+            else if (deviceEntry.type == PIN_TYPE_FAN && fanTachs[deviceEntry.value] != nullptr) {
+                JsonObject sensorObject = sensorsArray.createNestedObject();
+                sensorObject["deviceId"] = deviceEntry.deviceId;
+                sensorObject["type"] = "FAN";
+                uint32_t rpm;
+                bool stalled;
+                getFanRpm(deviceEntry.value, rpm, stalled);
+                sensorObject["status"] = stalled ? "error" : "success";
+                sensorObject["rpm"] = rpm;
+                sensorObject["stalled"] = stalled;
+                if (stalled) {
+                    sensorObject["message"] = "Fan is driven but not turning";
+                }
+            }
             // Handle other device types as needed…
         }
     }
-
-    String jsonString;
-    serializeJson(responseDoc, jsonString);
-    return jsonString;
 }
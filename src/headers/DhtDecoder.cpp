@@ -0,0 +1,97 @@
+#include "DhtDecoder.h"
+
+// Protocol timings (microseconds). A data bit is a ~50us low followed by a
+// ~26-28us high for '0' or a ~70us high for '1'.
+static const uint16_t BIT_LOW_MIN_US = 30;
+static const uint16_t BIT_LOW_MAX_US = 90;
+static const uint16_t BIT_HIGH_MIN_US = 10;
+static const uint16_t BIT_HIGH_MAX_US = 100;
+static const uint16_t BIT_ONE_THRESHOLD_US = 48;
+static const size_t DATA_BITS = 40;
+
+/// @brief Decodes a captured DHT pulse train
+/// @param pulses level/duration pairs in capture order
+/// @param count number of pulses
+/// @param bytes receives the 5 decoded bytes
+/// @return DHT_DECODE_OK when the checksum matches
+///
+/// The trace starts with the host release and the sensor's 80us/80us response,
+/// and ends with the trailing ~50us low before the line idles high. Only the
+/// last 40 high pulses that are followed by a low pulse carry data, which makes
+/// the decoder insensitive to how much of the preamble the receiver caught.
+DhtDecodeStatus dhtDecodePulses(const DhtPulse *pulses, size_t count, uint8_t bytes[5])
+{
+    if (pulses == nullptr || count == 0) {
+        return DHT_DECODE_NO_RESPONSE;
+    }
+
+    // Walk backwards collecting data highs (a high with a low both before and after it)
+    size_t highIndex[DATA_BITS];
+    size_t found = 0;
+    for (size_t i = count - 1; i > 0 && found < DATA_BITS; i--) {
+        if (pulses[i].level == 1 && i + 1 < count && pulses[i + 1].level == 0 && pulses[i - 1].level == 0) {
+            highIndex[DATA_BITS - 1 - found] = i;
+            found++;
+        }
+    }
+
+    if (found < DATA_BITS) {
+        return DHT_DECODE_TOO_FEW_BITS;
+    }
+
+    for (size_t b = 0; b < 5; b++) {
+        bytes[b] = 0;
+    }
+
+    for (size_t bit = 0; bit < DATA_BITS; bit++) {
+        const DhtPulse &low = pulses[highIndex[bit] - 1];
+        const DhtPulse &high = pulses[highIndex[bit]];
+
+        if (low.durationUs < BIT_LOW_MIN_US || low.durationUs > BIT_LOW_MAX_US ||
+            high.durationUs < BIT_HIGH_MIN_US || high.durationUs > BIT_HIGH_MAX_US) {
+            return DHT_DECODE_BAD_TIMING;
+        }
+
+        bytes[bit / 8] <<= 1;
+        if (high.durationUs > BIT_ONE_THRESHOLD_US) {
+            bytes[bit / 8] |= 1;
+        }
+    }
+
+    uint8_t checksum = (uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]);
+    if (checksum != bytes[4]) {
+        return DHT_DECODE_CHECKSUM;
+    }
+
+    return DHT_DECODE_OK;
+}
+
+/// @brief Converts a DHT11 frame, matching the Adafruit library's interpretation
+void dht11ConvertBytes(const uint8_t bytes[5], float &temperature, float &humidity)
+{
+    humidity = bytes[0] + bytes[1] * 0.1f;
+
+    float t = bytes[2];
+    if (bytes[3] & 0x80) {
+        t = -1 - t;
+    }
+    t += (bytes[3] & 0x0f) * 0.1f;
+    temperature = t;
+}
+
+const char *dhtDecodeStatusName(DhtDecodeStatus status)
+{
+    switch (status) {
+    case DHT_DECODE_OK:
+        return "ok";
+    case DHT_DECODE_NO_RESPONSE:
+        return "no response";
+    case DHT_DECODE_TOO_FEW_BITS:
+        return "too few bits";
+    case DHT_DECODE_BAD_TIMING:
+        return "bad timing";
+    case DHT_DECODE_CHECKSUM:
+        return "checksum mismatch";
+    }
+    return "unknown";
+}
@@ -0,0 +1,185 @@
+#include "DhtRmtReader.h"
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <rom/gpio.h>
+#include <soc/gpio_sig_map.h>
+
+// 1 tick = 1 us with the 80 MHz APB clock
+static const uint8_t RMT_CLK_DIV = 80;
+// Every DHT pulse is shorter than 100 us, so a longer quiet line ends the frame
+static const uint16_t RMT_IDLE_THRESHOLD_US = 150;
+// Ignore glitches shorter than ~3 us (value is in APB clock cycles)
+static const uint8_t RMT_FILTER_TICKS = 250;
+// Host start signal, DHT11 needs the line held low for at least 18 ms
+static const uint32_t START_SIGNAL_MS = 20;
+// Preamble + 40 bits + trailer fit in well under 96 level changes
+static const size_t MAX_PULSES = 96;
+
+DhtRmtReader::DhtRmtReader(int pin, int channel)
+    : pin(pin), channel((rmt_channel_t)channel), ringBuffer(NULL), installed(false),
+      temperature(0), humidity(0), hasReading(false), lastReadMs(0), lastDecodeUs(0),
+      failureCount(0), lastStatus(DHT_DECODE_NO_RESPONSE)
+{
+    lock = portMUX_INITIALIZER_UNLOCKED;
+}
+
+DhtRmtReader::~DhtRmtReader()
+{
+    if (installed) {
+        rmt_driver_uninstall(channel);
+    }
+}
+
+/// @brief Configures the RMT channel as a receiver on the sensor pin
+/// @return true if the driver was installed
+bool DhtRmtReader::begin()
+{
+    if (installed) {
+        return true;
+    }
+
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)pin, channel);
+    config.clk_div = RMT_CLK_DIV;
+    config.mem_block_num = 1;
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = RMT_FILTER_TICKS;
+    config.rx_config.idle_threshold = RMT_IDLE_THRESHOLD_US;
+
+    if (rmt_config(&config) != ESP_OK) {
+        return false;
+    }
+    if (rmt_driver_install(channel, 512, 0) != ESP_OK) {
+        return false;
+    }
+    if (rmt_get_ringbuf_handle(channel, &ringBuffer) != ESP_OK) {
+        rmt_driver_uninstall(channel);
+        return false;
+    }
+
+    // The host drives the start signal on the same pin the RMT listens on:
+    // open-drain output keeps the input path routed to the RMT
+    gpio_set_direction((gpio_num_t)pin, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_pull_mode((gpio_num_t)pin, GPIO_PULLUP_ONLY);
+    gpio_matrix_out(pin, SIG_GPIO_OUT_IDX, false, false);
+    gpio_set_level((gpio_num_t)pin, 1);
+
+    installed = true;
+    return true;
+}
+
+/// @brief Sends the start signal and waits for the RMT capture of the response
+/// @param timeoutMs how long to wait for the frame after releasing the line
+/// @return decode status, the cached reading is updated on success
+///
+/// Blocks only the calling task; interrupts stay enabled throughout and the
+/// CPU is idle while the hardware records the frame.
+DhtDecodeStatus DhtRmtReader::read(uint32_t timeoutMs)
+{
+    if (!installed) {
+        return DHT_DECODE_NO_RESPONSE;
+    }
+
+    // Drop anything left over from an aborted capture
+    size_t size = 0;
+    void *stale;
+    while ((stale = xRingbufferReceive(ringBuffer, &size, 0)) != NULL) {
+        vRingbufferReturnItem(ringBuffer, stale);
+    }
+
+    gpio_set_level((gpio_num_t)pin, 0);
+    vTaskDelay(pdMS_TO_TICKS(START_SIGNAL_MS));
+    rmt_rx_start(channel, true);
+    gpio_set_level((gpio_num_t)pin, 1); // Release the line, the sensor answers within ~40 us
+
+    rmt_item32_t *items = (rmt_item32_t *)xRingbufferReceive(ringBuffer, &size, pdMS_TO_TICKS(timeoutMs));
+    rmt_rx_stop(channel);
+
+    DhtDecodeStatus status = DHT_DECODE_NO_RESPONSE;
+    float t = 0, h = 0;
+    int64_t decodeStart = esp_timer_get_time();
+
+    if (items != NULL) {
+        DhtPulse pulses[MAX_PULSES];
+        size_t count = 0;
+        size_t itemCount = size / sizeof(rmt_item32_t);
+
+        for (size_t i = 0; i < itemCount && count + 2 <= MAX_PULSES; i++) {
+            if (items[i].duration0 == 0) {
+                break;
+            }
+            pulses[count++] = {(uint8_t)items[i].level0, (uint16_t)items[i].duration0};
+            if (items[i].duration1 == 0) {
+                break;
+            }
+            pulses[count++] = {(uint8_t)items[i].level1, (uint16_t)items[i].duration1};
+        }
+        vRingbufferReturnItem(ringBuffer, items);
+
+        uint8_t bytes[5];
+        status = dhtDecodePulses(pulses, count, bytes);
+        if (status == DHT_DECODE_OK) {
+            dht11ConvertBytes(bytes, t, h);
+        }
+    }
+
+    uint32_t decodeUs = (uint32_t)(esp_timer_get_time() - decodeStart);
+
+    portENTER_CRITICAL(&lock);
+    lastStatus = status;
+    lastDecodeUs = decodeUs;
+    if (status == DHT_DECODE_OK) {
+        temperature = t;
+        humidity = h;
+        hasReading = true;
+        lastReadMs = millis();
+        failureCount = 0;
+    } else {
+        failureCount++;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    return status;
+}
+
+/// @brief Returns the last successfully decoded reading without touching the sensor
+bool DhtRmtReader::getLastReading(float &temperature, float &humidity)
+{
+    portENTER_CRITICAL(&lock);
+    bool valid = hasReading;
+    temperature = this->temperature;
+    humidity = this->humidity;
+    portEXIT_CRITICAL(&lock);
+    return valid;
+}
+
+unsigned long DhtRmtReader::getLastReadMs()
+{
+    portENTER_CRITICAL(&lock);
+    unsigned long value = lastReadMs;
+    portEXIT_CRITICAL(&lock);
+    return value;
+}
+
+uint32_t DhtRmtReader::getLastDecodeUs()
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t value = lastDecodeUs;
+    portEXIT_CRITICAL(&lock);
+    return value;
+}
+
+uint32_t DhtRmtReader::getFailureCount()
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t value = failureCount;
+    portEXIT_CRITICAL(&lock);
+    return value;
+}
+
+DhtDecodeStatus DhtRmtReader::getLastStatus()
+{
+    portENTER_CRITICAL(&lock);
+    DhtDecodeStatus value = lastStatus;
+    portEXIT_CRITICAL(&lock);
+    return value;
+}
@@ -0,0 +1,110 @@
+#include "FanTachometer.h"
+
+// The counter wraps to 0 when it reaches the high limit
+static const int16_t PCNT_HIGH_LIMIT = 32767;
+// Ignore edges shorter than ~12 us (APB cycles), tach lines pick up PWM noise
+static const uint16_t PCNT_FILTER_CYCLES = 1000;
+// Publish RPM changes at most once per window and only when they are noticeable
+static const unsigned long PUBLISH_INTERVAL_MS = 1000;
+static const uint32_t PUBLISH_DEADBAND_RPM = 50;
+
+FanTachometer::FanTachometer(int tachPin, int unit, uint8_t pulsesPerRev)
+    : tachPin(tachPin), unit((pcnt_unit_t)unit), installed(false), lastCount(0), lastSampleMs(0),
+      window(pulsesPerRev), publishedRpm(0), publishedStalled(false), lastPublishMs(0)
+{
+    lock = portMUX_INITIALIZER_UNLOCKED;
+}
+
+FanTachometer::~FanTachometer()
+{
+    if (installed) {
+        pcnt_counter_pause(unit);
+    }
+}
+
+/// @brief Counts rising edges on the tach pin in the PCNT unit
+/// @return true if the unit was configured
+bool FanTachometer::begin()
+{
+    if (installed) {
+        return true;
+    }
+
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = tachPin;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.counter_h_lim = PCNT_HIGH_LIMIT;
+    config.counter_l_lim = -1;
+    config.unit = unit;
+    config.channel = PCNT_CHANNEL_0;
+
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        return false;
+    }
+    pcnt_set_filter_value(unit, PCNT_FILTER_CYCLES);
+    pcnt_filter_enable(unit);
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+
+    lastCount = 0;
+    lastSampleMs = millis();
+    installed = true;
+    return true;
+}
+
+/// @brief Reads the hardware counter and feeds the pulses since the last call into the window
+/// @param nowMs current millis()
+/// @param driven the fan's duty is above zero
+bool FanTachometer::sample(unsigned long nowMs, bool driven)
+{
+    if (!installed) {
+        return false;
+    }
+
+    int16_t count = 0;
+    if (pcnt_get_counter_value(unit, &count) != ESP_OK) {
+        return false;
+    }
+    int32_t delta = count - lastCount;
+    if (delta < 0) {
+        delta += PCNT_HIGH_LIMIT; // Wrapped at the high limit
+    }
+    lastCount = count;
+    unsigned long interval = nowMs - lastSampleMs;
+    lastSampleMs = nowMs;
+    if (interval == 0) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&lock);
+    window.addSample((uint16_t)delta, (uint16_t)min(interval, 65535UL), driven);
+    uint32_t rpm = window.rpm();
+    bool stalled = window.isStalled();
+
+    uint32_t change = rpm > publishedRpm ? rpm - publishedRpm : publishedRpm - rpm;
+    bool publish = stalled != publishedStalled ||
+                   (change >= PUBLISH_DEADBAND_RPM && nowMs - lastPublishMs >= PUBLISH_INTERVAL_MS) ||
+                   (change > 0 && rpm == 0); // Always report reaching a standstill
+    if (publish) {
+        publishedRpm = rpm;
+        publishedStalled = stalled;
+        lastPublishMs = nowMs;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    return publish;
+}
+
+/// @brief Current windowed RPM and stall flag, no hardware access
+void FanTachometer::getState(uint32_t &rpm, bool &stalled)
+{
+    portENTER_CRITICAL(&lock);
+    rpm = window.rpm();
+    stalled = window.isStalled();
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,245 @@
+#include "FanThermostat.h"
+#include <Preferences.h>
+
+static const uint8_t THERMOSTAT_FORMAT_VERSION = 1;
+static const char *THERMOSTAT_NAMESPACE = "thermostat";
+
+FanThermostat::FanThermostat(ControlService *cs) : cs(cs)
+{
+    mutex = xSemaphoreCreateRecursiveMutex(); // Writing the fan re-enters through the change listener
+}
+
+FanThermostat::~FanThermostat()
+{
+    if (mutex != NULL) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+/// @brief Loads saved loops from NVS and hooks into the sampler task
+void FanThermostat::begin()
+{
+    Preferences prefs;
+    if (prefs.begin(THERMOSTAT_NAMESPACE, true)) {
+        for (uint8_t i = 0; i < THERMOSTAT_MAX_LOOPS; i++) {
+            char key[4];
+            snprintf(key, sizeof(key), "t%u", i);
+            ThermostatConfig stored;
+            if (prefs.getBytes(key, &stored, sizeof(stored)) != sizeof(stored) ||
+                stored.formatVersion != THERMOSTAT_FORMAT_VERSION) {
+                break;
+            }
+            Loop &loop = loops[loopCount++];
+            loop.config = stored;
+            applyConfig(loop);
+        }
+        prefs.end();
+    }
+
+    cs->addTickListener([this](uint32_t nowMs) { this->onTick(nowMs); });
+    cs->addChangeListener([this](const DeviceEntry &device) { this->onDeviceChange(device); });
+}
+
+FanThermostat::Loop *FanThermostat::findLoop(uint8_t fanPin)
+{
+    for (uint8_t i = 0; i < loopCount; i++) {
+        if (loops[i].config.fanPin == fanPin) {
+            return &loops[i];
+        }
+    }
+    return nullptr;
+}
+
+/// @brief Pushes the stored gains and duty limits into the PID and restarts the loop
+void FanThermostat::applyConfig(Loop &loop)
+{
+    const ThermostatConfig &config = loop.config;
+    loop.pid.configure({config.kp, config.ki, config.kd, 0.0f, (float)config.maxDuty, PID_REVERSE});
+    loop.pid.reset();
+    loop.lastSampleMs = 0;
+    loop.lastTemperature = 0;
+    loop.duty = 0;
+}
+
+void FanThermostat::persist(uint8_t index)
+{
+    Preferences prefs;
+    if (prefs.begin(THERMOSTAT_NAMESPACE, false)) {
+        char key[4];
+        snprintf(key, sizeof(key), "t%u", index);
+        prefs.putBytes(key, &loops[index].config, sizeof(ThermostatConfig));
+        prefs.end();
+    }
+}
+
+/// @brief Validates a thermostat definition and (re)engages the fan's loop
+bool FanThermostat::configure(JsonObject definition, String &error)
+{
+    const char *areaId = definition["areaId"];
+    const char *deviceId = definition["deviceId"];
+    const char *sensorAreaId = definition["sensor"]["areaId"];
+    const char *sensorDeviceId = definition["sensor"]["deviceId"];
+    if (areaId == nullptr || deviceId == nullptr || sensorAreaId == nullptr || sensorDeviceId == nullptr) {
+        error = "Missing fan or sensor 'areaId'/'deviceId'";
+        return false;
+    }
+    if (cs->getDeviceType(areaId, deviceId) != PIN_TYPE_FAN) {
+        error = String("Device '") + deviceId + "' is not a fan";
+        return false;
+    }
+    if (cs->getDeviceType(sensorAreaId, sensorDeviceId) != PIN_TYPE_DHT11) {
+        error = String("Device '") + sensorDeviceId + "' is not a DHT11 sensor";
+        return false;
+    }
+    if (!definition["target"].is<float>()) {
+        error = "Missing numeric 'target'";
+        return false;
+    }
+
+    ThermostatConfig config = {};
+    config.formatVersion = THERMOSTAT_FORMAT_VERSION;
+    config.enabled = 1;
+    config.fanPin = (uint8_t)cs->getPinValue(areaId, deviceId);
+    config.sensorPin = (uint8_t)cs->getPinValue(sensorAreaId, sensorDeviceId);
+    config.targetCelsius = definition["target"];
+    config.kp = definition["kp"] | 8.0f;
+    config.ki = definition["ki"] | 0.05f;
+    config.kd = definition["kd"] | 0.0f;
+    int minDuty = definition["minDuty"] | 20;
+    int maxDuty = definition["maxDuty"] | 100;
+    int spinUpDuty = definition["spinUpDuty"] | 60;
+    if (minDuty < 0 || maxDuty > 100 || minDuty > maxDuty || spinUpDuty < 0 || spinUpDuty > 100) {
+        error = "Duty limits must satisfy 0 <= minDuty <= maxDuty <= 100";
+        return false;
+    }
+    if (config.kp < 0 || config.ki < 0 || config.kd < 0) {
+        error = "PID gains must not be negative";
+        return false;
+    }
+    config.minDuty = (uint8_t)minDuty;
+    config.maxDuty = (uint8_t)maxDuty;
+    config.spinUpDuty = (uint8_t)spinUpDuty;
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        error = "Thermostat busy";
+        return false;
+    }
+    Loop *loop = findLoop(config.fanPin);
+    if (loop == nullptr) {
+        if (loopCount >= THERMOSTAT_MAX_LOOPS) {
+            xSemaphoreGiveRecursive(mutex);
+            error = "Too many thermostat loops";
+            return false;
+        }
+        loop = &loops[loopCount++];
+    }
+    loop->config = config;
+    applyConfig(*loop);
+    persist((uint8_t)(loop - loops));
+    xSemaphoreGiveRecursive(mutex);
+    return true;
+}
+
+/// @brief Takes a fan out of thermostat mode, leaving its current speed in place
+bool FanThermostat::disable(uint8_t fanPin)
+{
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    Loop *loop = findLoop(fanPin);
+    bool found = loop != nullptr;
+    if (found && loop->config.enabled) {
+        loop->config.enabled = 0;
+        persist((uint8_t)(loop - loops));
+    }
+    xSemaphoreGiveRecursive(mutex);
+    return found;
+}
+
+/// @brief Runs every enabled loop once per new DHT sample
+void FanThermostat::onTick(uint32_t nowMs)
+{
+    GpioBatch batch;
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    for (uint8_t i = 0; i < loopCount; i++) {
+        Loop &loop = loops[i];
+        if (!loop.config.enabled) {
+            continue;
+        }
+        unsigned long sampleMs = cs->getDHT11SampleTime(loop.config.sensorPin);
+        if (sampleMs == 0 || sampleMs == loop.lastSampleMs) {
+            continue; // No new reading since the last step
+        }
+        float temperature, humidity;
+        if (!cs->getDHT11Readings(loop.config.sensorPin, temperature, humidity)) {
+            continue;
+        }
+
+        float dtSeconds = loop.lastSampleMs == 0 ? 0 : (sampleMs - loop.lastSampleMs) / 1000.0f;
+        loop.lastSampleMs = sampleMs;
+        loop.lastTemperature = temperature;
+
+        float output = loop.pid.update(loop.config.targetCelsius, temperature, dtSeconds);
+        int duty = fanDutyFromPid(output, loop.config.minDuty, loop.config.maxDuty, loop.config.spinUpDuty, loop.duty > 0);
+        loop.duty = (uint8_t)duty; // Recorded before the write so the change listener recognises it
+        cs->stageFanSpeed(batch, loop.config.fanPin, duty);
+    }
+    xSemaphoreGiveRecursive(mutex);
+
+    cs->commitBatch(batch);
+}
+
+/// @brief A fan speed the loop did not write means someone took manual control
+void FanThermostat::onDeviceChange(const DeviceEntry &device)
+{
+    if (device.type != PIN_TYPE_FAN) {
+        return;
+    }
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    Loop *loop = findLoop((uint8_t)device.value);
+    int speed;
+    if (loop != nullptr && loop->config.enabled && cs->getFanSpeed(device.value, speed) && speed != loop->duty) {
+        loop->config.enabled = 0;
+        persist((uint8_t)(loop - loops));
+    }
+    xSemaphoreGiveRecursive(mutex);
+}
+
+void FanThermostat::describe(JsonArray out)
+{
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    for (uint8_t i = 0; i < loopCount; i++) {
+        const Loop &loop = loops[i];
+        const PidState &state = loop.pid.getState();
+        JsonObject entry = out.add<JsonObject>();
+        entry["fanPin"] = loop.config.fanPin;
+        entry["sensorPin"] = loop.config.sensorPin;
+        entry["enabled"] = loop.config.enabled != 0;
+        entry["target"] = loop.config.targetCelsius;
+        entry["kp"] = loop.config.kp;
+        entry["ki"] = loop.config.ki;
+        entry["kd"] = loop.config.kd;
+        entry["minDuty"] = loop.config.minDuty;
+        entry["maxDuty"] = loop.config.maxDuty;
+        entry["spinUpDuty"] = loop.config.spinUpDuty;
+
+        JsonObject pid = entry["state"].to<JsonObject>();
+        pid["temperature"] = loop.lastTemperature;
+        pid["error"] = state.error;
+        pid["p"] = state.proportional;
+        pid["i"] = state.integral;
+        pid["d"] = state.derivative;
+        pid["output"] = state.output;
+        pid["saturated"] = state.saturated;
+        pid["duty"] = loop.duty;
+    }
+    xSemaphoreGiveRecursive(mutex);
+}
@@ -0,0 +1,85 @@
+#include "GpioBatch.h"
+
+#ifdef ESP_PLATFORM
+#include <soc/gpio_struct.h>
+#endif
+
+/// @brief Stages a digital level; a later write to the same pin replaces the earlier one
+/// @return false for pins that cannot be outputs (GPIO34-39 are input only)
+bool GpioBatch::stageDigital(int pin, int level)
+{
+    if (pin < 0 || pin > 33) {
+        return false;
+    }
+
+    uint32_t bit = pin < 32 ? (1UL << pin) : (1UL << (pin - 32));
+    uint32_t &setMask = pin < 32 ? setMaskLow : setMaskHigh;
+    uint32_t &clearMask = pin < 32 ? clearMaskLow : clearMaskHigh;
+    if (level == HIGH) {
+        setMask |= bit;
+        clearMask &= ~bit;
+    } else {
+        clearMask |= bit;
+        setMask &= ~bit;
+    }
+
+    for (size_t i = 0; i < digitalCount; i++) {
+        if (digital[i].pin == pin) {
+            digital[i].level = (uint8_t)level;
+            return true;
+        }
+    }
+    digital[digitalCount++] = {(uint8_t)pin, (uint8_t)level};
+    return true;
+}
+
+/// @brief Stages a PWM duty; a later write to the same channel replaces the earlier one
+bool GpioBatch::stagePwm(int pin, int channel, uint32_t duty, int tag)
+{
+    if (channel < 0 || channel >= (int)maxPwm) {
+        return false;
+    }
+
+    for (size_t i = 0; i < pwmCount; i++) {
+        if (pwm[i].channel == channel) {
+            pwm[i] = {(uint8_t)pin, (uint8_t)channel, duty, tag};
+            return true;
+        }
+    }
+    pwm[pwmCount++] = {(uint8_t)pin, (uint8_t)channel, duty, tag};
+    return true;
+}
+
+/// @brief Applies all staged outputs: four register writes for the digital pins, then PWM
+void GpioBatch::commit()
+{
+#ifdef ESP_PLATFORM
+    if (setMaskLow) {
+        GPIO.out_w1ts = setMaskLow;
+    }
+    if (clearMaskLow) {
+        GPIO.out_w1tc = clearMaskLow;
+    }
+    if (setMaskHigh) {
+        GPIO.out1_w1ts.val = setMaskHigh;
+    }
+    if (clearMaskHigh) {
+        GPIO.out1_w1tc.val = clearMaskHigh;
+    }
+#else
+    for (size_t i = 0; i < digitalCount; i++) {
+        digitalWrite(digital[i].pin, digital[i].level);
+    }
+#endif
+
+    for (size_t i = 0; i < pwmCount; i++) {
+        ledcWrite(pwm[i].channel, pwm[i].duty);
+    }
+}
+
+void GpioBatch::clear()
+{
+    setMaskLow = clearMaskLow = setMaskHigh = clearMaskHigh = 0;
+    digitalCount = 0;
+    pwmCount = 0;
+}
@@ -0,0 +1,106 @@
+#include "JsonArena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Every block is preceded by its size; 8 bytes keeps payloads 8-byte aligned
+static const size_t HEADER_SIZE = 8;
+static const size_t ALIGNMENT = 8;
+
+static size_t alignUp(size_t size)
+{
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+JsonArena::JsonArena(size_t capacity) : capacity(capacity)
+{
+    buffer = (uint8_t *)malloc(capacity);
+    if (buffer == nullptr) {
+        this->capacity = 0; // Every allocation falls back to the heap
+    }
+}
+
+JsonArena::~JsonArena()
+{
+    free(buffer);
+}
+
+bool JsonArena::owns(void *ptr) const
+{
+    return ptr >= buffer && ptr < buffer + capacity;
+}
+
+void *JsonArena::allocate(size_t size)
+{
+    size_t needed = HEADER_SIZE + alignUp(size);
+    if (offset + needed > capacity) {
+        overflowCount++;
+        return malloc(size);
+    }
+
+    uint8_t *block = buffer + offset;
+    *(size_t *)block = size;
+    lastBlock = offset;
+    offset += needed;
+    if (offset > highWater) {
+        highWater = offset;
+    }
+    return block + HEADER_SIZE;
+}
+
+void JsonArena::deallocate(void *ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    if (!owns(ptr)) {
+        free(ptr);
+        return;
+    }
+    // Give back the tail block, everything else is reclaimed by reset()
+    size_t blockOffset = (uint8_t *)ptr - buffer - HEADER_SIZE;
+    if (blockOffset == lastBlock) {
+        offset = blockOffset;
+        lastBlock = SIZE_MAX;
+    }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t newSize)
+{
+    if (ptr == nullptr) {
+        return allocate(newSize);
+    }
+    if (!owns(ptr)) {
+        return realloc(ptr, newSize);
+    }
+
+    uint8_t *block = (uint8_t *)ptr - HEADER_SIZE;
+    size_t blockOffset = block - buffer;
+    size_t oldSize = *(size_t *)block;
+
+    // The tail block grows or shrinks in place, which covers ArduinoJson's pool
+    // growth, string building and shrinkToFit()
+    if (blockOffset == lastBlock && blockOffset + HEADER_SIZE + alignUp(newSize) <= capacity) {
+        *(size_t *)block = newSize;
+        offset = blockOffset + HEADER_SIZE + alignUp(newSize);
+        if (offset > highWater) {
+            highWater = offset;
+        }
+        return ptr;
+    }
+    if (newSize <= oldSize) {
+        *(size_t *)block = newSize;
+        return ptr;
+    }
+
+    void *moved = allocate(newSize);
+    if (moved != nullptr) {
+        memcpy(moved, ptr, oldSize);
+    }
+    return moved;
+}
+
+void JsonArena::reset()
+{
+    offset = 0;
+    lastBlock = SIZE_MAX;
+}
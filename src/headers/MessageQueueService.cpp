@@ -1,38 +1,112 @@
 #include "MessageQueueService.h"
 #include <ArduinoJson.h>
 #include "SerialService.h"
+#include "BootTrace.h"
+#include "TaskTopology.h"
+#include "PowerManager.h"
+#include <esp_timer.h>
 
 void MessageQueueService::taskFunction(void* pvParameters) {
     MessageQueueService* service = static_cast<MessageQueueService*>(pvParameters);
+    TickType_t lastPublish = xTaskGetTickCount() - pdMS_TO_TICKS(service->publishIntervalMs);
     while (service->isRunning) {
-        service->publishMessage();
-        vTaskDelay(pdMS_TO_TICKS(service->publishIntervalMs));
+        if (service->power != nullptr) {
+            service->runPublishWindow();
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+        if (WiFi.status() == WL_CONNECTED) {
+            service->mqttClient->loop(millis()); // Never blocks: connects, reads, writes queued packets
+        }
+        if (xTaskGetTickCount() - lastPublish >= pdMS_TO_TICKS(service->publishIntervalMs)) {
+            lastPublish = xTaskGetTickCount();
+            service->publishMessage();
+        }
+        TaskTopology::checkIn(TASK_ROLE_MQTT, (uint32_t)(esp_timer_get_time() - start));
+        vTaskDelay(pdMS_TO_TICKS(service->pollIntervalMs));
+    }
+    TaskTopology::retire(NULL);
+}
+
+MessageQueueService::MessageQueueService(ControlService* cs, SerialService* ss, int intervalMs, const char* broker, int port, const char* topic, const char* username, const char* password, std::function<size_t(char *buffer, size_t size)> dataProvider) // Modified constructor
+    : controlService(cs), serialService(ss), publishIntervalMs(intervalMs), mqttBroker(broker), mqttPort(port), mqttTopic(topic), mqttUsername(username), mqttPassword(password), taskHandle(NULL), isRunning(false), dataProviderFunction(dataProvider) { // Initialize dataProviderFunction
+    MqttTransport::Options options = {};
+    options.host = mqttBroker;
+    options.port = (uint16_t)mqttPort;
+    options.clientId = "ESP32Client";
+    options.username = mqttUsername;
+    options.password = mqttPassword;
+    options.keepAliveSec = 15;
+    options.inflightWindow = 4;
+    options.retryMs = 10000;
+    options.reconnectMs = 5000;
+    options.connectTimeoutMs = 5000;
+    mqttClient = new MqttTransport(options);
+
+    mqttClient->onMessage([this](const char *topic, const uint8_t *payload, size_t length) {
+        this->onMessage(topic, payload, length);
+    });
+    serialService->registerCommand("/mqtt", "", "Connection, queue depth and publish latency", 0, 0,
+                                   [this](int argc, char **argv) { this->printDiagnostics(); });
+
+    mqttClient->onConnect([this]() {
+        Serial.print("Connected to MQTT Broker!\n");
+        if (!hasConnected) {
+            BootTrace::mark("mqtt.connected");
+            hasConnected = true;
+        }
+    });
+}
+
+/// @brief Prints the transport's state and counters to the shell
+/// @details Runs on the web server task; the counters are plain words written by the MQTT task
+void MessageQueueService::printDiagnostics() {
+    static const char *stateNames[] = {"disconnected", "connecting", "handshake", "connected"};
+    const MqttTransport::Stats &stats = mqttClient->getStats();
+    serialService->printToAll("Broker %s:%d: %s (last error %d), %u reconnects",
+                              mqttBroker, mqttPort, stateNames[mqttClient->getState()], mqttClient->lastError(), stats.reconnects);
+    serialService->printToAll("Queue: %u packets, %u of %u bytes, %u in flight",
+                              mqttClient->queuedPackets(), mqttClient->queuedBytes(), MQTT_QUEUE_BYTES, mqttClient->inflight());
+    serialService->printToAll("Publishes: %u queued, %u acked, %u dropped, %u retransmitted",
+                              stats.queued, stats.acked, stats.dropped, stats.retransmits);
+    serialService->printToAll("Publish latency: last %u ms, mean %u ms, max %u ms",
+                              stats.latencyLastMs, stats.latencySamples ? stats.latencyTotalMs / stats.latencySamples : 0,
+                              stats.latencyMaxMs);
+    serialService->printToAll("Wire: %u packets in %u segments, %u received (%u oversized)",
+                              stats.packetsSent, stats.segments, stats.received, stats.oversized);
+}
+
+/// @brief Registers a handler for an inbound topic
+/// @param topic topic to subscribe to (must outlive the service)
+/// @param handler called on the MQTT task with the raw payload
+void MessageQueueService::subscribe(const char *topic, std::function<void(const uint8_t *payload, unsigned int length)> handler) {
+    if (subscriptionCount >= maxSubscriptions) {
+        Serial.print("Too many MQTT subscriptions, ignoring registration\n");
+        return;
     }
-    vTaskDelete(NULL);
+    subscriptions[subscriptionCount++] = {topic, handler};
+    mqttClient->subscribe(topic); // Sent on every (re)connect
 }
 
-MessageQueueService::MessageQueueService(ControlService* cs, SerialService* ss, int intervalMs, const char* broker, int port, const char* topic, const char* username, const char* password, std::function<String()> dataProvider) // Modified constructor
-    : controlService(cs), serialService(ss), mqttClient(espClient), publishIntervalMs(intervalMs), mqttBroker(broker), mqttPort(port), mqttTopic(topic), mqttUsername(username), mqttPassword(password), taskHandle(NULL), isRunning(false), dataProviderFunction(dataProvider) { // Initialize dataProviderFunction
-    mqttClient.setServer(mqttBroker, mqttPort);
-    mqttClient.setBufferSize(16384);
+void MessageQueueService::onMessage(const char *topic, const uint8_t *payload, size_t length) {
+    for (int i = 0; i < subscriptionCount; i++) {
+        if (strcmp(topic, subscriptions[i].topic) == 0) {
+            subscriptions[i].handler(payload, length);
+            return;
+        }
+    }
 }
 
 MessageQueueService::~MessageQueueService() {
     stop();
+    delete mqttClient;
 }
 
 void MessageQueueService::start() {
     if (!isRunning) {
         isRunning = true;
-         BaseType_t taskCreationResult = xTaskCreatePinnedToCore(
-            taskFunction,
-            "MessageQueueServiceTask",
-            16384 * 2,  // **Increase stack size to 32768 (or even higher, like 65536 for testing)**
-            this,
-            1,
-            &taskHandle,
-            APP_CPU_NUM
-        );
+        // Payload and transport buffers are members, not on the stack
+        BaseType_t taskCreationResult = TaskTopology::spawn(TASK_ROLE_MQTT, taskFunction, this, &taskHandle);
         if (taskCreationResult != pdPASS) {
             Serial.print("Error creating MessageQueueService task!\n");
             isRunning = false;
@@ -56,51 +130,53 @@ void MessageQueueService::stop() {
     }
 }
 
-void MessageQueueService::publishMessage() {
-    if (!mqttClient.connected()) {
-        Serial.print("MQTT Client not connected before publish, calling reconnect()\n");
-        reconnect();
-        if (!mqttClient.connected()) {
-            Serial.print("MQTT still not connected after reconnect attempt. Publish skipped.\n");
-            return;
-        }
+/// @brief Called by the sampler when a publish is due, so sampling and the radio share one wake
+void MessageQueueService::openPublishWindow() {
+    if (taskHandle != NULL) {
+        xTaskNotifyGive(taskHandle);
     }
+}
 
-    String jsonData = dataProviderFunction(); // Comment out dataProvider
-    // String jsonData = "{\"test\":\"short\"}"; // **Very short, minimal JSON**
-    // Serial.print("jsonData to publish: ");
-    // Serial.print(jsonData + "\n");
-
-    // **Debug: Check connection state just before publish**
-    // Serial.print("MQTT Client connected state before publish: ");
-    // Serial.print(mqttClient.connected() + "\n"); // Will print 1 (true) if connected, 0 (false) if not
+/// @brief Low-power loop: sleeps until a publish window opens (or keep-alive is due), then runs
+/// the transport until the queue is drained and acknowledged or the window closes
+void MessageQueueService::runPublishWindow() {
+    bool window = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(keepAliveWakeMs)) > 0;
+    TaskTopology::checkIn(TASK_ROLE_MQTT, 0);
+    if (window) {
+        publishMessage();
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
 
-    if (mqttClient.publish(mqttTopic, jsonData.c_str())) {
-        // Serial.print("Published to MQTT Topic: ");
-        // Serial.print(mqttTopic);
-        // Serial.print("\n");
-        // Serial.print("Published to MQTT: ");
-        // Serial.print(jsonData + "\n");
-    } else {
-        Serial.print("MQTT publish failed!\n");
+    int64_t start = esp_timer_get_time();
+    uint32_t opened = millis();
+    power->setRadio(true);
+    while (isRunning) {
+        mqttClient->loop(millis());
+        if (mqttClient->connected() && mqttClient->queuedPackets() == 0) {
+            break; // Everything sent and, for QoS 1, acknowledged
+        }
+        if (millis() - opened >= (mqttClient->connected() ? radioWindowMs : connectWindowMs)) {
+            break; // Left queued for the next window
+        }
+        vTaskDelay(pdMS_TO_TICKS(pollIntervalMs));
     }
+    power->setRadio(false);
+    TaskTopology::checkIn(TASK_ROLE_MQTT, (uint32_t)(esp_timer_get_time() - start));
 }
 
-void MessageQueueService::reconnect() {
-    while (!mqttClient.connected()) {
-        Serial.print("Attempting MQTT connection...\n");
-        // **Capture the connect status code**
-        int connectStatus = mqttClient.connect("ESP32Client", mqttUsername, mqttPassword);
-        if (connectStatus) { // connect() returns 0 for success, non-zero for failure
-            Serial.print("Connected to MQTT Broker!\n");
-            // mqttClient.subscribe(mqttTopic);  // Subscribe if necessary
-        } else {
-            Serial.print("Failed, connectStatus=");
-            Serial.print(connectStatus); // **Print the connectStatus code**
-            Serial.print(", mqttClient.state()="); // Also keep printing state for comparison
-            Serial.print(mqttClient.state());
-            Serial.print("\n Trying again in 5 seconds...\n");
-            delay(5000);  // Wait before retrying
-        }
+/// @brief Builds the sensor payload and queues it; the task loop writes it out
+/// @details Publishes queue while the broker is unreachable and go out after reconnecting;
+/// when the queue is full the newest sample is dropped
+void MessageQueueService::publishMessage() {
+    size_t length = dataProviderFunction(payloadBuffer, sizeof(payloadBuffer));
+    if (length == 0) {
+        Serial.print("MQTT payload did not fit the publish buffer, publish skipped.\n");
+        return;
+    }
+
+    if (!mqttClient->publish(mqttTopic, (const uint8_t *)payloadBuffer, length, publishQos, millis())) {
+        Serial.print("MQTT queue full, sample dropped!\n");
     }
 }
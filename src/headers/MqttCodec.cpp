@@ -0,0 +1,217 @@
+#include "MqttCodec.h"
+#include <string.h>
+
+static const uint32_t MAX_REMAINING_LENGTH = 268435455; // 4-byte varint limit
+
+static size_t remainingLengthSize(uint32_t length)
+{
+    return length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+}
+
+static size_t encodeFixedHeader(uint8_t *out, uint8_t firstByte, uint32_t remainingLength)
+{
+    size_t n = 0;
+    out[n++] = firstByte;
+    do {
+        uint8_t digit = remainingLength % 128;
+        remainingLength /= 128;
+        if (remainingLength > 0) {
+            digit |= 0x80;
+        }
+        out[n++] = digit;
+    } while (remainingLength > 0);
+    return n;
+}
+
+static size_t stringSize(const char *value)
+{
+    return 2 + (value != nullptr ? strlen(value) : 0);
+}
+
+static uint8_t *writeString(uint8_t *out, const char *value)
+{
+    size_t length = value != nullptr ? strlen(value) : 0;
+    *out++ = (uint8_t)(length >> 8);
+    *out++ = (uint8_t)length;
+    memcpy(out, value, length);
+    return out + length;
+}
+
+static bool present(const char *value)
+{
+    return value != nullptr && value[0] != '\0';
+}
+
+size_t mqttConnectSize(const char *clientId, const char *username, const char *password)
+{
+    uint32_t remaining = 10 + stringSize(clientId); // "MQTT", level, flags, keep alive
+    if (present(username)) {
+        remaining += stringSize(username);
+        if (present(password)) {
+            remaining += stringSize(password);
+        }
+    }
+    return 1 + remainingLengthSize(remaining) + remaining;
+}
+
+size_t mqttEncodeConnect(uint8_t *out, size_t size, const char *clientId, const char *username,
+                         const char *password, uint16_t keepAliveSec, bool cleanSession)
+{
+    size_t total = mqttConnectSize(clientId, username, password);
+    if (total > size) {
+        return 0;
+    }
+
+    uint8_t flags = cleanSession ? 0x02 : 0x00;
+    if (present(username)) {
+        flags |= 0x80;
+        if (present(password)) {
+            flags |= 0x40;
+        }
+    }
+
+    size_t headerSize = 1 + remainingLengthSize(total - 1);
+    uint8_t *p = out + encodeFixedHeader(out, MQTT_CONNECT << 4, (uint32_t)(total - headerSize));
+    p = writeString(p, "MQTT");
+    *p++ = 4; // Protocol level 3.1.1
+    *p++ = flags;
+    *p++ = (uint8_t)(keepAliveSec >> 8);
+    *p++ = (uint8_t)keepAliveSec;
+    p = writeString(p, clientId);
+    if (flags & 0x80) {
+        p = writeString(p, username);
+    }
+    if (flags & 0x40) {
+        p = writeString(p, password);
+    }
+    return total;
+}
+
+size_t mqttPublishSize(const char *topic, size_t payloadLength, uint8_t qos)
+{
+    size_t remaining = stringSize(topic) + (qos > 0 ? 2 : 0) + payloadLength;
+    if (remaining > MAX_REMAINING_LENGTH) {
+        return 0;
+    }
+    return 1 + remainingLengthSize((uint32_t)remaining) + remaining;
+}
+
+size_t mqttEncodePublish(uint8_t *out, size_t size, const char *topic, const uint8_t *payload,
+                         size_t payloadLength, uint8_t qos, uint16_t packetId)
+{
+    size_t total = mqttPublishSize(topic, payloadLength, qos);
+    if (total == 0 || total > size) {
+        return 0;
+    }
+
+    size_t remaining = stringSize(topic) + (qos > 0 ? 2 : 0) + payloadLength;
+    uint8_t *p = out + encodeFixedHeader(out, (uint8_t)((MQTT_PUBLISH << 4) | ((qos & 0x03) << 1)), (uint32_t)remaining);
+    p = writeString(p, topic);
+    if (qos > 0) {
+        *p++ = (uint8_t)(packetId >> 8);
+        *p++ = (uint8_t)packetId;
+    }
+    if (payloadLength > 0) {
+        memcpy(p, payload, payloadLength);
+    }
+    return total;
+}
+
+static size_t encodeIdPacket(uint8_t *out, size_t size, uint8_t firstByte, uint16_t packetId)
+{
+    if (size < 4) {
+        return 0;
+    }
+    out[0] = firstByte;
+    out[1] = 2;
+    out[2] = (uint8_t)(packetId >> 8);
+    out[3] = (uint8_t)packetId;
+    return 4;
+}
+
+size_t mqttEncodePuback(uint8_t *out, size_t size, uint16_t packetId)
+{
+    return encodeIdPacket(out, size, MQTT_PUBACK << 4, packetId);
+}
+
+size_t mqttEncodeSubscribe(uint8_t *out, size_t size, uint16_t packetId, const char *topic, uint8_t qos)
+{
+    uint32_t remaining = 2 + stringSize(topic) + 1;
+    size_t total = 1 + remainingLengthSize(remaining) + remaining;
+    if (total > size) {
+        return 0;
+    }
+    uint8_t *p = out + encodeFixedHeader(out, (MQTT_SUBSCRIBE << 4) | 0x02, remaining);
+    *p++ = (uint8_t)(packetId >> 8);
+    *p++ = (uint8_t)packetId;
+    p = writeString(p, topic);
+    *p++ = qos & 0x03;
+    return total;
+}
+
+static size_t encodeEmptyPacket(uint8_t *out, size_t size, uint8_t firstByte)
+{
+    if (size < 2) {
+        return 0;
+    }
+    out[0] = firstByte;
+    out[1] = 0;
+    return 2;
+}
+
+size_t mqttEncodePingreq(uint8_t *out, size_t size)
+{
+    return encodeEmptyPacket(out, size, MQTT_PINGREQ << 4);
+}
+
+size_t mqttEncodeDisconnect(uint8_t *out, size_t size)
+{
+    return encodeEmptyPacket(out, size, MQTT_DISCONNECT << 4);
+}
+
+int mqttParseFixedHeader(const uint8_t *data, size_t length, uint8_t &firstByte,
+                         uint32_t &remainingLength, size_t &headerSize)
+{
+    if (length < 2) {
+        return 0;
+    }
+    firstByte = data[0];
+    uint32_t value = 0;
+    uint32_t multiplier = 1;
+    for (size_t i = 1; i <= 4; i++) {
+        if (i >= length) {
+            return 0;
+        }
+        value += (data[i] & 0x7F) * multiplier;
+        if ((data[i] & 0x80) == 0) {
+            remainingLength = value;
+            headerSize = i + 1;
+            return 1;
+        }
+        multiplier *= 128;
+    }
+    return -1; // More than 4 length bytes
+}
+
+bool mqttParsePublish(uint8_t firstByte, const uint8_t *body, size_t bodyLength,
+                      const char *&topic, size_t &topicLength, uint16_t &packetId,
+                      const uint8_t *&payload, size_t &payloadLength)
+{
+    if (bodyLength < 2) {
+        return false;
+    }
+    topicLength = ((size_t)body[0] << 8) | body[1];
+    size_t offset = 2 + topicLength;
+    uint8_t qos = (firstByte >> 1) & 0x03;
+    if (qos > 0) {
+        offset += 2;
+    }
+    if (offset > bodyLength) {
+        return false;
+    }
+    topic = (const char *)body + 2;
+    packetId = qos > 0 ? (uint16_t)((body[2 + topicLength] << 8) | body[3 + topicLength]) : 0;
+    payload = body + offset;
+    payloadLength = bodyLength - offset;
+    return true;
+}
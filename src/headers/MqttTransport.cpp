@@ -0,0 +1,568 @@
+#include "MqttTransport.h"
+#include "MqttCodec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // lwIP never raises SIGPIPE
+#endif
+
+static const size_t NO_RECORD = SIZE_MAX;
+
+MqttTransport::MqttTransport(const Options &options) : options(options)
+{
+}
+
+MqttTransport::~MqttTransport()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+uint16_t MqttTransport::takePacketId()
+{
+    uint16_t id = nextPacketId++;
+    if (nextPacketId == 0) {
+        nextPacketId = 1; // 0 is not a valid packet id
+    }
+    return id;
+}
+
+size_t MqttTransport::recordSize(size_t packetLength)
+{
+    return (sizeof(Record) + packetLength + 3) & ~(size_t)3;
+}
+
+size_t MqttTransport::nextRecord(size_t offset)
+{
+    size_t next = offset + recordSize(recordAt(offset)->length);
+    if (queueWrapAt != NO_RECORD && next == queueWrapAt) {
+        next = 0;
+    }
+    return next;
+}
+
+/// @brief Reserves space for a packet at the queue tail
+/// @return where to encode the packet, nullptr when the queue is full
+uint8_t *MqttTransport::reserve(size_t packetLength, size_t &offset)
+{
+    size_t need = recordSize(packetLength);
+    if (need > MQTT_QUEUE_BYTES) {
+        return nullptr;
+    }
+    if (recordCount == 0) {
+        queueHead = queueTail = 0;
+        queueWrapAt = NO_RECORD;
+    }
+
+    if (recordCount == 0 || queueTail > queueHead) {
+        // Data in [head, tail): append, or wrap to the free space before the head
+        if (queueTail + need <= MQTT_QUEUE_BYTES) {
+            offset = queueTail;
+        } else if (need <= queueHead) {
+            queueWrapAt = queueTail;
+            offset = 0;
+        } else {
+            return nullptr;
+        }
+    } else {
+        // Wrapped: data in [head, wrapAt) and [0, tail)
+        if (queueTail + need <= queueHead) {
+            offset = queueTail;
+        } else {
+            return nullptr;
+        }
+    }
+
+    Record *record = recordAt(offset);
+    memset(record, 0, sizeof(Record));
+    record->length = (uint16_t)packetLength;
+    record->status = RECORD_QUEUED;
+    queueTail = offset + need;
+    queueUsed += need;
+    recordCount++;
+    return queue + offset + sizeof(Record);
+}
+
+/// @brief Drops finished records from the head of the queue
+void MqttTransport::releaseDone()
+{
+    while (recordCount > 0 && recordAt(queueHead)->status == RECORD_DONE) {
+        size_t next = nextRecord(queueHead);
+        queueUsed -= recordSize(recordAt(queueHead)->length);
+        if (--recordCount == 0) {
+            queueHead = queueTail = 0;
+            queueWrapAt = NO_RECORD;
+            return;
+        }
+        if (next == 0) {
+            queueWrapAt = NO_RECORD; // The head caught up with the wrap
+        }
+        queueHead = next;
+    }
+}
+
+bool MqttTransport::queueControl(const uint8_t *packet, size_t length)
+{
+    if (length == 0 || controlLength + length > MQTT_CONTROL_BYTES) {
+        return false;
+    }
+    memcpy(control + controlLength, packet, length);
+    controlLength += length;
+    return true;
+}
+
+/// @brief Queues a publish; it is written out by loop() once connected
+/// @param qos 0 or 1 (QoS 2 is downgraded to 1)
+/// @param nowMs current time, the start of the publish latency
+bool MqttTransport::publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint32_t nowMs)
+{
+    qos = qos > 0 ? 1 : 0;
+    size_t packetLength = mqttPublishSize(topic, length, qos);
+    size_t offset;
+    uint8_t *packet = packetLength > 0 && packetLength <= UINT16_MAX ? reserve(packetLength, offset) : nullptr;
+    if (packet == nullptr) {
+        stats.dropped++;
+        return false;
+    }
+
+    uint16_t packetId = qos > 0 ? takePacketId() : 0;
+    mqttEncodePublish(packet, packetLength, topic, payload, length, qos, packetId);
+    Record *record = recordAt(offset);
+    record->packetId = packetId;
+    record->qos = qos;
+    record->queuedMs = nowMs;
+    stats.queued++;
+    return true;
+}
+
+bool MqttTransport::subscribe(const char *topic)
+{
+    if (subscriptionCount >= MQTT_MAX_SUBSCRIPTIONS || strlen(topic) >= MQTT_TOPIC_LEN) {
+        return false;
+    }
+    subscriptions[subscriptionCount++] = topic;
+    if (state == MQTT_STATE_CONNECTED) {
+        uint8_t packet[MQTT_TOPIC_LEN + 8];
+        queueControl(packet, mqttEncodeSubscribe(packet, sizeof(packet), takePacketId(), topic, 0));
+    }
+    return true;
+}
+
+/// @brief Runs the connection state machine and moves data in both directions
+void MqttTransport::loop(uint32_t nowMs)
+{
+    if (state == MQTT_STATE_DISCONNECTED) {
+        if (!attempted || nowMs - lastAttemptMs >= options.reconnectMs) {
+            startConnect(nowMs);
+        }
+        if (state == MQTT_STATE_DISCONNECTED || state == MQTT_STATE_CONNECTING) {
+            return;
+        }
+    }
+    if (state == MQTT_STATE_CONNECTING) {
+        checkConnect(nowMs);
+        if (state != MQTT_STATE_HANDSHAKE) {
+            return;
+        }
+    }
+
+    if (!readIn(nowMs)) {
+        return;
+    }
+
+    if (state == MQTT_STATE_HANDSHAKE && nowMs - stateSinceMs >= options.connectTimeoutMs) {
+        closeSocket(ETIMEDOUT);
+        return;
+    }
+    if (state == MQTT_STATE_CONNECTED) {
+        uint32_t keepAliveMs = options.keepAliveSec * 1000u;
+        if (keepAliveMs > 0 && nowMs - lastRxMs > keepAliveMs + keepAliveMs / 2) {
+            closeSocket(ETIMEDOUT); // Broker went silent
+            return;
+        }
+        if (keepAliveMs > 0 && nowMs - lastTxMs >= keepAliveMs / 2) {
+            uint8_t ping[2];
+            queueControl(ping, mqttEncodePingreq(ping, sizeof(ping)));
+            lastTxMs = nowMs;
+        }
+        retransmitExpired(nowMs);
+    }
+
+    writeOut(nowMs);
+    releaseDone();
+}
+
+/// @brief Sends DISCONNECT if possible and closes the socket; loop() reconnects later
+void MqttTransport::disconnect()
+{
+    if (state == MQTT_STATE_CONNECTED) {
+        uint8_t packet[2];
+        send(fd, packet, mqttEncodeDisconnect(packet, sizeof(packet)), MSG_NOSIGNAL);
+    }
+    closeSocket(0);
+}
+
+void MqttTransport::startConnect(uint32_t nowMs)
+{
+    attempted = true;
+    lastAttemptMs = nowMs;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host, &address.sin_addr) != 1) {
+        error = EINVAL; // Not an IPv4 address, no lookup here (see MqttTransport.h)
+        return;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        error = errno;
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Segments are packed here, no need to wait for Nagle
+
+    state = MQTT_STATE_CONNECTING;
+    stateSinceMs = nowMs;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        checkConnect(nowMs);
+    } else if (errno != EINPROGRESS) {
+        closeSocket(errno);
+    }
+}
+
+/// @brief Polls a pending TCP connect and sends CONNECT once it completes
+void MqttTransport::checkConnect(uint32_t nowMs)
+{
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    struct timeval noWait = {0, 0};
+    int ready = select(fd + 1, nullptr, &writable, nullptr, &noWait);
+    if (ready < 0) {
+        closeSocket(errno);
+        return;
+    }
+    if (ready == 0) {
+        if (nowMs - stateSinceMs >= options.connectTimeoutMs) {
+            closeSocket(ETIMEDOUT);
+        }
+        return;
+    }
+
+    int socketError = 0;
+    socklen_t length = sizeof(socketError);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &socketError, &length);
+    if (socketError != 0) {
+        closeSocket(socketError);
+        return;
+    }
+
+    uint8_t packet[MQTT_CONTROL_BYTES];
+    size_t packetLength = mqttEncodeConnect(packet, sizeof(packet), options.clientId, options.username,
+                                            options.password, options.keepAliveSec, true);
+    if (!queueControl(packet, packetLength)) {
+        closeSocket(EMSGSIZE);
+        return;
+    }
+    state = MQTT_STATE_HANDSHAKE;
+    stateSinceMs = nowMs;
+    lastRxMs = lastTxMs = nowMs;
+}
+
+void MqttTransport::closeSocket(int reason)
+{
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (state == MQTT_STATE_CONNECTED) {
+        stats.reconnects++;
+    }
+    state = MQTT_STATE_DISCONNECTED;
+    error = reason;
+
+    // Unacknowledged QoS 1 publishes go out again, flagged DUP, after reconnecting.
+    // QoS 0 packets already handed to the socket are not retried.
+    size_t offset = queueHead;
+    for (uint16_t i = 0; i < recordCount; i++, offset = nextRecord(offset)) {
+        Record *record = recordAt(offset);
+        if (record->status == RECORD_SENT) {
+            record->status = RECORD_QUEUED;
+            *(uint8_t *)(record + 1) |= MQTT_PUBLISH_DUP;
+        }
+    }
+    inflightCount = 0;
+    streamRecord = NO_RECORD;
+    streamOffset = 0;
+    segmentLength = segmentSent = 0;
+    controlLength = 0;
+    rxLength = 0;
+    rxSkip = 0;
+}
+
+void MqttTransport::markSent(Record *record, uint32_t nowMs)
+{
+    stats.packetsSent++;
+    if (record->qos > 0) {
+        record->status = RECORD_SENT;
+        record->sentMs = nowMs;
+        inflightCount++;
+    } else {
+        record->status = RECORD_DONE;
+        recordLatency(record, nowMs);
+    }
+}
+
+void MqttTransport::recordLatency(const Record *record, uint32_t nowMs)
+{
+    uint32_t latency = nowMs - record->queuedMs;
+    stats.latencyLastMs = latency;
+    if (latency > stats.latencyMaxMs) {
+        stats.latencyMaxMs = latency;
+    }
+    stats.latencyTotalMs += latency;
+    stats.latencySamples++;
+}
+
+/// @brief Packs pending control packets and queued publishes into the segment buffer
+void MqttTransport::fillSegment(uint32_t nowMs)
+{
+    memcpy(segment, control, controlLength);
+    segmentLength = controlLength;
+    controlLength = 0;
+    if (state != MQTT_STATE_CONNECTED) {
+        return;
+    }
+
+    size_t offset = queueHead;
+    for (uint16_t i = 0; i < recordCount; i++, offset = nextRecord(offset)) {
+        Record *record = recordAt(offset);
+        if (record->status != RECORD_QUEUED) {
+            continue;
+        }
+        if (record->qos > 0 && inflightCount >= options.inflightWindow) {
+            break; // Window full; later publishes wait so ordering is kept
+        }
+        if (segmentLength + record->length > MQTT_SEGMENT_BYTES) {
+            if (segmentLength == 0) {
+                streamRecord = offset; // Bigger than a segment, written straight from the queue
+                streamOffset = 0;
+            }
+            break;
+        }
+        memcpy(segment + segmentLength, record + 1, record->length);
+        segmentLength += record->length;
+        markSent(record, nowMs);
+    }
+}
+
+/// @brief Writes as much as the socket accepts without blocking
+/// @return false if the connection failed
+bool MqttTransport::writeOut(uint32_t nowMs)
+{
+    while (true) {
+        const uint8_t *data = nullptr;
+        size_t length = 0;
+        if (segmentSent < segmentLength) {
+            data = segment + segmentSent;
+            length = segmentLength - segmentSent;
+        } else if (streamRecord != NO_RECORD) {
+            Record *record = recordAt(streamRecord);
+            data = (const uint8_t *)(record + 1) + streamOffset;
+            length = record->length - streamOffset;
+        } else {
+            segmentLength = segmentSent = 0;
+            fillSegment(nowMs);
+            if (segmentLength == 0 && streamRecord == NO_RECORD) {
+                return true; // Nothing left to send
+            }
+            continue;
+        }
+
+        ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true; // Socket buffer full, continue on the next loop()
+            }
+            closeSocket(errno);
+            return false;
+        }
+        lastTxMs = nowMs;
+
+        if (segmentSent < segmentLength) {
+            segmentSent += written;
+            if (segmentSent == segmentLength) {
+                stats.segments++;
+            }
+        } else {
+            streamOffset += written;
+            Record *record = recordAt(streamRecord);
+            if (streamOffset == record->length) {
+                markSent(record, nowMs);
+                streamRecord = NO_RECORD;
+                streamOffset = 0;
+            }
+        }
+        if ((size_t)written < length) {
+            return true;
+        }
+    }
+}
+
+/// @brief Reads everything available and dispatches complete packets
+/// @return false if the connection was closed
+bool MqttTransport::readIn(uint32_t nowMs)
+{
+    while (true) {
+        size_t room = rxSkip > 0 ? (rxSkip < sizeof(rx) ? rxSkip : sizeof(rx)) : sizeof(rx) - rxLength;
+        ssize_t received = recv(fd, rxSkip > 0 ? rx : rx + rxLength, room, 0);
+        if (received == 0) {
+            closeSocket(ECONNRESET);
+            return false;
+        }
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            closeSocket(errno);
+            return false;
+        }
+        lastRxMs = nowMs;
+        if (rxSkip > 0) {
+            rxSkip -= received;
+            continue;
+        }
+        rxLength += received;
+
+        size_t consumed = 0;
+        while (consumed < rxLength) {
+            uint8_t firstByte;
+            uint32_t remaining;
+            size_t headerSize;
+            int parsed = mqttParseFixedHeader(rx + consumed, rxLength - consumed, firstByte, remaining, headerSize);
+            if (parsed < 0) {
+                closeSocket(EPROTO);
+                return false;
+            }
+            if (parsed == 0) {
+                break;
+            }
+            size_t total = headerSize + remaining;
+            if (total > sizeof(rx)) {
+                stats.oversized++;
+                rxSkip = total - (rxLength - consumed);
+                consumed = rxLength;
+                break;
+            }
+            if (rxLength - consumed < total) {
+                break;
+            }
+            handlePacket(firstByte, rx + consumed + headerSize, remaining, nowMs);
+            if (state == MQTT_STATE_DISCONNECTED) {
+                return false;
+            }
+            consumed += total;
+        }
+        memmove(rx, rx + consumed, rxLength - consumed);
+        rxLength -= consumed;
+    }
+}
+
+void MqttTransport::handlePacket(uint8_t firstByte, const uint8_t *body, size_t length, uint32_t nowMs)
+{
+    switch (firstByte >> 4) {
+    case MQTT_CONNACK:
+        if (state != MQTT_STATE_HANDSHAKE || length < 2) {
+            return;
+        }
+        if (body[1] != 0) {
+            closeSocket(body[1]); // Refused: bad credentials, unknown client id, ...
+            return;
+        }
+        state = MQTT_STATE_CONNECTED;
+        stateSinceMs = nowMs;
+        for (uint8_t i = 0; i < subscriptionCount; i++) {
+            uint8_t packet[MQTT_TOPIC_LEN + 8];
+            queueControl(packet, mqttEncodeSubscribe(packet, sizeof(packet), takePacketId(), subscriptions[i], 0));
+        }
+        if (connectHandler) {
+            connectHandler();
+        }
+        return;
+
+    case MQTT_PUBACK:
+        if (length >= 2) {
+            handlePuback((uint16_t)((body[0] << 8) | body[1]), nowMs);
+        }
+        return;
+
+    case MQTT_PUBLISH: {
+        const char *topic;
+        size_t topicLength;
+        uint16_t packetId;
+        const uint8_t *payload;
+        size_t payloadLength;
+        if (!mqttParsePublish(firstByte, body, length, topic, topicLength, packetId, payload, payloadLength)) {
+            return;
+        }
+        stats.received++;
+        if (((firstByte >> 1) & 0x03) == 1) {
+            uint8_t ack[4];
+            queueControl(ack, mqttEncodePuback(ack, sizeof(ack), packetId));
+        }
+        if (topicLength < MQTT_TOPIC_LEN && messageHandler) {
+            char topicName[MQTT_TOPIC_LEN];
+            memcpy(topicName, topic, topicLength);
+            topicName[topicLength] = '\0';
+            messageHandler(topicName, payload, payloadLength);
+        }
+        return;
+    }
+
+    default:
+        return; // SUBACK, PINGRESP: receiving them already refreshed lastRxMs
+    }
+}
+
+void MqttTransport::handlePuback(uint16_t packetId, uint32_t nowMs)
+{
+    size_t offset = queueHead;
+    for (uint16_t i = 0; i < recordCount; i++, offset = nextRecord(offset)) {
+        Record *record = recordAt(offset);
+        if (record->status == RECORD_SENT && record->packetId == packetId) {
+            record->status = RECORD_DONE;
+            inflightCount--;
+            stats.acked++;
+            recordLatency(record, nowMs);
+            return;
+        }
+    }
+}
+
+/// @brief Requeues QoS 1 publishes whose PUBACK is overdue
+void MqttTransport::retransmitExpired(uint32_t nowMs)
+{
+    size_t offset = queueHead;
+    for (uint16_t i = 0; i < recordCount; i++, offset = nextRecord(offset)) {
+        Record *record = recordAt(offset);
+        if (record->status == RECORD_SENT && nowMs - record->sentMs >= options.retryMs) {
+            record->status = RECORD_QUEUED;
+            *(uint8_t *)(record + 1) |= MQTT_PUBLISH_DUP;
+            inflightCount--;
+            stats.retransmits++;
+        }
+    }
+}
@@ -0,0 +1,450 @@
+#include "OtaStreamWriter.h"
+#include <Update.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/pk.h>
+#include <rom/miniz.h>
+
+#define GZIP_ID1 0x1f
+#define GZIP_ID2 0x8b
+#define GZIP_CM_DEFLATE 8
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+// gzip member header parser states (RFC 1952), each optional field is skipped when its flag is clear
+enum GzipHeaderState
+{
+    GZ_FIXED,
+    GZ_EXTRA_LEN_LO,
+    GZ_EXTRA_LEN_HI,
+    GZ_EXTRA,
+    GZ_NAME,
+    GZ_COMMENT,
+    GZ_HCRC,
+    GZ_DONE
+};
+
+static const size_t GZIP_FIXED_HEADER_LEN = 10;
+
+OtaStreamWriter::OtaStreamWriter()
+    : encoding(ENCODING_DETECT), active(false), declaredSize(0), hasDigest(false),
+      receivedBytes(0), writtenBytes(0), magicPending(0), hasMagicPending(false),
+      headerState(GZ_FIXED), headerFlags(0), headerRemaining(0), inflateDone(false),
+      inflator(NULL), window(NULL), windowOffset(0)
+{
+    mbedtls_md_init(&sha);
+}
+
+OtaStreamWriter::~OtaStreamWriter()
+{
+    abort();
+    mbedtls_md_free(&sha);
+}
+
+static bool parseHexDigest(const char *hex, uint8_t digest[32])
+{
+    if (hex == NULL || strlen(hex) != 64) {
+        return false;
+    }
+    for (size_t i = 0; i < 32; i++) {
+        char pair[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+        char *end;
+        digest[i] = (uint8_t)strtoul(pair, &end, 16);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Checks the manifest signature over "<size>:<sha256 hex>"
+OtaError OtaStreamWriter::verifyManifestSignature(const char *sizeText, const char *digestHex, const char *signatureB64)
+{
+#ifdef OTA_SIGNING_PUBKEY_PEM
+    if (signatureB64 == NULL || *signatureB64 == '\0' || !hasDigest || declaredSize == 0) {
+        return OTA_ERR_SIGNATURE; // A signing key is compiled in, unsigned images are refused
+    }
+
+    uint8_t signature[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+    size_t signatureLen = 0;
+    if (mbedtls_base64_decode(signature, sizeof(signature), &signatureLen,
+                              (const unsigned char *)signatureB64, strlen(signatureB64)) != 0) {
+        return OTA_ERR_BAD_MANIFEST;
+    }
+
+    char manifest[96];
+    int manifestLen = snprintf(manifest, sizeof(manifest), "%s:%s", sizeText, digestHex);
+    uint8_t manifestHash[32];
+    mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const unsigned char *)manifest, manifestLen, manifestHash);
+
+    static const char publicKey[] = OTA_SIGNING_PUBKEY_PEM;
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+    int result = mbedtls_pk_parse_public_key(&pk, (const unsigned char *)publicKey, sizeof(publicKey));
+    if (result == 0) {
+        result = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, manifestHash, sizeof(manifestHash), signature, signatureLen);
+    }
+    mbedtls_pk_free(&pk);
+
+    return result == 0 ? OTA_OK : OTA_ERR_SIGNATURE;
+#else
+    (void)sizeText;
+    (void)digestHex;
+    (void)signatureB64;
+    return OTA_OK;
+#endif
+}
+
+/// @brief Validates the manifest and opens the OTA partition
+/// @param sizeText decimal decompressed image size, or NULL
+/// @param digestHex hex SHA-256 of the decompressed image, or NULL
+/// @param signatureB64 base64 manifest signature, or NULL
+OtaError OtaStreamWriter::begin(const char *sizeText, const char *digestHex, const char *signatureB64)
+{
+    abort();
+
+    encoding = ENCODING_DETECT;
+    declaredSize = 0;
+    hasDigest = false;
+    receivedBytes = 0;
+    writtenBytes = 0;
+    hasMagicPending = false;
+    headerState = GZ_FIXED;
+    headerFlags = 0;
+    headerRemaining = GZIP_FIXED_HEADER_LEN;
+    inflateDone = false;
+    windowOffset = 0;
+
+    if (sizeText != NULL && *sizeText != '\0') {
+        char *end;
+        declaredSize = strtoul(sizeText, &end, 10);
+        if (*end != '\0' || declaredSize == 0) {
+            return OTA_ERR_BAD_MANIFEST;
+        }
+    }
+
+    if (digestHex != NULL && *digestHex != '\0') {
+        if (!parseHexDigest(digestHex, expectedDigest)) {
+            return OTA_ERR_BAD_MANIFEST;
+        }
+        hasDigest = true;
+    }
+
+    OtaError error = verifyManifestSignature(sizeText, digestHex, signatureB64);
+    if (error != OTA_OK) {
+        return error;
+    }
+
+    // Refuse before erasing anything if the image cannot fit
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL || (declaredSize > 0 && declaredSize > partition->size)) {
+        return OTA_ERR_TOO_LARGE;
+    }
+
+    mbedtls_md_free(&sha);
+    mbedtls_md_init(&sha);
+    if (mbedtls_md_setup(&sha, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0) != 0 ||
+        mbedtls_md_starts(&sha) != 0) {
+        return OTA_ERR_NO_MEMORY;
+    }
+
+    if (!Update.begin(declaredSize > 0 ? declaredSize : UPDATE_SIZE_UNKNOWN)) {
+        Update.printError(Serial);
+        return OTA_ERR_BEGIN;
+    }
+
+    active = true;
+    return OTA_OK;
+}
+
+/// @brief Feeds the next chunk of the upload, inflating it first when gzip
+OtaError OtaStreamWriter::write(const uint8_t *data, size_t len)
+{
+    if (!active) {
+        return OTA_ERR_BEGIN;
+    }
+    receivedBytes += len;
+
+    if (encoding == ENCODING_DETECT && len > 0) {
+        if (!hasMagicPending) {
+            magicPending = data[0];
+            hasMagicPending = true;
+            data++;
+            len--;
+        }
+        if (len == 0) {
+            return OTA_OK; // Need the second byte to tell gzip apart from a raw image
+        }
+
+        encoding = (magicPending == GZIP_ID1 && data[0] == GZIP_ID2) ? ENCODING_GZIP : ENCODING_RAW;
+        if (encoding == ENCODING_GZIP) {
+            inflator = malloc(sizeof(tinfl_decompressor));
+            window = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+            if (inflator == NULL || window == NULL) {
+                abort();
+                return OTA_ERR_NO_MEMORY;
+            }
+            tinfl_init((tinfl_decompressor *)inflator);
+            headerRemaining--; // ID1 already consumed
+        }
+
+        hasMagicPending = false;
+        OtaError error = encoding == ENCODING_GZIP ? writeGzip(&magicPending, 0) : writeDecompressed(&magicPending, 1);
+        if (error != OTA_OK) {
+            return error;
+        }
+    }
+
+    return encoding == ENCODING_GZIP ? writeGzip(data, len) : writeDecompressed(data, len);
+}
+
+/// @brief Hashes and writes decompressed firmware bytes to flash
+OtaError OtaStreamWriter::writeDecompressed(const uint8_t *data, size_t len)
+{
+    if (len == 0) {
+        return OTA_OK;
+    }
+    if (declaredSize > 0 && writtenBytes + len > declaredSize) {
+        abort();
+        return OTA_ERR_SIZE_MISMATCH;
+    }
+
+    mbedtls_md_update(&sha, data, len);
+    if (Update.write(const_cast<uint8_t *>(data), len) != len) {
+        Update.printError(Serial);
+        abort();
+        return OTA_ERR_WRITE;
+    }
+    writtenBytes += len;
+    return OTA_OK;
+}
+
+/// @brief Skips the gzip member header, which may be split across chunks
+int OtaStreamWriter::consumeGzipHeader(const uint8_t *&data, size_t &len)
+{
+    while (headerState != GZ_DONE) {
+        if (len == 0) {
+            return 0;
+        }
+
+        switch (headerState) {
+        case GZ_FIXED: {
+            size_t position = GZIP_FIXED_HEADER_LEN - headerRemaining;
+            uint8_t b = *data++;
+            len--;
+            if ((position == 1 && b != GZIP_ID2) || (position == 2 && b != GZIP_CM_DEFLATE)) {
+                return -1;
+            }
+            if (position == 3) {
+                headerFlags = b;
+            }
+            if (--headerRemaining == 0) {
+                headerState = GZ_EXTRA_LEN_LO;
+            }
+            break;
+        }
+        case GZ_EXTRA_LEN_LO:
+            if (!(headerFlags & GZIP_FEXTRA)) {
+                headerState = GZ_NAME;
+                break;
+            }
+            headerRemaining = *data++;
+            len--;
+            headerState = GZ_EXTRA_LEN_HI;
+            break;
+        case GZ_EXTRA_LEN_HI:
+            headerRemaining |= (uint16_t)(*data++) << 8;
+            len--;
+            headerState = GZ_EXTRA;
+            break;
+        case GZ_EXTRA: {
+            size_t skip = len < headerRemaining ? len : headerRemaining;
+            data += skip;
+            len -= skip;
+            headerRemaining -= skip;
+            if (headerRemaining == 0) {
+                headerState = GZ_NAME;
+            }
+            break;
+        }
+        case GZ_NAME:
+        case GZ_COMMENT: {
+            uint8_t flag = headerState == GZ_NAME ? GZIP_FNAME : GZIP_FCOMMENT;
+            if (!(headerFlags & flag)) {
+                headerState++;
+                break;
+            }
+            uint8_t b = *data++;
+            len--;
+            if (b == '\0') {
+                headerState++;
+            }
+            break;
+        }
+        case GZ_HCRC:
+            if (!(headerFlags & GZIP_FHCRC)) {
+                headerState = GZ_DONE;
+                break;
+            }
+            if (headerRemaining == 0) {
+                headerRemaining = 2;
+            }
+            data++;
+            len--;
+            if (--headerRemaining == 0) {
+                headerState = GZ_DONE;
+            }
+            break;
+        }
+    }
+    return 1;
+}
+
+/// @brief Inflates a chunk through the fixed circular window and writes the output
+OtaError OtaStreamWriter::writeGzip(const uint8_t *data, size_t len)
+{
+    int header = consumeGzipHeader(data, len);
+    if (header < 0) {
+        abort();
+        return OTA_ERR_DECOMPRESS;
+    }
+    if (header == 0 || inflateDone) {
+        return OTA_OK; // Still in the header, or in the CRC32/ISIZE trailer
+    }
+
+    tinfl_decompressor *decompressor = (tinfl_decompressor *)inflator;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    while (len > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT) {
+        size_t inBytes = len;
+        size_t outBytes = TINFL_LZ_DICT_SIZE - windowOffset;
+        status = tinfl_decompress(decompressor, data, &inBytes, window, window + windowOffset, &outBytes,
+                                  TINFL_FLAG_HAS_MORE_INPUT);
+        data += inBytes;
+        len -= inBytes;
+
+        OtaError error = writeDecompressed(window + windowOffset, outBytes);
+        if (error != OTA_OK) {
+            return error;
+        }
+        windowOffset = (windowOffset + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (status == TINFL_STATUS_DONE) {
+            inflateDone = true;
+            break;
+        }
+        if (status < TINFL_STATUS_DONE) {
+            abort();
+            return OTA_ERR_DECOMPRESS;
+        }
+    }
+    return OTA_OK;
+}
+
+/// @brief Verifies size and digest, then marks the new partition bootable
+OtaError OtaStreamWriter::finish()
+{
+    if (!active) {
+        return OTA_ERR_BEGIN;
+    }
+
+    if (encoding == ENCODING_GZIP && !inflateDone) {
+        abort();
+        return OTA_ERR_DECOMPRESS; // Truncated stream
+    }
+    if (hasMagicPending) {
+        OtaError error = writeDecompressed(&magicPending, 1); // One byte upload, let Update reject it
+        hasMagicPending = false;
+        if (error != OTA_OK) {
+            return error;
+        }
+    }
+    if (declaredSize > 0 && writtenBytes != declaredSize) {
+        abort();
+        return OTA_ERR_SIZE_MISMATCH;
+    }
+
+    uint8_t digest[32];
+    mbedtls_md_finish(&sha, digest);
+    if (hasDigest && memcmp(digest, expectedDigest, sizeof(digest)) != 0) {
+        abort();
+        return OTA_ERR_HASH_MISMATCH;
+    }
+
+    releaseBuffers();
+    active = false;
+    if (!Update.end(true)) {
+        Update.printError(Serial);
+        return OTA_ERR_COMMIT;
+    }
+    return OTA_OK;
+}
+
+/// @brief Abandons the update, the running partition stays bootable
+void OtaStreamWriter::abort()
+{
+    if (active) {
+        Update.abort();
+        active = false;
+    }
+    releaseBuffers();
+}
+
+void OtaStreamWriter::releaseBuffers()
+{
+    free(inflator);
+    free(window);
+    inflator = NULL;
+    window = NULL;
+}
+
+const char *OtaStreamWriter::errorMessage(OtaError error)
+{
+    switch (error) {
+    case OTA_OK:
+        return "OK";
+    case OTA_ERR_BAD_MANIFEST:
+        return "Malformed OTA manifest";
+    case OTA_ERR_SIGNATURE:
+        return "OTA manifest signature missing or invalid";
+    case OTA_ERR_TOO_LARGE:
+        return "Firmware does not fit the OTA partition";
+    case OTA_ERR_NO_MEMORY:
+        return "Not enough memory for OTA";
+    case OTA_ERR_BEGIN:
+        return "OTA Begin Failed!";
+    case OTA_ERR_DECOMPRESS:
+        return "Corrupt or truncated compressed image";
+    case OTA_ERR_WRITE:
+        return "Flash write failed";
+    case OTA_ERR_SIZE_MISMATCH:
+        return "Firmware size does not match manifest";
+    case OTA_ERR_HASH_MISMATCH:
+        return "Firmware SHA-256 does not match manifest";
+    case OTA_ERR_COMMIT:
+        return "OTA Update Failed!";
+    }
+    return "Unknown OTA error";
+}
+
+int OtaStreamWriter::httpStatus(OtaError error)
+{
+    switch (error) {
+    case OTA_OK:
+        return 200;
+    case OTA_ERR_BAD_MANIFEST:
+    case OTA_ERR_DECOMPRESS:
+        return 400;
+    case OTA_ERR_SIGNATURE:
+        return 403;
+    case OTA_ERR_TOO_LARGE:
+        return 413;
+    case OTA_ERR_SIZE_MISMATCH:
+    case OTA_ERR_HASH_MISMATCH:
+        return 422;
+    default:
+        return 500;
+    }
+}
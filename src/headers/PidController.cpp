@@ -0,0 +1,93 @@
+#include "PidController.h"
+
+static float clampf(float value, float low, float high)
+{
+    if (value < low) {
+        return low;
+    }
+    if (value > high) {
+        return high;
+    }
+    return value;
+}
+
+PidController::PidController()
+{
+    config = {1.0f, 0.0f, 0.0f, 0.0f, 100.0f, PID_DIRECT};
+    reset();
+}
+
+void PidController::configure(const PidConfig &config)
+{
+    this->config = config;
+    state.integral = clampf(state.integral, config.outputMin, config.outputMax);
+}
+
+void PidController::reset()
+{
+    state = {};
+}
+
+/// @brief Advances the controller by one sample
+/// @param setpoint target value
+/// @param measurement current process value
+/// @param dtSeconds time since the previous update; 0 or negative skips the I and D terms
+/// @return output clamped to [outputMin, outputMax]
+///
+/// The derivative acts on the measurement rather than the error so changing the
+/// setpoint does not kick the output. Anti-windup: the integral is clamped to the
+/// output range and is not accumulated while the output is saturated in the same
+/// direction the error is pushing.
+float PidController::update(float setpoint, float measurement, float dtSeconds)
+{
+    float error = setpoint - measurement;
+    float sign = config.direction == PID_REVERSE ? -1.0f : 1.0f;
+    error *= sign;
+
+    float proportional = config.kp * error;
+
+    float derivative = 0;
+    if (dtSeconds > 0 && state.hasLastMeasurement) {
+        derivative = -sign * config.kd * (measurement - state.lastMeasurement) / dtSeconds;
+    }
+
+    float integral = state.integral;
+    if (dtSeconds > 0) {
+        float candidate = integral + config.ki * error * dtSeconds;
+        float unclamped = proportional + candidate + derivative;
+        bool windingHigh = unclamped > config.outputMax && error > 0;
+        bool windingLow = unclamped < config.outputMin && error < 0;
+        if (!windingHigh && !windingLow) {
+            integral = candidate;
+        }
+        integral = clampf(integral, config.outputMin, config.outputMax);
+    }
+
+    float unclamped = proportional + integral + derivative;
+    float output = clampf(unclamped, config.outputMin, config.outputMax);
+
+    state.integral = integral;
+    state.lastMeasurement = measurement;
+    state.hasLastMeasurement = true;
+    state.error = error;
+    state.proportional = proportional;
+    state.derivative = derivative;
+    state.output = output;
+    state.saturated = output != unclamped;
+    return output;
+}
+
+int fanDutyFromPid(float output, int minDuty, int maxDuty, int spinUpDuty, bool running)
+{
+    int duty = (int)(output + 0.5f);
+    if (duty > maxDuty) {
+        duty = maxDuty;
+    }
+    if (duty < minDuty || duty <= 0) {
+        return 0;
+    }
+    if (!running && spinUpDuty > duty) {
+        return spinUpDuty > maxDuty ? maxDuty : spinUpDuty;
+    }
+    return duty;
+}
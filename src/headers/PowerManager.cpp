@@ -0,0 +1,248 @@
+#include "PowerManager.h"
+#include "SerialService.h"
+#include "TaskTopology.h"
+#include <ArduinoJson.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+
+TaskHandle_t PowerManager::samplerTask = NULL;
+volatile bool PowerManager::externalWake = false;
+
+PowerManager::PowerManager(ControlService *cs, MessageQueueService *mq, SerialService *ss) : cs(cs), mq(mq), ss(ss)
+{
+}
+
+void PowerManager::begin(AsyncWebServer *server, bool lowPower)
+{
+    ss->registerCommand("/power", "", "Low-power mode, duty cycle and estimated charge", 0, 0,
+                        [this](int argc, char **argv) { printDiagnostics(); });
+    server->on("/api/diagnostics/power", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        request->send(200, "application/json", this->toJson());
+    });
+    if (!lowPower) {
+        return;
+    }
+
+    configurePowerManagement();
+
+    PowerSchedulerConfig config = {};
+    config.pollMs = 100; // ControlService's normal tick, for the tach while a fan runs
+    config.sampleMs = sampleMs;
+    config.publishMs = (uint32_t)mq->getPublishIntervalMs();
+    config.coalesceMs = 50;
+    config.maxSleepMs = TASK_WATCHDOG_TIMEOUT_S * 1000 / 2;
+    // ESP32-WROOM datasheet figures
+    config.activeUa = 40000;
+    config.radioUa = 110000;
+    config.idleUa = 20000;
+    config.sleepUa = lightSleep ? 1500 : config.idleUa; // Without light sleep, idle is modem sleep only
+    scheduler.begin(config, millis());
+
+    samplerTask = cs->getSamplerTask();
+    configurePirWake();
+    cs->addChangeListener([this](const DeviceEntry &device) { this->onDeviceChange(device); });
+    updateFanHold(); // Fans restored at boot are already running
+
+    enabled = true;
+    mq->setPowerManager(this);
+    cs->setPowerManager(this); // The sampler follows the schedule from its next tick
+}
+
+/// @brief Modem sleep between DTIM beacons, frequency scaling and, if the core supports it, automatic light sleep
+void PowerManager::configurePowerManagement()
+{
+    WiFi.setSleep(WIFI_PS_MIN_MODEM); // The access point buffers traffic until the next DTIM beacon
+
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = getCpuFrequencyMhz();
+    pm.min_freq_mhz = 80; // Lowest frequency that keeps the APB clock (UART, LEDC) at 80 MHz
+    pm.light_sleep_enable = true;
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        // Light sleep needs CONFIG_FREERTOS_USE_TICKLESS_IDLE, which the prebuilt Arduino core lacks
+        pm.light_sleep_enable = false;
+        err = esp_pm_configure(&pm);
+    }
+    lightSleep = err == ESP_OK && pm.light_sleep_enable;
+    if (err != ESP_OK) {
+        Serial.printf("esp_pm_configure failed: %s\n", esp_err_to_name(err));
+    }
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "fans", &noSleepLock);
+#endif
+}
+
+/// @brief Makes every PIR input a light sleep wake source that also notifies the sampler
+void PowerManager::configurePirWake()
+{
+    for (DeviceEntry *device : cs->getDevices()) {
+        if (device->type == PIN_TYPE_PIR && pirCount < POWER_MAX_PIR_PINS) {
+            pirPins[pirCount++] = (uint8_t)device->value;
+        }
+    }
+    if (pirCount == 0) {
+        return;
+    }
+
+    gpio_install_isr_service(0); // ESP_ERR_INVALID_STATE if attachInterrupt() already installed it
+    for (uint8_t i = 0; i < pirCount; i++) {
+        gpio_isr_handler_add((gpio_num_t)pirPins[i], pirEdgeIsr, (void *)(intptr_t)pirPins[i]);
+    }
+    armPirWake();
+    esp_sleep_enable_gpio_wakeup();
+}
+
+/// @brief Light sleep only wakes on a GPIO level, so each PIR waits for the level it is not at now
+void PowerManager::armPirWake()
+{
+    for (uint8_t i = 0; i < pirCount; i++) {
+        gpio_num_t pin = (gpio_num_t)pirPins[i];
+        gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+        gpio_intr_enable(pin);
+    }
+}
+
+void IRAM_ATTR PowerManager::pirEdgeIsr(void *arg)
+{
+    gpio_intr_disable((gpio_num_t)(intptr_t)arg); // Level triggered: quiet until armPirWake()
+    externalWake = true;
+    BaseType_t woken = pdFALSE;
+    if (samplerTask != NULL) {
+        vTaskNotifyGiveFromISR(samplerTask, &woken);
+    }
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void PowerManager::onDeviceChange(const DeviceEntry &device)
+{
+    if (device.type == PIN_TYPE_FAN) {
+        updateFanHold();
+    }
+}
+
+/// @brief Holds light sleep off while any fan runs, and polls at the fast rate for the tach
+void PowerManager::updateFanHold()
+{
+    bool running = false;
+    for (DeviceEntry *fan : cs->getDevices()) {
+        int speed = 0;
+        if (fan->type == PIN_TYPE_FAN && cs->getFanSpeed(fan->value, speed) && speed > 0) {
+            running = true;
+            break;
+        }
+    }
+
+    portENTER_CRITICAL(&lock);
+    bool changed = running != fansRunning;
+    fansRunning = running;
+    if (changed) {
+        scheduler.setHoldAwake(running, millis());
+    }
+    portEXIT_CRITICAL(&lock);
+    if (!changed) {
+        return;
+    }
+
+#if CONFIG_PM_ENABLE
+    if (noSleepLock != nullptr) {
+        if (running) {
+            esp_pm_lock_acquire(noSleepLock);
+        } else {
+            esp_pm_lock_release(noSleepLock);
+        }
+    }
+#endif
+    if (samplerTask != NULL) {
+        xTaskNotifyGive(samplerTask); // Re-plan the sleep with or without the fast poll
+    }
+}
+
+uint32_t PowerManager::beginWake()
+{
+    bool external = externalWake;
+    externalWake = false;
+    portENTER_CRITICAL(&lock);
+    uint32_t jobs = scheduler.beginWake(millis(), external);
+    portEXIT_CRITICAL(&lock);
+    return jobs;
+}
+
+void PowerManager::endWake(uint32_t jobs)
+{
+    armPirWake();
+    portENTER_CRITICAL(&lock);
+    scheduler.endWake(millis());
+    portEXIT_CRITICAL(&lock);
+    if (jobs & POWER_JOB_PUBLISH) {
+        mq->openPublishWindow();
+    }
+}
+
+uint32_t PowerManager::sleepMs()
+{
+    portENTER_CRITICAL(&lock);
+    uint32_t sleep = scheduler.sleepMs(millis());
+    portEXIT_CRITICAL(&lock);
+    return sleep;
+}
+
+void PowerManager::setRadio(bool on)
+{
+    portENTER_CRITICAL(&lock);
+    scheduler.setRadio(on, millis());
+    portEXIT_CRITICAL(&lock);
+}
+
+/// @brief Mode, wake counts and seconds per state since low-power mode started; charge is an estimate
+String PowerManager::toJson()
+{
+    portENTER_CRITICAL(&lock);
+    PowerStats stats = scheduler.stats(millis());
+    portEXIT_CRITICAL(&lock);
+
+    JsonDocument doc;
+    doc["enabled"] = enabled;
+    doc["lightSleep"] = lightSleep;
+    doc["fansRunning"] = fansRunning;
+    if (enabled) {
+        doc["sampleMs"] = (uint32_t)sampleMs;
+        doc["publishMs"] = mq->getPublishIntervalMs();
+        doc["wakeups"] = stats.wakeups;
+        doc["batchedWakeups"] = stats.batchedWakeups;
+        doc["externalWakeups"] = stats.externalWakeups;
+        doc["activeS"] = stats.activeMs / 1000.0;
+        doc["radioS"] = stats.radioMs / 1000.0;
+        doc["idleS"] = stats.idleMs / 1000.0;
+        doc["sleepS"] = stats.sleepMs / 1000.0;
+        doc["dutyPercent"] = stats.dutyPermille() / 10.0f;
+        doc["averageMa"] = stats.averageUa() / 1000.0f;
+        doc["chargeMah"] = stats.chargeUah() / 1000.0f;
+    }
+
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
+
+void PowerManager::printDiagnostics()
+{
+    if (!enabled) {
+        ss->printToAll("Low-power mode off (build with -DLOW_POWER_MODE=1)");
+        return;
+    }
+    portENTER_CRITICAL(&lock);
+    PowerStats stats = scheduler.stats(millis());
+    portEXIT_CRITICAL(&lock);
+
+    ss->printToAll("Low-power mode, light sleep %s, fans %s", lightSleep ? "on" : "unavailable",
+                   fansRunning ? "running (sleep held off)" : "off");
+    ss->printToAll("Wakes %u (%u batched with publish, %u by PIR)", stats.wakeups, stats.batchedWakeups,
+                   stats.externalWakeups);
+    ss->printToAll("Active %u s, radio %u s, idle %u s, asleep %u s: duty %u.%u%%", (uint32_t)(stats.activeMs / 1000),
+                   (uint32_t)(stats.radioMs / 1000), (uint32_t)(stats.idleMs / 1000), (uint32_t)(stats.sleepMs / 1000),
+                   stats.dutyPermille() / 10, stats.dutyPermille() % 10);
+    ss->printToAll("Estimated average %u.%03u mA, %u uAh drawn", stats.averageUa() / 1000, stats.averageUa() % 1000,
+                   stats.chargeUah());
+}
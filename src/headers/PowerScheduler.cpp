@@ -0,0 +1,149 @@
+#include "PowerScheduler.h"
+
+uint32_t PowerStats::dutyPermille() const
+{
+    uint64_t total = totalMs();
+    return total == 0 ? 0 : (uint32_t)((activeMs + radioMs) * 1000 / total);
+}
+
+uint32_t PowerStats::averageUa() const
+{
+    uint64_t total = totalMs();
+    return total == 0 ? 0 : (uint32_t)(chargeUaMs / total);
+}
+
+/// @brief Starts every job's grid at nowMs and clears the counters
+void PowerScheduler::begin(const PowerSchedulerConfig &config, uint32_t nowMs)
+{
+    this->config = config;
+    period[JOB_POLL] = config.pollMs;
+    period[JOB_SAMPLE] = config.sampleMs;
+    period[JOB_PUBLISH] = config.publishMs;
+    for (int job = 0; job < JOB_COUNT; job++) {
+        next[job] = nowMs + period[job];
+    }
+    working = false;
+    radio = false;
+    holdAwake = false;
+    accountedMs = nowMs;
+    totals = {};
+}
+
+/// @brief Publishing rides on sample wakes unless it is due more often than sampling
+bool PowerScheduler::wakes(int job) const
+{
+    switch (job) {
+    case JOB_POLL:
+        return holdAwake && period[JOB_POLL] > 0;
+    case JOB_SAMPLE:
+        return period[JOB_SAMPLE] > 0;
+    case JOB_PUBLISH:
+        return period[JOB_PUBLISH] > 0 && (period[JOB_SAMPLE] == 0 || period[JOB_SAMPLE] > period[JOB_PUBLISH]);
+    default:
+        return false;
+    }
+}
+
+/// @brief Returns the jobs to run on this wake and moves each to its next slot on the grid
+/// @param external woken early by an event rather than by sleepMs() running out
+uint32_t PowerScheduler::beginWake(uint32_t nowMs, bool external)
+{
+    account(nowMs);
+    working = true;
+
+    uint32_t jobs = 0;
+    for (int job = 0; job < JOB_COUNT; job++) {
+        bool enabled = job == JOB_POLL ? holdAwake : period[job] > 0;
+        if (!enabled || (int32_t)(next[job] - nowMs) > (int32_t)config.coalesceMs) {
+            continue;
+        }
+        if (!wakes(job) && !(jobs & POWER_JOB_SAMPLE)) {
+            continue; // Waits for the next sample wake
+        }
+        jobs |= 1u << job;
+        do {
+            next[job] += period[job];
+        } while ((int32_t)(next[job] - nowMs) <= 0); // Skip slots missed while busy
+    }
+
+    if (jobs != 0) {
+        totals.wakeups++;
+    }
+    if ((jobs & POWER_JOB_SAMPLE) && (jobs & POWER_JOB_PUBLISH)) {
+        totals.batchedWakeups++;
+    }
+    if (external) {
+        totals.externalWakeups++;
+    }
+    return jobs;
+}
+
+void PowerScheduler::endWake(uint32_t nowMs)
+{
+    account(nowMs);
+    working = false;
+}
+
+/// @return milliseconds until the earliest job that may wake the node, at most maxSleepMs
+uint32_t PowerScheduler::sleepMs(uint32_t nowMs) const
+{
+    uint32_t sleep = config.maxSleepMs;
+    for (int job = 0; job < JOB_COUNT; job++) {
+        if (!wakes(job)) {
+            continue;
+        }
+        int32_t until = (int32_t)(next[job] - nowMs);
+        if (until <= 0) {
+            return 0;
+        }
+        if ((uint32_t)until < sleep) {
+            sleep = (uint32_t)until;
+        }
+    }
+    return sleep;
+}
+
+void PowerScheduler::setHoldAwake(bool hold, uint32_t nowMs)
+{
+    account(nowMs);
+    if (hold && !holdAwake) {
+        next[JOB_POLL] = nowMs + period[JOB_POLL];
+    }
+    holdAwake = hold;
+}
+
+void PowerScheduler::setRadio(bool on, uint32_t nowMs)
+{
+    account(nowMs);
+    radio = on;
+}
+
+PowerStats PowerScheduler::stats(uint32_t nowMs) const
+{
+    PowerStats current = totals;
+    addTime(current, nowMs - accountedMs);
+    return current;
+}
+
+void PowerScheduler::account(uint32_t nowMs)
+{
+    addTime(totals, nowMs - accountedMs);
+    accountedMs = nowMs;
+}
+
+void PowerScheduler::addTime(PowerStats &stats, uint32_t elapsedMs) const
+{
+    if (radio) {
+        stats.radioMs += elapsedMs;
+        stats.chargeUaMs += (uint64_t)elapsedMs * config.radioUa;
+    } else if (working) {
+        stats.activeMs += elapsedMs;
+        stats.chargeUaMs += (uint64_t)elapsedMs * config.activeUa;
+    } else if (holdAwake) {
+        stats.idleMs += elapsedMs;
+        stats.chargeUaMs += (uint64_t)elapsedMs * config.idleUa;
+    } else {
+        stats.sleepMs += elapsedMs;
+        stats.chargeUaMs += (uint64_t)elapsedMs * config.sleepUa;
+    }
+}
@@ -1,5 +1,9 @@
 #include <RestAPI.h>
 #include <Update.h>
+#include <BootTrace.h>
+#include <AllocCounter.h>
+#include <CommandTrace.h>
+#include <esp_heap_caps.h>
 
 // inline void RestAPI::onOTAStart()
 // {
@@ -43,39 +47,60 @@ void RestAPI::onOTAProgress(size_t current, size_t final)
 //     // <Add your own code here>
 // }
 
+/// @brief Streams an uploaded firmware image (raw or gzip) into the OTA partition
+/// @details The optional X-OTA-Size / X-OTA-SHA256 / X-OTA-Signature headers form the
+/// manifest; the image is only committed when its decompressed size and SHA-256 match it
 void RestAPI::handleOTAUpload(AsyncWebServerRequest* request, String filename, size_t index, uint8_t* data, size_t len, bool final) {
     if (!index) {
+        otaResponseSent = false;
         Serial.printf("OTA Update Start: %s\n", filename.c_str());
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {  // Start OTA process
-            Update.printError(Serial);
-            request->send(500, "text/plain", "OTA Begin Failed!");
+
+        const AsyncWebHeader *sizeHeader = request->getHeader("X-OTA-Size");
+        const AsyncWebHeader *digestHeader = request->getHeader("X-OTA-SHA256");
+        const AsyncWebHeader *signatureHeader = request->getHeader("X-OTA-Signature");
+
+        OtaError error = ota.begin(sizeHeader ? sizeHeader->value().c_str() : NULL,
+                                   digestHeader ? digestHeader->value().c_str() : NULL,
+                                   signatureHeader ? signatureHeader->value().c_str() : NULL);
+        if (error != OTA_OK) {
+            Serial.printf("OTA rejected: %s\n", OtaStreamWriter::errorMessage(error));
+            request->send(OtaStreamWriter::httpStatus(error), "text/plain", OtaStreamWriter::errorMessage(error));
             otaResponseSent = true;
             return;
         }
         ota_progress_millis = millis(); // Initialize timer at start of OTA
     }
 
-    if (Update.write(data, len) != len) {  // Write firmware chunk
-        Update.printError(Serial);
-    } else {
-        onOTAProgress(Update.progress(), Update.size()); // Log progress
+    if (otaResponseSent) {
+        return; // Update already rejected, drain the rest of the upload
+    }
+
+    OtaError error = ota.write(data, len);
+    if (error == OTA_OK) {
+        onOTAProgress(ota.written(), ota.expectedSize()); // Log progress
     }
 
-    if (final) {  // Finalize update
-        if (Update.end(true)) {
+    if (error == OTA_OK && final) {  // Finalize update
+        Serial.printf("OTA received %u bytes (%s), wrote %u bytes\n", ota.received(),
+                      ota.isCompressed() ? "gzip" : "raw", ota.written());
+        error = ota.finish();
+        if (error == OTA_OK) {
             Serial.println("OTA Update Success! Restarting...");
             request->send(200, "text/plain", "OTA Update Successful! Restarting...");
             otaResponseSent = true;
             digitalWrite(LED_BUILTIN, LOW); // Turn off LED before restart
             delay(100);
             ESP.restart();
-        } else {
-            Update.printError(Serial);
-            request->send(500, "text/plain", "OTA Update Failed!");
-            otaResponseSent = true;
-            digitalWrite(LED_BUILTIN, LOW); // Turn off LED if update failed
+            return;
         }
     }
+
+    if (error != OTA_OK) {
+        Serial.printf("OTA failed: %s\n", OtaStreamWriter::errorMessage(error));
+        request->send(OtaStreamWriter::httpStatus(error), "text/plain", OtaStreamWriter::errorMessage(error));
+        otaResponseSent = true;
+        digitalWrite(LED_BUILTIN, LOW); // Turn off LED if update failed
+    }
 }
 
 
@@ -83,8 +108,14 @@ void RestAPI::handleOTAUpload(AsyncWebServerRequest* request, String filename, s
 /// @param cs Pointer to the ControlService instance
 /// @param ss Pointer to the SerialService instance
 /// @param server Pointer to the AsyncWebServer instance
-RestAPI::RestAPI(ControlService *cs, SerialService *ss, AsyncWebServer *server)
+/// @param scenes Pointer to the SceneService instance
+/// @param rules Pointer to the RuleEngine instance
+/// @param thermostat Pointer to the FanThermostat instance
+RestAPI::RestAPI(ControlService *cs, SerialService *ss, AsyncWebServer *server, SceneService *scenes, RuleEngine *rules, FanThermostat *thermostat) : snapshot(cs), requestArena(16384)
 {
+    this->scenes = scenes;
+    this->rules = rules;
+    this->thermostat = thermostat;
     this->server = server;
     this->ss = ss;
     this->cs = cs;
@@ -132,12 +163,163 @@ void RestAPI::setupApi()
     });
 
     server->on("/api/test_sensor_data", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_READ)) {
+            return;
+        }
         String sensorDataJson = cs->getAllSensorDataJson(); // Call getAllSensorDataJson directly
         Serial.print("Test API - Sensor Data JSON: "); // Add serial print before sending
         Serial.println(sensorDataJson);
         request->send(200, "application/json", sensorDataJson);
     });
 
+    // Tiny trigger request, the scene is already compiled: POST /api/scenes/trigger?id=<n>
+    server->on("/api/scenes/trigger", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_COMMAND)) {
+            return;
+        }
+        if (!request->hasParam("id")) {
+            request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Missing 'id'\"}");
+            return;
+        }
+        uint8_t sceneId;
+        if (!SceneService::parseId(request->getParam("id")->value().c_str(), sceneId)) {
+            request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"'id' must be between 0 and 15\"}");
+            return;
+        }
+        if (scenes->trigger(sceneId)) {
+            request->send(200, "application/json", "{\"status\":\"success\"}");
+        } else {
+            request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"Scene not found\"}");
+        }
+    });
+
+    server->on("/api/scenes", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_READ)) {
+            return;
+        }
+        JsonDocument response;
+        response["status"] = "success";
+        scenes->listScenes(response["scenes"].to<JsonArray>());
+        String stringResponse;
+        serializeJson(response, stringResponse);
+        request->send(200, "application/json", stringResponse);
+    });
+
+    server->on("/api/scenes", HTTP_DELETE, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_COMMAND)) {
+            return;
+        }
+        uint8_t sceneId;
+        if (!request->hasParam("id") || !SceneService::parseId(request->getParam("id")->value().c_str(), sceneId)) {
+            request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"'id' must be between 0 and 15\"}");
+            return;
+        }
+        if (scenes->remove(sceneId)) {
+            request->send(200, "application/json", "{\"status\":\"success\"}");
+        } else {
+            request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"Scene not found\"}");
+        }
+    });
+
+    server->on("/api/scenes", HTTP_POST, [](AsyncWebServerRequest *request) {},
+               nullptr,
+               [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+               { this->sceneOnBody(request, data, len, index, total); });
+
+    server->on("/api/rules", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_READ)) {
+            return;
+        }
+        JsonDocument response;
+        response["status"] = "success";
+        rules->describe(response.as<JsonObject>());
+        String stringResponse;
+        serializeJson(response, stringResponse);
+        request->send(200, "application/json", stringResponse);
+    });
+
+    server->on("/api/rules", HTTP_DELETE, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_COMMAND)) {
+            return;
+        }
+        rules->clear();
+        request->send(200, "application/json", "{\"status\":\"success\"}");
+    });
+
+    server->on("/api/rules", HTTP_POST, [](AsyncWebServerRequest *request) {},
+               nullptr,
+               [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+               { this->rulesOnBody(request, data, len, index, total); });
+
+    server->on("/api/thermostat", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_READ)) {
+            return;
+        }
+        JsonDocument response;
+        response["status"] = "success";
+        thermostat->describe(response["loops"].to<JsonArray>());
+        String stringResponse;
+        serializeJson(response, stringResponse);
+        request->send(200, "application/json", stringResponse);
+    });
+
+    // Back to manual control: DELETE /api/thermostat?areaId=<fan area>&deviceId=<fan>
+    server->on("/api/thermostat", HTTP_DELETE, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_COMMAND)) {
+            return;
+        }
+        int pin = -1;
+        if (request->hasParam("areaId") && request->hasParam("deviceId")) {
+            pin = cs->getPinValue(request->getParam("areaId")->value().c_str(), request->getParam("deviceId")->value().c_str());
+        }
+        if (pin != -1 && thermostat->disable((uint8_t)pin)) {
+            request->send(200, "application/json", "{\"status\":\"success\"}");
+        } else {
+            request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"Thermostat not found\"}");
+        }
+    });
+
+    server->on("/api/thermostat", HTTP_POST, [](AsyncWebServerRequest *request) {},
+               nullptr,
+               [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+               { this->thermostatOnBody(request, data, len, index, total); });
+
+    server->on("/api/state", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        if (!admission.admit(request, ADMISSION_READ)) {
+            return;
+        }
+        snapshot.handleRequest(request);
+    });
+
+    server->on("/api/diagnostics/boot", HTTP_GET, [](AsyncWebServerRequest *request) {
+        request->send(200, "application/json", BootTrace::toJson());
+    });
+
+    // Polled by tools/loadgen.py during soak runs to spot leaks and fragmentation
+    server->on("/api/diagnostics/heap", HTTP_GET, [](AsyncWebServerRequest *request) {
+        char body[160];
+        snprintf(body, sizeof(body),
+                 "{\"free\":%u,\"largest\":%u,\"minFree\":%u,\"allocations\":%u,\"uptimeMs\":%lu}",
+                 ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT), ESP.getMinFreeHeap(),
+                 AllocCounter::total(), millis());
+        request->send(200, "application/json", body);
+    });
+
+    // Task placement against the topology profile, CPU share since the previous call
+    server->on("/api/diagnostics/tasks", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        request->send(200, "application/json", TaskTopology::toJson(this->taskMeter));
+    });
+
+    // Requests in flight and shed per class: commands and reads, by concurrency, heap or fragmentation
+    server->on("/api/diagnostics/admission", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        request->send(200, "application/json", this->admission.toJson());
+    });
+
+    // Recent command traces, newest first: GET /api/diagnostics/traces[?limit=<n>][&id=<X-Request-ID>]
+    server->on("/api/diagnostics/traces", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        this->tracesOnRequest(request);
+    });
+
     // ElegantOTA.begin(server);
     // ElegantOTA.setAuth("OTAdmin", "P@ssw0rd");
     // ElegantOTA.onStart([this]()
@@ -160,6 +342,213 @@ void RestAPI::commandOnRequest(AsyncWebServerRequest *request)
     //  request->send(200, "application/json", "{\"status\":\"success\"}");
 }
 
+/// @brief Lists the finished command traces, stage times in microseconds from the first body byte
+void RestAPI::tracesOnRequest(AsyncWebServerRequest *request)
+{
+    size_t limit = request->hasParam("limit") ? (size_t)request->getParam("limit")->value().toInt() : COMMAND_TRACE_SLOTS;
+    const char *requestId = request->hasParam("id") ? request->getParam("id")->value().c_str() : nullptr;
+
+    JsonDocument response;
+    response["status"] = "success";
+    JsonArray traces = response["traces"].to<JsonArray>();
+    uint32_t now = millis();
+    CommandTraceRecord record;
+    for (size_t newest = 0; newest < COMMAND_TRACE_SLOTS && traces.size() < limit; newest++)
+    {
+        if (!CommandTrace::read(newest, record) || (requestId != nullptr && strcmp(record.requestId, requestId) != 0))
+        {
+            continue;
+        }
+        JsonObject trace = traces.add<JsonObject>();
+        trace["requestId"] = (const char *)record.requestId;
+        trace["trace"] = record.traceId;
+        trace["ageMs"] = now - record.startMs;
+        trace["status"] = record.status;
+        trace["bodyBytes"] = record.bodyBytes;
+        JsonObject stages = trace["stagesUs"].to<JsonObject>();
+        for (int stage = 0; stage < TRACE_STAGE_COUNT; stage++)
+        {
+            if (record.stageUs[stage] != COMMAND_TRACE_NOT_REACHED)
+            {
+                stages[CommandTrace::stageName((CommandTraceStage)stage)] = record.stageUs[stage];
+            }
+        }
+        trace["deviceCount"] = record.deviceCount;
+        JsonArray devices = trace["devicesUs"].to<JsonArray>(); // [start, end] per device
+        for (uint8_t i = 0; i < record.deviceCount && i < COMMAND_TRACE_MAX_DEVICES; i++)
+        {
+            JsonArray span = devices.add<JsonArray>();
+            span.add(record.deviceStartUs[i]);
+            span.add(record.deviceEndUs[i]);
+        }
+    }
+
+    String stringResponse;
+    serializeJson(response, stringResponse);
+    request->send(200, "application/json", stringResponse);
+}
+
+/// @brief Reassembles a body that spans several TCP segments
+/// @details On the last segment data/len point at the complete body (owned by the request)
+/// @return true once the whole body is available
+bool RestAPI::collectBody(AsyncWebServerRequest *request, uint8_t *&data, size_t &len, size_t index, size_t total)
+{
+    if (len == total)
+    {
+        return true; // Single segment, parse in place
+    }
+
+    if (index == 0)
+    {
+        if (total > maxCommandBodySize || (request->_tempObject = malloc(total)) == nullptr)
+        {
+            request->send(413, "application/json", "{\"status\":\"error\",\"message\":\"Body too large\"}");
+            return false;
+        }
+    }
+    if (request->_tempObject == nullptr)
+    {
+        return false; // Already rejected
+    }
+    memcpy((uint8_t *)request->_tempObject + index, data, len);
+    if (index + len < total)
+    {
+        return false;
+    }
+    data = (uint8_t *)request->_tempObject; // Freed by the request
+    len = total;
+    return true;
+}
+
+/// @brief Admits a request with a body as a command, on its first segment
+/// @details A rejected request gets no body buffer, so collectBody drops its later segments.
+/// Oversized bodies reserve nothing and get their 413 from collectBody instead of a 503
+bool RestAPI::admitBody(AsyncWebServerRequest *request, size_t index, size_t total)
+{
+    if (index > 0)
+    {
+        return true;
+    }
+    return admission.admit(request, ADMISSION_COMMAND, total <= maxCommandBodySize ? total : 0);
+}
+
+/// @brief Handles scene definitions (POST /api/scenes)
+void RestAPI::sceneOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+    if (!admitBody(request, index, total))
+    {
+        return;
+    }
+    if (!collectBody(request, data, len, index, total))
+    {
+        return;
+    }
+
+    JsonDocument response;
+    JsonDocument doc;
+    if (deserializeJson(doc, data, len))
+    {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Failed to parse JSON!\"}");
+        return;
+    }
+
+    uint8_t sceneId = 0;
+    String error;
+    int code = 200;
+    if (scenes->define(doc.as<JsonObject>(), sceneId, error))
+    {
+        response["status"] = "success";
+        response["sceneId"] = sceneId;
+    }
+    else
+    {
+        response["status"] = "error";
+        response["message"] = error;
+        code = 400;
+    }
+
+    String stringResponse;
+    serializeJson(response, stringResponse);
+    request->send(code, "application/json", stringResponse);
+}
+
+/// @brief Handles thermostat configuration (POST /api/thermostat)
+void RestAPI::thermostatOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+    if (!admitBody(request, index, total))
+    {
+        return;
+    }
+    if (!collectBody(request, data, len, index, total))
+    {
+        return;
+    }
+
+    JsonDocument doc;
+    if (deserializeJson(doc, data, len))
+    {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Failed to parse JSON!\"}");
+        return;
+    }
+
+    String error;
+    if (!thermostat->configure(doc.as<JsonObject>(), error))
+    {
+        JsonDocument response;
+        response["status"] = "error";
+        response["message"] = error;
+        String stringResponse;
+        serializeJson(response, stringResponse);
+        request->send(400, "application/json", stringResponse);
+        return;
+    }
+    request->send(200, "application/json", "{\"status\":\"success\"}");
+}
+
+/// @brief Handles rule uploads (POST /api/rules), replacing the whole rule set
+void RestAPI::rulesOnBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+    if (!admitBody(request, index, total))
+    {
+        return;
+    }
+    if (!collectBody(request, data, len, index, total))
+    {
+        return;
+    }
+
+    JsonDocument doc;
+    if (deserializeJson(doc, data, len))
+    {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Failed to parse JSON!\"}");
+        return;
+    }
+
+    String error;
+    if (!rules->load(doc.as<JsonObject>(), error))
+    {
+        JsonDocument response;
+        response["status"] = "error";
+        response["message"] = error;
+        String stringResponse;
+        serializeJson(response, stringResponse);
+        request->send(400, "application/json", stringResponse);
+        return;
+    }
+    request->send(200, "application/json", "{\"status\":\"success\"}");
+}
+
+/// @brief Compact command responses are opt-in: ?format=compact or "X-Response-Format: compact"
+bool RestAPI::wantsCompact(AsyncWebServerRequest *request)
+{
+    if (request->hasParam("format"))
+    {
+        return request->getParam("format")->value() == "compact";
+    }
+    const AsyncWebHeader *header = request->getHeader("X-Response-Format");
+    return header != nullptr && header->value() == "compact";
+}
+
 /// @brief Handles the body of the command request
 /// @param request Pointer to the AsyncWebServerRequest instance
 /// @param data Pointer to the data received
@@ -175,23 +564,89 @@ inline void RestAPI::commandOnBody(AsyncWebServerRequest *request, uint8_t *data
         return;
     }
 
-    JsonDocument response;
-    JsonDocument doc;
+    CommandTraceRecord *trace = nullptr;
+    if (index == 0)
+    {
+        const AsyncWebHeader *requestId = request->getHeader("X-Request-ID");
+        trace = CommandTrace::open(request, requestId ? requestId->value().c_str() : nullptr, total);
+    }
 
-    DeserializationError error = deserializeJson(doc, data);
-    if (error)
+    if (!admitBody(request, index, total))
     {
-        response["status"] = "error";
-        response["message"] = "Failed to parse JSON!";
-        String stringResponse;
-        serializeJson(response, stringResponse);
-        request->send(400, "application/json", stringResponse);
+        CommandTrace::close(trace, 503); // Rejected requests are traced too, admission sent the 503
         return;
     }
 
-    cs->handleCommand(doc, response);
+    if (!collectBody(request, data, len, index, total))
+    {
+        if (request->_tempObject == nullptr)
+        {
+            CommandTrace::close(CommandTrace::find(request), 413); // Rejected; nullptr on later segments, already closed
+        }
+        return; // Waiting for more segments, or rejected
+    }
 
-    String stringResponse;
-    serializeJson(response, stringResponse);
-    request->send(200, "application/json", stringResponse);
+    if (index > 0)
+    {
+        trace = CommandTrace::find(request);
+    }
+    CommandTrace::activate(trace);
+    CommandTrace::stage(TRACE_BODY_COMPLETE);
+
+    uint32_t allocationsBefore = AllocCounter::taskCount();
+    int code = 200;
+    size_t length = 0; // Stays 0 when the response did not fit the buffer
+    String overflowResponse;
+    {
+        // Both documents live in the arena; the scope is declared first so it resets last
+        JsonArenaScope scope(requestArena);
+        JsonDocument response(&requestArena);
+        JsonDocument doc(&requestArena);
+
+        DeserializationError error = deserializeJson(doc, data, len);
+        if (error)
+        {
+            response["status"] = "error";
+            response["message"] = "Failed to parse JSON!";
+            code = 400;
+        }
+        else
+        {
+            CommandTrace::stage(TRACE_PARSED);
+            cs->handleCommand(doc, response, wantsCompact(request));
+        }
+
+        if (measureJson(response) < sizeof(buffer))
+        {
+            length = serializeJson(response, buffer, sizeof(buffer));
+        }
+        else
+        {
+            serializeJson(response, overflowResponse); // Rare large batch result
+        }
+    }
+    CommandTrace::stage(TRACE_RESPONSE_READY);
+
+    // The basic response copies the body, so the buffer is free for the next request
+    AsyncWebServerResponse *reply = length > 0
+                                        ? request->beginResponse(code, "application/json", (const char *)buffer)
+                                        : request->beginResponse(code, "application/json", overflowResponse);
+    if (trace != nullptr)
+    {
+        char timing[160];
+        CommandTrace::formatServerTiming(*trace, timing, sizeof(timing));
+        reply->addHeader("X-Request-ID", trace->requestId);
+        reply->addHeader("Server-Timing", timing); // Client time minus "total" is the network share
+    }
+    if (AllocCounter::enabled())
+    {
+        // Counted once the response is built: its object, body copy and headers are part of the cost
+        uint32_t allocations = AllocCounter::taskCount() - allocationsBefore;
+        char value[12];
+        snprintf(value, sizeof(value), "%u", (unsigned)allocations);
+        reply->addHeader("X-Heap-Allocs", value); // Allocations made while handling, constant in steady state
+    }
+    request->send(reply);
+    CommandTrace::stage(TRACE_RESPONSE_SENT);
+    CommandTrace::close(trace, code);
 }
\ No newline at end of file
@@ -0,0 +1,396 @@
+#include "RuleEngine.h"
+#include <Preferences.h>
+#include <esp_timer.h>
+
+static const uint8_t RULE_FORMAT_VERSION = 1;
+static const char *RULE_NAMESPACE = "rules";
+
+static const char *METRIC_NAMES[] = {"temperature", "humidity", "motion", "state", "speed"};
+static const char *OP_NAMES[] = {">", ">=", "<", "<=", "==", "!="};
+
+// Rule actions applied further up this task's stack; commitBatch() re-enters onDeviceChange
+static thread_local uint8_t chainDepth = 0;
+
+RuleEngine::RuleEngine(ControlService *cs) : cs(cs)
+{
+    mutex = xSemaphoreCreateRecursiveMutex(); // Applying an action re-enters through the change listener
+    memset(&table, 0, sizeof(table));
+    memset(states, 0, sizeof(states));
+}
+
+RuleEngine::~RuleEngine()
+{
+    if (mutex != NULL) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+/// @brief Loads the stored rule table and hooks into ControlService events
+void RuleEngine::begin()
+{
+    Preferences prefs;
+    if (prefs.begin(RULE_NAMESPACE, true)) {
+        RuleTable stored;
+        if (prefs.getBytes("table", &stored, sizeof(stored)) == sizeof(stored) &&
+            stored.formatVersion == RULE_FORMAT_VERSION && stored.count <= RULE_MAX_COUNT) {
+            if (findCycle(stored) < 0) {
+                table = stored;
+                evaluateAllPending = true;
+            } else {
+                Serial.println("Stored rules feed back into themselves, not loading them"); // Stored before cycles were checked
+            }
+        }
+        prefs.end();
+    }
+
+    cs->addChangeListener([this](const DeviceEntry &device) { this->onDeviceChange(device); });
+    cs->addTickListener([this](uint32_t nowMs) { this->onTick(nowMs); });
+}
+
+static bool lookupName(const char *name, const char *const *names, size_t count, uint8_t &index)
+{
+    if (name == nullptr) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            index = (uint8_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Compiles one rule definition into its table form
+bool RuleEngine::compileRule(JsonObject definition, CompiledRule &rule, String &error)
+{
+    memset(&rule, 0, sizeof(rule));
+
+    JsonObject when = definition["when"];
+    const char *areaId = when["areaId"];
+    const char *deviceId = when["deviceId"];
+    if (areaId == nullptr || deviceId == nullptr) {
+        error = "Rule 'when' needs 'areaId' and 'deviceId'";
+        return false;
+    }
+
+    int pin = cs->getPinValue(areaId, deviceId);
+    if (pin == -1) {
+        error = String("Invalid device ID '") + deviceId + "' or area '" + areaId + "'";
+        return false;
+    }
+    rule.sourcePin = (uint8_t)pin;
+
+    if (!lookupName(when["metric"], METRIC_NAMES, sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0]), rule.metric)) {
+        error = "Unknown rule metric";
+        return false;
+    }
+    if (!lookupName(when["op"], OP_NAMES, sizeof(OP_NAMES) / sizeof(OP_NAMES[0]), rule.op)) {
+        error = "Unknown rule operator";
+        return false;
+    }
+    if (!when["value"].is<float>()) {
+        error = "Rule 'when' needs a numeric 'value'";
+        return false;
+    }
+    rule.threshold = when["value"];
+    rule.hysteresis = definition["hysteresis"] | 0.0f;
+    rule.holdMs = (definition["holdSeconds"] | 0UL) * 1000UL;
+
+    JsonObject then = definition["then"];
+    if (!cs->compileAction(then["areaId"], then, rule.then, error)) {
+        return false;
+    }
+    if (definition["otherwise"].is<JsonObject>()) {
+        JsonObject otherwise = definition["otherwise"];
+        if (!cs->compileAction(otherwise["areaId"], otherwise, rule.otherwise, error)) {
+            return false;
+        }
+        rule.hasOtherwise = 1;
+    }
+    return true;
+}
+
+/// @brief Compiles and installs a new rule set, replacing the current one
+bool RuleEngine::load(JsonObject definition, String &error)
+{
+    if (!definition["rules"].is<JsonArray>()) {
+        error = "Missing or invalid 'rules' array";
+        return false;
+    }
+
+    RuleTable compiled;
+    memset(&compiled, 0, sizeof(compiled));
+    compiled.formatVersion = RULE_FORMAT_VERSION;
+
+    for (JsonObject rule : definition["rules"].as<JsonArray>()) {
+        if (compiled.count >= RULE_MAX_COUNT) {
+            error = "Too many rules";
+            return false;
+        }
+        if (!compileRule(rule, compiled.rules[compiled.count], error)) {
+            error = String("Rule ") + compiled.count + ": " + error;
+            return false;
+        }
+        compiled.count++;
+    }
+
+    int cyclic = findCycle(compiled);
+    if (cyclic >= 0) {
+        error = String("Rule ") + cyclic + ": its action feeds back into its own condition";
+        return false;
+    }
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        error = "Rule engine busy";
+        return false;
+    }
+    table = compiled;
+    memset(states, 0, sizeof(states));
+    evaluateAllPending = true; // Apply rules whose condition already holds
+    persist();
+    xSemaphoreGiveRecursive(mutex);
+    return true;
+}
+
+void RuleEngine::clear()
+{
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    table.count = 0;
+    memset(states, 0, sizeof(states));
+    persist();
+    xSemaphoreGiveRecursive(mutex);
+}
+
+/// @brief Finds a rule whose action can, through any chain of rules, change its own source
+int RuleEngine::findCycle(const RuleTable &table)
+{
+    for (uint8_t i = 0; i < table.count; i++) {
+        // Walk every pin this rule's actions can reach; each pin is expanded once
+        uint8_t stack[2 * RULE_MAX_COUNT + 2];
+        size_t top = 0;
+        uint64_t visited = 0;
+        stack[top++] = table.rules[i].then.pin;
+        if (table.rules[i].hasOtherwise) {
+            stack[top++] = table.rules[i].otherwise.pin;
+        }
+        while (top > 0) {
+            uint8_t pin = stack[--top];
+            if (pin == table.rules[i].sourcePin) {
+                return i;
+            }
+            if (pin >= 64 || (visited & (1ULL << pin))) {
+                continue;
+            }
+            visited |= 1ULL << pin;
+            for (uint8_t j = 0; j < table.count; j++) {
+                if (table.rules[j].sourcePin == pin) {
+                    stack[top++] = table.rules[j].then.pin;
+                    if (table.rules[j].hasOtherwise) {
+                        stack[top++] = table.rules[j].otherwise.pin;
+                    }
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+void RuleEngine::persist()
+{
+    Preferences prefs;
+    if (prefs.begin(RULE_NAMESPACE, false)) {
+        prefs.putBytes("table", &table, sizeof(table));
+        prefs.end();
+    }
+}
+
+/// @brief Reads a rule's source value from ControlService's cached state
+bool RuleEngine::readMetric(const CompiledRule &rule, float &value)
+{
+    float temperature, humidity;
+    bool motion;
+    int level;
+
+    switch (rule.metric) {
+    case RULE_METRIC_TEMPERATURE:
+    case RULE_METRIC_HUMIDITY:
+        if (!cs->getDHT11Readings(rule.sourcePin, temperature, humidity)) {
+            return false;
+        }
+        value = rule.metric == RULE_METRIC_TEMPERATURE ? temperature : humidity;
+        return true;
+    case RULE_METRIC_MOTION:
+        if (!cs->getPIRState(rule.sourcePin, motion)) {
+            return false;
+        }
+        value = motion ? 1 : 0;
+        return true;
+    case RULE_METRIC_STATE:
+        if (!cs->getDigitalState(rule.sourcePin, level)) {
+            return false;
+        }
+        value = level;
+        return true;
+    case RULE_METRIC_SPEED:
+        if (!cs->getFanSpeed(rule.sourcePin, level)) {
+            return false;
+        }
+        value = level;
+        return true;
+    }
+    return false;
+}
+
+/// @brief Evaluates one rule, staging its action on a rising edge or scheduling its release
+void RuleEngine::evaluate(uint8_t index, uint32_t nowMs, GpioBatch &batch)
+{
+    const CompiledRule &rule = table.rules[index];
+    RuleState &state = states[index];
+
+    float value;
+    if (!readMetric(rule, value)) {
+        return;
+    }
+
+    // While active, comparisons are shifted by the hysteresis so the rule does not chatter
+    float threshold = rule.threshold;
+    if (state.active) {
+        if (rule.op == RULE_OP_GT || rule.op == RULE_OP_GE) {
+            threshold -= rule.hysteresis;
+        } else if (rule.op == RULE_OP_LT || rule.op == RULE_OP_LE) {
+            threshold += rule.hysteresis;
+        }
+    }
+
+    bool condition = false;
+    switch (rule.op) {
+    case RULE_OP_GT: condition = value > threshold; break;
+    case RULE_OP_GE: condition = value >= threshold; break;
+    case RULE_OP_LT: condition = value < threshold; break;
+    case RULE_OP_LE: condition = value <= threshold; break;
+    case RULE_OP_EQ: condition = value == threshold; break;
+    case RULE_OP_NE: condition = value != threshold; break;
+    }
+
+    if (condition) {
+        state.releaseAtMs = 0; // Retriggered while holding
+        if (!state.active) {
+            cs->stageAction(batch, rule.then);
+            state.active = true;
+        }
+    } else if (state.active && state.releaseAtMs == 0) {
+        if (rule.holdMs == 0) {
+            release(index, batch);
+        } else {
+            state.releaseAtMs = (nowMs + rule.holdMs) | 1; // 0 means "no release pending"
+        }
+    }
+    state.conditionTrue = condition;
+}
+
+void RuleEngine::release(uint8_t index, GpioBatch &batch)
+{
+    if (table.rules[index].hasOtherwise) {
+        cs->stageAction(batch, table.rules[index].otherwise);
+    }
+    states[index].active = false;
+    states[index].releaseAtMs = 0;
+}
+
+void RuleEngine::evaluateSource(uint8_t pin, uint32_t nowMs, GpioBatch &batch)
+{
+    for (uint8_t i = 0; i < table.count; i++) {
+        if (table.rules[i].sourcePin == pin) {
+            evaluate(i, nowMs, batch);
+        }
+    }
+}
+
+/// @brief Applies staged actions outside the lock; the changes re-enter onDeviceChange one level deeper
+void RuleEngine::commit(GpioBatch &batch)
+{
+    chainDepth++;
+    cs->commitBatch(batch);
+    chainDepth--;
+}
+
+/// @brief Evaluates only the rules whose source is the changed device
+void RuleEngine::onDeviceChange(const DeviceEntry &device)
+{
+    GpioBatch batch;
+    int64_t start = esp_timer_get_time();
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (chainDepth >= RULE_MAX_CHAIN_DEPTH) {
+        // Deep in a chain of rule actions on this task; finish it on the next tick with a fresh stack
+        deferredPins |= 1ULL << device.value;
+        deferredCount++;
+        xSemaphoreGiveRecursive(mutex);
+        return;
+    }
+    evaluateSource((uint8_t)device.value, millis(), batch);
+    evaluationCount++;
+    lastEvaluationUs = (uint32_t)(esp_timer_get_time() - start);
+    xSemaphoreGiveRecursive(mutex);
+
+    commit(batch);
+}
+
+/// @brief Releases expired holds and runs the full evaluation after a (re)load
+void RuleEngine::onTick(uint32_t nowMs)
+{
+    GpioBatch batch;
+
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    bool evaluateAll = evaluateAllPending;
+    evaluateAllPending = false;
+    uint64_t deferred = evaluateAll ? 0 : deferredPins;
+    deferredPins = 0;
+    for (uint8_t pin = 0; deferred != 0; pin++, deferred >>= 1) {
+        if (deferred & 1) {
+            evaluateSource(pin, nowMs, batch);
+        }
+    }
+    for (uint8_t i = 0; i < table.count; i++) {
+        if (evaluateAll) {
+            evaluate(i, nowMs, batch);
+        }
+        if (states[i].active && states[i].releaseAtMs != 0 && (int32_t)(nowMs - states[i].releaseAtMs) >= 0) {
+            release(i, batch);
+        }
+    }
+    xSemaphoreGiveRecursive(mutex);
+
+    commit(batch);
+}
+
+void RuleEngine::describe(JsonObject out)
+{
+    if (xSemaphoreTakeRecursive(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    out["evaluations"] = evaluationCount;
+    out["last_evaluation_us"] = lastEvaluationUs;
+    out["deferred"] = deferredCount;
+    JsonArray rules = out["rules"].to<JsonArray>();
+    for (uint8_t i = 0; i < table.count; i++) {
+        const CompiledRule &rule = table.rules[i];
+        JsonObject entry = rules.add<JsonObject>();
+        entry["sourcePin"] = rule.sourcePin;
+        entry["metric"] = METRIC_NAMES[rule.metric];
+        entry["op"] = OP_NAMES[rule.op];
+        entry["value"] = rule.threshold;
+        entry["targetPin"] = rule.then.pin;
+        entry["holdSeconds"] = rule.holdMs / 1000;
+        entry["active"] = states[i].active;
+        entry["condition"] = states[i].conditionTrue;
+    }
+    xSemaphoreGiveRecursive(mutex);
+}
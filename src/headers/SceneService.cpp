@@ -0,0 +1,210 @@
+#include "SceneService.h"
+#include <Preferences.h>
+
+static const uint8_t SCENE_FORMAT_VERSION = 1;
+static const char *SCENE_NAMESPACE = "scenes";
+
+SceneService::SceneService(ControlService *cs) : cs(cs)
+{
+    mutex = xSemaphoreCreateMutex();
+    memset(defined, 0, sizeof(defined));
+}
+
+SceneService::~SceneService()
+{
+    if (mutex != NULL) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+static void sceneKey(uint8_t sceneId, char *key, size_t keyLen)
+{
+    snprintf(key, keyLen, "s%u", sceneId);
+}
+
+/// @brief Loads every saved scene from NVS into RAM
+void SceneService::begin()
+{
+    Preferences prefs;
+    if (!prefs.begin(SCENE_NAMESPACE, true)) {
+        return; // Nothing saved yet
+    }
+
+    for (uint8_t id = 0; id < SCENE_MAX_COUNT; id++) {
+        char key[8];
+        sceneKey(id, key, sizeof(key));
+        CompiledScene scene;
+        size_t read = prefs.getBytes(key, &scene, sizeof(scene));
+        if (read == sizeof(scene) && scene.formatVersion == SCENE_FORMAT_VERSION &&
+            scene.actionCount <= SCENE_MAX_ACTIONS) {
+            scenes[id] = scene;
+            defined[id] = true;
+        }
+    }
+    prefs.end();
+}
+
+/// @brief Resolves a scene definition to pin actions
+/// @param definition {"name", "commands": [{"areaId", "devices": [{"deviceId", "function", "parameters"}]}]}
+bool SceneService::compile(JsonObject definition, CompiledScene &scene, String &error)
+{
+    memset(&scene, 0, sizeof(scene));
+    scene.formatVersion = SCENE_FORMAT_VERSION;
+    strlcpy(scene.name, definition["name"] | "", sizeof(scene.name));
+
+    if (!definition["commands"].is<JsonArray>()) {
+        error = "Missing or invalid 'commands' array in scene";
+        return false;
+    }
+
+    for (JsonObject command : definition["commands"].as<JsonArray>()) {
+        const char *areaId = command["areaId"];
+        if (areaId == nullptr || !command["devices"].is<JsonArray>()) {
+            error = "Each scene command needs 'areaId' and 'devices'";
+            return false;
+        }
+
+        for (JsonObject device : command["devices"].as<JsonArray>()) {
+            if (scene.actionCount >= SCENE_MAX_ACTIONS) {
+                error = "Too many devices in scene";
+                return false;
+            }
+            if (!cs->compileAction(areaId, device, scene.actions[scene.actionCount], error)) {
+                return false;
+            }
+            scene.actionCount++;
+        }
+    }
+    return true;
+}
+
+void SceneService::persist(uint8_t sceneId)
+{
+    Preferences prefs;
+    if (!prefs.begin(SCENE_NAMESPACE, false)) {
+        return;
+    }
+    char key[8];
+    sceneKey(sceneId, key, sizeof(key));
+    if (defined[sceneId]) {
+        prefs.putBytes(key, &scenes[sceneId], sizeof(CompiledScene));
+    } else {
+        prefs.remove(key);
+    }
+    prefs.end();
+}
+
+/// @brief Compiles and saves a scene
+/// @param definition scene JSON including "sceneId" (0-15)
+/// @param sceneId receives the saved scene's ID
+/// @param error receives a message on failure
+bool SceneService::define(JsonObject definition, uint8_t &sceneId, String &error)
+{
+    if (!definition["sceneId"].is<int>() || definition["sceneId"].as<int>() < 0 ||
+        definition["sceneId"].as<int>() >= SCENE_MAX_COUNT) {
+        error = "'sceneId' must be between 0 and 15";
+        return false;
+    }
+    sceneId = definition["sceneId"].as<int>();
+
+    CompiledScene compiled;
+    if (!compile(definition, compiled, error)) {
+        return false;
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        error = "Scene store busy";
+        return false;
+    }
+    scenes[sceneId] = compiled;
+    defined[sceneId] = true;
+    persist(sceneId);
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+bool SceneService::remove(uint8_t sceneId)
+{
+    if (sceneId >= SCENE_MAX_COUNT || xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    bool existed = defined[sceneId];
+    defined[sceneId] = false;
+    if (existed) {
+        persist(sceneId);
+    }
+    xSemaphoreGive(mutex);
+    return existed;
+}
+
+/// @brief Applies a scene: stages its precompiled actions and commits them together
+bool SceneService::trigger(uint8_t sceneId)
+{
+    if (sceneId >= SCENE_MAX_COUNT || xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    if (!defined[sceneId]) {
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    GpioBatch batch;
+    const CompiledScene &scene = scenes[sceneId];
+    for (uint8_t i = 0; i < scene.actionCount; i++) {
+        cs->stageAction(batch, scene.actions[i]);
+    }
+    xSemaphoreGive(mutex);
+
+    cs->commitBatch(batch);
+    return true;
+}
+
+/// @brief Triggers a scene from a message payload: one raw byte, or the ID in ASCII
+bool SceneService::triggerFromPayload(const uint8_t *payload, size_t length)
+{
+    if (length == 1 && payload[0] < SCENE_MAX_COUNT) {
+        return trigger(payload[0]);
+    }
+    if (length == 0 || length > 3) {
+        return false;
+    }
+
+    char text[4];
+    memcpy(text, payload, length);
+    text[length] = '\0';
+    uint8_t sceneId;
+    return strlen(text) == length && parseId(text, sceneId) && trigger(sceneId);
+}
+
+/// @brief Parses a scene ID sent as text (REST query, MQTT payload)
+/// @return false unless text is only decimal digits naming a slot below SCENE_MAX_COUNT
+bool SceneService::parseId(const char *text, uint8_t &sceneId)
+{
+    // strtol() would also skip leading spaces and take a sign
+    if (text == nullptr || *text < '0' || *text > '9') {
+        return false;
+    }
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (*end != '\0' || value >= SCENE_MAX_COUNT) {
+        return false;
+    }
+    sceneId = (uint8_t)value;
+    return true;
+}
+
+void SceneService::listScenes(JsonArray out)
+{
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    for (uint8_t id = 0; id < SCENE_MAX_COUNT; id++) {
+        if (defined[id]) {
+            JsonObject scene = out.add<JsonObject>();
+            scene["sceneId"] = id;
+            scene["name"] = (const char *)scenes[id].name;
+            scene["actions"] = scenes[id].actionCount;
+        }
+    }
+    xSemaphoreGive(mutex);
+}
@@ -0,0 +1,398 @@
+#include "SensorHistory.h"
+#include <memory>
+
+// Ring sizes per tier: 128-byte blocks, the oldest block is dropped when a ring wraps
+static const uint8_t TIER_FIELDS[HISTORY_TIERS] = {1, 3, 3};
+static const uint8_t TIER_BLOCKS[HISTORY_TIERS] = {6, 16, 4};
+static const uint16_t TIER_BLOCK_BYTES = 128;
+
+const uint32_t SensorHistory::tierResolution[HISTORY_TIERS] = {HISTORY_RECORD_INTERVAL_MS / 1000, 60, 3600};
+
+SensorHistory::SensorHistory(ControlService *cs) : cs(cs)
+{
+    mutex = xSemaphoreCreateMutex();
+}
+
+SensorHistory::~SensorHistory()
+{
+    for (uint8_t i = 0; i < channelCount; i++) {
+        for (uint8_t tier = 0; tier < HISTORY_TIERS; tier++) {
+            delete channels[i].tiers[tier];
+        }
+    }
+    if (mutex != NULL) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+const char *SensorHistory::metricName(HistoryMetric metric)
+{
+    switch (metric) {
+    case HISTORY_TEMPERATURE: return "temperature";
+    case HISTORY_HUMIDITY: return "humidity";
+    case HISTORY_MOTION: return "motion";
+    case HISTORY_FAN_RPM: return "rpm";
+    }
+    return "unknown";
+}
+
+/// @brief Creates a history channel for every sensor reading, then starts recording
+/// @param server web server to attach the /api/history handler to
+void SensorHistory::begin(AsyncWebServer *server, AdmissionController *admission)
+{
+    for (DeviceEntry *device : cs->getDevices()) {
+        uint32_t rpm;
+        bool stalled;
+        switch (device->type) {
+        case PIN_TYPE_DHT11:
+            addChannel(device, HISTORY_TEMPERATURE);
+            addChannel(device, HISTORY_HUMIDITY);
+            break;
+        case PIN_TYPE_PIR:
+            addChannel(device, HISTORY_MOTION);
+            break;
+        case PIN_TYPE_FAN:
+            if (cs->getFanRpm(device->value, rpm, stalled)) {
+                addChannel(device, HISTORY_FAN_RPM);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    Serial.printf("Sensor history: %u channels, %u bytes\n", channelCount, memoryBytes());
+
+    cs->addTickListener([this](uint32_t nowMs) { this->onTick(nowMs); });
+    server->on("/api/history", HTTP_GET, [this, admission](AsyncWebServerRequest *request) {
+        if (admission != nullptr && !admission->admit(request, ADMISSION_READ)) {
+            return;
+        }
+        this->handleRequest(request);
+    });
+}
+
+void SensorHistory::addChannel(const DeviceEntry *device, HistoryMetric metric)
+{
+    if (channelCount >= HISTORY_MAX_CHANNELS) {
+        Serial.println("Too many history channels, ignoring sensor");
+        return;
+    }
+    HistoryChannel &channel = channels[channelCount++];
+    channel.device = device;
+    channel.metric = metric;
+    for (uint8_t tier = 0; tier < HISTORY_TIERS; tier++) {
+        channel.tiers[tier] = new SeriesRing(TIER_FIELDS[tier], TIER_BLOCK_BYTES, TIER_BLOCKS[tier]);
+    }
+    for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+        channel.pending[i].reset();
+        channel.pendingStart[i] = 0;
+    }
+    channel.motionSeen = false;
+}
+
+size_t SensorHistory::memoryBytes()
+{
+    size_t total = 0;
+    for (uint8_t i = 0; i < channelCount; i++) {
+        for (uint8_t tier = 0; tier < HISTORY_TIERS; tier++) {
+            total += channels[i].tiers[tier]->memoryBytes();
+        }
+    }
+    return total;
+}
+
+/// @brief Reads a channel's current value from ControlService's cache
+/// @return false when there is nothing current to record (no reading yet, sensor failing)
+bool SensorHistory::sample(HistoryChannel &channel, int32_t &value)
+{
+    int pin = channel.device->value;
+    switch (channel.metric) {
+    case HISTORY_TEMPERATURE:
+    case HISTORY_HUMIDITY: {
+        float temperature, humidity;
+        if (!cs->getDHT11Readings(pin, temperature, humidity) ||
+            millis() - cs->getDHT11SampleTime(pin) > HISTORY_RECORD_INTERVAL_MS) {
+            return false; // Leave a gap rather than repeat a stale reading
+        }
+        value = lroundf((channel.metric == HISTORY_TEMPERATURE ? temperature : humidity) * 10.0f);
+        return true;
+    }
+    case HISTORY_MOTION: {
+        value = channel.motionSeen ? 1 : 0;
+        bool detected = false;
+        cs->getPIRState(pin, detected);
+        channel.motionSeen = detected; // Still active motion counts for the next period too
+        return true;
+    }
+    case HISTORY_FAN_RPM: {
+        uint32_t rpm;
+        bool stalled;
+        if (!cs->getFanRpm(pin, rpm, stalled)) {
+            return false;
+        }
+        value = (int32_t)rpm;
+        return true;
+    }
+    }
+    return false;
+}
+
+/// @brief Appends a raw sample and folds it into the rollups, storing each rollup once its period ends
+void SensorHistory::record(HistoryChannel &channel, uint32_t time, int32_t value)
+{
+    channel.tiers[0]->append(time, &value);
+    for (uint8_t i = 0; i < HISTORY_TIERS - 1; i++) {
+        channel.tiers[i + 1]->rollup(channel.pending[i], channel.pendingStart[i], tierResolution[i + 1], time, value);
+    }
+}
+
+/// @brief Tracks PIR activity every tick and records every channel once per record interval
+void SensorHistory::onTick(uint32_t nowMs)
+{
+    for (uint8_t i = 0; i < channelCount; i++) {
+        bool detected = false;
+        if (channels[i].metric == HISTORY_MOTION && cs->getPIRState(channels[i].device->value, detected) && detected) {
+            channels[i].motionSeen = true;
+        }
+    }
+
+    if (nextRecordMs == 0) {
+        nextRecordMs = nowMs;
+    }
+    if ((int32_t)(nowMs - nextRecordMs) < 0) {
+        return;
+    }
+    // Timestamps come from the schedule, not the tick, so they stay exactly one interval
+    // apart and every delta-of-delta encodes in a single bit
+    uint32_t time = nextRecordMs / 1000;
+    nextRecordMs += HISTORY_RECORD_INTERVAL_MS;
+    if ((int32_t)(nowMs - nextRecordMs) >= 0) {
+        nextRecordMs = nowMs + HISTORY_RECORD_INTERVAL_MS; // Fell behind, skip the missed periods
+    }
+
+    int32_t values[HISTORY_MAX_CHANNELS];
+    bool valid[HISTORY_MAX_CHANNELS];
+    for (uint8_t i = 0; i < channelCount; i++) {
+        valid[i] = sample(channels[i], values[i]);
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    for (uint8_t i = 0; i < channelCount; i++) {
+        if (valid[i]) {
+            record(channels[i], time, values[i]);
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+void SensorHistory::handleRequest(AsyncWebServerRequest *request)
+{
+    if (!request->hasParam("device")) {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Missing 'device'\"}");
+        return;
+    }
+    const char *deviceId = request->getParam("device")->value().c_str();
+    const char *areaId = request->hasParam("areaId") ? request->getParam("areaId")->value().c_str() : nullptr;
+    const char *metric = request->hasParam("metric") ? request->getParam("metric")->value().c_str() : nullptr;
+
+    // Channels never change after begin(), no lock needed to match them
+    uint8_t matches[HISTORY_MAX_CHANNELS];
+    uint8_t matchCount = 0;
+    for (uint8_t i = 0; i < channelCount; i++) {
+        const HistoryChannel &channel = channels[i];
+        if (strcmp(channel.device->deviceId, deviceId) == 0 &&
+            (areaId == nullptr || strcmp(channel.device->areaId, areaId) == 0) &&
+            (metric == nullptr || strcmp(metricName(channel.metric), metric) == 0)) {
+            matches[matchCount++] = i;
+        }
+    }
+    if (matchCount == 0) {
+        request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"No history for this device\"}");
+        return;
+    }
+
+    uint32_t now = millis() / 1000;
+    long from = request->hasParam("from") ? request->getParam("from")->value().toInt() : -3600;
+    if (from < 0) {
+        from = (long)now + from; // Relative: seconds ago
+    }
+    long step = request->hasParam("step") ? request->getParam("step")->value().toInt() : 0;
+
+    auto query = std::make_shared<HistoryQuery>(this, matches, matchCount, now, from < 0 ? 0 : (uint32_t)from,
+                                                step < 0 ? 0 : (uint32_t)step);
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [query](uint8_t *buffer, size_t maxLen, size_t index) -> size_t { return query->fill(buffer, maxLen); });
+    request->send(response);
+}
+
+HistoryQuery::HistoryQuery(SensorHistory *history, const uint8_t *channels, uint8_t channelCount, uint32_t now, uint32_t from, uint32_t step)
+    : history(history), channelCount(channelCount), now(now), from(from), requestedStep(step)
+{
+    memcpy(this->channels, channels, channelCount);
+}
+
+/// @brief Copies as much of the response as fits, producing JSON pieces on demand
+size_t HistoryQuery::fill(uint8_t *buffer, size_t maxLen)
+{
+    if (xSemaphoreTake(history->mutex, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    size_t written = 0;
+    while (written < maxLen) {
+        if (outOffset == outLength) {
+            outOffset = outLength = 0;
+            if (!produce()) {
+                break;
+            }
+            continue;
+        }
+        size_t chunk = outLength - outOffset;
+        if (chunk > maxLen - written) {
+            chunk = maxLen - written;
+        }
+        memcpy(buffer + written, out + outOffset, chunk);
+        outOffset += chunk;
+        written += chunk;
+    }
+    xSemaphoreGive(history->mutex);
+    return written;
+}
+
+/// @brief Picks the tier for the current series and writes its header
+/// @details The finest tier no finer than the requested step, moving to coarser tiers
+/// while the finer one does not reach back to 'from' but the coarser one does
+void HistoryQuery::openSeries()
+{
+    const HistoryChannel &channel = history->channels[channels[current]];
+
+    tier = 0;
+    while (tier + 1 < HISTORY_TIERS && SensorHistory::tierResolution[tier + 1] <= requestedStep) {
+        tier++;
+    }
+    while (tier + 1 < HISTORY_TIERS) {
+        const SeriesRing *fine = channel.tiers[tier];
+        const SeriesRing *coarse = channel.tiers[tier + 1];
+        bool fineCovers = !fine->empty() && fine->oldestTime() <= from;
+        bool coarseOlder = !coarse->empty() && (fine->empty() || coarse->oldestTime() < fine->oldestTime());
+        if (fineCovers || !coarseOlder) {
+            break;
+        }
+        tier++;
+    }
+
+    uint32_t resolution = SensorHistory::tierResolution[tier];
+    step = requestedStep > resolution ? requestedStep : resolution;
+    channel.tiers[tier]->seek(cursor, from);
+    bucket.reset();
+    firstRow = true;
+    pendingAdded = false;
+
+    outLength = snprintf(out, sizeof(out),
+                         "%s{\"areaId\":\"%s\",\"deviceId\":\"%s\",\"metric\":\"%s\",\"resolution\":%u,\"step\":%u,\"points\":[",
+                         current > 0 ? "," : "", channel.device->areaId, channel.device->deviceId,
+                         SensorHistory::metricName(channel.metric), resolution, step);
+}
+
+/// @brief Adds a stored point to the step bucket it falls in
+/// @return true if the previous bucket was complete and its row is now in the output
+bool HistoryQuery::addPoint(uint32_t time, int32_t low, int32_t high, int32_t average)
+{
+    uint32_t start = time - time % step;
+    bool wrote = false;
+    if (bucket.count > 0 && start != bucketStart) {
+        writeRow();
+        wrote = true;
+    }
+    if (bucket.count == 0) {
+        bucketStart = start;
+    }
+    bucket.add(low, high, average);
+    return wrote;
+}
+
+static int formatValue(char *out, size_t size, int32_t value, bool tenths)
+{
+    if (!tenths) {
+        return snprintf(out, size, "%ld", (long)value);
+    }
+    uint32_t magnitude = value < 0 ? (uint32_t)(-(int64_t)value) : (uint32_t)value;
+    return snprintf(out, size, "%s%lu.%lu", value < 0 ? "-" : "", (unsigned long)(magnitude / 10), (unsigned long)(magnitude % 10));
+}
+
+void HistoryQuery::writeRow()
+{
+    HistoryMetric metric = history->channels[channels[current]].metric;
+    bool tenths = metric == HISTORY_TEMPERATURE || metric == HISTORY_HUMIDITY;
+    char low[16], high[16], average[16];
+    formatValue(low, sizeof(low), bucket.min, tenths);
+    formatValue(high, sizeof(high), bucket.max, tenths);
+    formatValue(average, sizeof(average), bucket.average(), tenths);
+
+    outLength = snprintf(out, sizeof(out), "%s[%u,%s,%s,%s]", firstRow ? "" : ",", bucketStart, low, high, average);
+    firstRow = false;
+    bucket.reset();
+}
+
+/// @brief Writes the next piece of the response into the output buffer
+/// @return false once the response is complete
+bool HistoryQuery::produce()
+{
+    while (true) {
+        switch (state) {
+        case QUERY_HEADER:
+            outLength = snprintf(out, sizeof(out), "{\"status\":\"success\",\"now\":%u,\"from\":%u,\"series\":[", now, from);
+            state = QUERY_SERIES_OPEN;
+            return true;
+
+        case QUERY_SERIES_OPEN:
+            openSeries();
+            state = QUERY_POINTS;
+            return true;
+
+        case QUERY_POINTS: {
+            const HistoryChannel &channel = history->channels[channels[current]];
+            SeriesPoint point;
+            while (!pendingAdded && channel.tiers[tier]->next(cursor, point)) {
+                bool wrote = tier == 0 ? addPoint(point.time, point.values[0], point.values[0], point.values[0])
+                                       : addPoint(point.time, point.values[0], point.values[1], point.values[2]);
+                if (wrote) {
+                    return true;
+                }
+            }
+            if (!pendingAdded) {
+                // The rollup still being accumulated, so the newest period is not missing
+                pendingAdded = true;
+                if (tier > 0) {
+                    const SeriesAggregate &rollup = channel.pending[tier - 1];
+                    if (rollup.count > 0 && channel.pendingStart[tier - 1] >= from &&
+                        addPoint(channel.pendingStart[tier - 1], rollup.min, rollup.max, rollup.average())) {
+                        return true;
+                    }
+                }
+            }
+            if (bucket.count > 0) {
+                writeRow();
+                return true;
+            }
+            state = QUERY_SERIES_CLOSE;
+            break;
+        }
+
+        case QUERY_SERIES_CLOSE:
+            outLength = snprintf(out, sizeof(out), "]}");
+            current++;
+            state = current < channelCount ? QUERY_SERIES_OPEN : QUERY_FOOTER;
+            return true;
+
+        case QUERY_FOOTER:
+            outLength = snprintf(out, sizeof(out), "]}");
+            state = QUERY_DONE;
+            return true;
+
+        case QUERY_DONE:
+            return false;
+        }
+    }
+}
@@ -1,9 +1,13 @@
 #include "WifiManagerService.h"  // Full definition of WifiManagerService
 #include <SerialService.h>
+#include <BootTrace.h>
+#include <AllocCounter.h>
+#include <esp_heap_caps.h>
 
 SerialService::SerialService(WifiManagerService *wm)
 {
     this->wm = wm;
+    registerBuiltinCommands();
 }
 
 SerialService::~SerialService()
@@ -93,36 +97,232 @@ void SerialService::loop()
     WebSerial.loop();
 }
 
-/// @brief handles command sent through the webserial 
-/// @param command string that may contain a command to be executed
-void SerialService::commandHandler(String command)
+/// @brief Adds a command to the shell
+/// @param name command, one or more words ("/mqtt", "/wifi reset"); must outlive the service
+/// @param usage argument synopsis shown by /help, "" if none
+/// @param minArgs fewest arguments accepted after the name
+/// @param maxArgs most arguments accepted after the name
+/// @param handler runs on the web server task, must not block
+bool SerialService::registerCommand(const char *name, const char *usage, const char *description,
+                                    uint8_t minArgs, uint8_t maxArgs, SerialCommandHandler handler)
 {
-    if(command == "/help") {
-        printToAll("Available commands:");
-        printToAll("/wifi reset - Reset network settings");
-        printToAll("/system info - Show device information");
+    if (commandCount >= maxCommands) {
+        Serial.printf("Too many shell commands, ignoring %s\n", name);
+        return false;
     }
-    else if(command == "/system info") {
-        printToAll("Chip ID: %d\nChip Revision: %d\nFree heap: %d bytes", ESP.getChipModel(), ESP.getChipRevision(), ESP.getFreeHeap());
-    }else if(command == "/wifi reset"){
-        wm->resetAndRestart();
-    }else if(command == "/wifi info"){
-        printToAll("IP Address: %s", WiFi.localIP().toString());
+    commands[commandCount++] = {name, usage, description, minArgs, maxArgs, handler};
+    return true;
+}
+
+void SerialService::registerBuiltinCommands()
+{
+    registerCommand("/help", "", "List commands", 0, 0, [this](int argc, char **argv) { printHelp(); });
+    registerCommand("/system info", "", "Chip, SDK and uptime", 0, 0, [this](int argc, char **argv) { printSystemInfo(); });
+    registerCommand("/heap", "", "Free heap, largest block, minimum ever", 0, 0, [this](int argc, char **argv) { printHeap(); });
+    registerCommand("/tasks", "", "State, priority, core, stack headroom, CPU % since last call, topology placement", 0, 0,
+                    [this](int argc, char **argv) { printTasks(); });
+    registerCommand("/boot", "", "Show boot timeline", 0, 0, [this](int argc, char **argv) {
+        const BootTimeline &timeline = BootTrace::current();
+        printToAll("Boot #%u, reset reason %u", timeline.bootCount, timeline.resetReason);
+        for (uint8_t i = 0; i < timeline.count; i++) {
+            const BootPhase &phase = timeline.phases[i];
+            if (phase.endUs == 0) {
+                printToAll("%10u us  %-20s (open)", phase.startUs, phase.name);
+            } else {
+                printToAll("%10u us  %-20s %u us", phase.startUs, phase.name, phase.endUs - phase.startUs);
+            }
+        }
+    });
+    registerCommand("/wifi reset", "", "Reset network settings", 0, 0, [this](int argc, char **argv) { wm->resetAndRestart(); });
+    registerCommand("/wifi info", "", "IP address and signal", 0, 0, [this](int argc, char **argv) {
+        printToAll("IP Address: %s\nRSSI: %d dBm\nChannel: %d", WiFi.localIP().toString().c_str(), WiFi.RSSI(), WiFi.channel());
+    });
+}
+
+void SerialService::printHelp()
+{
+    printToAll("Available commands:");
+    for (int i = 0; i < commandCount; i++) {
+        char synopsis[48];
+        snprintf(synopsis, sizeof(synopsis), "%s%s%s", commands[i].name, commands[i].usage[0] ? " " : "", commands[i].usage);
+        printToAll("%-28s %s", synopsis, commands[i].description);
     }
-    else {
-        printToAll("Unknown command: %s", command.c_str());
+}
+
+void SerialService::printSystemInfo()
+{
+    uint32_t uptimeSec = millis() / 1000;
+    printToAll("Chip model: %s\nChip revision: %d\nCores: %d @ %u MHz\nFlash: %u bytes\nSDK: %s\nUptime: %uh %02um %02us",
+               ESP.getChipModel(), ESP.getChipRevision(), ESP.getChipCores(), ESP.getCpuFreqMHz(),
+               ESP.getFlashChipSize(), ESP.getSdkVersion(), uptimeSec / 3600, (uptimeSec / 60) % 60, uptimeSec % 60);
+}
+
+void SerialService::printHeap()
+{
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    printToAll("Heap free: %u of %u bytes\nLargest free block: %u bytes (%u%% fragmented)\nMinimum free ever: %u bytes",
+               freeHeap, ESP.getHeapSize(), largest, freeHeap > 0 ? 100 - (uint32_t)((uint64_t)largest * 100 / freeHeap) : 0,
+               ESP.getMinFreeHeap());
+    if (AllocCounter::enabled()) {
+        printToAll("Allocations since boot: %u", AllocCounter::total());
+    }
+}
+
+static char taskStateCode(eTaskState state)
+{
+    switch (state) {
+    case eRunning: return 'X';
+    case eReady: return 'R';
+    case eBlocked: return 'B';
+    case eSuspended: return 'S';
+    case eDeleted: return 'D';
+    default: return '?';
     }
 }
 
+/// @brief Lists every FreeRTOS task
+/// @details CPU % is the share of its core's time since the previous /tasks (since boot on the first
+/// call) and needs run time stats in the FreeRTOS config; without them tasks of the topology show
+/// the busy time their loops report (marked ~). Stack is the lowest headroom ever seen
+void SerialService::printTasks()
+{
+    TaskCpuMeter::Usage *usage = nullptr;
+    UBaseType_t count = cpuMeter.sample(&usage);
+    if (usage == nullptr) {
+        printToAll("Out of memory");
+        return;
+    }
+
+    printToAll("Profile %s, Wi-Fi on core %d", TaskTopology::profileName(), TASK_WIFI_CORE);
+    printToAll("%-18s St Pri Core Stack  CPU%%  Want", "Task");
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t &task = usage[i].status;
+        char core[4] = "-";
+#if configTASKLIST_INCLUDE_COREID
+        if (task.xCoreID != tskNO_AFFINITY) {
+            snprintf(core, sizeof(core), "%d", (int)task.xCoreID);
+        }
+#endif
+        char cpu[8] = "-";
+        char want[12] = "";
+        if (usage[i].cpuPermille >= 0) {
+            unsigned permille = (unsigned)usage[i].cpuPermille;
+            snprintf(cpu, sizeof(cpu), "%u.%u", permille / 10, permille % 10);
+        }
+        if (usage[i].role >= 0) {
+            TaskRole role = (TaskRole)usage[i].role;
+            const TaskSpec &spec = TaskTopology::spec(role);
+            if (usage[i].cpuPermille < 0 && !TaskTopology::isLibraryTask(role)) {
+                unsigned busy = cpuMeter.busyPermille(role);
+                snprintf(cpu, sizeof(cpu), "~%u.%u", busy / 10, busy % 10);
+            }
+            snprintf(want, sizeof(want), "%u/%d%s", (unsigned)spec.priority, spec.core, spec.watchdog ? " wdt" : "");
+        }
+        printToAll("%-18s %c  %3u %4s %5u %5s  %s", task.pcTaskName, taskStateCode(task.eCurrentState),
+                   (unsigned)task.uxCurrentPriority, core, (unsigned)task.usStackHighWaterMark, cpu, want);
+    }
+    if (!TaskCpuMeter::runTimeStatsAvailable()) {
+        printToAll("CPU %% of other tasks needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+    }
+    free(usage);
+}
+
+/// @brief Splits a line into words in place; double quotes group words with spaces
+/// @return number of words
+static int tokenize(char *line, char **argv, int maxArgs)
+{
+    int argc = 0;
+    char *p = line;
+    while (*p != '\0' && argc < maxArgs) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        char end = ' ';
+        if (*p == '"') {
+            end = '"';
+            p++;
+        }
+        argv[argc++] = p;
+        while (*p != '\0' && *p != end && !(end == ' ' && *p == '\t')) {
+            p++;
+        }
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+    }
+    return argc;
+}
+
+/// @brief Number of leading words that spell out a (multi-word) command name, 0 if no match
+static int matchCommand(const char *name, char **argv, int argc)
+{
+    int words = 0;
+    const char *p = name;
+    while (*p != '\0') {
+        const char *space = strchr(p, ' ');
+        size_t length = space ? (size_t)(space - p) : strlen(p);
+        if (words >= argc || strlen(argv[words]) != length || strncmp(argv[words], p, length) != 0) {
+            return 0;
+        }
+        words++;
+        p += length;
+        while (*p == ' ') {
+            p++;
+        }
+    }
+    return words;
+}
+
+/// @brief Runs the registered command matching the most leading words of the line
+/// @param line command line, modified while it is split into words
+void SerialService::commandHandler(char *line)
+{
+    char *argv[maxTokens];
+    int argc = tokenize(line, argv, maxTokens);
+    if (argc == 0) {
+        return;
+    }
+
+    const SerialCommand *best = nullptr;
+    int bestWords = 0;
+    for (int i = 0; i < commandCount; i++) {
+        int words = matchCommand(commands[i].name, argv, argc);
+        if (words > bestWords) {
+            best = &commands[i];
+            bestWords = words;
+        }
+    }
+    if (best == nullptr) {
+        printToAll("Unknown command: %s (try /help)", argv[0]);
+        return;
+    }
+
+    int args = argc - bestWords;
+    if (args < best->minArgs || args > best->maxArgs) {
+        printToAll("Usage: %s %s", best->name, best->usage);
+        return;
+    }
+    best->handler(args, argv + bestWords);
+}
+
 /// @brief handles the message comming from webserial
 /// @param data data recieved
 /// @param len length of data
 void SerialService::recvMsg(uint8_t *data, size_t len)
 {
-  String d = "";
-  for(size_t i = 0; i < len; i++){
-    d += char(data[i]);
-  }
-  WebSerial.println(d);
-  commandHandler(d);
-}
\ No newline at end of file
+    char line[maxLineLength + 1];
+    if (len > maxLineLength) {
+        len = maxLineLength;
+    }
+    memcpy(line, data, len);
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
+        len--;
+    }
+    line[len] = '\0';
+    WebSerial.println(line);
+    commandHandler(line);
+}
@@ -0,0 +1,332 @@
+#include "SeriesRing.h"
+#include <string.h>
+
+static const uint8_t NO_WINDOW = 0xFF; // No XOR window yet, the next non-zero XOR sends its own
+
+void SeriesAggregate::add(int32_t low, int32_t high, int32_t average)
+{
+    if (count == 0 || low < min) {
+        min = low;
+    }
+    if (count == 0 || high > max) {
+        max = high;
+    }
+    sum += average;
+    count++;
+}
+
+int32_t SeriesAggregate::average() const
+{
+    if (count == 0) {
+        return 0;
+    }
+    // Round half away from zero so negative temperatures are not biased down
+    return (int32_t)(sum >= 0 ? (sum + count / 2) / (int64_t)count : (sum - count / 2) / (int64_t)count);
+}
+
+static void writeBits(uint8_t *block, uint16_t &bit, uint32_t value, uint8_t width)
+{
+    while (width > 0) {
+        width--;
+        if ((value >> width) & 1u) {
+            block[bit >> 3] |= (uint8_t)(0x80u >> (bit & 7));
+        }
+        bit++;
+    }
+}
+
+static uint32_t readBits(const uint8_t *block, uint16_t &bit, uint8_t width)
+{
+    uint32_t value = 0;
+    while (width > 0) {
+        width--;
+        value = (value << 1) | ((block[bit >> 3] >> (7 - (bit & 7))) & 1u);
+        bit++;
+    }
+    return value;
+}
+
+static int32_t signExtend(uint32_t value, uint8_t width)
+{
+    uint32_t sign = 1u << (width - 1);
+    return (int32_t)((value ^ sign) - sign);
+}
+
+static bool fitsSigned(int32_t value, uint8_t width)
+{
+    int32_t limit = 1 << (width - 1);
+    return value >= -limit && value < limit;
+}
+
+static uint8_t leadingZeros(uint32_t value)
+{
+    uint8_t n = 0;
+    while (n < 31 && !(value & (0x80000000u >> n))) {
+        n++;
+    }
+    return n;
+}
+
+static uint8_t trailingZeros(uint32_t value)
+{
+    uint8_t n = 0;
+    while (n < 31 && !(value & (1u << n))) {
+        n++;
+    }
+    return n;
+}
+
+SeriesRing::SeriesRing(uint8_t fields, uint16_t blockBytes, uint8_t blockCount)
+    : fields(fields > SERIES_MAX_FIELDS ? SERIES_MAX_FIELDS : fields), blockBytes(blockBytes), blockCount(blockCount)
+{
+    data = new uint8_t[(size_t)blockBytes * blockCount];
+    blocks = new Block[blockCount];
+    clear();
+}
+
+SeriesRing::~SeriesRing()
+{
+    delete[] data;
+    delete[] blocks;
+}
+
+void SeriesRing::clear()
+{
+    for (uint8_t i = 0; i < blockCount; i++) {
+        blocks[i] = {0, 0, 0, 0};
+    }
+    head = 0;
+    used = 0;
+    nextGeneration = 1; // 0 marks a cursor that has not been positioned
+}
+
+/// @brief Bits one point can take in the worst case: a 32-bit timestamp change and new XOR windows
+uint16_t SeriesRing::worstCaseBits() const
+{
+    return (uint16_t)(4 + 32 + fields * (2 + 5 + 5 + 32));
+}
+
+void SeriesRing::startBlock(uint8_t slot, uint32_t time)
+{
+    memset(data + (size_t)slot * blockBytes, 0, blockBytes);
+    Block &block = blocks[slot];
+    block.startTime = time;
+    block.generation = nextGeneration++;
+    block.bits = 0;
+    block.count = 0;
+}
+
+/// @brief Compresses a point into the newest block, starting a new block (and dropping
+/// the oldest one if the ring is full) when it might not fit
+void SeriesRing::append(uint32_t time, const int32_t *values)
+{
+    if (used == 0) {
+        head = 0;
+        used = 1;
+        startBlock(head, time);
+    } else if (blocks[head].bits + worstCaseBits() > blockBytes * 8 || blocks[head].count == UINT16_MAX) {
+        head = slotAfter(head);
+        if (used < blockCount) {
+            used++;
+        }
+        startBlock(head, time);
+    }
+
+    Block &block = blocks[head];
+    uint8_t *bytes = data + (size_t)head * blockBytes;
+
+    if (block.count == 0) {
+        // Block header point, stored as is
+        writeBits(bytes, block.bits, time, 32);
+        writer.time = time;
+        writer.delta = 0;
+        for (uint8_t f = 0; f < fields; f++) {
+            writeBits(bytes, block.bits, (uint32_t)values[f], 32);
+            writer.values[f] = values[f];
+            writer.leading[f] = NO_WINDOW;
+            writer.trailing[f] = 0;
+        }
+        block.count = 1;
+        return;
+    }
+
+    // Timestamp: delta of the delta, which is 0 (one bit) for a steady sampling interval
+    int32_t delta = (int32_t)(time - writer.time);
+    int32_t deltaOfDelta = delta - writer.delta;
+    if (deltaOfDelta == 0) {
+        writeBits(bytes, block.bits, 0b0, 1);
+    } else if (fitsSigned(deltaOfDelta, 7)) {
+        writeBits(bytes, block.bits, 0b10, 2);
+        writeBits(bytes, block.bits, (uint32_t)deltaOfDelta & 0x7Fu, 7);
+    } else if (fitsSigned(deltaOfDelta, 9)) {
+        writeBits(bytes, block.bits, 0b110, 3);
+        writeBits(bytes, block.bits, (uint32_t)deltaOfDelta & 0x1FFu, 9);
+    } else if (fitsSigned(deltaOfDelta, 12)) {
+        writeBits(bytes, block.bits, 0b1110, 4);
+        writeBits(bytes, block.bits, (uint32_t)deltaOfDelta & 0xFFFu, 12);
+    } else {
+        writeBits(bytes, block.bits, 0b1111, 4);
+        writeBits(bytes, block.bits, (uint32_t)deltaOfDelta, 32);
+    }
+    writer.time = time;
+    writer.delta = delta;
+
+    // Values: XOR with the previous value, only the meaningful bits are stored
+    for (uint8_t f = 0; f < fields; f++) {
+        uint32_t xorValue = (uint32_t)values[f] ^ (uint32_t)writer.values[f];
+        writer.values[f] = values[f];
+        if (xorValue == 0) {
+            writeBits(bytes, block.bits, 0b0, 1);
+            continue;
+        }
+
+        uint8_t leading = leadingZeros(xorValue);
+        uint8_t trailing = trailingZeros(xorValue);
+        if (writer.leading[f] != NO_WINDOW && leading >= writer.leading[f] && trailing >= writer.trailing[f]) {
+            // Fits the previous window
+            writeBits(bytes, block.bits, 0b10, 2);
+            writeBits(bytes, block.bits, xorValue >> writer.trailing[f], 32 - writer.leading[f] - writer.trailing[f]);
+        } else {
+            uint8_t meaningful = 32 - leading - trailing;
+            writeBits(bytes, block.bits, 0b11, 2);
+            writeBits(bytes, block.bits, leading, 5);
+            writeBits(bytes, block.bits, meaningful - 1, 5);
+            writeBits(bytes, block.bits, xorValue >> trailing, meaningful);
+            writer.leading[f] = leading;
+            writer.trailing[f] = trailing;
+        }
+    }
+    block.count++;
+}
+
+/// @brief Accumulates samples into resolution-aligned periods, storing each period once it ends
+/// @param resolution period length in seconds; a sample at a multiple of it opens a new period
+void SeriesRing::rollup(SeriesAggregate &pending, uint32_t &pendingStart, uint32_t resolution, uint32_t time, int32_t value)
+{
+    uint32_t start = time - time % resolution;
+    if (pending.count > 0 && start != pendingStart) {
+        int32_t values[3] = {pending.min, pending.max, pending.average()};
+        append(pendingStart, values);
+        pending.reset();
+    }
+    pendingStart = start;
+    pending.add(value);
+}
+
+uint32_t SeriesRing::oldestTime() const
+{
+    return used == 0 ? 0 : blocks[oldestSlot()].startTime;
+}
+
+uint32_t SeriesRing::pointCount() const
+{
+    uint32_t total = 0;
+    for (uint8_t i = 0, slot = oldestSlot(); i < used; i++, slot = slotAfter(slot)) {
+        total += blocks[slot].count;
+    }
+    return total;
+}
+
+/// @brief Positions a cursor on the block containing from, so the blocks before it are never decoded
+void SeriesRing::seek(Cursor &cursor, uint32_t from) const
+{
+    cursor.from = from;
+    cursor.generation = 0;
+    cursor.index = 0;
+    cursor.bit = 0;
+    cursor.started = false;
+    if (used == 0) {
+        return;
+    }
+
+    uint8_t slot = oldestSlot();
+    cursor.slot = slot;
+    for (uint8_t i = 0; i < used; i++, slot = slotAfter(slot)) {
+        if (blocks[slot].startTime <= from) {
+            cursor.slot = slot;
+        }
+    }
+    cursor.generation = blocks[cursor.slot].generation;
+}
+
+/// @brief Decodes the next point at or after the cursor's start time
+/// @details If the block under the cursor was dropped meanwhile, reading resumes at the
+/// oldest remaining point after the last one returned
+bool SeriesRing::next(Cursor &cursor, SeriesPoint &point) const
+{
+    while (used > 0) {
+        if (cursor.generation == 0 || blocks[cursor.slot].generation != cursor.generation) {
+            if (cursor.started) {
+                cursor.from = cursor.codec.time + 1;
+            }
+            cursor.slot = oldestSlot();
+            cursor.generation = blocks[cursor.slot].generation;
+            cursor.index = 0;
+            cursor.bit = 0;
+        }
+
+        const Block &block = blocks[cursor.slot];
+        if (cursor.index >= block.count) {
+            if (cursor.slot == head) {
+                return false;
+            }
+            cursor.slot = slotAfter(cursor.slot);
+            cursor.generation = blocks[cursor.slot].generation;
+            cursor.index = 0;
+            cursor.bit = 0;
+            continue;
+        }
+
+        const uint8_t *bytes = data + (size_t)cursor.slot * blockBytes;
+        Codec &codec = cursor.codec;
+        if (cursor.index == 0) {
+            codec.time = readBits(bytes, cursor.bit, 32);
+            codec.delta = 0;
+            for (uint8_t f = 0; f < fields; f++) {
+                codec.values[f] = (int32_t)readBits(bytes, cursor.bit, 32);
+                codec.leading[f] = NO_WINDOW;
+                codec.trailing[f] = 0;
+            }
+        } else {
+            int32_t deltaOfDelta;
+            if (readBits(bytes, cursor.bit, 1) == 0) {
+                deltaOfDelta = 0;
+            } else if (readBits(bytes, cursor.bit, 1) == 0) {
+                deltaOfDelta = signExtend(readBits(bytes, cursor.bit, 7), 7);
+            } else if (readBits(bytes, cursor.bit, 1) == 0) {
+                deltaOfDelta = signExtend(readBits(bytes, cursor.bit, 9), 9);
+            } else if (readBits(bytes, cursor.bit, 1) == 0) {
+                deltaOfDelta = signExtend(readBits(bytes, cursor.bit, 12), 12);
+            } else {
+                deltaOfDelta = (int32_t)readBits(bytes, cursor.bit, 32);
+            }
+            codec.delta += deltaOfDelta;
+            codec.time += (uint32_t)codec.delta;
+
+            for (uint8_t f = 0; f < fields; f++) {
+                if (readBits(bytes, cursor.bit, 1) == 0) {
+                    continue; // Unchanged
+                }
+                if (readBits(bytes, cursor.bit, 1) == 1) {
+                    codec.leading[f] = (uint8_t)readBits(bytes, cursor.bit, 5);
+                    codec.trailing[f] = (uint8_t)(32 - codec.leading[f] - (readBits(bytes, cursor.bit, 5) + 1));
+                }
+                uint8_t meaningful = 32 - codec.leading[f] - codec.trailing[f];
+                uint32_t xorValue = readBits(bytes, cursor.bit, meaningful) << codec.trailing[f];
+                codec.values[f] = (int32_t)((uint32_t)codec.values[f] ^ xorValue);
+            }
+        }
+        cursor.index++;
+        cursor.started = true;
+
+        if (codec.time < cursor.from) {
+            continue;
+        }
+        point.time = codec.time;
+        for (uint8_t f = 0; f < fields; f++) {
+            point.values[f] = codec.values[f];
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,124 @@
+#include "StateSnapshot.h"
+#include <esp_system.h>
+
+StateSnapshot::StateSnapshot(ControlService *cs) : cs(cs)
+{
+    mutex = xSemaphoreCreateMutex();
+    bootId = esp_random();
+}
+
+StateSnapshot::~StateSnapshot()
+{
+    if (mutex != NULL) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+/// @brief Serializes the devices changed after a version (0 = all devices)
+std::shared_ptr<const String> StateSnapshot::build(uint32_t since, uint32_t version)
+{
+    JsonDocument doc;
+    doc["status"] = "success";
+    doc["bootId"] = bootId;
+    doc["version"] = version;
+    if (since > 0) {
+        doc["since"] = since;
+    }
+
+    JsonArray devices = doc["devices"].to<JsonArray>();
+    for (DeviceEntry *device : cs->getDevices()) {
+        if (since == 0 || cs->getDeviceVersion(*device) > since) {
+            cs->writeDeviceState(*device, devices.add<JsonObject>());
+        }
+    }
+
+    String *json = new String();
+    json->reserve(measureJson(doc) + 1);
+    serializeJson(doc, *json);
+    return std::shared_ptr<const String>(json);
+}
+
+/// @brief Returns the full snapshot, rebuilding it only if any device changed since
+std::shared_ptr<const String> StateSnapshot::get(uint32_t &version)
+{
+    std::shared_ptr<const String> current;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        version = cs->getStateVersion();
+        if (!body || bodyVersion != version) {
+            body = build(0, version);
+            bodyVersion = version;
+            rebuildCount++;
+        }
+        current = body;
+        xSemaphoreGive(mutex);
+    }
+    return current;
+}
+
+void StateSnapshot::makeEtag(uint32_t version, char *out, size_t outLen)
+{
+    snprintf(out, outLen, "\"%08x-%u\"", bootId, version);
+}
+
+/// @brief Streams a shared body without copying it; the response keeps it alive
+void StateSnapshot::sendBody(AsyncWebServerRequest *request, std::shared_ptr<const String> json, const char *etag)
+{
+    AsyncWebServerResponse *response = request->beginResponse("application/json", json->length(),
+        [json](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t remaining = json->length() - index;
+            size_t chunk = remaining < maxLen ? remaining : maxLen;
+            memcpy(buffer, json->c_str() + index, chunk);
+            return chunk;
+        });
+    if (etag != nullptr) {
+        response->addHeader("ETag", etag);
+    }
+    response->addHeader("Cache-Control", "no-cache"); // Cache, but revalidate every time
+    request->send(response);
+}
+
+static void sendNotModified(AsyncWebServerRequest *request, const char *etag)
+{
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+}
+
+/// @brief Serves GET /api/state
+void StateSnapshot::handleRequest(AsyncWebServerRequest *request)
+{
+    uint32_t version = cs->getStateVersion();
+    char etag[24];
+    makeEtag(version, etag, sizeof(etag));
+
+    if (request->hasParam("since")) {
+        uint32_t since = strtoul(request->getParam("since")->value().c_str(), NULL, 10);
+        bool sameBoot = !request->hasParam("boot") ||
+                        strtoul(request->getParam("boot")->value().c_str(), NULL, 10) == bootId;
+        if (!sameBoot || since > version) {
+            since = 0; // Version from before a reboot, fall back to a full snapshot
+        }
+        if (since > 0 && since == version) {
+            sendNotModified(request, etag);
+            return;
+        }
+        if (since > 0) {
+            sendBody(request, build(since, version), nullptr);
+            return;
+        }
+    }
+
+    const AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+    if (ifNoneMatch != nullptr && ifNoneMatch->value() == etag) {
+        sendNotModified(request, etag);
+        return;
+    }
+
+    std::shared_ptr<const String> json = get(version);
+    if (!json) {
+        request->send(503);
+        return;
+    }
+    makeEtag(version, etag, sizeof(etag)); // The snapshot may be newer than the version checked above
+    sendBody(request, json, etag);
+}
@@ -0,0 +1,56 @@
+#include "TachWindow.h"
+
+TachWindow::TachWindow(uint8_t pulsesPerRev, uint32_t stallRpm, uint32_t stallDelayMs)
+    : pulsesPerRev(pulsesPerRev == 0 ? 2 : pulsesPerRev), stallRpm(stallRpm), stallDelayMs(stallDelayMs)
+{
+    reset();
+}
+
+void TachWindow::reset()
+{
+    for (uint8_t i = 0; i < TACH_WINDOW_SLOTS; i++) {
+        pulses[i] = 0;
+        elapsedMs[i] = 0;
+    }
+    head = 0;
+    filled = 0;
+    pulseSum = 0;
+    msSum = 0;
+    lowForMs = 0;
+    stalled = false;
+}
+
+/// @brief Adds one sampling interval, dropping the oldest once the window is full
+/// @param pulseCount tach pulses counted during the interval
+/// @param intervalMs length of the interval
+/// @param driven the fan is being driven, only then can a low RPM be a stall
+void TachWindow::addSample(uint16_t pulseCount, uint16_t intervalMs, bool driven)
+{
+    if (filled == TACH_WINDOW_SLOTS) {
+        pulseSum -= pulses[head];
+        msSum -= elapsedMs[head];
+    } else {
+        filled++;
+    }
+    pulses[head] = pulseCount;
+    elapsedMs[head] = intervalMs;
+    pulseSum += pulseCount;
+    msSum += intervalMs;
+    head = (uint8_t)((head + 1) % TACH_WINDOW_SLOTS);
+
+    if (driven && rpm() < stallRpm) {
+        lowForMs += intervalMs;
+        stalled = lowForMs >= stallDelayMs;
+    } else {
+        lowForMs = 0;
+        stalled = false;
+    }
+}
+
+uint32_t TachWindow::rpm() const
+{
+    if (msSum == 0) {
+        return 0;
+    }
+    return (uint32_t)((uint64_t)pulseSum * 60000u / ((uint64_t)msSum * pulsesPerRev));
+}
@@ -0,0 +1,276 @@
+#include "TaskTopology.h"
+#include <ArduinoJson.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+
+// AsyncTCP's own defaults, used when the build does not override them
+#ifdef CONFIG_ASYNC_TCP_RUNNING_CORE
+#define ASYNC_TCP_CORE CONFIG_ASYNC_TCP_RUNNING_CORE
+#else
+#define ASYNC_TCP_CORE TASK_NO_AFFINITY
+#endif
+#ifdef CONFIG_ASYNC_TCP_PRIORITY
+#define ASYNC_TCP_PRIORITY CONFIG_ASYNC_TCP_PRIORITY
+#else
+#define ASYNC_TCP_PRIORITY 10
+#endif
+#ifdef CONFIG_ASYNC_TCP_STACK_SIZE
+#define ASYNC_TCP_STACK_SIZE CONFIG_ASYNC_TCP_STACK_SIZE
+#else
+#define ASYNC_TCP_STACK_SIZE (8192 * 2)
+#endif
+#ifdef CONFIG_ASYNC_TCP_USE_WDT
+#define ASYNC_TCP_USE_WDT CONFIG_ASYNC_TCP_USE_WDT
+#else
+#define ASYNC_TCP_USE_WDT 1
+#endif
+
+// AsyncUDP takes its placement from the core's sdkconfig
+#ifdef CONFIG_ARDUINO_UDP_RUNNING_CORE
+#define ASYNC_UDP_CORE CONFIG_ARDUINO_UDP_RUNNING_CORE
+#else
+#define ASYNC_UDP_CORE TASK_NO_AFFINITY
+#endif
+#ifdef CONFIG_ARDUINO_UDP_TASK_PRIORITY
+#define ASYNC_UDP_PRIORITY CONFIG_ARDUINO_UDP_TASK_PRIORITY
+#else
+#define ASYNC_UDP_PRIORITY 3
+#endif
+
+#define TASK_REALTIME_CORE (1 - TASK_WIFI_CORE)
+
+#if TASK_PROFILE == TASK_PROFILE_ISOLATED
+#if ASYNC_TCP_CORE != TASK_WIFI_CORE
+#error "TASK_PROFILE_ISOLATED needs -DCONFIG_ASYNC_TCP_RUNNING_CORE set to the Wi-Fi core"
+#endif
+static const TaskSpec taskSpecs[TASK_ROLE_COUNT] = {
+    {"SensorSamplerTask", TASK_REALTIME_CORE, 5, 6144, true}, // Alone on its core, preempts nothing else there
+    {"MessageQueueServiceTask", TASK_WIFI_CORE, 2, 8192, true},
+    {"WiFi_Connect_Task", TASK_WIFI_CORE, 1, 8192, false},    // Blocks in the config portal for minutes
+    {"LCD_Scroll_Task", TASK_WIFI_CORE, 1, 4096, true},
+    {"AP_Credentials_Task", TASK_WIFI_CORE, 1, 4096, true},
+    {"async_tcp", ASYNC_TCP_CORE, ASYNC_TCP_PRIORITY, ASYNC_TCP_STACK_SIZE, ASYNC_TCP_USE_WDT != 0},
+    {"async_udp", ASYNC_UDP_CORE, ASYNC_UDP_PRIORITY, 4096, false},
+};
+#else
+static const TaskSpec taskSpecs[TASK_ROLE_COUNT] = {
+    {"SensorSamplerTask", APP_CPU_NUM, 2, 6144, true},
+    {"MessageQueueServiceTask", APP_CPU_NUM, 1, 8192, true},
+    {"WiFi_Connect_Task", PRO_CPU_NUM, 1, 8192, false},       // Blocks in the config portal for minutes
+    {"LCD_Scroll_Task", APP_CPU_NUM, 1, 4096, true},
+    {"AP_Credentials_Task", APP_CPU_NUM, 1, 4096, true},
+    {"async_tcp", ASYNC_TCP_CORE, ASYNC_TCP_PRIORITY, ASYNC_TCP_STACK_SIZE, ASYNC_TCP_USE_WDT != 0},
+    {"async_udp", ASYNC_UDP_CORE, ASYNC_UDP_PRIORITY, 4096, false},
+};
+#endif
+
+static uint64_t roleBusyUs[TASK_ROLE_COUNT];
+static portMUX_TYPE busyLock = portMUX_INITIALIZER_UNLOCKED;
+
+const char *TaskTopology::profileName()
+{
+    return TASK_PROFILE == TASK_PROFILE_ISOLATED ? "isolated" : "balanced";
+}
+
+const TaskSpec &TaskTopology::spec(TaskRole role)
+{
+    return taskSpecs[role];
+}
+
+const char *TaskTopology::roleName(TaskRole role)
+{
+    switch (role) {
+    case TASK_ROLE_SAMPLER: return "sampler";
+    case TASK_ROLE_MQTT: return "mqtt";
+    case TASK_ROLE_WIFI_CONNECT: return "wifiConnect";
+    case TASK_ROLE_LCD_SCROLL: return "lcdScroll";
+    case TASK_ROLE_AP_CREDENTIALS: return "apCredentials";
+    case TASK_ROLE_ASYNC_TCP: return "asyncTcp";
+    case TASK_ROLE_ASYNC_UDP: return "asyncUdp";
+    default: return "unknown";
+    }
+}
+
+int TaskTopology::roleOf(const char *taskName)
+{
+    for (int role = 0; role < TASK_ROLE_COUNT; role++) {
+        if (strcmp(taskSpecs[role].name, taskName) == 0) {
+            return role;
+        }
+    }
+    return -1;
+}
+
+/// @brief Sets the TWDT timeout for supervised tasks; a task that misses it resets the device
+void TaskTopology::begin()
+{
+    esp_task_wdt_init(TASK_WATCHDOG_TIMEOUT_S, true); // Reconfigures the TWDT the core already started
+}
+
+/// @brief Creates the task of a role with the placement of the active profile
+/// @return pdPASS when the task was created
+BaseType_t TaskTopology::spawn(TaskRole role, TaskFunction_t function, void *parameter, TaskHandle_t *handle)
+{
+    const TaskSpec &task = taskSpecs[role];
+    TaskHandle_t created = NULL;
+    BaseType_t result = xTaskCreatePinnedToCore(function, task.name, task.stackBytes, parameter, task.priority, &created,
+                                                task.core == TASK_NO_AFFINITY ? tskNO_AFFINITY : task.core);
+    if (result == pdPASS && task.watchdog) {
+        esp_task_wdt_add(created);
+    }
+    if (handle != nullptr) {
+        *handle = result == pdPASS ? created : NULL;
+    }
+    return result;
+}
+
+/// @brief Feeds the watchdog for the calling task and adds the time its last pass spent working
+void TaskTopology::checkIn(TaskRole role, uint32_t busyUs)
+{
+    if (taskSpecs[role].watchdog) {
+        esp_task_wdt_reset();
+    }
+    portENTER_CRITICAL(&busyLock);
+    roleBusyUs[role] += busyUs;
+    portEXIT_CRITICAL(&busyLock);
+}
+
+uint64_t TaskTopology::busyUs(TaskRole role)
+{
+    portENTER_CRITICAL(&busyLock);
+    uint64_t busy = roleBusyUs[role];
+    portEXIT_CRITICAL(&busyLock);
+    return busy;
+}
+
+/// @brief Deletes a task, unsubscribing it from the TWDT first so the watchdog does not wait for it
+void TaskTopology::retire(TaskHandle_t handle)
+{
+    esp_task_wdt_delete(handle != NULL ? handle : xTaskGetCurrentTaskHandle());
+    vTaskDelete(handle);
+}
+
+/// @brief Ends the Arduino loop task, which only spins on an empty loop() and keeps the idle
+/// task of its core from running; that idle task is then supervised, so anything starving
+/// the core resets the device
+void TaskTopology::retireLoopTask()
+{
+    esp_task_wdt_add(xTaskGetIdleTaskHandleForCPU(xPortGetCoreID()));
+    vTaskDelete(NULL);
+}
+
+bool TaskCpuMeter::runTimeStatsAvailable()
+{
+#if configGENERATE_RUN_TIME_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// @brief Snapshots every task and its CPU share since the previous sample (since boot on the first)
+UBaseType_t TaskCpuMeter::sample(Usage **usage)
+{
+    *usage = nullptr;
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4; // Room for tasks created meanwhile
+    TaskStatus_t *tasks = (TaskStatus_t *)malloc(capacity * sizeof(TaskStatus_t));
+    Usage *out = (Usage *)malloc(capacity * sizeof(Usage));
+    if (tasks == nullptr || out == nullptr) {
+        free(tasks);
+        free(out);
+        return 0;
+    }
+    uint32_t totalRunTime = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, capacity, &totalRunTime);
+
+#if configGENERATE_RUN_TIME_STATS
+    uint32_t elapsed = totalRunTime - lastTotalRunTime;
+#endif
+    for (UBaseType_t i = 0; i < count; i++) {
+        out[i].status = tasks[i];
+        out[i].role = (int8_t)TaskTopology::roleOf(tasks[i].pcTaskName);
+        out[i].cpuPermille = -1;
+#if configGENERATE_RUN_TIME_STATS
+        uint32_t previous = 0;
+        for (int j = 0; j < lastRunTimeCount; j++) {
+            if (lastRunTimes[j].handle == tasks[i].xHandle) {
+                previous = lastRunTimes[j].runTime;
+                break;
+            }
+        }
+        if (elapsed > 0) {
+            out[i].cpuPermille = (int16_t)((uint64_t)(tasks[i].ulRunTimeCounter - previous) * 1000 / elapsed);
+        }
+#endif
+    }
+
+#if configGENERATE_RUN_TIME_STATS
+    lastRunTimeCount = 0;
+    for (UBaseType_t i = 0; i < count && lastRunTimeCount < maxTrackedTasks; i++) {
+        lastRunTimes[lastRunTimeCount++] = {tasks[i].xHandle, tasks[i].ulRunTimeCounter};
+    }
+    lastTotalRunTime = totalRunTime;
+#endif
+    free(tasks);
+
+    int64_t now = esp_timer_get_time();
+    int64_t wall = now - lastSampleUs;
+    for (int role = 0; role < TASK_ROLE_COUNT; role++) {
+        uint64_t busyUs = TaskTopology::busyUs((TaskRole)role);
+        uint64_t permille = wall > 0 ? (busyUs - lastBusyUs[role]) * 1000 / (uint64_t)wall : 0;
+        busy[role] = (uint16_t)min(permille, (uint64_t)1000);
+        lastBusyUs[role] = busyUs;
+    }
+    lastSampleUs = now;
+
+    *usage = out;
+    return count;
+}
+
+/// @brief Topology of the active profile next to where every task actually runs
+/// @details cpu is the share of one core from run-time stats (null without them), busy the
+/// work a managed loop reported through checkIn(); both cover the time since the meter's last sample
+String TaskTopology::toJson(TaskCpuMeter &meter)
+{
+    TaskCpuMeter::Usage *usage = nullptr;
+    UBaseType_t count = meter.sample(&usage);
+
+    JsonDocument doc;
+    doc["profile"] = profileName();
+    doc["wifiCore"] = TASK_WIFI_CORE;
+    doc["watchdogTimeoutS"] = TASK_WATCHDOG_TIMEOUT_S;
+    doc["runTimeStats"] = TaskCpuMeter::runTimeStatsAvailable();
+
+    JsonArray tasks = doc["tasks"].to<JsonArray>();
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t &status = usage[i].status;
+        JsonObject task = tasks.add<JsonObject>();
+        task["name"] = (const char *)status.pcTaskName;
+        task["priority"] = (unsigned)status.uxCurrentPriority;
+#if configTASKLIST_INCLUDE_COREID
+        task["core"] = status.xCoreID == tskNO_AFFINITY ? TASK_NO_AFFINITY : (int)status.xCoreID;
+#endif
+        task["stackFree"] = (unsigned)status.usStackHighWaterMark;
+        if (usage[i].cpuPermille >= 0) {
+            task["cpu"] = usage[i].cpuPermille / 10.0f;
+        } else {
+            task["cpu"] = nullptr;
+        }
+        if (usage[i].role >= 0) {
+            TaskRole role = (TaskRole)usage[i].role;
+            const TaskSpec &expected = taskSpecs[role];
+            task["role"] = roleName(role);
+            task["expectedCore"] = expected.core;
+            task["expectedPriority"] = expected.priority;
+            task["watchdog"] = expected.watchdog;
+            if (!isLibraryTask(role)) {
+                task["busy"] = meter.busyPermille(role) / 10.0f;
+            }
+        }
+    }
+    free(usage);
+
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
@@ -0,0 +1,98 @@
+#include "TelemetryStream.h"
+
+TelemetryStream::TelemetryStream(ControlService *cs) : cs(cs), events("/api/events")
+{
+    clientsMutex = xSemaphoreCreateRecursiveMutex(); // close() may re-enter through onDisconnect
+}
+
+TelemetryStream::~TelemetryStream()
+{
+    if (clientsMutex != NULL) {
+        vSemaphoreDelete(clientsMutex);
+    }
+}
+
+/// @brief Registers the SSE endpoint and subscribes to device changes
+/// @param server web server to attach the /api/events handler to
+void TelemetryStream::begin(AsyncWebServer *server)
+{
+    events.onConnect([this](AsyncEventSourceClient *client) {
+        bool accepted = false;
+        if (xSemaphoreTakeRecursive(clientsMutex, portMAX_DELAY) == pdTRUE) {
+            if (clients.size() < maxClients) {
+                clients.push_back(client);
+                accepted = true;
+            }
+            xSemaphoreGiveRecursive(clientsMutex);
+        }
+
+        if (!accepted) {
+            client->close();
+            return;
+        }
+        // Tell EventSource to wait a second before reconnecting if we drop it
+        client->send("connected", "hello", eventId, 1000);
+    });
+
+    events.onDisconnect([this](AsyncEventSourceClient *client) {
+        if (xSemaphoreTakeRecursive(clientsMutex, portMAX_DELAY) == pdTRUE) {
+            for (auto it = clients.begin(); it != clients.end(); ++it) {
+                if (*it == client) {
+                    clients.erase(it);
+                    break;
+                }
+            }
+            xSemaphoreGiveRecursive(clientsMutex);
+        }
+    });
+
+    server->addHandler(&events);
+
+    cs->addChangeListener([this](const DeviceEntry &device) { this->onDeviceChange(device); });
+}
+
+size_t TelemetryStream::clientCount()
+{
+    return events.count();
+}
+
+/// @brief Closes subscribers whose queue has backed up instead of buffering for them
+/// @details Holding the mutex keeps the server from freeing a client while we look at it
+void TelemetryStream::dropSlowClients()
+{
+    if (xSemaphoreTakeRecursive(clientsMutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    std::vector<AsyncEventSourceClient *> slow;
+    for (AsyncEventSourceClient *client : clients) {
+        if (client->packetsWaiting() >= maxPendingEvents) {
+            slow.push_back(client);
+        }
+    }
+    for (AsyncEventSourceClient *client : slow) {
+        client->close(); // onDisconnect removes it from the list
+        droppedClients++;
+    }
+    xSemaphoreGiveRecursive(clientsMutex);
+}
+
+/// @brief Serializes the changed device once and broadcasts it to every subscriber
+void TelemetryStream::onDeviceChange(const DeviceEntry &device)
+{
+    if (events.count() == 0) {
+        return; // Nobody listening, skip serialization entirely
+    }
+
+    dropSlowClients();
+
+    JsonDocument doc;
+    cs->writeDeviceState(device, doc.to<JsonObject>());
+
+    char payload[256];
+    size_t len = serializeJson(doc, payload, sizeof(payload));
+    if (len == 0 || len >= sizeof(payload)) {
+        return;
+    }
+
+    events.send(payload, "device", ++eventId);
+}
@@ -0,0 +1,144 @@
+#include "UdpControlCodec.h"
+#include <mbedtls/md.h>
+#include <string.h>
+
+static void writeU16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)(value >> 8);
+    out[1] = (uint8_t)value;
+}
+
+static void writeU32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static uint16_t readU16(const uint8_t *in)
+{
+    return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static uint32_t readU32(const uint8_t *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static bool computeTag(const uint8_t *data, size_t length, const uint8_t *key, size_t keyLength, uint8_t *tag)
+{
+    uint8_t mac[32];
+    if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, keyLength, data, length, mac) != 0) {
+        return false;
+    }
+    memcpy(tag, mac, UDP_CONTROL_TAG_BYTES);
+    return true;
+}
+
+/// @brief Checks the tag at the end of a frame without an early exit on the first mismatch
+static bool verifyTag(const uint8_t *frame, size_t length, const uint8_t *key, size_t keyLength)
+{
+    uint8_t expected[UDP_CONTROL_TAG_BYTES];
+    size_t body = length - UDP_CONTROL_TAG_BYTES;
+    if (!computeTag(frame, body, key, keyLength, expected)) {
+        return false;
+    }
+    uint8_t difference = 0;
+    for (size_t i = 0; i < UDP_CONTROL_TAG_BYTES; i++) {
+        difference |= expected[i] ^ frame[body + i];
+    }
+    return difference == 0;
+}
+
+size_t udpEncodeRequest(uint8_t *out, size_t size, const UdpControlRequest &request, const uint8_t *key, size_t keyLength)
+{
+    bool byUuid = request.flags & UDP_FLAG_UUID;
+    size_t body = UDP_CONTROL_HEADER_BYTES + (byUuid ? UDP_CONTROL_UUID_BYTES : 2);
+    if (size < body + UDP_CONTROL_TAG_BYTES) {
+        return 0;
+    }
+    out[0] = UDP_CONTROL_VERSION;
+    out[1] = request.opcode;
+    out[2] = request.flags;
+    out[3] = request.argument;
+    writeU32(out + 4, request.clientId);
+    writeU32(out + 8, request.sequence);
+    writeU32(out + 12, request.nonce);
+    if (byUuid) {
+        memcpy(out + UDP_CONTROL_HEADER_BYTES, request.uuid, UDP_CONTROL_UUID_BYTES);
+    } else {
+        writeU16(out + UDP_CONTROL_HEADER_BYTES, request.index);
+    }
+    if (!computeTag(out, body, key, keyLength, out + body)) {
+        return 0;
+    }
+    return body + UDP_CONTROL_TAG_BYTES;
+}
+
+bool udpDecodeRequest(const uint8_t *frame, size_t length, UdpControlRequest &request, const uint8_t *key, size_t keyLength)
+{
+    if (length < UDP_CONTROL_HEADER_BYTES || frame[0] != UDP_CONTROL_VERSION) {
+        return false;
+    }
+    bool byUuid = frame[2] & UDP_FLAG_UUID;
+    if (length != UDP_CONTROL_HEADER_BYTES + (byUuid ? UDP_CONTROL_UUID_BYTES : 2) + UDP_CONTROL_TAG_BYTES) {
+        return false;
+    }
+    if (!verifyTag(frame, length, key, keyLength)) {
+        return false;
+    }
+    request.opcode = frame[1];
+    request.flags = frame[2];
+    request.argument = frame[3];
+    request.clientId = readU32(frame + 4);
+    request.sequence = readU32(frame + 8);
+    request.nonce = readU32(frame + 12);
+    request.index = UDP_NO_DEVICE;
+    memset(request.uuid, 0, sizeof(request.uuid));
+    if (byUuid) {
+        memcpy(request.uuid, frame + UDP_CONTROL_HEADER_BYTES, UDP_CONTROL_UUID_BYTES);
+    } else {
+        request.index = readU16(frame + UDP_CONTROL_HEADER_BYTES);
+    }
+    return true;
+}
+
+size_t udpEncodeAck(uint8_t *out, size_t size, const UdpControlAck &ack, const uint8_t *key, size_t keyLength)
+{
+    if (size < UDP_CONTROL_ACK_BYTES) {
+        return 0;
+    }
+    out[0] = UDP_CONTROL_VERSION;
+    out[1] = ack.opcode | UDP_ACK_BIT;
+    out[2] = ack.status;
+    out[3] = 0;
+    writeU32(out + 4, ack.clientId);
+    writeU32(out + 8, ack.sequence);
+    writeU32(out + 12, ack.nonce);
+    writeU16(out + 16, ack.index);
+    writeU16(out + 18, (uint16_t)ack.state);
+    if (!computeTag(out, UDP_CONTROL_ACK_BYTES - UDP_CONTROL_TAG_BYTES, key, keyLength,
+                    out + UDP_CONTROL_ACK_BYTES - UDP_CONTROL_TAG_BYTES)) {
+        return 0;
+    }
+    return UDP_CONTROL_ACK_BYTES;
+}
+
+bool udpDecodeAck(const uint8_t *frame, size_t length, UdpControlAck &ack, const uint8_t *key, size_t keyLength)
+{
+    if (length != UDP_CONTROL_ACK_BYTES || frame[0] != UDP_CONTROL_VERSION || !(frame[1] & UDP_ACK_BIT)) {
+        return false;
+    }
+    if (!verifyTag(frame, length, key, keyLength)) {
+        return false;
+    }
+    ack.opcode = frame[1] & ~UDP_ACK_BIT;
+    ack.status = frame[2];
+    ack.clientId = readU32(frame + 4);
+    ack.sequence = readU32(frame + 8);
+    ack.nonce = readU32(frame + 12);
+    ack.index = readU16(frame + 16);
+    ack.state = (int16_t)readU16(frame + 18);
+    return true;
+}
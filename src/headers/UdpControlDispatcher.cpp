@@ -0,0 +1,131 @@
+#include "UdpControlDispatcher.h"
+
+UdpControlDispatcher::UdpControlDispatcher(const uint8_t *key, size_t keyLength, Resolver resolve, Executor execute,
+                                           Random random)
+    : key(key), keyLength(keyLength), resolve(resolve), execute(execute), random(random)
+{
+}
+
+/// @brief Window of a client id, taking over the least recently heard slot for a new one
+/// @details A new slot gets a fresh nonce and no window until a frame carrying that nonce arrives
+UdpControlDispatcher::Client &UdpControlDispatcher::clientFor(uint32_t id)
+{
+    Client *oldest = &clients[0];
+    for (Client &client : clients) {
+        if (client.used && client.id == id) {
+            return client;
+        }
+        if (!client.used || (oldest->used && (int32_t)(client.lastHeard - oldest->lastHeard) < 0)) {
+            oldest = &client;
+        }
+    }
+    if (oldest->used) {
+        counters.evictions++;
+    }
+    *oldest = {};
+    oldest->used = true;
+    oldest->id = id;
+    do {
+        oldest->nonce = random();
+    } while (oldest->nonce == 0);
+    return *oldest;
+}
+
+UdpControlDispatcher::Freshness UdpControlDispatcher::freshness(const Client &client, uint32_t sequence)
+{
+    if (!client.synced) {
+        return SEQUENCE_NEW;
+    }
+    int32_t ahead = (int32_t)(sequence - client.newest); // Serial number arithmetic, survives wraparound
+    if (ahead > 0) {
+        return SEQUENCE_NEW;
+    }
+    uint32_t behind = (uint32_t)(-(int64_t)ahead);
+    if (behind >= UDP_REPLAY_WINDOW) {
+        return SEQUENCE_STALE;
+    }
+    return (client.seen >> behind) & 1 ? SEQUENCE_SEEN : SEQUENCE_NEW;
+}
+
+void UdpControlDispatcher::markRun(Client &client, uint32_t sequence, uint8_t status)
+{
+    if (!client.synced) {
+        client.synced = true;
+        client.newest = sequence;
+        client.seen = 1;
+        client.newestStatus = status;
+        return;
+    }
+    int32_t ahead = (int32_t)(sequence - client.newest);
+    if (ahead > 0) {
+        client.seen = ahead >= UDP_REPLAY_WINDOW ? 0 : client.seen << ahead;
+        client.seen |= 1;
+        client.newest = sequence;
+        client.newestStatus = status;
+    } else {
+        client.seen |= (uint64_t)1 << (uint32_t)(-(int64_t)ahead); // Late but inside the window
+    }
+}
+
+/// @brief Verifies, deduplicates and runs one request
+/// @return length of the ack written to ack, 0 for frames that must not be answered
+size_t UdpControlDispatcher::handle(const uint8_t *frame, size_t length, uint8_t *ack, size_t ackSize)
+{
+    counters.received++;
+    UdpControlRequest request;
+    if (!udpDecodeRequest(frame, length, request, key, keyLength)) {
+        counters.rejected++;
+        return 0; // Unauthenticated: no reply, so the port is no reflector or oracle
+    }
+
+    Client &client = clientFor(request.clientId);
+    client.lastHeard = ++frameCount;
+
+    UdpControlAck reply = {};
+    reply.opcode = request.opcode;
+    reply.clientId = request.clientId;
+    reply.sequence = request.sequence;
+    reply.nonce = client.nonce;
+    reply.index = resolve(request);
+
+    if (request.nonce != client.nonce) {
+        // Made before this slot existed (a replay, or a client that has not heard the nonce yet)
+        counters.resyncs++;
+        reply.status = UDP_STATUS_RESYNC;
+        return udpEncodeAck(ack, ackSize, reply, key, keyLength);
+    }
+
+    switch (freshness(client, request.sequence)) {
+    case SEQUENCE_STALE:
+        counters.stale++;
+        reply.status = UDP_STATUS_STALE;
+        break;
+    case SEQUENCE_SEEN:
+        counters.duplicates++;
+        // A retry of the newest command gets its original answer, older ones just "already done"
+        reply.status = request.sequence == client.newest ? client.newestStatus : (uint8_t)UDP_STATUS_DUPLICATE;
+        if (reply.index != UDP_NO_DEVICE) {
+            execute(reply.index, UDP_OP_QUERY, 0, reply.state);
+        }
+        break;
+    case SEQUENCE_NEW: {
+        UdpStatus status;
+        if (reply.index == UDP_NO_DEVICE) {
+            status = UDP_STATUS_UNKNOWN_DEVICE;
+        } else if (request.opcode < UDP_OP_SET || request.opcode > UDP_OP_QUERY) {
+            status = UDP_STATUS_BAD_OPCODE;
+        } else {
+            status = execute(reply.index, request.opcode, request.argument, reply.state);
+        }
+        markRun(client, request.sequence, status);
+        reply.status = status;
+        if (status == UDP_STATUS_OK) {
+            counters.executed++;
+        } else {
+            counters.failed++;
+        }
+        break;
+    }
+    }
+    return udpEncodeAck(ack, ackSize, reply, key, keyLength);
+}
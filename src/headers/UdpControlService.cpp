@@ -0,0 +1,176 @@
+#include "UdpControlService.h"
+#include <ArduinoJson.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+static_assert(UDP_CONTROL_UUID_BYTES == DEVICE_UUID_BYTES, "UUID frames carry the table's parsed device UUIDs");
+
+UdpControlService::UdpControlService(ControlService *cs)
+    : cs(cs),
+      dispatcher((const uint8_t *)UDP_CONTROL_KEY, strlen(UDP_CONTROL_KEY),
+                 [this](const UdpControlRequest &request) { return this->resolve(request); },
+                 [this](uint16_t index, uint8_t opcode, uint8_t argument, int16_t &state) {
+                     return this->execute(index, opcode, argument, state);
+                 },
+                 []() { return esp_random(); }) // Hardware RNG, truly random once the radio is up
+{
+}
+
+/// @brief Registers diagnostics and, when a key is configured, starts listening
+void UdpControlService::begin(AsyncWebServer *server)
+{
+    server->on("/api/diagnostics/udp", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        request->send(200, "application/json", this->toJson());
+    });
+
+    if (strlen(UDP_CONTROL_KEY) == 0) {
+        Serial.println("UDP control: off, build with -DUDP_CONTROL_KEY to enable");
+        return;
+    }
+
+    listening = udp.listen(UDP_CONTROL_PORT);
+    if (!listening) {
+        Serial.printf("UDP control: cannot listen on port %u\n", UDP_CONTROL_PORT);
+        return;
+    }
+    udp.onPacket([this](AsyncUDPPacket &packet) { this->onPacket(packet); });
+    Serial.printf("UDP control: listening on port %u\n", UDP_CONTROL_PORT);
+}
+
+/// @brief Runs on the AsyncUDP task; the ack goes back to the sender's address and port
+void UdpControlService::onPacket(AsyncUDPPacket &packet)
+{
+    int64_t start = esp_timer_get_time();
+    uint8_t ack[UDP_CONTROL_ACK_BYTES];
+    size_t length = dispatcher.handle(packet.data(), packet.length(), ack, sizeof(ack));
+    if (length > 0) {
+        packet.write(ack, length);
+    }
+    lastHandleUs = (uint32_t)(esp_timer_get_time() - start);
+    if (lastHandleUs > maxHandleUs) {
+        maxHandleUs = lastHandleUs;
+    }
+}
+
+uint16_t UdpControlService::resolve(const UdpControlRequest &request)
+{
+    DeviceList devices = cs->getDevices();
+    if (!(request.flags & UDP_FLAG_UUID)) {
+        return request.index < devices.size() ? request.index : UDP_NO_DEVICE;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (memcmp(devices[i]->config->deviceUuid, request.uuid, UDP_CONTROL_UUID_BYTES) == 0) {
+            return (uint16_t)i;
+        }
+    }
+    return UDP_NO_DEVICE;
+}
+
+/// @brief Applies one command through a GpioBatch, like a REST command of one device
+/// @param state set to the state after the command: level, fan speed, motion or 0.1 degC
+UdpStatus UdpControlService::execute(uint16_t index, uint8_t opcode, uint8_t argument, int16_t &state)
+{
+    const DeviceEntry *device = cs->getDevices()[index];
+    int pin = device->value;
+    OutputAction action = {(uint8_t)pin, OUTPUT_ACTION_DIGITAL, 0};
+
+    switch (device->type) {
+    case PIN_TYPE_LED: {
+        int level = LOW;
+        cs->getDigitalState(pin, level);
+        if (opcode == UDP_OP_QUERY) {
+            state = level == HIGH ? 1 : 0;
+            return UDP_STATUS_OK;
+        }
+        if (opcode == UDP_OP_SET) {
+            if (argument > 1) {
+                return UDP_STATUS_INVALID_ARGUMENT;
+            }
+            action.value = argument ? HIGH : LOW;
+        } else if (opcode == UDP_OP_INVERT) {
+            action.value = level == HIGH ? LOW : HIGH;
+        } else {
+            return UDP_STATUS_NOT_SUPPORTED;
+        }
+        break;
+    }
+    case PIN_TYPE_FAN: {
+        int speed = 0;
+        cs->getFanSpeed(pin, speed);
+        action.kind = OUTPUT_ACTION_FAN;
+        if (opcode == UDP_OP_QUERY) {
+            state = (int16_t)speed;
+            return UDP_STATUS_OK;
+        }
+        if (opcode == UDP_OP_FAN_SPEED) {
+            if (argument > 100) {
+                return UDP_STATUS_INVALID_ARGUMENT;
+            }
+            action.value = argument;
+        } else if (opcode == UDP_OP_INVERT) {
+            action.value = speed > 0 ? 0 : (argument > 0 && argument <= 100 ? argument : 100);
+        } else if (opcode == UDP_OP_SET) {
+            if (argument > 1) {
+                return UDP_STATUS_INVALID_ARGUMENT;
+            }
+            action.value = argument ? 100 : 0;
+        } else {
+            return UDP_STATUS_NOT_SUPPORTED;
+        }
+        break;
+    }
+    case PIN_TYPE_PIR: {
+        bool motion = false;
+        if (opcode != UDP_OP_QUERY) {
+            return UDP_STATUS_NOT_SUPPORTED;
+        }
+        cs->getPIRState(pin, motion);
+        state = motion ? 1 : 0;
+        return UDP_STATUS_OK;
+    }
+    case PIN_TYPE_DHT11: {
+        float temperature = 0, humidity = 0;
+        if (opcode != UDP_OP_QUERY) {
+            return UDP_STATUS_NOT_SUPPORTED;
+        }
+        if (!cs->getDHT11Readings(pin, temperature, humidity)) {
+            return UDP_STATUS_OUTPUT_ERROR;
+        }
+        state = (int16_t)lroundf(temperature * 10.0f);
+        return UDP_STATUS_OK;
+    }
+    default:
+        return UDP_STATUS_NOT_SUPPORTED;
+    }
+
+    GpioBatch batch;
+    if (!cs->stageAction(batch, action)) {
+        return UDP_STATUS_OUTPUT_ERROR;
+    }
+    cs->commitBatch(batch); // Listeners (SSE, MQTT, rules) run here, after the GPIO write
+    state = action.value;
+    return UDP_STATUS_OK;
+}
+
+/// @brief Frame counts since boot and the time from datagram to ack
+String UdpControlService::toJson()
+{
+    const UdpControlDispatcher::Stats &stats = dispatcher.stats();
+    JsonDocument doc;
+    doc["enabled"] = listening;
+    doc["port"] = UDP_CONTROL_PORT;
+    doc["received"] = stats.received;
+    doc["rejected"] = stats.rejected;
+    doc["executed"] = stats.executed;
+    doc["failed"] = stats.failed;
+    doc["duplicates"] = stats.duplicates;
+    doc["stale"] = stats.stale;
+    doc["resyncs"] = stats.resyncs;
+    doc["evictions"] = stats.evictions;
+    doc["lastHandleUs"] = lastHandleUs;
+    doc["maxHandleUs"] = maxHandleUs;
+
+    String json;
+    serializeJson(doc, json);
+    return json;
+}
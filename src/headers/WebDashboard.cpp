@@ -0,0 +1,45 @@
+#include "WebDashboard.h"
+#include "generated/WebAssets.h"
+
+/// @brief Registers a route for every embedded asset
+/// @param admission when given, assets are admitted as reads
+void WebDashboard::begin(AsyncWebServer *server, AdmissionController *admission)
+{
+    this->admission = admission;
+    size_t total = 0;
+    for (size_t i = 0; i < webAssetCount; i++) {
+        const WebAsset &asset = webAssets[i];
+        server->on(asset.path, HTTP_GET, [this, &asset](AsyncWebServerRequest *request) { this->serve(request, asset); });
+        total += asset.length;
+    }
+    Serial.printf("Web dashboard: %u assets, %u bytes in flash\n", (unsigned)webAssetCount, (unsigned)total);
+}
+
+/// @brief Answers 304 to a matching If-None-Match, otherwise streams the gzip bytes from flash
+void WebDashboard::serve(AsyncWebServerRequest *request, const WebAsset &asset)
+{
+    const AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+    if (ifNoneMatch != nullptr && ifNoneMatch->value() == asset.etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", asset.etag);
+        request->send(response);
+        return;
+    }
+
+    const AsyncWebHeader *acceptEncoding = request->getHeader("Accept-Encoding");
+    if (acceptEncoding == nullptr || acceptEncoding->value().indexOf("gzip") < 0) {
+        request->send(406, "text/plain", "The dashboard is stored gzip-compressed only");
+        return;
+    }
+    if (admission != nullptr && !admission->admit(request, ADMISSION_READ)) {
+        return;
+    }
+
+    // Chunked straight out of the flash-mapped array, no copy of the whole asset
+    AsyncWebServerResponse *response = request->beginResponse(200, asset.contentType, asset.gzip, asset.length);
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Vary", "Accept-Encoding");
+    response->addHeader("Cache-Control", asset.immutable ? "public, max-age=31536000, immutable" : "no-cache");
+    request->send(response);
+}
@@ -1,53 +1,226 @@
 #include <WifiManagerService.h>
+#include <Preferences.h>
+#include <BootTrace.h>
+#include <TaskTopology.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp32/rom/crc.h>
+#include <stddef.h>
 
+#define WIFI_CONNECTED_BIT BIT0
+
+static const uint32_t FAST_CONNECT_MAGIC = 0x57464331; // "WFC1"
+static const char *FAST_CONNECT_NAMESPACE = "wifi-fast";
+
+// Not initialized at boot, so it survives esp_restart() and deep sleep; power loss
+// leaves random data that the magic and CRC reject (the NVS copy covers that case)
+RTC_NOINIT_ATTR static WifiFastConnectCache rtcFastConnectCache;
+
+static uint32_t fastConnectCrc(const WifiFastConnectCache &cache)
+{
+    return crc32_le(0, (const uint8_t *)&cache, offsetof(WifiFastConnectCache, crc));
+}
+
+static bool fastConnectValid(const WifiFastConnectCache &cache)
+{
+    return cache.magic == FAST_CONNECT_MAGIC && cache.crc == fastConnectCrc(cache);
+}
 
 WifiManagerService::WifiManagerService(I2CLedScreen *lcd) : lcd(lcd)
 {
     lcdMutex = xSemaphoreCreateMutex();
+    connectionEvents = xEventGroupCreate();
 }
 
 WifiManagerService::~WifiManagerService()
 {
     if (scrollTaskHandle != NULL) {
-        vTaskDelete(scrollTaskHandle);
+        TaskTopology::retire(scrollTaskHandle);
     }
     if (apCredentialsTaskHandle != NULL) {
-        vTaskDelete(apCredentialsTaskHandle);
+        TaskTopology::retire(apCredentialsTaskHandle);
+    }
+    if (connectTaskHandle != NULL) {
+        TaskTopology::retire(connectTaskHandle);
     }
     if(lcdMutex != NULL){
         vSemaphoreDelete(lcdMutex);
     }
+    if (stationEventId != 0) {
+        WiFi.removeEvent(stationEventId);
+    }
+    if (connectionEvents != NULL) {
+        vEventGroupDelete(connectionEvents);
+    }
 }
 
 /// @brief initialize wifi connection
 /// @param apPassword password to secure the AccessPoint if wifi connection fails
 void WifiManagerService::Initialize(const char *apPassword)
 {
-    // Always start displaying AP credentials immediately
+    this->apPassword = apPassword;
+    this->apName = wm.getDefaultAPName();
+
+    int lcdPhase = BootTrace::begin("lcd.begin");
+    lcd->begin();
+    delay(100); // Small delay to ensure LCD initializes properly
+    BootTrace::end(lcdPhase);
+
+    // Bring the network stack up now so the web server can bind before we are associated.
+    // Credentials are already stored by WiFiManager, don't rewrite them on every boot.
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+
+    if (stationEventId == 0) {
+        // Tracks the link after the first connect too: the core reconnects on its own
+        stationEventId = WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+            this->onStationEvent(event);
+        });
+    }
+
+    if (connectTaskHandle == NULL) {
+        TaskTopology::spawn(TASK_ROLE_WIFI_CONNECT, WifiManagerService::connectTask, this, &connectTaskHandle);
+    }
+}
+
+void WifiManagerService::setStaticIp(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns)
+{
+    staticIp = ip;
+    staticGateway = gateway;
+    staticSubnet = subnet;
+    staticDns = dns;
+    hasStaticIp = true;
+}
+
+void WifiManagerService::enableLeaseReuse(bool enabled)
+{
+    reuseLease = enabled;
+}
+
+bool WifiManagerService::isConnected()
+{
+    return (xEventGroupGetBits(connectionEvents) & WIFI_CONNECTED_BIT) != 0;
+}
+
+bool WifiManagerService::waitForConnection(TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(connectionEvents, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, timeout);
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
+
+void WifiManagerService::onStationEvent(arduino_event_id_t event)
+{
+    switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        xEventGroupSetBits(connectionEvents, WIFI_CONNECTED_BIT);
+        break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+        xEventGroupClearBits(connectionEvents, WIFI_CONNECTED_BIT);
+        break;
+    default:
+        break;
+    }
+}
+
+/// @brief Background connect: cached BSSID/channel first, full scan next, portal last
+void WifiManagerService::connectTask(void *pvParameters)
+{
+    WifiManagerService *service = static_cast<WifiManagerService *>(pvParameters);
+
+    uint8_t failures = service->loadFailureCount();
+    bool hasCredentials = service->wm.getWiFiIsSaved();
+    bool connected = false;
+
+    while (hasCredentials && !connected && failures < maxConnectFailures) {
+        WifiFastConnectCache cache;
+        if (service->loadFastConnectCache(cache)) {
+            connected = service->connectWithCache(cache);
+        }
+        if (!connected) {
+            connected = service->connectWithScan();
+        }
+        if (!connected) {
+            failures++;
+            service->storeFailureCount(failures);
+            Serial.printf("WiFi connect attempt failed (%u/%u)\n", failures, maxConnectFailures);
+        }
+    }
+
+    if (failures != 0) {
+        // Give the fast path another chance after the portal restarts the device
+        service->storeFailureCount(0);
+    }
+    if (!connected) {
+        service->runConfigPortal();
+    }
+
+    service->onConnected();
+
+    service->connectTaskHandle = NULL;
+    TaskTopology::retire(NULL);
+}
+
+/// @brief Reconnect straight to the last access point, skipping the channel scan
+bool WifiManagerService::connectWithCache(const WifiFastConnectCache &cache)
+{
+    if (hasStaticIp) {
+        WiFi.config(staticIp, staticGateway, staticSubnet, staticDns);
+    } else if (reuseLease && cache.ip != 0) {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+    }
+
+    unsigned long start = millis();
+    WiFi.begin(wm.getWiFiSSID().c_str(), wm.getWiFiPass().c_str(), cache.channel, cache.bssid, true);
+    if (WiFi.waitForConnectResult(fastConnectTimeoutMs) == WL_CONNECTED) {
+        Serial.printf("WiFi fast connect in %lu ms (channel %d)\n", millis() - start, cache.channel);
+        return true;
+    }
+
+    WiFi.disconnect();
+    if (!hasStaticIp) {
+        // The cached lease may be stale, go back to DHCP for the slow path
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    }
+    return false;
+}
+
+/// @brief Regular connect with the stored credentials, scanning every channel
+bool WifiManagerService::connectWithScan()
+{
+    if (hasStaticIp) {
+        WiFi.config(staticIp, staticGateway, staticSubnet, staticDns);
+    }
+
+    unsigned long start = millis();
+    WiFi.begin(wm.getWiFiSSID().c_str(), wm.getWiFiPass().c_str());
+    if (WiFi.waitForConnectResult(fullConnectTimeoutMs) == WL_CONNECTED) {
+        Serial.printf("WiFi connected in %lu ms\n", millis() - start);
+        return true;
+    }
+
+    WiFi.disconnect();
+    return false;
+}
+
+/// @brief Show the AP credentials and block in the WiFiManager portal until configured
+void WifiManagerService::runConfigPortal()
+{
     Serial.println("Starting AP credentials display...");
 
     // Ensure previous AP credentials task is not running
     if (apCredentialsTaskHandle != NULL) {
-        vTaskDelete(apCredentialsTaskHandle);
+        TaskTopology::retire(apCredentialsTaskHandle);
         apCredentialsTaskHandle = NULL;
     }
 
-    lcd->begin();
-    delay(100); // Small delay to ensure LCD initializes properly
-
-    APCredentialsParams *params = new APCredentialsParams{this, wm.getDefaultAPName().c_str(), apPassword};
+    APCredentialsParams *params = new APCredentialsParams{this, apName.c_str(), apPassword};
 
-    xTaskCreatePinnedToCore(
-        WifiManagerService::apCredentialsTask,
-        "AP_Credentials_Task",
-        4096,
-        params,
-        1,
-        &apCredentialsTaskHandle,
-        1);
+    TaskTopology::spawn(TASK_ROLE_AP_CREDENTIALS, WifiManagerService::apCredentialsTask, params, &apCredentialsTaskHandle);
 
-    // Now attempt to connect to WiFi
-    bool res = this->wm.autoConnect(wm.getDefaultAPName().c_str(), apPassword);
+    // Time out so a node whose access point is just slow to come back retries the fast path
+    this->wm.setConfigPortalTimeout(configPortalTimeoutSec);
+    bool res = this->wm.autoConnect(apName.c_str(), apPassword);
 
     // check if wifi connected
     if (!res) {
@@ -56,23 +229,104 @@ void WifiManagerService::Initialize(const char *apPassword)
         ESP.restart();
     }
 
-    // if you get here you have connected to the WiFi
-    Serial.println("connected...😊");
-
     // Stop displaying AP credentials now that WiFi is connected
     if (apCredentialsTaskHandle != NULL) {
-        vTaskDelete(apCredentialsTaskHandle);
+        TaskTopology::retire(apCredentialsTaskHandle);
         apCredentialsTaskHandle = NULL;
     }
 
     // Stop the portal
     this->stopPortal();
+}
+
+void WifiManagerService::onConnected()
+{
+    // if you get here you have connected to the WiFi
+    Serial.println("connected...😊");
+    BootTrace::mark("wifi.connected");
+
+    saveFastConnectCache();
+    xEventGroupSetBits(connectionEvents, WIFI_CONNECTED_BIT);
 
     // Display IP on LCD
     uint16_t port = 2826; // Change this if using a different port
     displayIPandPort(port);
 }
 
+/// @brief Load the cache from RTC memory, or from NVS after a power loss
+bool WifiManagerService::loadFastConnectCache(WifiFastConnectCache &cache)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool rtcKept = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT;
+    if (rtcKept && fastConnectValid(rtcFastConnectCache)) {
+        cache = rtcFastConnectCache;
+        return true;
+    }
+
+    Preferences prefs;
+    if (!prefs.begin(FAST_CONNECT_NAMESPACE, true)) {
+        return false;
+    }
+    size_t read = prefs.getBytes("cache", &cache, sizeof(cache));
+    prefs.end();
+
+    if (read != sizeof(cache) || !fastConnectValid(cache)) {
+        return false;
+    }
+    rtcFastConnectCache = cache;
+    return true;
+}
+
+/// @brief Record the current association, touching flash only when it changed
+void WifiManagerService::saveFastConnectCache()
+{
+    WifiFastConnectCache cache = {};
+    cache.magic = FAST_CONNECT_MAGIC;
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = (uint32_t)WiFi.localIP();
+    cache.gateway = (uint32_t)WiFi.gatewayIP();
+    cache.subnet = (uint32_t)WiFi.subnetMask();
+    cache.dns = (uint32_t)WiFi.dnsIP();
+    cache.crc = fastConnectCrc(cache);
+
+    bool changed = memcmp(&cache, &rtcFastConnectCache, sizeof(cache)) != 0;
+    rtcFastConnectCache = cache;
+    if (!changed) {
+        return;
+    }
+
+    Preferences prefs;
+    if (prefs.begin(FAST_CONNECT_NAMESPACE, false)) {
+        WifiFastConnectCache stored;
+        if (prefs.getBytes("cache", &stored, sizeof(stored)) != sizeof(stored) ||
+            memcmp(&stored, &cache, sizeof(cache)) != 0) {
+            prefs.putBytes("cache", &cache, sizeof(cache));
+        }
+        prefs.end();
+    }
+}
+
+uint8_t WifiManagerService::loadFailureCount()
+{
+    Preferences prefs;
+    if (!prefs.begin(FAST_CONNECT_NAMESPACE, true)) {
+        return 0;
+    }
+    uint8_t failures = prefs.getUChar("failures", 0);
+    prefs.end();
+    return failures;
+}
+
+void WifiManagerService::storeFailureCount(uint8_t failures)
+{
+    Preferences prefs;
+    if (prefs.begin(FAST_CONNECT_NAMESPACE, false)) {
+        prefs.putUChar("failures", failures);
+        prefs.end();
+    }
+}
+
 /// @brief reset wificonfigurations and restart ESP32
 void WifiManagerService::resetAndRestart()
 {
@@ -91,16 +345,18 @@ void WifiManagerService::displayIPandPort(uint16_t port) {
     lcd->begin();
     lcd->clear();
 
+#if LOW_POWER_MODE
+    // Drawn once: the scroll task's redraws every 300 ms would keep the node out of light sleep
+    lcd->setCursor(0, 0);
+    lcd->displayText(WiFi.localIP().toString());
+    lcd->setCursor(0, 1);
+    lcd->displayText("Port: " + String(port));
+    return;
+#endif
+
     TaskParams *params = new TaskParams{this, port};
 
-    xTaskCreatePinnedToCore(
-        WifiManagerService::scrollTask,
-        "LCD_Scroll_Task",
-        4096,
-        params,
-        1,
-        &scrollTaskHandle,
-        1);
+    TaskTopology::spawn(TASK_ROLE_LCD_SCROLL, WifiManagerService::scrollTask, params, &scrollTaskHandle);
 }
 
 void WifiManagerService::scrollTask(void *pvParameters) {
@@ -120,8 +376,10 @@ void WifiManagerService::scrollTask(void *pvParameters) {
     int portScrollPos = 0;
 
     while (true) {
+        int64_t start = esp_timer_get_time();
         service->displayScrollingText(0, ipText, ipScrollPos);
         service->displayScrollingText(1, portText, portScrollPos);
+        TaskTopology::checkIn(TASK_ROLE_LCD_SCROLL, (uint32_t)(esp_timer_get_time() - start));
         vTaskDelay(pdMS_TO_TICKS(300));
     }
 }
@@ -137,7 +395,9 @@ void WifiManagerService::apCredentialsTask(void *pvParameters) {
     int passwordScrollPos = 0;
 
     while (true) {
+        int64_t start = esp_timer_get_time();
         service->displayAPCredentials(ssid, password, ssidScrollPos, passwordScrollPos);
+        TaskTopology::checkIn(TASK_ROLE_AP_CREDENTIALS, (uint32_t)(esp_timer_get_time() - start));
         vTaskDelay(pdMS_TO_TICKS(300));
     }
 }
@@ -6,6 +6,18 @@
 #include <ControlService.h>
 #include <RestAPI.h>
 #include <MessageQueueService.h>
+#include <BootTrace.h>
+#include <TelemetryStream.h>
+#include <SensorHistory.h>
+#include <SceneService.h>
+#include <RuleEngine.h>
+#include <FanThermostat.h>
+#include <ActuatorStore.h>
+#include <JsonArena.h>
+#include <TaskTopology.h>
+#include <PowerManager.h>
+#include <WebDashboard.h>
+#include <UdpControlService.h>
 #include "I2CLedScreen.h"
 
 #define SCREEN_I2C_ADDRESS 0x27 // Change according to your screen
@@ -15,15 +27,51 @@ I2CLedScreen screen(SCREEN_I2C_ADDRESS, 16, 2);
 WifiManagerService wm(&screen);
 SerialService ss(&wm);
 ControlService cs(&ss);
-RestAPI RestApi(&cs, &ss, &server);
-MessageQueueService mq(&cs, &ss, 5000, "192.168.1.9", 1883, "sensor_data", "mqttuser", "P@ssw0rd", []
-                       { return cs.getAllSensorDataJson(); });
+SceneService scenes(&cs);
+RuleEngine rules(&cs);
+FanThermostat thermostat(&cs);
+ActuatorStore actuators(&cs);
+RestAPI RestApi(&cs, &ss, &server, &scenes, &rules, &thermostat);
+TelemetryStream telemetry(&cs);
+SensorHistory history(&cs);
+JsonArena publishArena(4096); // Only used from the MQTT task
+MessageQueueService mq(&cs, &ss, 5000, "192.168.1.9", 1883, "sensor_data", "mqttuser", "P@ssw0rd", [](char *buffer, size_t size)
+                       { JsonArenaScope scope(publishArena);
+                         return cs.writeAllSensorDataJson(buffer, size, &publishArena); });
+PowerManager power(&cs, &mq, &ss); // Low-power mode with -DLOW_POWER_MODE=1
+WebDashboard dashboard;
+UdpControlService udpControl(&cs); // Binary control on UDP 2827 with -DUDP_CONTROL_KEY
 // LiquidCrystal_I2C lcd(0x27, 16, 2);  // Adjust address based on I2C scanner
 
 void setup()
 {
+  int setupPhase = BootTrace::begin("setup");
+  TaskTopology::begin(); // Before any service creates its task
+
+  // Outputs first: lights and fans are back before anything slow (serial, Wi-Fi) runs
+  int phase = BootTrace::begin("cs.configureOutputs");
+  cs.configureOutputs();
+  BootTrace::end(phase);
+
+  phase = BootTrace::begin("actuators.restore");
+  actuators.restore();
+  BootTrace::end(phase);
+
+  phase = BootTrace::begin("ss.Initialize");
   ss.Initialize(115200, &server);
+  BootTrace::end(phase);
+
+  phase = BootTrace::begin("cs.begin");
+  cs.begin();
+  scenes.begin();
+  rules.begin();
+  thermostat.begin();
+  actuators.begin();
+  BootTrace::end(phase);
+
+  phase = BootTrace::begin("wm.Initialize");
   wm.Initialize("P@ssw0rd");
+  BootTrace::end(phase);
   // screen.begin();
   // screen.displayText("Hello ESP32!");
 
@@ -46,12 +94,29 @@ void setup()
   pinMode(LED_BUILTIN, OUTPUT);
   digitalWrite(LED_BUILTIN, LOW); // Start with the LED off
 
+  phase = BootTrace::begin("RestApi.setupApi");
+  telemetry.begin(&server);
+  history.begin(&server, RestApi.getAdmission());
+  power.begin(&server);
+  dashboard.begin(&server, RestApi.getAdmission());
+  udpControl.begin(&server);
   RestApi.setupApi();
+  BootTrace::end(phase);
+
+  phase = BootTrace::begin("mq.start");
+  mq.subscribe("scene_trigger", [](const uint8_t *payload, unsigned int length)
+               { scenes.triggerFromPayload(payload, length); });
   mq.start();
+  BootTrace::end(phase);
+
+  BootTrace::end(setupPhase);
 }
 
 void loop()
 {
+  // Nothing runs here: every service has its own task (see TaskTopology)
+  TaskTopology::retireLoopTask();
+
   // int touchValue = touchRead(4);
 
   // ss.printToSerial("Touch value: %d\n", touchValue);
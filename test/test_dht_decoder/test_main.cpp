@@ -0,0 +1,116 @@
+// Replays captured DHT11 pulse trains through the decoder: pio test -e native -f test_dht_decoder
+#include <unity.h>
+#include <string.h>
+#include "DhtDecoder.h"
+
+// Captured by the RMT receiver from a DHT11 at 45 % / 23.4 C: host release, the
+// sensor's 80/80 us response, 40 data bits and the trailing low
+static const DhtPulse CAPTURE_45_23_4[] = {
+    {1, 31}, {0, 82}, {1, 86}, {0, 53}, {1, 24}, {0, 54}, {1, 28}, {0, 48},
+    {1, 68}, {0, 56}, {1, 23}, {0, 53}, {1, 72}, {0, 48}, {1, 72}, {0, 51},
+    {1, 23}, {0, 49}, {1, 71}, {0, 54}, {1, 23}, {0, 51}, {1, 23}, {0, 56},
+    {1, 26}, {0, 48}, {1, 29}, {0, 49}, {1, 24}, {0, 48}, {1, 27}, {0, 54},
+    {1, 23}, {0, 51}, {1, 23}, {0, 56}, {1, 29}, {0, 50}, {1, 25}, {0, 54},
+    {1, 24}, {0, 56}, {1, 68}, {0, 52}, {1, 27}, {0, 50}, {1, 68}, {0, 51},
+    {1, 70}, {0, 49}, {1, 72}, {0, 49}, {1, 27}, {0, 48}, {1, 27}, {0, 51},
+    {1, 26}, {0, 56}, {1, 26}, {0, 53}, {1, 26}, {0, 55}, {1, 70}, {0, 52},
+    {1, 24}, {0, 50}, {1, 28}, {0, 51}, {1, 23}, {0, 52}, {1, 72}, {0, 55},
+    {1, 25}, {0, 55}, {1, 25}, {0, 49}, {1, 68}, {0, 56}, {1, 26}, {0, 50},
+    {1, 29}, {0, 53}, {1, 24}, {0, 53},
+};
+static const size_t CAPTURE_COUNT = sizeof(CAPTURE_45_23_4) / sizeof(CAPTURE_45_23_4[0]);
+static const size_t FIRST_DATA_HIGH = 4; // Index of bit 0's high pulse
+
+static DhtPulse trace[CAPTURE_COUNT];
+static uint8_t bytes[5];
+
+void setUp(void)
+{
+    memcpy(trace, CAPTURE_45_23_4, sizeof(trace));
+    memset(bytes, 0, sizeof(bytes));
+}
+
+void tearDown(void) {}
+
+static void test_valid_frame_decodes_and_converts(void)
+{
+    TEST_ASSERT_EQUAL(DHT_DECODE_OK, dhtDecodePulses(trace, CAPTURE_COUNT, bytes));
+    const uint8_t expected[5] = {0x2D, 0x00, 0x17, 0x04, 0x48};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, bytes, 5);
+
+    float temperature = 0, humidity = 0;
+    dht11ConvertBytes(bytes, temperature, humidity);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 23.4f, temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 45.0f, humidity);
+}
+
+static void test_missing_preamble_still_decodes(void)
+{
+    // Receiver armed late: the host release and the response low were not captured
+    TEST_ASSERT_EQUAL(DHT_DECODE_OK, dhtDecodePulses(trace + 2, CAPTURE_COUNT - 2, bytes));
+    TEST_ASSERT_EQUAL_UINT8(0x17, bytes[2]);
+}
+
+static void test_flipped_bit_fails_checksum(void)
+{
+    trace[FIRST_DATA_HIGH].durationUs = 70; // Humidity bit 7, 0 read as 1
+    TEST_ASSERT_EQUAL(DHT_DECODE_CHECKSUM, dhtDecodePulses(trace, CAPTURE_COUNT, bytes));
+}
+
+static void test_missing_edge_loses_a_bit(void)
+{
+    // A missed rising edge in the last bit merges its low, high and the trailing low into one pulse
+    size_t last = CAPTURE_COUNT - 2;
+    trace[last - 1].durationUs = trace[last - 1].durationUs + trace[last].durationUs + trace[last + 1].durationUs;
+    TEST_ASSERT_EQUAL(DHT_DECODE_TOO_FEW_BITS, dhtDecodePulses(trace + FIRST_DATA_HIGH - 1, last - FIRST_DATA_HIGH + 1, bytes));
+    // With the response captured, its 80 us high slips in as bit 0 and the checksum catches the shift
+    TEST_ASSERT_EQUAL(DHT_DECODE_CHECKSUM, dhtDecodePulses(trace, last, bytes));
+}
+
+static void test_missing_edge_mid_frame_is_bad_timing(void)
+{
+    // A missed falling edge mid-frame merges a high, the next low and high into one long high
+    DhtPulse merged[CAPTURE_COUNT];
+    size_t count = 0;
+    for (size_t i = 0; i < CAPTURE_COUNT; i++) {
+        if (i == 41) {
+            merged[count - 1].durationUs += trace[41].durationUs + trace[42].durationUs;
+            i++;
+            continue;
+        }
+        merged[count++] = trace[i];
+    }
+    TEST_ASSERT_EQUAL(DHT_DECODE_BAD_TIMING, dhtDecodePulses(merged, count, bytes));
+}
+
+static void test_timeout_mid_frame_has_too_few_bits(void)
+{
+    // Sensor stopped after byte 2, the receiver's idle timeout ended the capture
+    TEST_ASSERT_EQUAL(DHT_DECODE_TOO_FEW_BITS, dhtDecodePulses(trace, FIRST_DATA_HIGH + 2 * 24, bytes));
+}
+
+static void test_no_response_times_out(void)
+{
+    TEST_ASSERT_EQUAL(DHT_DECODE_NO_RESPONSE, dhtDecodePulses(trace, 0, bytes));
+    TEST_ASSERT_EQUAL(DHT_DECODE_NO_RESPONSE, dhtDecodePulses(nullptr, 10, bytes));
+}
+
+static void test_stretched_high_is_bad_timing(void)
+{
+    trace[FIRST_DATA_HIGH + 20].durationUs = 140; // Line held high past the bit window
+    TEST_ASSERT_EQUAL(DHT_DECODE_BAD_TIMING, dhtDecodePulses(trace, CAPTURE_COUNT, bytes));
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_valid_frame_decodes_and_converts);
+    RUN_TEST(test_missing_preamble_still_decodes);
+    RUN_TEST(test_flipped_bit_fails_checksum);
+    RUN_TEST(test_missing_edge_loses_a_bit);
+    RUN_TEST(test_missing_edge_mid_frame_is_bad_timing);
+    RUN_TEST(test_timeout_mid_frame_has_too_few_bits);
+    RUN_TEST(test_no_response_times_out);
+    RUN_TEST(test_stretched_high_is_bad_timing);
+    return UNITY_END();
+}
@@ -0,0 +1,435 @@
+// MqttTransport against an in-process fake broker on loopback: pio test -e native -f test_mqtt_transport
+#include <unity.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+#include "MqttCodec.h"
+#include "MqttTransport.h"
+
+// Single-client broker driven from the test thread. Parses what the transport sends
+// with its own decoder, answers CONNECT, SUBSCRIBE and PINGREQ, and acknowledges
+// QoS 1 publishes unless told not to.
+class FakeBroker
+{
+public:
+    struct Packet
+    {
+        uint8_t firstByte;
+        uint16_t packetId;
+        std::string topic;
+        std::string payload;
+        int connection; // Which accepted connection it arrived on, from 1
+    };
+
+    std::vector<Packet> packets;
+    bool autoAck = true;
+    int connections = 0;
+    uint16_t port = 0;
+
+    void start()
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listenFd, (struct sockaddr *)&address, sizeof(address)); // Ephemeral port
+        socklen_t length = sizeof(address);
+        getsockname(listenFd, (struct sockaddr *)&address, &length);
+        port = ntohs(address.sin_port);
+        listen(listenFd, 1);
+        fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    }
+
+    void stop()
+    {
+        drop();
+        if (listenFd >= 0) {
+            close(listenFd);
+            listenFd = -1;
+        }
+    }
+
+    void drop() // Connection lost without DISCONNECT
+    {
+        if (clientFd >= 0) {
+            close(clientFd);
+            clientFd = -1;
+        }
+        rx.clear();
+    }
+
+    void pump()
+    {
+        if (clientFd < 0) {
+            clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0) {
+                return;
+            }
+            fcntl(clientFd, F_SETFL, O_NONBLOCK);
+            int one = 1;
+            setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Acks go out at once, as from mosquitto
+            connections++;
+        }
+        uint8_t buffer[2048];
+        ssize_t received;
+        while ((received = recv(clientFd, buffer, sizeof(buffer), 0)) > 0) {
+            rx.insert(rx.end(), buffer, buffer + received);
+        }
+        if (received == 0) {
+            drop();
+            return;
+        }
+        while (parseOne()) {
+        }
+    }
+
+    void ack(uint16_t packetId)
+    {
+        uint8_t puback[4] = {MQTT_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)packetId};
+        reply(puback, sizeof(puback));
+    }
+
+    size_t count(uint8_t type) const
+    {
+        size_t n = 0;
+        for (const Packet &packet : packets) {
+            n += (packet.firstByte >> 4) == type;
+        }
+        return n;
+    }
+
+    std::vector<Packet> publishes() const
+    {
+        std::vector<Packet> result;
+        for (const Packet &packet : packets) {
+            if ((packet.firstByte >> 4) == MQTT_PUBLISH) {
+                result.push_back(packet);
+            }
+        }
+        return result;
+    }
+
+private:
+    int listenFd = -1;
+    int clientFd = -1;
+    std::vector<uint8_t> rx;
+
+    void reply(const uint8_t *data, size_t length)
+    {
+        TEST_ASSERT_EQUAL((ssize_t)length, send(clientFd, data, length, MSG_NOSIGNAL));
+    }
+
+    bool parseOne()
+    {
+        size_t header = 1;
+        uint32_t remaining = 0;
+        for (uint32_t multiplier = 1;; multiplier *= 128) {
+            if (header >= rx.size()) {
+                return false;
+            }
+            uint8_t digit = rx[header++];
+            remaining += (digit & 0x7F) * multiplier;
+            if ((digit & 0x80) == 0) {
+                break;
+            }
+        }
+        if (rx.size() < header + remaining) {
+            return false;
+        }
+
+        Packet packet = {rx[0], 0, "", "", connections};
+        const uint8_t *body = rx.data() + header;
+        switch (packet.firstByte >> 4) {
+        case MQTT_CONNECT: {
+            uint8_t connack[4] = {MQTT_CONNACK << 4, 2, 0, 0};
+            reply(connack, sizeof(connack));
+            break;
+        }
+        case MQTT_PUBLISH: {
+            size_t topicLength = (body[0] << 8) | body[1];
+            packet.topic.assign((const char *)body + 2, topicLength);
+            size_t offset = 2 + topicLength;
+            if ((packet.firstByte & 0x06) != 0) {
+                packet.packetId = (uint16_t)((body[offset] << 8) | body[offset + 1]);
+                offset += 2;
+            }
+            packet.payload.assign((const char *)body + offset, remaining - offset);
+            break;
+        }
+        case MQTT_SUBSCRIBE: {
+            packet.packetId = (uint16_t)((body[0] << 8) | body[1]);
+            uint8_t suback[5] = {MQTT_SUBACK << 4, 3, body[0], body[1], 0};
+            reply(suback, sizeof(suback));
+            break;
+        }
+        case MQTT_PINGREQ: {
+            uint8_t pingresp[2] = {MQTT_PINGRESP << 4, 0};
+            reply(pingresp, sizeof(pingresp));
+            break;
+        }
+        default:
+            break;
+        }
+        rx.erase(rx.begin(), rx.begin() + header + remaining);
+        packets.push_back(packet);
+        if ((packet.firstByte >> 4) == MQTT_PUBLISH && packet.packetId != 0 && autoAck) {
+            ack(packet.packetId);
+        }
+        return true;
+    }
+};
+
+static FakeBroker broker;
+static MqttTransport *transport;
+static uint32_t nowMs; // Virtual time for the transport, sockets run in real time
+
+static const char *TOPIC = "sensor_data";
+
+void setUp(void)
+{
+    broker = FakeBroker();
+    broker.start();
+    MqttTransport::Options options = {};
+    options.host = "127.0.0.1";
+    options.port = broker.port;
+    options.clientId = "node-test";
+    options.keepAliveSec = 60;
+    options.inflightWindow = 2;
+    options.retryMs = 5000;
+    options.reconnectMs = 1000;
+    options.connectTimeoutMs = 3000;
+    transport = new MqttTransport(options);
+    nowMs = 1000;
+}
+
+void tearDown(void)
+{
+    delete transport;
+    broker.stop();
+}
+
+// Runs transport and broker until nothing has moved for a while
+static void settle()
+{
+    int quietRounds = 0;
+    for (int i = 0; i < 1000 && quietRounds < 20; i++) {
+        size_t packets = broker.packets.size();
+        MqttTransport::State state = transport->getState();
+        uint32_t acked = transport->getStats().acked;
+        uint32_t sent = transport->getStats().packetsSent;
+        transport->loop(nowMs);
+        broker.pump();
+        bool moved = packets != broker.packets.size() || state != transport->getState() ||
+                     acked != transport->getStats().acked || sent != transport->getStats().packetsSent;
+        quietRounds = moved ? 0 : quietRounds + 1;
+        usleep(200);
+    }
+}
+
+static void connect()
+{
+    settle();
+    TEST_ASSERT_TRUE(transport->connected());
+    TEST_ASSERT_EQUAL(1, broker.count(MQTT_CONNECT));
+}
+
+static bool publishText(const char *text, uint8_t qos)
+{
+    return transport->publish(TOPIC, (const uint8_t *)text, strlen(text), qos, nowMs);
+}
+
+static void test_small_publishes_share_a_segment(void)
+{
+    connect();
+    uint32_t segmentsBefore = transport->getStats().segments;
+    char payload[16];
+    for (int i = 0; i < 10; i++) {
+        snprintf(payload, sizeof(payload), "reading %d", i);
+        TEST_ASSERT_TRUE(publishText(payload, 0));
+    }
+    settle();
+
+    TEST_ASSERT_EQUAL_UINT32(1, transport->getStats().segments - segmentsBefore); // One send() for all ten
+    std::vector<FakeBroker::Packet> received = broker.publishes();
+    TEST_ASSERT_EQUAL(10, received.size());
+    for (int i = 0; i < 10; i++) {
+        snprintf(payload, sizeof(payload), "reading %d", i);
+        TEST_ASSERT_EQUAL_STRING(payload, received[i].payload.c_str()); // In order
+        TEST_ASSERT_EQUAL_STRING(TOPIC, received[i].topic.c_str());
+    }
+    TEST_ASSERT_EQUAL(0, transport->queuedPackets());
+    TEST_ASSERT_EQUAL(0, transport->queuedBytes());
+}
+
+static void test_payload_larger_than_segment_is_streamed(void)
+{
+    connect();
+    std::string large(MQTT_SEGMENT_BYTES * 3 + 17, '\0');
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = (char)('a' + i % 26);
+    }
+    TEST_ASSERT_TRUE(publishText("before", 0));
+    TEST_ASSERT_TRUE(transport->publish(TOPIC, (const uint8_t *)large.data(), large.size(), 0, nowMs));
+    TEST_ASSERT_TRUE(publishText("after", 0));
+    settle();
+
+    std::vector<FakeBroker::Packet> received = broker.publishes();
+    TEST_ASSERT_EQUAL(3, received.size());
+    TEST_ASSERT_EQUAL_STRING("before", received[0].payload.c_str());
+    TEST_ASSERT_EQUAL(large.size(), received[1].payload.size());
+    TEST_ASSERT_TRUE(received[1].payload == large);
+    TEST_ASSERT_EQUAL_STRING("after", received[2].payload.c_str());
+    TEST_ASSERT_EQUAL(0, transport->queuedPackets());
+}
+
+static void test_oversized_publish_is_dropped(void)
+{
+    std::string huge(MQTT_QUEUE_BYTES, 'x');
+    TEST_ASSERT_FALSE(transport->publish(TOPIC, (const uint8_t *)huge.data(), huge.size(), 1, nowMs));
+    TEST_ASSERT_EQUAL_UINT32(1, transport->getStats().dropped);
+    TEST_ASSERT_EQUAL(0, transport->queuedPackets());
+}
+
+static void test_qos1_window_limits_inflight(void)
+{
+    connect();
+    broker.autoAck = false;
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(publishText("q1", 1));
+    }
+    settle();
+    std::vector<FakeBroker::Packet> received = broker.publishes();
+    TEST_ASSERT_EQUAL(2, received.size()); // inflightWindow
+    TEST_ASSERT_EQUAL(2, transport->inflight());
+    TEST_ASSERT_EQUAL(5, transport->queuedPackets());
+
+    broker.ack(received[0].packetId);
+    settle();
+    TEST_ASSERT_EQUAL(3, broker.publishes().size()); // One slot freed, one more sent
+    TEST_ASSERT_EQUAL(2, transport->inflight());
+    TEST_ASSERT_EQUAL(4, transport->queuedPackets());
+
+    while (broker.publishes().size() < 5 || transport->inflight() > 0) {
+        for (const FakeBroker::Packet &packet : broker.publishes()) {
+            if (packet.packetId > received[0].packetId) {
+                broker.ack(packet.packetId); // Duplicate acks for done records are ignored
+            }
+        }
+        settle();
+    }
+    received = broker.publishes();
+    for (int i = 1; i < 5; i++) {
+        TEST_ASSERT_EQUAL(received[0].packetId + i, received[i].packetId); // Sent in publish order
+    }
+    TEST_ASSERT_EQUAL_UINT32(5, transport->getStats().acked);
+    TEST_ASSERT_EQUAL(0, transport->queuedPackets());
+}
+
+static void test_unacked_publish_resent_with_dup_after_retry(void)
+{
+    connect();
+    broker.autoAck = false;
+    TEST_ASSERT_TRUE(publishText("retry me", 1));
+    settle();
+    TEST_ASSERT_EQUAL(1, broker.publishes().size());
+
+    nowMs += 5000; // retryMs
+    settle();
+    std::vector<FakeBroker::Packet> received = broker.publishes();
+    TEST_ASSERT_EQUAL(2, received.size());
+    TEST_ASSERT_EQUAL(0, received[0].firstByte & MQTT_PUBLISH_DUP);
+    TEST_ASSERT_EQUAL(MQTT_PUBLISH_DUP, received[1].firstByte & MQTT_PUBLISH_DUP);
+    TEST_ASSERT_EQUAL(received[0].packetId, received[1].packetId);
+    TEST_ASSERT_EQUAL_UINT32(1, transport->getStats().retransmits);
+}
+
+static void test_unacked_publishes_resent_with_dup_after_reconnect(void)
+{
+    connect();
+    broker.autoAck = false;
+    TEST_ASSERT_TRUE(publishText("first", 1));
+    TEST_ASSERT_TRUE(publishText("second", 1));
+    settle();
+    std::vector<FakeBroker::Packet> before = broker.publishes();
+    TEST_ASSERT_EQUAL(2, before.size());
+
+    broker.drop();
+    settle();
+    TEST_ASSERT_FALSE(transport->connected());
+    TEST_ASSERT_EQUAL(2, transport->queuedPackets()); // Still owed to the broker
+
+    TEST_ASSERT_TRUE(publishText("while down", 1)); // Queues while disconnected
+    broker.autoAck = true;
+    nowMs += 1000; // reconnectMs
+    settle();
+    TEST_ASSERT_TRUE(transport->connected());
+    TEST_ASSERT_EQUAL(2, broker.connections);
+    TEST_ASSERT_EQUAL_UINT32(1, transport->getStats().reconnects);
+
+    std::vector<FakeBroker::Packet> after;
+    for (const FakeBroker::Packet &packet : broker.publishes()) {
+        if (packet.connection == 2) {
+            after.push_back(packet);
+        }
+    }
+    TEST_ASSERT_EQUAL(3, after.size());
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(MQTT_PUBLISH_DUP, after[i].firstByte & MQTT_PUBLISH_DUP);
+        TEST_ASSERT_EQUAL(before[i].packetId, after[i].packetId);
+        TEST_ASSERT_TRUE(before[i].payload == after[i].payload);
+    }
+    TEST_ASSERT_EQUAL(0, after[2].firstByte & MQTT_PUBLISH_DUP); // Never sent before
+    TEST_ASSERT_EQUAL_STRING("while down", after[2].payload.c_str());
+    TEST_ASSERT_EQUAL(0, transport->queuedPackets());
+}
+
+static void test_subscriptions_renewed_on_connect(void)
+{
+    TEST_ASSERT_TRUE(transport->subscribe("commands"));
+    connect();
+    TEST_ASSERT_EQUAL(1, broker.count(MQTT_SUBSCRIBE));
+    broker.drop();
+    settle();
+    nowMs += 1000;
+    settle();
+    TEST_ASSERT_TRUE(transport->connected());
+    TEST_ASSERT_EQUAL(2, broker.count(MQTT_SUBSCRIBE));
+}
+
+static void test_host_name_is_not_resolved(void)
+{
+    delete transport;
+    MqttTransport::Options options = {};
+    options.host = "localhost";
+    options.port = broker.port;
+    options.clientId = "node-test";
+    options.reconnectMs = 1000;
+    transport = new MqttTransport(options);
+    settle();
+    TEST_ASSERT_EQUAL(MqttTransport::MQTT_STATE_DISCONNECTED, transport->getState());
+    TEST_ASSERT_EQUAL(EINVAL, transport->lastError());
+    TEST_ASSERT_EQUAL(0, broker.connections);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_small_publishes_share_a_segment);
+    RUN_TEST(test_payload_larger_than_segment_is_streamed);
+    RUN_TEST(test_oversized_publish_is_dropped);
+    RUN_TEST(test_qos1_window_limits_inflight);
+    RUN_TEST(test_unacked_publish_resent_with_dup_after_retry);
+    RUN_TEST(test_unacked_publishes_resent_with_dup_after_reconnect);
+    RUN_TEST(test_subscriptions_renewed_on_connect);
+    RUN_TEST(test_host_name_is_not_resolved);
+    return UNITY_END();
+}
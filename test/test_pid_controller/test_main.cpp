@@ -0,0 +1,169 @@
+// PID controller and fan duty shaping against a simulated enclosure: pio test -e native -f test_pid_controller
+#include <unity.h>
+#include "PidController.h"
+
+// Lumped thermal model of an enclosure: a heat source, passive loss to ambient and
+// a fan whose conductance scales with duty. Without the fan it settles at 62 C,
+// at full duty at 32 C.
+struct Enclosure
+{
+    float temperature = 22.0f;
+    float ambient = 22.0f;
+    float heatWatts = 20.0f;
+    float capacityJPerK = 2000.0f;
+    float passiveWPerK = 0.5f;
+    float fanWPerK = 1.5f; // At 100 % duty
+
+    void step(int duty, float dtSeconds)
+    {
+        float conductance = passiveWPerK + fanWPerK * duty / 100.0f;
+        temperature += (heatWatts - conductance * (temperature - ambient)) * dtSeconds / capacityJPerK;
+    }
+};
+
+static const float SAMPLE_S = 2.0f; // DHT sampling interval of the thermostat
+static const int MIN_DUTY = 20, MAX_DUTY = 100, SPIN_UP_DUTY = 60;
+
+static PidController pid;
+static Enclosure enclosure;
+static int duty;
+
+void setUp(void)
+{
+    pid = PidController();
+    pid.configure({8.0f, 0.05f, 0.0f, 0.0f, (float)MAX_DUTY, PID_REVERSE}); // FanThermostat defaults
+    enclosure = Enclosure();
+    duty = 0;
+}
+
+void tearDown(void) {}
+
+// Runs the thermostat loop as FanThermostat does, returns the number of samples at maxDuty
+static int run(float setpoint, float seconds)
+{
+    int saturatedSamples = 0;
+    for (float t = 0; t < seconds; t += SAMPLE_S) {
+        float output = pid.update(setpoint, enclosure.temperature, SAMPLE_S);
+        duty = fanDutyFromPid(output, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, duty > 0);
+        if (duty == MAX_DUTY) {
+            saturatedSamples++;
+        }
+        enclosure.step(duty, SAMPLE_S);
+    }
+    return saturatedSamples;
+}
+
+static void test_settles_on_a_reachable_setpoint(void)
+{
+    run(35.0f, 4 * 3600);
+    TEST_ASSERT_FLOAT_WITHIN(0.3f, 35.0f, enclosure.temperature);
+    TEST_ASSERT_INT_WITHIN(5, 69, duty); // (20 W / 13 K - 0.5) / 1.5
+    TEST_ASSERT_FALSE(pid.getState().saturated);
+}
+
+static void test_integral_stops_winding_at_saturation(void)
+{
+    // 28 C is out of reach at 20 W: the fan runs flat out for an hour
+    run(28.0f, 3600);
+    TEST_ASSERT_EQUAL(MAX_DUTY, duty);
+    TEST_ASSERT_TRUE(pid.getState().saturated);
+    float frozen = pid.getState().integral;
+    run(28.0f, 3600);
+    TEST_ASSERT_EQUAL_FLOAT(frozen, pid.getState().integral);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT((float)MAX_DUTY, pid.getState().integral);
+
+    // The load drops; once below the setpoint the fan must back off at once instead
+    // of unwinding an hour of accumulated error
+    enclosure.heatWatts = 5.0f;
+    int samplesBelowAtMax = 0;
+    for (int i = 0; i < 1800; i++) {
+        float output = pid.update(28.0f, enclosure.temperature, SAMPLE_S);
+        duty = fanDutyFromPid(output, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, duty > 0);
+        if (enclosure.temperature < 28.0f && duty == MAX_DUTY) {
+            samplesBelowAtMax++;
+        }
+        enclosure.step(duty, SAMPLE_S);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, samplesBelowAtMax);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 28.0f, enclosure.temperature);
+}
+
+static void test_integral_stays_inside_output_range(void)
+{
+    pid.configure({0.0f, 1.0f, 0.0f, 0.0f, 50.0f, PID_REVERSE});
+    for (int i = 0; i < 100; i++) {
+        pid.update(20.0f, 40.0f, SAMPLE_S);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(40.0f, pid.getState().integral); // Steps that would push the output past 50 are not integrated
+    pid.configure({0.0f, 1.0f, 0.0f, 0.0f, 30.0f, PID_REVERSE}); // Narrower range keeps the integral inside it
+    TEST_ASSERT_EQUAL_FLOAT(30.0f, pid.getState().integral);
+}
+
+static void test_reverse_derivative_acts_on_measurement(void)
+{
+    pid.configure({0.0f, 0.0f, 20.0f, 0.0f, 100.0f, PID_REVERSE});
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, pid.update(30.0f, 30.0f, 1.0f)); // No history yet
+
+    // Warming by 0.5 C/s speeds the fan up in reverse action
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, pid.update(30.0f, 30.5f, 1.0f));
+    // Cooling pushes the other way, clamped at the bottom of the range
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, pid.update(30.0f, 30.0f, 1.0f));
+    TEST_ASSERT_EQUAL_FLOAT(-10.0f, pid.getState().derivative);
+
+    // A setpoint step with a steady measurement does not kick the output
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, pid.update(20.0f, 30.0f, 1.0f));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, pid.getState().derivative);
+}
+
+static void test_direct_derivative_opposes_rise(void)
+{
+    pid.configure({0.0f, 0.0f, 20.0f, -100.0f, 100.0f, PID_DIRECT});
+    pid.update(30.0f, 30.0f, 1.0f);
+    TEST_ASSERT_EQUAL_FLOAT(-10.0f, pid.update(30.0f, 30.5f, 1.0f)); // Heater backs off while warming
+}
+
+static void test_duty_below_minimum_is_off(void)
+{
+    TEST_ASSERT_EQUAL(0, fanDutyFromPid(0.0f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, true));
+    TEST_ASSERT_EQUAL(0, fanDutyFromPid(19.4f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, true));
+    TEST_ASSERT_EQUAL(20, fanDutyFromPid(19.6f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, true)); // Rounded
+    TEST_ASSERT_EQUAL(0, fanDutyFromPid(-5.0f, 0, MAX_DUTY, SPIN_UP_DUTY, true));
+}
+
+static void test_spin_up_from_standstill(void)
+{
+    TEST_ASSERT_EQUAL(SPIN_UP_DUTY, fanDutyFromPid(30.0f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, false));
+    TEST_ASSERT_EQUAL(30, fanDutyFromPid(30.0f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, true));
+    TEST_ASSERT_EQUAL(75, fanDutyFromPid(75.0f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, false)); // Already above the kick
+    TEST_ASSERT_EQUAL(0, fanDutyFromPid(10.0f, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, false));  // No kick for an off fan
+
+    // In the loop the kick lasts exactly one sample
+    enclosure.temperature = 36.0f;
+    pid.configure({8.0f, 0.0f, 0.0f, 0.0f, (float)MAX_DUTY, PID_REVERSE});
+    float output = pid.update(32.0f, enclosure.temperature, SAMPLE_S); // 32 % wanted
+    duty = fanDutyFromPid(output, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, duty > 0);
+    TEST_ASSERT_EQUAL(SPIN_UP_DUTY, duty);
+    output = pid.update(32.0f, enclosure.temperature, SAMPLE_S);
+    duty = fanDutyFromPid(output, MIN_DUTY, MAX_DUTY, SPIN_UP_DUTY, duty > 0);
+    TEST_ASSERT_EQUAL(32, duty);
+}
+
+static void test_duty_capped_at_maximum(void)
+{
+    TEST_ASSERT_EQUAL(80, fanDutyFromPid(100.0f, MIN_DUTY, 80, SPIN_UP_DUTY, true));
+    TEST_ASSERT_EQUAL(50, fanDutyFromPid(30.0f, MIN_DUTY, 50, SPIN_UP_DUTY, false)); // Kick above maxDuty is capped
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_settles_on_a_reachable_setpoint);
+    RUN_TEST(test_integral_stops_winding_at_saturation);
+    RUN_TEST(test_integral_stays_inside_output_range);
+    RUN_TEST(test_reverse_derivative_acts_on_measurement);
+    RUN_TEST(test_direct_derivative_opposes_rise);
+    RUN_TEST(test_duty_below_minimum_is_off);
+    RUN_TEST(test_spin_up_from_standstill);
+    RUN_TEST(test_duty_capped_at_maximum);
+    return UNITY_END();
+}
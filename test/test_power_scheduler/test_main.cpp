@@ -0,0 +1,192 @@
+// Wake planning and energy accounting on a virtual clock: pio test -e native -f test_power_scheduler
+#include <unity.h>
+#include "PowerScheduler.h"
+
+static const uint32_t ACTIVE_UA = 40000, RADIO_UA = 110000, IDLE_UA = 20000, SLEEP_UA = 1500;
+
+static PowerScheduler scheduler;
+static PowerSchedulerConfig config;
+static uint32_t clockMs; // Virtual time, advanced only by the tests
+
+static void start(uint32_t sampleMs, uint32_t publishMs)
+{
+    config = {};
+    config.pollMs = 100;
+    config.sampleMs = sampleMs;
+    config.publishMs = publishMs;
+    config.coalesceMs = 50;
+    config.maxSleepMs = 30000;
+    config.activeUa = ACTIVE_UA;
+    config.radioUa = RADIO_UA;
+    config.idleUa = IDLE_UA;
+    config.sleepUa = SLEEP_UA;
+    clockMs = 0;
+    scheduler.begin(config, clockMs);
+}
+
+// Sleeps as the sampler task would, wakes and works for workMs; returns the jobs run
+static uint32_t sleepAndWake(uint32_t lateMs = 0, uint32_t workMs = 5)
+{
+    clockMs += scheduler.sleepMs(clockMs) + lateMs;
+    uint32_t jobs = scheduler.beginWake(clockMs, false);
+    clockMs += workMs;
+    scheduler.endWake(clockMs);
+    return jobs;
+}
+
+void setUp(void)
+{
+    start(2000, 10000);
+}
+
+void tearDown(void) {}
+
+static void test_job_due_within_window_runs_early(void)
+{
+    // Publishing more often than sampling wakes the node; the sample due 30 ms later joins it
+    start(2000, 1970);
+    TEST_ASSERT_EQUAL_UINT32(1970, scheduler.sleepMs(clockMs));
+    uint32_t jobs = sleepAndWake(0, 0);
+    TEST_ASSERT_EQUAL_UINT32(1970, clockMs);
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_SAMPLE | POWER_JOB_PUBLISH, jobs);
+    TEST_ASSERT_EQUAL_UINT32(1970, scheduler.sleepMs(clockMs)); // Publish at 3940 comes before the sample at 4000
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler.stats(clockMs).batchedWakeups);
+}
+
+static void test_external_wake_coalesces_only_near_jobs(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler.beginWake(1900, true)); // PIR edge, sample still 100 ms away
+    scheduler.endWake(1901);
+    TEST_ASSERT_EQUAL_UINT32(99, scheduler.sleepMs(1901));
+
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_SAMPLE, scheduler.beginWake(1960, true)); // Within 50 ms, sampled now
+    scheduler.endWake(1961);
+    TEST_ASSERT_EQUAL_UINT32(2039, scheduler.sleepMs(1961)); // Next sample stays at 4000
+
+    PowerStats stats = scheduler.stats(1961);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.wakeups);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.externalWakeups);
+}
+
+static void test_publish_rides_on_sample_wake(void)
+{
+    // Due at 11000, between samples: it waits for the sample at 12000 instead of waking the node
+    start(2000, 11000);
+    uint32_t publishedAt = 0;
+    for (int i = 0; i < 6 && publishedAt == 0; i++) {
+        uint32_t sleep = scheduler.sleepMs(clockMs);
+        TEST_ASSERT_NOT_EQUAL(11000u, clockMs + sleep);
+        uint32_t jobs = sleepAndWake(0, 0);
+        TEST_ASSERT_TRUE(jobs & POWER_JOB_SAMPLE);
+        if (jobs & POWER_JOB_PUBLISH) {
+            publishedAt = clockMs;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(12000, publishedAt);
+    TEST_ASSERT_EQUAL_UINT32(6, scheduler.stats(clockMs).wakeups);
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler.stats(clockMs).batchedWakeups);
+
+    // The next publish is still due at 22000 on its own grid, and rides on the 22000 sample
+    while (clockMs < 22000) {
+        uint32_t jobs = sleepAndWake(0, 0);
+        TEST_ASSERT_EQUAL(clockMs == 22000, (jobs & POWER_JOB_PUBLISH) != 0);
+    }
+}
+
+static void test_late_wake_does_not_drift(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_SAMPLE, sleepAndWake(700, 50)); // Woke at 2700, busy until 2750
+    TEST_ASSERT_EQUAL_UINT32(1250, scheduler.sleepMs(clockMs));        // Back on the grid at 4000
+
+    // Asleep through two slots: sampled once, the missed slots are skipped
+    clockMs = 6500;
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_SAMPLE, scheduler.beginWake(clockMs, false));
+    scheduler.endWake(clockMs);
+    TEST_ASSERT_EQUAL_UINT32(1500, scheduler.sleepMs(clockMs));
+
+    // An hour of wakes up to 300 ms late still samples once per slot
+    start(2000, 10000);
+    uint32_t samples = 0, publishes = 0;
+    for (uint32_t i = 0; clockMs < 3600000 - 2000; i++) {
+        uint32_t jobs = sleepAndWake((i * 37) % 300);
+        samples += (jobs & POWER_JOB_SAMPLE) != 0;
+        publishes += (jobs & POWER_JOB_PUBLISH) != 0;
+        TEST_ASSERT_EQUAL_UINT32(0, (clockMs + scheduler.sleepMs(clockMs)) % 2000);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1799, samples);
+    TEST_ASSERT_EQUAL_UINT32(359, publishes);
+}
+
+static void test_hold_awake_polls_fast(void)
+{
+    clockMs = 500;
+    scheduler.setHoldAwake(true, clockMs); // A fan started
+    TEST_ASSERT_EQUAL_UINT32(100, scheduler.sleepMs(clockMs));
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_POLL, sleepAndWake(0, 0));
+
+    scheduler.setHoldAwake(false, clockMs);
+    TEST_ASSERT_EQUAL_UINT32(1400, scheduler.sleepMs(clockMs)); // Polls stop, back to the sample grid
+}
+
+static void test_charge_follows_state_time(void)
+{
+    clockMs = 2000;
+    TEST_ASSERT_EQUAL_UINT32(POWER_JOB_SAMPLE, scheduler.beginWake(clockMs, false));
+    scheduler.setRadio(true, 2010);
+    scheduler.setRadio(false, 2510);
+    scheduler.endWake(2520);
+    scheduler.setHoldAwake(true, 3000);
+    scheduler.setHoldAwake(false, 3600);
+
+    PowerStats stats = scheduler.stats(4000);
+    TEST_ASSERT_EQUAL_UINT32(20, (uint32_t)stats.activeMs);
+    TEST_ASSERT_EQUAL_UINT32(500, (uint32_t)stats.radioMs);
+    TEST_ASSERT_EQUAL_UINT32(600, (uint32_t)stats.idleMs);
+    TEST_ASSERT_EQUAL_UINT32(2880, (uint32_t)stats.sleepMs);
+    TEST_ASSERT_EQUAL_UINT32(4000, (uint32_t)stats.totalMs());
+
+    uint64_t charge = 20ull * ACTIVE_UA + 500ull * RADIO_UA + 600ull * IDLE_UA + 2880ull * SLEEP_UA;
+    TEST_ASSERT_EQUAL_UINT64(charge, stats.chargeUaMs);
+    TEST_ASSERT_EQUAL_UINT32(130, stats.dutyPermille()); // (20 + 500) / 4000
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(charge / 4000), stats.averageUa());
+
+    // stats() is a snapshot, the counters only move on transitions
+    TEST_ASSERT_EQUAL_UINT64(charge, scheduler.stats(4000).chargeUaMs);
+}
+
+static void test_charge_over_a_day(void)
+{
+    // Sample every 2 s working 5 ms, publish every 10 s with 300 ms of radio
+    start(2000, 10000);
+    while (clockMs < 86400000) {
+        clockMs += scheduler.sleepMs(clockMs);
+        uint32_t jobs = scheduler.beginWake(clockMs, false);
+        clockMs += 5;
+        if (jobs & POWER_JOB_PUBLISH) {
+            scheduler.setRadio(true, clockMs);
+            clockMs += 300;
+            scheduler.setRadio(false, clockMs);
+        }
+        scheduler.endWake(clockMs);
+    }
+    PowerStats stats = scheduler.stats(clockMs);
+    TEST_ASSERT_EQUAL_UINT32(43200, stats.wakeups);
+    TEST_ASSERT_EQUAL_UINT32(8640, stats.batchedWakeups);
+    TEST_ASSERT_EQUAL_UINT32(32, stats.dutyPermille()); // (5 x 5 ms + 300 ms) per 10 s
+    // Per 10 s: 25 ms at 40 mA, 300 ms at 110 mA, 9675 ms at 1.5 mA
+    TEST_ASSERT_EQUAL_UINT32(4851, stats.averageUa());
+    TEST_ASSERT_EQUAL_UINT32(116430, stats.chargeUah());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_job_due_within_window_runs_early);
+    RUN_TEST(test_external_wake_coalesces_only_near_jobs);
+    RUN_TEST(test_publish_rides_on_sample_wake);
+    RUN_TEST(test_late_wake_does_not_drift);
+    RUN_TEST(test_hold_awake_polls_fast);
+    RUN_TEST(test_charge_follows_state_time);
+    RUN_TEST(test_charge_over_a_day);
+    return UNITY_END();
+}
@@ -0,0 +1,282 @@
+// Compressed series round trips, ring eviction and rollups: pio test -e native -f test_series_ring
+#include <unity.h>
+#include <limits.h>
+#include "SeriesRing.h"
+
+static const uint16_t BLOCK_BYTES = 128; // As in SensorHistory
+static const int MAX_POINTS = 1200;
+
+static SeriesPoint expected[MAX_POINTS];
+static SeriesPoint actual[MAX_POINTS];
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int readAll(const SeriesRing &ring, SeriesPoint *out, uint32_t from = 0)
+{
+    SeriesRing::Cursor cursor;
+    ring.seek(cursor, from);
+    int count = 0;
+    while (count < MAX_POINTS && ring.next(cursor, out[count])) {
+        count++;
+    }
+    return count;
+}
+
+static void appendExpected(SeriesRing &ring, int count)
+{
+    for (int i = 0; i < count; i++) {
+        ring.append(expected[i].time, expected[i].values);
+    }
+}
+
+static void assertPointsEqual(const SeriesPoint *want, const SeriesPoint *got, int count, uint8_t fields)
+{
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL_UINT32(want[i].time, got[i].time);
+        for (uint8_t f = 0; f < fields; f++) {
+            TEST_ASSERT_EQUAL_INT32(want[i].values[f], got[i].values[f]);
+        }
+    }
+}
+
+void setUp(void)
+{
+    rng = 0x2545F491;
+}
+
+void tearDown(void) {}
+
+static void test_steady_series_round_trips_compactly(void)
+{
+    // Temperature in 0.1 degC every 10 s, a random walk across zero
+    SeriesRing ring(1, BLOCK_BYTES, 8);
+    int32_t temperature = 15;
+    for (int i = 0; i < 400; i++) {
+        expected[i].time = 1000 + i * 10;
+        temperature += (int32_t)(nextRandom() % 5) - 2;
+        expected[i].values[0] = temperature;
+    }
+    appendExpected(ring, 400);
+
+    TEST_ASSERT_EQUAL_UINT32(400, ring.pointCount());
+    TEST_ASSERT_EQUAL(400, readAll(ring, actual));
+    assertPointsEqual(expected, actual, 400, 1);
+
+    // Unchanged value at a steady interval costs 2 bits: 300 points fit one block
+    SeriesRing flat(1, BLOCK_BYTES, 2);
+    int32_t value = 215;
+    for (uint32_t i = 0; i < 300; i++) {
+        flat.append(i * 10, &value);
+    }
+    TEST_ASSERT_EQUAL_UINT32(300, flat.pointCount());
+    TEST_ASSERT_EQUAL_UINT32(0, flat.oldestTime());
+    flat.append(3000, &value); // The next one starts the second block
+    flat.append(3010, &value);
+    TEST_ASSERT_EQUAL_UINT32(302, flat.pointCount());
+}
+
+static void test_irregular_timestamps_use_every_width(void)
+{
+    // Delta-of-deltas at both limits of each width and one past them
+    static const int32_t deltaOfDeltas[] = {3000, 0, 63, -64, 64, -65, 255, -256, 256, -257,
+                                            2047, -2048, 2048, -2049, 100000};
+    SeriesRing ring(1, BLOCK_BYTES, 4);
+    int count = 0;
+    uint32_t time = 50;
+    int32_t delta = 0;
+    for (int32_t deltaOfDelta : deltaOfDeltas) {
+        delta += deltaOfDelta;
+        time += (uint32_t)delta;
+        expected[count].time = time;
+        expected[count].values[0] = count;
+        count++;
+    }
+    // Then the same second twice, and a jump of most of the 32-bit range
+    static const uint32_t deltas[] = {0, 0, 4000000000u, 1};
+    for (uint32_t step : deltas) {
+        time += step;
+        expected[count].time = time;
+        expected[count].values[0] = count;
+        count++;
+    }
+    appendExpected(ring, count);
+    TEST_ASSERT_EQUAL(count, readAll(ring, actual));
+    assertPointsEqual(expected, actual, count, 1);
+}
+
+static void test_xor_values_round_trip(void)
+{
+    SeriesRing ring(3, BLOCK_BYTES, 48); // About 9 incompressible points per block
+    for (int i = 0; i < 300; i++) {
+        expected[i].time = i * 60;
+        expected[i].values[0] = (i & 1) ? INT32_MAX : INT32_MIN;         // Every bit flips
+        expected[i].values[1] = (int32_t)nextRandom();                   // New XOR windows
+        expected[i].values[2] = (i % 7 == 0) ? (int32_t)(0xF0u << (i % 24)) : -1; // Window reuse and repeats
+    }
+    appendExpected(ring, 300);
+    TEST_ASSERT_EQUAL_UINT32(300, ring.pointCount());
+    TEST_ASSERT_EQUAL(300, readAll(ring, actual));
+    assertPointsEqual(expected, actual, 300, 3);
+
+    // More fields than SERIES_MAX_FIELDS are capped
+    SeriesRing capped(SERIES_MAX_FIELDS + 2, BLOCK_BYTES, 2);
+    TEST_ASSERT_EQUAL(SERIES_MAX_FIELDS, capped.fieldCount());
+}
+
+static void test_ring_wrap_drops_oldest_block(void)
+{
+    SeriesRing ring(1, 32, 3); // 256 bits per block, a handful of points each
+    TEST_ASSERT_TRUE(ring.empty());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.oldestTime());
+
+    for (int i = 0; i < 1000; i++) {
+        int32_t value = (int32_t)(nextRandom() % 1000) - 500;
+        ring.append(i * 10, &value);
+        expected[i].time = i * 10;
+        expected[i].values[0] = value;
+    }
+    TEST_ASSERT_FALSE(ring.empty());
+
+    int count = readAll(ring, actual);
+    TEST_ASSERT_EQUAL_UINT32(count, ring.pointCount());
+    TEST_ASSERT_TRUE(count > 0 && count < 100);
+    TEST_ASSERT_EQUAL_UINT32(ring.oldestTime(), actual[0].time);
+    // What is left is the newest points, contiguous and intact
+    assertPointsEqual(expected + 1000 - count, actual, count, 1);
+
+    ring.clear();
+    TEST_ASSERT_TRUE(ring.empty());
+    TEST_ASSERT_EQUAL(0, readAll(ring, actual));
+}
+
+static void test_cursor_survives_eviction_under_it(void)
+{
+    SeriesRing ring(1, 32, 3);
+    int32_t value = 0;
+    for (uint32_t i = 0; i < 200; i++) {
+        value += 3;
+        ring.append(i * 10, &value);
+    }
+
+    SeriesRing::Cursor cursor;
+    SeriesPoint point;
+    ring.seek(cursor, 0);
+    TEST_ASSERT_TRUE(ring.next(cursor, point));
+    TEST_ASSERT_TRUE(ring.next(cursor, point));
+    uint32_t lastTime = point.time;
+
+    for (uint32_t i = 200; i < 400; i++) { // Drops the block under the cursor
+        value += 3;
+        ring.append(i * 10, &value);
+    }
+    TEST_ASSERT_TRUE(ring.oldestTime() > lastTime);
+
+    // Resumes at the oldest remaining point, then runs to the newest without repeats
+    TEST_ASSERT_TRUE(ring.next(cursor, point));
+    TEST_ASSERT_EQUAL_UINT32(ring.oldestTime(), point.time);
+    uint32_t count = 1;
+    while (ring.next(cursor, point)) {
+        TEST_ASSERT_EQUAL_INT32(3 + (int32_t)(point.time / 10) * 3, point.values[0]);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(3990, point.time);
+    TEST_ASSERT_EQUAL_UINT32(ring.pointCount(), count);
+}
+
+static void test_seek_starts_at_time(void)
+{
+    SeriesRing ring(1, 32, 8);
+    for (uint32_t i = 0; i < 60; i++) {
+        int32_t value = (int32_t)i;
+        ring.append(1000 + i * 10, &value);
+    }
+    TEST_ASSERT_EQUAL(30, readAll(ring, actual, 1295)); // Between points: starts at the next one
+    TEST_ASSERT_EQUAL_UINT32(1300, actual[0].time);
+    TEST_ASSERT_EQUAL_INT32(30, actual[0].values[0]);
+    TEST_ASSERT_EQUAL(60, readAll(ring, actual, 0));
+    TEST_ASSERT_EQUAL(0, readAll(ring, actual, 1591)); // After the newest
+}
+
+static void test_rollups_close_on_period_boundaries(void)
+{
+    SeriesRing minutes(3, BLOCK_BYTES, 4);
+    SeriesAggregate pending;
+    pending.reset();
+    uint32_t pendingStart = 0;
+
+    // 10 s samples from 0:30; the sample at 1:00 belongs to the next minute and closes the first
+    for (uint32_t time = 30; time < 60; time += 10) {
+        minutes.rollup(pending, pendingStart, 60, time, (int32_t)time / 10); // 3, 4, 5
+    }
+    TEST_ASSERT_TRUE(minutes.empty());
+    TEST_ASSERT_EQUAL_UINT32(0, pendingStart);
+    TEST_ASSERT_EQUAL_UINT32(3, pending.count);
+
+    minutes.rollup(pending, pendingStart, 60, 60, -1);
+    TEST_ASSERT_EQUAL_UINT32(1, minutes.pointCount());
+    TEST_ASSERT_EQUAL_UINT32(60, pendingStart);
+    TEST_ASSERT_EQUAL_UINT32(1, pending.count);
+
+    minutes.rollup(pending, pendingStart, 60, 119, -2); // Last second of the minute
+    // A gap: nothing is stored for the empty minutes in between
+    minutes.rollup(pending, pendingStart, 60, 305, 7);
+    TEST_ASSERT_EQUAL_UINT32(300, pendingStart);
+
+    TEST_ASSERT_EQUAL(2, readAll(minutes, actual));
+    TEST_ASSERT_EQUAL_UINT32(0, actual[0].time);
+    TEST_ASSERT_EQUAL_INT32(3, actual[0].values[0]);
+    TEST_ASSERT_EQUAL_INT32(5, actual[0].values[1]);
+    TEST_ASSERT_EQUAL_INT32(4, actual[0].values[2]);
+    TEST_ASSERT_EQUAL_UINT32(60, actual[1].time);
+    TEST_ASSERT_EQUAL_INT32(-2, actual[1].values[0]);
+    TEST_ASSERT_EQUAL_INT32(-1, actual[1].values[1]);
+    TEST_ASSERT_EQUAL_INT32(-2, actual[1].values[2]); // -1.5 rounds away from zero
+
+    // An hour tier fed from the same samples closes only on the hour
+    SeriesRing hours(3, BLOCK_BYTES, 2);
+    pending.reset();
+    pendingStart = 0;
+    for (uint32_t time = 0; time <= 7200; time += 10) {
+        hours.rollup(pending, pendingStart, 3600, time, time < 3600 ? 100 : 200);
+    }
+    TEST_ASSERT_EQUAL(2, readAll(hours, actual));
+    TEST_ASSERT_EQUAL_UINT32(3600, actual[1].time);
+    TEST_ASSERT_EQUAL_INT32(200, actual[1].values[2]);
+    TEST_ASSERT_EQUAL_UINT32(7200, pendingStart);
+    TEST_ASSERT_EQUAL_UINT32(1, pending.count);
+}
+
+static void test_aggregate_combines_rollups(void)
+{
+    SeriesAggregate bucket;
+    bucket.reset();
+    TEST_ASSERT_EQUAL_INT32(0, bucket.average());
+    bucket.add(-40, 10, -5); // Downsampling whole rollups keeps their extremes
+    bucket.add(-20, 30, 6);
+    TEST_ASSERT_EQUAL_INT32(-40, bucket.min);
+    TEST_ASSERT_EQUAL_INT32(30, bucket.max);
+    TEST_ASSERT_EQUAL_INT32(1, bucket.average()); // 0.5 rounds up
+    bucket.add(-7);
+    TEST_ASSERT_EQUAL_INT32(-2, bucket.average()); // -6 / 3
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_steady_series_round_trips_compactly);
+    RUN_TEST(test_irregular_timestamps_use_every_width);
+    RUN_TEST(test_xor_values_round_trip);
+    RUN_TEST(test_ring_wrap_drops_oldest_block);
+    RUN_TEST(test_cursor_survives_eviction_under_it);
+    RUN_TEST(test_seek_starts_at_time);
+    RUN_TEST(test_rollups_close_on_period_boundaries);
+    RUN_TEST(test_aggregate_combines_rollups);
+    return UNITY_END();
+}
@@ -0,0 +1,134 @@
+// RPM estimate and stall detection from synthetic pulse trains: pio test -e native -f test_tach_window
+#include <unity.h>
+#include "TachWindow.h"
+
+static const uint16_t TICK_MS = 100; // Sampler tick feeding the window
+
+static TachWindow tach;
+
+// Feeds count ticks of a fan turning at rpm with two pulses per revolution
+static void spin(uint32_t rpm, int count, bool driven = true, uint16_t intervalMs = TICK_MS)
+{
+    for (int i = 0; i < count; i++) {
+        tach.addSample((uint16_t)(rpm * 2 * intervalMs / 60000), intervalMs, driven);
+    }
+}
+
+void setUp(void)
+{
+    tach = TachWindow(2, 200, 3000);
+}
+
+void tearDown(void) {}
+
+static void test_steady_train_gives_rpm(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(0, tach.rpm()); // Nothing sampled yet
+
+    spin(3000, 1); // 10 pulses in 100 ms
+    TEST_ASSERT_EQUAL_UINT32(3000, tach.rpm()); // A partial window already averages what it has
+    spin(3000, 30);
+    TEST_ASSERT_EQUAL_UINT32(3000, tach.rpm());
+    TEST_ASSERT_FALSE(tach.isStalled());
+
+    TachWindow singlePulse(1, 200, 3000);
+    singlePulse.addSample(10, TICK_MS, true);
+    TEST_ASSERT_EQUAL_UINT32(6000, singlePulse.rpm());
+    TachWindow defaulted(0, 200, 3000); // 0 pulses per revolution falls back to 2
+    defaulted.addSample(10, TICK_MS, true);
+    TEST_ASSERT_EQUAL_UINT32(3000, defaulted.rpm());
+}
+
+static void test_irregular_intervals_weigh_by_time(void)
+{
+    // A late tick carries more pulses; the estimate divides by time, not by samples
+    tach.addSample(10, 100, true);
+    tach.addSample(25, 250, true);
+    tach.addSample(5, 50, true);
+    TEST_ASSERT_EQUAL_UINT32(3000, tach.rpm());
+
+    tach.addSample(0, 600, true); // 40 pulses over 1 s
+    TEST_ASSERT_EQUAL_UINT32(1200, tach.rpm());
+}
+
+static void test_window_wraps_onto_new_speed(void)
+{
+    spin(3000, TACH_WINDOW_SLOTS);
+    spin(1200, TACH_WINDOW_SLOTS / 2); // Half the window at 4 pulses per tick
+    TEST_ASSERT_EQUAL_UINT32(2100, tach.rpm());
+    spin(1200, TACH_WINDOW_SLOTS / 2);
+    TEST_ASSERT_EQUAL_UINT32(1200, tach.rpm()); // The 3000 RPM samples are gone
+
+    spin(1200, TACH_WINDOW_SLOTS * 5 + 3); // Several laps keep the sums exact
+    TEST_ASSERT_EQUAL_UINT32(1200, tach.rpm());
+
+    // Wrap with mixed interval lengths: the evicted slot takes its own time with it
+    spin(1200, TACH_WINDOW_SLOTS, true, 150);
+    TEST_ASSERT_EQUAL_UINT32(1200, tach.rpm());
+    spin(0, 1, true, TICK_MS);
+    TEST_ASSERT_EQUAL_UINT32(1200 * 1350 / 1450, tach.rpm()); // Nine 150 ms slots with pulses, one empty
+}
+
+static void test_stall_only_after_delay_while_driven(void)
+{
+    spin(0, 29); // Driven but not turning for 2.9 s: could still be spinning up
+    TEST_ASSERT_FALSE(tach.isStalled());
+    spin(0, 1);
+    TEST_ASSERT_TRUE(tach.isStalled());
+    spin(0, 50);
+    TEST_ASSERT_TRUE(tach.isStalled());
+
+    spin(3000, 1); // Turning again: 10 pulses in the window are 300 RPM
+    TEST_ASSERT_FALSE(tach.isStalled());
+
+    // A slow spin-up below stallRpm for 2 s, then up to speed, never reports a stall
+    tach.reset();
+    spin(0, 20);
+    spin(3000, 50);
+    TEST_ASSERT_FALSE(tach.isStalled());
+
+    // The delay restarts after every recovery, counted from when the estimate drops
+    // below stallRpm: one 300 RPM slot still in the window keeps it above
+    spin(0, TACH_WINDOW_SLOTS - 1 + 29);
+    TEST_ASSERT_FALSE(tach.isStalled());
+    spin(0, 1);
+    TEST_ASSERT_TRUE(tach.isStalled());
+}
+
+static void test_no_stall_while_commanded_off(void)
+{
+    spin(0, 200, false); // 20 s at duty 0
+    TEST_ASSERT_FALSE(tach.isStalled());
+    TEST_ASSERT_EQUAL_UINT32(0, tach.rpm());
+
+    spin(0, 29, true); // Started: the delay counts from the start, not from when it went quiet
+    TEST_ASSERT_FALSE(tach.isStalled());
+    spin(0, 1, true);
+    TEST_ASSERT_TRUE(tach.isStalled());
+
+    spin(0, 1, false); // Commanded off again clears the stall at once
+    TEST_ASSERT_FALSE(tach.isStalled());
+}
+
+static void test_reset_clears_window_and_stall(void)
+{
+    spin(0, 40);
+    TEST_ASSERT_TRUE(tach.isStalled());
+    tach.reset();
+    TEST_ASSERT_FALSE(tach.isStalled());
+    TEST_ASSERT_EQUAL_UINT32(0, tach.rpm());
+    spin(1200, 1);
+    TEST_ASSERT_EQUAL_UINT32(1200, tach.rpm());
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_steady_train_gives_rpm);
+    RUN_TEST(test_irregular_intervals_weigh_by_time);
+    RUN_TEST(test_window_wraps_onto_new_speed);
+    RUN_TEST(test_stall_only_after_delay_while_driven);
+    RUN_TEST(test_no_stall_while_commanded_off);
+    RUN_TEST(test_reset_clears_window_and_stall);
+    return UNITY_END();
+}
@@ -0,0 +1,262 @@
+// UDP control frames and replay protection: pio test -e native -f test_udp_control
+#include <unity.h>
+#include <string.h>
+#include "UdpControlCodec.h"
+#include "UdpControlDispatcher.h"
+
+static const uint8_t KEY[] = "test-key";
+static const size_t KEY_LENGTH = sizeof(KEY) - 1;
+static const uint16_t DEVICE_COUNT = 4;
+
+static UdpControlDispatcher *dispatcher;
+static int executions;    // Commands that reached the device
+static uint32_t nextRandom;
+
+static uint16_t resolve(const UdpControlRequest &request)
+{
+    return !(request.flags & UDP_FLAG_UUID) && request.index < DEVICE_COUNT ? request.index : UDP_NO_DEVICE;
+}
+
+static UdpStatus execute(uint16_t index, uint8_t opcode, uint8_t argument, int16_t &state)
+{
+    (void)index;
+    if (opcode != UDP_OP_QUERY) {
+        executions++;
+    }
+    state = argument;
+    return UDP_STATUS_OK;
+}
+
+static uint32_t random32()
+{
+    nextRandom = nextRandom * 1664525u + 1013904223u; // Deterministic stand-in for esp_random()
+    return nextRandom;
+}
+
+static UdpControlDispatcher *newDispatcher()
+{
+    return new UdpControlDispatcher(KEY, KEY_LENGTH, resolve, execute, random32);
+}
+
+void setUp(void)
+{
+    executions = 0;
+    nextRandom = 1;
+    dispatcher = newDispatcher();
+}
+
+void tearDown(void)
+{
+    delete dispatcher;
+}
+
+static UdpControlRequest command(uint32_t clientId, uint32_t sequence, uint32_t nonce)
+{
+    UdpControlRequest request = {};
+    request.opcode = UDP_OP_SET;
+    request.argument = 1;
+    request.clientId = clientId;
+    request.sequence = sequence;
+    request.nonce = nonce;
+    request.index = 2;
+    return request;
+}
+
+static size_t encode(const UdpControlRequest &request, uint8_t *frame)
+{
+    size_t length = udpEncodeRequest(frame, UDP_CONTROL_MAX_REQUEST, request, KEY, KEY_LENGTH);
+    TEST_ASSERT_NOT_EQUAL(0, length);
+    return length;
+}
+
+// Sends a frame and decodes the ack; status 0xFF when there was none
+static UdpControlAck send(const uint8_t *frame, size_t length)
+{
+    uint8_t out[UDP_CONTROL_ACK_BYTES];
+    UdpControlAck ack = {};
+    ack.status = 0xFF;
+    size_t ackLength = dispatcher->handle(frame, length, out, sizeof(out));
+    if (ackLength > 0) {
+        TEST_ASSERT_TRUE(udpDecodeAck(out, ackLength, ack, KEY, KEY_LENGTH));
+    }
+    return ack;
+}
+
+static UdpControlAck send(const UdpControlRequest &request)
+{
+    uint8_t frame[UDP_CONTROL_MAX_REQUEST];
+    return send(frame, encode(request, frame));
+}
+
+// Learns the client's nonce the way a client does: the first frame is answered with RESYNC
+static uint32_t sync(uint32_t clientId)
+{
+    UdpControlRequest query = command(clientId, 0, 0);
+    query.opcode = UDP_OP_QUERY;
+    UdpControlAck ack = send(query);
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, ack.status);
+    TEST_ASSERT_NOT_EQUAL(0, ack.nonce);
+    return ack.nonce;
+}
+
+static void test_request_round_trip(void)
+{
+    UdpControlRequest request = command(0x7F000001, 0xFFFFFFFE, 0xA5A55A5A);
+    uint8_t frame[UDP_CONTROL_MAX_REQUEST];
+    TEST_ASSERT_EQUAL(34, encode(request, frame));
+    UdpControlRequest decoded;
+    TEST_ASSERT_TRUE(udpDecodeRequest(frame, 34, decoded, KEY, KEY_LENGTH));
+    TEST_ASSERT_EQUAL(UDP_OP_SET, decoded.opcode);
+    TEST_ASSERT_EQUAL(1, decoded.argument);
+    TEST_ASSERT_EQUAL_UINT32(0x7F000001, decoded.clientId);
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFE, decoded.sequence);
+    TEST_ASSERT_EQUAL_UINT32(0xA5A55A5A, decoded.nonce);
+    TEST_ASSERT_EQUAL(2, decoded.index);
+
+    request.flags = UDP_FLAG_UUID;
+    for (int i = 0; i < UDP_CONTROL_UUID_BYTES; i++) {
+        request.uuid[i] = (uint8_t)(0x10 + i);
+    }
+    TEST_ASSERT_EQUAL(48, encode(request, frame));
+    TEST_ASSERT_TRUE(udpDecodeRequest(frame, 48, decoded, KEY, KEY_LENGTH));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(request.uuid, decoded.uuid, UDP_CONTROL_UUID_BYTES);
+    TEST_ASSERT_EQUAL(UDP_NO_DEVICE, decoded.index);
+    TEST_ASSERT_FALSE(udpDecodeRequest(frame, 34, decoded, KEY, KEY_LENGTH)); // Length must match the flags
+}
+
+static void test_ack_round_trip(void)
+{
+    UdpControlAck ack = {UDP_OP_QUERY, UDP_STATUS_OK, 7, 8, 0x12345678, 3, -125};
+    uint8_t frame[UDP_CONTROL_ACK_BYTES];
+    TEST_ASSERT_EQUAL(UDP_CONTROL_ACK_BYTES, udpEncodeAck(frame, sizeof(frame), ack, KEY, KEY_LENGTH));
+    TEST_ASSERT_EQUAL(UDP_OP_QUERY | UDP_ACK_BIT, frame[1]);
+    UdpControlAck decoded;
+    TEST_ASSERT_TRUE(udpDecodeAck(frame, sizeof(frame), decoded, KEY, KEY_LENGTH));
+    TEST_ASSERT_EQUAL(UDP_OP_QUERY, decoded.opcode);
+    TEST_ASSERT_EQUAL_UINT32(0x12345678, decoded.nonce);
+    TEST_ASSERT_EQUAL(3, decoded.index);
+    TEST_ASSERT_EQUAL(-125, decoded.state);
+    TEST_ASSERT_EQUAL(0, udpEncodeAck(frame, sizeof(frame) - 1, ack, KEY, KEY_LENGTH));
+}
+
+static void test_bad_tag_is_not_answered(void)
+{
+    uint8_t frame[UDP_CONTROL_MAX_REQUEST];
+    size_t length = encode(command(1, 1, sync(1)), frame);
+    frame[length - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL(0xFF, send(frame, length).status);
+    frame[length - 1] ^= 0x01;
+    frame[3] = 0; // Body changed under a valid tag
+    TEST_ASSERT_EQUAL(0xFF, send(frame, length).status);
+
+    UdpControlRequest request = command(1, 2, 0);
+    length = udpEncodeRequest(frame, sizeof(frame), request, (const uint8_t *)"other-key", 9);
+    TEST_ASSERT_EQUAL(0xFF, send(frame, length).status);
+    TEST_ASSERT_EQUAL(0, executions);
+    TEST_ASSERT_EQUAL_UINT32(3, dispatcher->stats().rejected);
+}
+
+static void test_new_client_must_resync(void)
+{
+    UdpControlAck ack = send(command(1, 100, 0));
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, ack.status);
+    TEST_ASSERT_EQUAL(0, executions);
+
+    ack = send(command(1, 100, ack.nonce)); // Same command, now in the session
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, ack.status);
+    TEST_ASSERT_EQUAL(1, executions);
+    TEST_ASSERT_EQUAL(1, ack.state);
+}
+
+static void test_duplicate_runs_once(void)
+{
+    uint32_t nonce = sync(1);
+    uint8_t frame[UDP_CONTROL_MAX_REQUEST];
+    size_t length = encode(command(1, 10, nonce), frame);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(frame, length).status);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(frame, length).status); // Retry of the newest: original answer
+    TEST_ASSERT_EQUAL(1, executions);
+
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(1, 12, nonce)).status);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(1, 11, nonce)).status); // Late, but not run before
+    TEST_ASSERT_EQUAL(UDP_STATUS_DUPLICATE, send(frame, length).status);
+    TEST_ASSERT_EQUAL(3, executions);
+    TEST_ASSERT_EQUAL_UINT32(2, dispatcher->stats().duplicates);
+}
+
+static void test_stale_sequence_refused(void)
+{
+    uint32_t nonce = sync(1);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(1, 1000, nonce)).status);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(1, 1000 - UDP_REPLAY_WINDOW + 1, nonce)).status);
+    TEST_ASSERT_EQUAL(UDP_STATUS_STALE, send(command(1, 1000 - UDP_REPLAY_WINDOW, nonce)).status);
+    TEST_ASSERT_EQUAL(2, executions);
+
+    // Serial number arithmetic: a sequence past the wrap is newer
+    nonce = sync(2);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(2, 0xFFFFFFFF, nonce)).status);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(2, 3, nonce)).status);
+    TEST_ASSERT_EQUAL(4, executions);
+}
+
+static void test_evicted_client_cannot_be_replayed(void)
+{
+    uint32_t nonce = sync(1);
+    uint8_t old[UDP_CONTROL_MAX_REQUEST];
+    size_t oldLength = encode(command(1, 50, nonce), old);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(old, oldLength).status);
+
+    // Enough other clients to push client 1 out of the table
+    for (uint32_t id = 100; id < 100 + UDP_CONTROL_MAX_CLIENTS; id++) {
+        TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(id, 1, sync(id))).status);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, dispatcher->stats().evictions);
+
+    // Its window is gone, but the captured frame does not carry the new nonce
+    UdpControlAck ack = send(old, oldLength);
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, ack.status);
+    TEST_ASSERT_NOT_EQUAL(nonce, ack.nonce);
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, send(old, oldLength).status); // Replaying again changes nothing
+    TEST_ASSERT_EQUAL(1 + UDP_CONTROL_MAX_CLIENTS, executions);
+
+    // The real client resyncs and carries on
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(command(1, 51, ack.nonce)).status);
+    TEST_ASSERT_EQUAL(2 + UDP_CONTROL_MAX_CLIENTS, executions);
+}
+
+static void test_frames_from_before_reboot_are_refused(void)
+{
+    uint8_t old[UDP_CONTROL_MAX_REQUEST];
+    size_t oldLength = encode(command(1, 7, sync(1)), old);
+    TEST_ASSERT_EQUAL(UDP_STATUS_OK, send(old, oldLength).status);
+
+    delete dispatcher; // Reboot: windows lost, nonces drawn again
+    nextRandom = 99;
+    dispatcher = newDispatcher();
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, send(old, oldLength).status);
+    TEST_ASSERT_EQUAL(1, executions);
+    TEST_ASSERT_EQUAL_UINT32(1, dispatcher->stats().resyncs);
+}
+
+static void test_nonce_never_zero(void)
+{
+    nextRandom = 0x25D60FE5u; // random32() returns 0 next: (x * 1664525 + 1013904223) mod 2^32
+    TEST_ASSERT_EQUAL_UINT32(0, nextRandom * 1664525u + 1013904223u);
+    TEST_ASSERT_NOT_EQUAL(0, sync(1));
+    TEST_ASSERT_EQUAL(UDP_STATUS_RESYNC, send(command(1, 1, 0)).status); // 0 is never current
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_request_round_trip);
+    RUN_TEST(test_ack_round_trip);
+    RUN_TEST(test_bad_tag_is_not_answered);
+    RUN_TEST(test_new_client_must_resync);
+    RUN_TEST(test_duplicate_runs_once);
+    RUN_TEST(test_stale_sequence_refused);
+    RUN_TEST(test_evicted_client_cannot_be_replayed);
+    RUN_TEST(test_frames_from_before_reboot_are_refused);
+    RUN_TEST(test_nonce_never_zero);
+    return UNITY_END();
+}
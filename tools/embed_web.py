@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Embeds the web dashboard (web/) into the firmware as gzip-compressed assets.
+
+Runs before every build as a PlatformIO extra script, and can be run by hand:
+
+    tools/embed_web.py [--web web] [--output include/generated/WebAssets.h]
+
+Every file in web/ is gzipped once here, at build time, and written as a const
+byte array (kept in flash) to a generated header that WebDashboard serves as is.
+Assets other than index.html get their content hash in the URL
+(app.js -> /assets/app.<hash>.js), and index.html references are rewritten to
+match, so they can be cached forever; index.html itself revalidates by ETag.
+
+The header is only rewritten when its content changes, so unchanged assets do
+not trigger a recompile.
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html; charset=utf-8",
+    ".js": "text/javascript; charset=utf-8",
+    ".css": "text/css; charset=utf-8",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".json": "application/json",
+}
+
+INDEX = "index.html"
+
+
+def hashed_path(name, data):
+    stem, extension = os.path.splitext(name)
+    return f"/assets/{stem}.{hashlib.sha256(data).hexdigest()[:8]}{extension}"
+
+
+def load_assets(web_dir):
+    names = sorted(
+        name for name in os.listdir(web_dir) if os.path.isfile(os.path.join(web_dir, name)) and not name.startswith(".")
+    )
+    if INDEX not in names:
+        raise SystemExit(f"embed_web: {web_dir}/{INDEX} is missing")
+
+    files = {}
+    for name in names:
+        if os.path.splitext(name)[1] not in CONTENT_TYPES:
+            raise SystemExit(f"embed_web: no content type for {name}")
+        with open(os.path.join(web_dir, name), "rb") as f:
+            files[name] = f.read()
+
+    # Immutable assets first, so index.html can point at their hashed paths
+    paths = {name: hashed_path(name, data) for name, data in files.items() if name != INDEX}
+    index = files[INDEX].decode("utf-8")
+    for name, path in paths.items():
+        index = re.sub(r'(src|href)="(\./)?%s"' % re.escape(name), r'\1="%s"' % path, index)
+    files[INDEX] = index.encode("utf-8")
+    paths[INDEX] = "/"
+
+    assets = []
+    for name in names:
+        # mtime=0 keeps the output reproducible for the same input
+        compressed = gzip.compress(files[name], compresslevel=9, mtime=0)
+        etag = '"%s"' % hashlib.sha256(compressed).hexdigest()[:16]
+        assets.append((name, paths[name], CONTENT_TYPES[os.path.splitext(name)[1]], compressed, etag, len(files[name])))
+    return assets
+
+
+def render_header(assets):
+    lines = [
+        "// Generated by tools/embed_web.py from web/, do not edit",
+        "#ifndef WebAssets_h",
+        "#define WebAssets_h",
+        "",
+        '#include "WebDashboard.h"',
+        "",
+    ]
+    for i, (name, _, _, compressed, _, size) in enumerate(assets):
+        lines.append(f"// {name}: {size} bytes, {len(compressed)} gzipped")
+        lines.append(f"static const uint8_t webAsset{i}[{len(compressed)}] = {{")
+        for offset in range(0, len(compressed), 20):
+            chunk = compressed[offset : offset + 20]
+            lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+        lines.append("};")
+        lines.append("")
+
+    lines.append("static const WebAsset webAssets[] = {")
+    for i, (name, path, content_type, compressed, etag, _) in enumerate(assets):
+        immutable = "false" if name == INDEX else "true"
+        etag_literal = etag.replace('"', '\\"')
+        lines.append(
+            f'    {{"{path}", "{content_type}", webAsset{i}, sizeof(webAsset{i}), "{etag_literal}", {immutable}}},'
+        )
+    lines.append("};")
+    lines.append("static const size_t webAssetCount = sizeof(webAssets) / sizeof(webAssets[0]);")
+    lines.append("")
+    lines.append("#endif // WebAssets_h")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def embed(web_dir, output):
+    assets = load_assets(web_dir)
+    header = render_header(assets)
+    if os.path.exists(output):
+        with open(output, "r", encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    os.makedirs(os.path.dirname(output), exist_ok=True)
+    with open(output, "w", encoding="utf-8") as f:
+        f.write(header)
+    total = sum(len(asset[3]) for asset in assets)
+    print(f"embed_web: {len(assets)} assets, {total} bytes gzipped -> {output}")
+
+
+try:
+    Import("env")  # noqa: F821 (defined when run by PlatformIO)
+except NameError:
+    env = None
+
+if env is not None:
+    project = env.subst("$PROJECT_DIR")
+    embed(os.path.join(project, "web"), os.path.join(project, "include", "generated", "WebAssets.h"))
+elif __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--web", default="web", help="dashboard sources (default: web)")
+    parser.add_argument("--output", default="include/generated/WebAssets.h", help="generated header")
+    args = parser.parse_args()
+    embed(args.web, args.output)
+    sys.exit(0)
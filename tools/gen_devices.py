@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""Generates the firmware's site device table (include/generated/SiteDevices.h) from a site config.
+
+Runs before every build as a PlatformIO extra script, and can be run by hand:
+
+    tools/gen_devices.py [--config config/devices.json] [--output include/generated/SiteDevices.h]
+
+A PlatformIO environment picks its site with `custom_device_config = <path>`
+(default config/devices.json). Each device is one entry of "devices", in the
+order that device indexes (UDP control, /api/state) follow:
+
+    {"area": "<uuid>", "id": "<uuid>", "type": "LED|FAN|DHT11|PIR", "pin": 18,
+     "mode": "OUTPUT|INPUT|INPUT_PULLUP|INPUT_PULLDOWN",   (default by type)
+     "allowStrapping": false,                              (GPIO 0, 2, 5, 12, 15)
+     "tach": {"pin": 27, "pulsesPerRev": 2}}               (FAN only, optional)
+
+A fan tach is an open-collector output and relies on the input's pull-up. GPIO
+34-39 have none, so a tach there needs an external pull-up (10 kOhm to 3.3 V) or
+it floats and counts noise; the script warns when one is declared there.
+
+This script parses the ids to bytes and assigns LEDC channels to fans, RMT
+channels to DHT11s and PCNT units to tach inputs. Whether the pins suit the
+ESP32 is checked by the compiler (DEVICE_TABLE_CHECK in include/DeviceTable.h),
+so a bad config stops the build with the device and the broken rule.
+
+The header is only rewritten when its content changes.
+"""
+
+import argparse
+import json
+import os
+import sys
+import uuid
+
+TYPES = {"LED": "PIN_TYPE_LED", "FAN": "PIN_TYPE_FAN", "DHT11": "PIN_TYPE_DHT11", "PIR": "PIN_TYPE_PIR"}
+DEFAULT_MODES = {"LED": "OUTPUT", "FAN": "OUTPUT", "DHT11": "INPUT_PULLUP", "PIR": "INPUT"}
+MODES = {"OUTPUT", "INPUT", "INPUT_PULLUP", "INPUT_PULLDOWN"}
+KEYS = {"area", "id", "type", "pin", "mode", "allowStrapping", "tach"}
+
+
+def fail(message):
+    raise SystemExit(f"gen_devices: {message}")
+
+
+def warn(message):
+    print(f"gen_devices: warning: {message}", file=sys.stderr)
+
+
+def parse_uuid(text, where):
+    try:
+        value = uuid.UUID(text)
+    except (TypeError, ValueError, AttributeError):
+        fail(f"{where}: '{text}' is not a UUID")
+    if str(value) != text:
+        # Commands match ids as written, so only one spelling may exist
+        fail(f"{where}: write the UUID as '{value}'")
+    return value
+
+
+def load_devices(path):
+    try:
+        with open(path, "r", encoding="utf-8") as f:
+            config = json.load(f)
+    except OSError as e:
+        fail(f"cannot read {path}: {e.strerror}")
+    except json.JSONDecodeError as e:
+        fail(f"{path}:{e.lineno}: {e.msg}")
+
+    entries = config.get("devices") if isinstance(config, dict) else None
+    if not isinstance(entries, list) or not entries:
+        fail(f"{path}: expected a non-empty \"devices\" array")
+
+    devices = []
+    next_channel = {"ledc": 0, "rmt": 0, "pcnt": 0}
+    for index, entry in enumerate(entries):
+        where = f"{path}: device {index}"
+        if not isinstance(entry, dict):
+            fail(f"{where}: expected an object")
+        unknown = set(entry) - KEYS
+        if unknown:
+            fail(f"{where}: unknown key(s) {', '.join(sorted(unknown))}")
+        for key in ("area", "id", "type", "pin"):
+            if key not in entry:
+                fail(f"{where}: missing \"{key}\"")
+
+        kind = entry["type"]
+        if kind not in TYPES:
+            fail(f"{where}: type must be one of {', '.join(TYPES)}")
+        if not isinstance(entry["pin"], int) or isinstance(entry["pin"], bool):
+            fail(f"{where}: pin must be a GPIO number")
+        mode = entry.get("mode", DEFAULT_MODES[kind])
+        if mode not in MODES:
+            fail(f"{where}: mode must be one of {', '.join(sorted(MODES))}")
+
+        device = {
+            "area": entry["area"],
+            "id": entry["id"],
+            "uuid": parse_uuid(entry["id"], where).bytes,
+            "type": kind,
+            "pin": entry["pin"],
+            "mode": mode,
+            "allowStrapping": bool(entry.get("allowStrapping", False)),
+            "ledc": -1,
+            "rmt": -1,
+            "tachPin": -1,
+            "pcnt": -1,
+            "pulsesPerRev": 0,
+        }
+        parse_uuid(entry["area"], where)
+
+        if kind == "FAN":
+            device["ledc"] = next_channel["ledc"]
+            next_channel["ledc"] += 1
+        elif kind == "DHT11":
+            device["rmt"] = next_channel["rmt"]
+            next_channel["rmt"] += 1
+
+        tach = entry.get("tach")
+        if tach is not None:
+            if kind != "FAN":
+                fail(f"{where}: only a FAN can have a tach input")
+            if not isinstance(tach, dict) or not isinstance(tach.get("pin"), int):
+                fail(f"{where}: tach must be {{\"pin\": <gpio>, \"pulsesPerRev\": <n>}}")
+            pulses = tach.get("pulsesPerRev", 2)
+            if not isinstance(pulses, int) or not 1 <= pulses <= 255:
+                fail(f"{where}: tach pulsesPerRev must be 1-255")
+            if 34 <= tach["pin"] <= 39:
+                warn(f"{where}: tach on GPIO {tach['pin']} has no internal pull-up, fit an external one")
+            device["tachPin"] = tach["pin"]
+            device["pulsesPerRev"] = pulses
+            device["pcnt"] = next_channel["pcnt"]
+            next_channel["pcnt"] += 1
+
+        devices.append(device)
+    return devices
+
+
+def render_header(devices, source):
+    lines = [
+        f"// Generated by tools/gen_devices.py from {source}, do not edit",
+        "#ifndef SiteDevices_h",
+        "#define SiteDevices_h",
+        "",
+        '#include "DeviceTable.h"',
+        "",
+        "static constexpr DeviceConfig deviceTable[] = {",
+    ]
+    for index, device in enumerate(devices):
+        tach = f", tach on GPIO {device['tachPin']}" if device["tachPin"] >= 0 else ""
+        lines.append(f"    // {index}: {device['type']} on GPIO {device['pin']}{tach}")
+        uuid_bytes = ", ".join("0x%02x" % b for b in device["uuid"])
+        lines.append(
+            f'    {{"{device["area"]}", "{device["id"]}",\n'
+            f"     {{{uuid_bytes}}},\n"
+            f"     {TYPES[device['type']]}, {device['pin']}, {device['mode']}, "
+            f"{'true' if device['allowStrapping'] else 'false'}, {device['ledc']}, {device['rmt']}, "
+            f"{device['tachPin']}, {device['pcnt']}, {device['pulsesPerRev']}}},"
+        )
+    lines.append("};")
+    lines.append("static constexpr size_t deviceTableSize = sizeof(deviceTable) / sizeof(deviceTable[0]);")
+    lines.append("")
+    lines.append(f'static_assert(deviceTableSize <= DEVICE_MAX, "{source}: more devices than DEVICE_MAX");')
+    for index, device in enumerate(devices):
+        where = f"{source}: device {index} ({device['type']} {device['id']})"
+        lines.append(f'DEVICE_TABLE_CHECK(deviceTable, deviceTableSize, {index}, "{where}")')
+    lines.append("")
+    lines.append("#endif // SiteDevices_h")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def generate(config, output, source=None):
+    devices = load_devices(config)
+    header = render_header(devices, source or config)
+    if os.path.exists(output):
+        with open(output, "r", encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    os.makedirs(os.path.dirname(output), exist_ok=True)
+    with open(output, "w", encoding="utf-8") as f:
+        f.write(header)
+    print(f"gen_devices: {len(devices)} devices from {source or config} -> {output}")
+
+
+try:
+    Import("env")  # noqa: F821 (defined when run by PlatformIO)
+except NameError:
+    env = None
+
+if env is not None:
+    project = env.subst("$PROJECT_DIR")
+    config = env.GetProjectOption("custom_device_config", "config/devices.json")
+    generate(os.path.join(project, config), os.path.join(project, "include", "generated", "SiteDevices.h"), config)
+elif __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--config", default="config/devices.json", help="site device config (default: config/devices.json)")
+    parser.add_argument("--output", default="include/generated/SiteDevices.h", help="generated header")
+    args = parser.parse_args()
+    generate(args.config, args.output)
+    sys.exit(0)
@@ -0,0 +1,415 @@
+#!/usr/bin/env python3
+"""HTTP load generator and soak test for a node's REST API.
+
+Drives /api/command/send and a sensor endpoint from many concurrent
+connections, then reports throughput, latency percentiles and error rates.
+Output devices are discovered from /api/state. Free heap and the largest
+block are polled from /api/diagnostics/heap during the run, so a soak shows
+leaks and fragmentation next to the load that caused them.
+
+The device's Server-Timing header gives its own processing time, reported
+separately from the end-to-end latency. Every request carries an
+X-Request-ID, and the slowest IDs are printed for lookup in
+/api/diagnostics/traces.
+
+It needs a real node. There is no host build of RestAPI and ControlService to
+run it against (AsyncTCP, ESPAsyncWebServer and the GPIO/LEDC/RMT/PCNT drivers
+have no host port), so capacity regressions are caught on a bench node, not in
+`pio test -e native`.
+
+Usage:
+    tools/loadgen.py http://<ip>:2826 --concurrency 8 --duration 60
+    tools/loadgen.py http://<ip>:2826 --mix command=1 --batch 4 --body-bytes 1024
+    tools/loadgen.py http://<ip>:2826 --rate 40 --duration 3600 --report-every 60   # soak
+    tools/loadgen.py http://<ip>:2826 --ramp 1,2,4,8,16 --duration 20               # capacity knee
+
+Exits with status 1 when the error rate exceeds --max-error-rate.
+"""
+
+import argparse
+import asyncio
+import itertools
+import json
+import random
+import sys
+import time
+from urllib.parse import urlsplit
+
+SERVER_TIMING_TOTAL = "total;dur="
+
+
+class Endpoint:
+    def __init__(self, host, port):
+        self.host = host
+        self.port = port
+
+
+class Result:
+    __slots__ = ("kind", "latency", "status", "error", "device_ms", "request_id")
+
+    def __init__(self, kind, latency, status=0, error=None, device_ms=None, request_id=None):
+        self.kind = kind
+        self.latency = latency
+        self.status = status
+        self.error = error
+        self.device_ms = device_ms
+        self.request_id = request_id
+
+
+async def read_response(reader):
+    """Reads one HTTP/1.1 response, returns (status, headers, body)."""
+    head = await reader.readuntil(b"\r\n\r\n")
+    lines = head.decode("latin-1").split("\r\n")
+    status = int(lines[0].split(" ", 2)[1])
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers[name.strip().lower()] = value.strip()
+
+    if status in (204, 304):
+        return status, headers, b""
+    if headers.get("transfer-encoding", "").lower() == "chunked":
+        body = bytearray()
+        while True:
+            size = int((await reader.readuntil(b"\r\n")).split(b";")[0], 16)
+            if size == 0:
+                await reader.readuntil(b"\r\n")
+                return status, headers, bytes(body)
+            body += await reader.readexactly(size)
+            await reader.readexactly(2)
+    if "content-length" in headers:
+        return status, headers, await reader.readexactly(int(headers["content-length"]))
+    return status, headers, await reader.read()
+
+
+class Connection:
+    """One client connection, reopened whenever the server closes it."""
+
+    def __init__(self, endpoint, keepalive, timeout):
+        self.endpoint = endpoint
+        self.keepalive = keepalive
+        self.timeout = timeout
+        self.reader = None
+        self.writer = None
+
+    async def close(self):
+        if self.writer is not None:
+            self.writer.close()
+            try:
+                await self.writer.wait_closed()
+            except (ConnectionError, OSError):
+                pass
+        self.reader = self.writer = None
+
+    async def request(self, method, path, body=None, headers=None):
+        if self.writer is None:
+            self.reader, self.writer = await asyncio.wait_for(
+                asyncio.open_connection(self.endpoint.host, self.endpoint.port), self.timeout)
+        lines = [f"{method} {path} HTTP/1.1", f"Host: {self.endpoint.host}",
+                 "Connection: " + ("keep-alive" if self.keepalive else "close")]
+        for name, value in (headers or {}).items():
+            lines.append(f"{name}: {value}")
+        if body is not None:
+            lines += ["Content-Type: application/json", f"Content-Length: {len(body)}"]
+        self.writer.write(("\r\n".join(lines) + "\r\n\r\n").encode() + (body or b""))
+        try:
+            status, response_headers, response_body = await asyncio.wait_for(read_response(self.reader), self.timeout)
+        except BaseException:
+            await self.close()
+            raise
+        if not self.keepalive or response_headers.get("connection", "").lower() == "close":
+            await self.close()
+        return status, response_headers, response_body
+
+
+def device_time_ms(headers):
+    timing = headers.get("server-timing", "")
+    start = timing.find(SERVER_TIMING_TOTAL)
+    if start < 0:
+        return None
+    value = timing[start + len(SERVER_TIMING_TOTAL):].split(",")[0]
+    try:
+        return float(value)
+    except ValueError:
+        return None
+
+
+def application_error(body):
+    """True if the device answered but reported a failed command."""
+    try:
+        document = json.loads(body)
+    except ValueError:
+        return True
+    if document.get("status") == "error" or document.get("c", 0) != 0:
+        return True
+    for result in document.get("results", document.get("r", [])):
+        if result.get("status") == "error" or result.get("c", 0) != 0:
+            return True
+    return False
+
+
+class CommandFactory:
+    """Builds command bodies over the discovered outputs."""
+
+    def __init__(self, outputs, batch, body_bytes, compact):
+        self.outputs = outputs
+        self.batch = batch
+        self.body_bytes = body_bytes
+        self.path = "/api/command/send" + ("?format=compact" if compact else "")
+        self.cycle = itertools.cycle(outputs)
+        self.toggle = False
+
+    def build(self):
+        areas = {}
+        for _ in range(self.batch):
+            output = next(self.cycle)
+            if output["type"] == "FAN":
+                device = {"deviceId": output["deviceId"], "function": "setspeed",
+                          "parameters": {"speed": random.randrange(0, 101, 10)}}
+            else:
+                self.toggle = not self.toggle
+                device = {"deviceId": output["deviceId"], "function": "toggle",
+                          "parameters": {"state": self.toggle}}
+            areas.setdefault(output["areaId"], []).append(device)
+
+        commands = [{"areaId": area, "devices": devices} for area, devices in areas.items()]
+        document = commands[0] if len(commands) == 1 else {"commands": commands}
+        body = json.dumps(document, separators=(",", ":"))
+        if self.body_bytes > len(body):
+            # Unknown keys are ignored by the device, they only cost transfer and parsing
+            document["pad"] = ""
+            padding = self.body_bytes - len(json.dumps(document, separators=(",", ":")))
+            document["pad"] = "x" * max(padding, 0)
+            body = json.dumps(document, separators=(",", ":"))
+        return body.encode()
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return float("nan")
+    index = min(len(sorted_values) - 1, int(fraction * len(sorted_values)))
+    return sorted_values[index]
+
+
+def summarize(results, elapsed):
+    latencies = sorted(r.latency * 1000 for r in results if r.error is None)
+    device = sorted(r.device_ms for r in results if r.device_ms is not None)
+    errors = {}
+    for r in results:
+        if r.error is not None:
+            errors[r.error] = errors.get(r.error, 0) + 1
+    return {
+        "requests": len(results),
+        "throughput_rps": len(results) / elapsed if elapsed > 0 else 0.0,
+        "latency_ms": {"p50": percentile(latencies, 0.50), "p99": percentile(latencies, 0.99),
+                       "p999": percentile(latencies, 0.999), "max": latencies[-1] if latencies else float("nan")},
+        "device_ms": {"p50": percentile(device, 0.50), "p99": percentile(device, 0.99)} if device else None,
+        "errors": errors,
+        "error_rate": sum(errors.values()) / len(results) if results else 0.0,
+    }
+
+
+def format_summary(name, summary):
+    latency = summary["latency_ms"]
+    line = (f"{name:<10} {summary['requests']:>7} req {summary['throughput_rps']:>8.1f} req/s  "
+            f"p50 {latency['p50']:>7.1f}  p99 {latency['p99']:>7.1f}  p999 {latency['p999']:>7.1f}  "
+            f"max {latency['max']:>7.1f} ms  errors {summary['error_rate'] * 100:.2f}%")
+    if summary["device_ms"]:
+        line += f"  device p50 {summary['device_ms']['p50']:.2f} p99 {summary['device_ms']['p99']:.2f} ms"
+    if summary["errors"]:
+        line += "  " + ", ".join(f"{kind}={count}" for kind, count in sorted(summary["errors"].items()))
+    return line
+
+
+async def discover_outputs(endpoint, timeout):
+    connection = Connection(endpoint, False, timeout)
+    status, _, body = await connection.request("GET", "/api/state")
+    if status != 200:
+        raise RuntimeError(f"/api/state answered {status}")
+    devices = json.loads(body)["devices"]
+    return [d for d in devices if d.get("type") in ("LED", "FAN")]
+
+
+async def poll_heap(endpoint, timeout):
+    connection = Connection(endpoint, False, timeout)
+    try:
+        status, _, body = await connection.request("GET", "/api/diagnostics/heap")
+        return json.loads(body) if status == 200 else None
+    except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError):
+        return None
+
+
+class LoadRun:
+    def __init__(self, args, endpoint, factory, concurrency):
+        self.args = args
+        self.endpoint = endpoint
+        self.factory = factory
+        self.concurrency = concurrency
+        self.results = []
+        self.sequence = itertools.count(1)
+        weights = dict(item.split("=") for item in args.mix.split(","))
+        self.kinds = [kind for kind, weight in weights.items() for _ in range(int(weight))]
+
+    async def one_request(self, connection, kind, started):
+        request_id = f"lg-{next(self.sequence)}"
+        headers = {"X-Request-ID": request_id}
+        try:
+            if kind == "command":
+                status, response_headers, body = await connection.request(
+                    "POST", self.factory.path, self.factory.build(), headers)
+            else:
+                status, response_headers, body = await connection.request(
+                    "GET", self.args.sensor_path, None, headers)
+        except asyncio.TimeoutError:
+            return Result(kind, time.perf_counter() - started, error="timeout", request_id=request_id)
+        except ConnectionRefusedError:
+            return Result(kind, time.perf_counter() - started, error="refused", request_id=request_id)
+        except (ConnectionError, OSError, asyncio.IncompleteReadError):
+            return Result(kind, time.perf_counter() - started, error="reset", request_id=request_id)
+
+        latency = time.perf_counter() - started
+        error = None
+        if status >= 400:
+            error = f"http{status}"
+        elif kind == "command" and application_error(body):
+            error = "command"
+        return Result(kind, latency, status, error, device_time_ms(response_headers), request_id)
+
+    async def worker(self, deadline, interval, offset):
+        connection = Connection(self.endpoint, self.args.keepalive, self.args.timeout)
+        kinds = itertools.cycle(random.sample(self.kinds, len(self.kinds)))
+        next_send = time.perf_counter() + offset
+        try:
+            while time.perf_counter() < deadline:
+                if interval:
+                    # Open loop: latency counts from the scheduled send time, so a stalled
+                    # device is not hidden by the client waiting for it (coordinated omission)
+                    delay = next_send - time.perf_counter()
+                    if delay > 0:
+                        await asyncio.sleep(delay)
+                    started = next_send
+                    next_send += interval
+                else:
+                    started = time.perf_counter()
+                self.results.append(await self.one_request(connection, next(kinds), started))
+        finally:
+            await connection.close()
+
+    async def run(self, duration):
+        start = time.perf_counter()
+        deadline = start + duration
+        interval = self.concurrency / self.args.rate if self.args.rate else 0.0
+        workers = [asyncio.create_task(self.worker(deadline, interval, interval * i / self.concurrency))
+                   for i in range(self.concurrency)]
+
+        heap_samples = []
+        reported = 0
+        reported_at = start
+        while not all(w.done() for w in workers):
+            await asyncio.sleep(min(self.args.report_every, max(deadline - time.perf_counter(), 0.1)))
+            heap = await poll_heap(self.endpoint, self.args.timeout)
+            now = time.perf_counter()
+            if heap:
+                heap_samples.append((now - start, heap))
+            window = self.results[reported:]
+            reported = len(self.results)
+            summary = summarize(window, now - reported_at)
+            reported_at = now
+            heap_text = f"  heap {heap['free']} free, {heap['largest']} largest" if heap else ""
+            print(f"[{now - start:7.1f}s] " + format_summary("interval", summary) + heap_text, flush=True)
+        await asyncio.gather(*workers)
+        return time.perf_counter() - start, heap_samples
+
+
+def heap_trend(samples):
+    """Least-squares slope of free heap in bytes per minute."""
+    if len(samples) < 3:
+        return None
+    xs = [t for t, _ in samples]
+    ys = [h["free"] for _, h in samples]
+    mean_x = sum(xs) / len(xs)
+    mean_y = sum(ys) / len(ys)
+    denominator = sum((x - mean_x) ** 2 for x in xs)
+    if denominator == 0:
+        return None
+    return sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys)) / denominator * 60
+
+
+async def main_async(args):
+    url = urlsplit(args.target)
+    endpoint = Endpoint(url.hostname, url.port or 80)
+
+    outputs = await discover_outputs(endpoint, args.timeout)
+    if not outputs and "command" in args.mix:
+        raise RuntimeError("no LED or FAN devices in /api/state to command")
+    factory = CommandFactory(outputs, args.batch, args.body_bytes, args.compact)
+    print(f"{len(outputs)} outputs, batch {args.batch}, body {len(factory.build())} bytes, "
+          f"mix {args.mix}, {'keep-alive' if args.keepalive else 'new connection per request'}")
+
+    levels = [int(level) for level in args.ramp.split(",")] if args.ramp else [args.concurrency]
+    report = []
+    failed = False
+    for concurrency in levels:
+        print(f"--- concurrency {concurrency}" + (f", {args.rate} req/s" if args.rate else ", closed loop"))
+        run = LoadRun(args, endpoint, factory, concurrency)
+        elapsed, heap_samples = await run.run(args.duration)
+
+        level = {"concurrency": concurrency, "elapsed_s": elapsed}
+        for kind in ("command", "sensors"):
+            results = [r for r in run.results if r.kind == kind]
+            if results:
+                level[kind] = summarize(results, elapsed)
+                print(format_summary(kind, level[kind]))
+        level["all"] = summarize(run.results, elapsed)
+        print(format_summary("all", level["all"]))
+
+        slowest = sorted((r for r in run.results if r.error is None), key=lambda r: r.latency, reverse=True)[:5]
+        if slowest:
+            print("slowest: " + ", ".join(f"{r.request_id} {r.latency * 1000:.1f} ms" for r in slowest))
+        if heap_samples:
+            first, last = heap_samples[0][1], heap_samples[-1][1]
+            slope = heap_trend(heap_samples)
+            level["heap"] = {"first": first, "last": last, "free_bytes_per_min": slope}
+            print(f"heap: free {first['free']} -> {last['free']}, largest {first['largest']} -> {last['largest']}, "
+                  f"min ever {last['minFree']}" + (f", trend {slope:+.0f} B/min" if slope is not None else ""))
+        if level["all"]["error_rate"] > args.max_error_rate:
+            failed = True
+        report.append(level)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("target", help="node base URL, e.g. http://192.168.1.50:2826")
+    parser.add_argument("--concurrency", type=int, default=4, help="parallel connections (default 4)")
+    parser.add_argument("--ramp", help="comma-separated concurrency levels, each run for --duration")
+    parser.add_argument("--duration", type=float, default=30, help="seconds per run (default 30)")
+    parser.add_argument("--rate", type=float, help="total requests per second (open loop); default: as fast as possible")
+    parser.add_argument("--mix", default="command=3,sensors=1", help="request mix weights (default command=3,sensors=1)")
+    parser.add_argument("--batch", type=int, default=1, help="devices per command request (default 1)")
+    parser.add_argument("--body-bytes", type=int, default=0, help="pad command bodies to this size")
+    parser.add_argument("--compact", action="store_true", help="request compact command responses")
+    parser.add_argument("--sensor-path", default="/api/state", help="sensor endpoint (default /api/state)")
+    parser.add_argument("--keepalive", action="store_true", help="reuse connections when the server allows it")
+    parser.add_argument("--timeout", type=float, default=5.0, help="per-request timeout in seconds (default 5)")
+    parser.add_argument("--report-every", type=float, default=5.0, help="interval report period in seconds (default 5)")
+    parser.add_argument("--max-error-rate", type=float, default=0.01, help="fail above this error rate (default 0.01)")
+    parser.add_argument("--json", help="write the per-level summaries to this file")
+    args = parser.parse_args()
+
+    try:
+        sys.exit(asyncio.run(main_async(args)))
+    except KeyboardInterrupt:
+        sys.exit(130)
+    except (RuntimeError, OSError) as error:
+        print(f"loadgen: {error}", file=sys.stderr)
+        sys.exit(2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Packages a firmware image for the /update endpoint.
+
+Compresses the image with gzip and prints the manifest headers the device
+checks before committing the update:
+
+    X-OTA-Size       decompressed image size
+    X-OTA-SHA256     SHA-256 of the decompressed image
+    X-OTA-Signature  signature over "<size>:<sha256 hex>" (only with --key)
+
+Usage:
+    tools/ota_package.py .pio/build/esp32dev/firmware.bin [--key ota_private.pem]
+    curl -F "firmware=@firmware.bin.gz" -H "X-OTA-Size: ..." ... http://<ip>:2826/update
+"""
+
+import argparse
+import base64
+import gzip
+import hashlib
+import subprocess
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("firmware", help="raw firmware.bin produced by the build")
+    parser.add_argument("--key", help="PEM private key matching OTA_SIGNING_PUBKEY_PEM")
+    parser.add_argument("--output", help="compressed output path (default: <firmware>.gz)")
+    args = parser.parse_args()
+
+    with open(args.firmware, "rb") as f:
+        image = f.read()
+
+    digest = hashlib.sha256(image).hexdigest()
+    manifest = f"{len(image)}:{digest}"
+
+    output = args.output or args.firmware + ".gz"
+    with open(output, "wb") as f:
+        # mtime=0 keeps the output reproducible for the same input
+        f.write(gzip.compress(image, compresslevel=9, mtime=0))
+
+    headers = [f"X-OTA-Size: {len(image)}", f"X-OTA-SHA256: {digest}"]
+    if args.key:
+        signature = subprocess.run(
+            ["openssl", "dgst", "-sha256", "-sign", args.key],
+            input=manifest.encode(), capture_output=True, check=True).stdout
+        headers.append("X-OTA-Signature: " + base64.b64encode(signature).decode())
+
+    compressed_size = len(open(output, "rb").read())
+    print(f"{output}: {len(image)} -> {compressed_size} bytes", file=sys.stderr)
+    for header in headers:
+        print(header)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Sends binary UDP control frames (include/UdpControlCodec.h) and reports the round trip.
+
+    tools/udp_control.py <ip> --key <secret> --index 0 invert
+    tools/udp_control.py <ip> --key <secret> --uuid 891647d0-e5a8-4f02-bfce-a17facfa6e5c speed 60
+    tools/udp_control.py <ip> --key <secret> --index 0 invert --count 200 --interval 0.05
+
+Sequence numbers start from the current time in milliseconds, so they keep
+increasing across runs with the same --client-id. A frame whose ack does not
+arrive within --timeout is retransmitted with the same sequence; the device runs
+it at most once.
+
+Frames carry the session nonce from the device's last ack. The first frame of a
+run (and any after the device rebooted or dropped this client) is answered with
+"resync" and a new nonce instead of running; it is then sent again with that
+nonce, so the first round trip of a run includes the resync.
+"""
+
+import argparse
+import hashlib
+import hmac
+import os
+import socket
+import statistics
+import struct
+import sys
+import time
+import uuid as uuidlib
+
+VERSION = 1
+FLAG_UUID = 0x01
+ACK_BIT = 0x80
+TAG_BYTES = 16
+ACK_BYTES = 36
+NO_DEVICE = 0xFFFF
+STATUS_RESYNC = 8
+
+OPCODES = {"set": 1, "invert": 2, "speed": 3, "query": 4}
+STATUSES = ["ok", "duplicate", "stale", "unknown device", "bad opcode", "invalid argument", "not supported",
+            "output error", "resync"]
+
+
+def tag(key, data):
+    return hmac.new(key, data, hashlib.sha256).digest()[:TAG_BYTES]
+
+
+def encode_request(key, opcode, argument, client_id, sequence, nonce, index=None, device_uuid=None):
+    flags = FLAG_UUID if device_uuid is not None else 0
+    body = struct.pack(">BBBBIII", VERSION, opcode, flags, argument, client_id, sequence, nonce)
+    body += device_uuid.bytes if device_uuid is not None else struct.pack(">H", index)
+    return body + tag(key, body)
+
+
+def decode_ack(key, frame):
+    if len(frame) != ACK_BYTES or not hmac.compare_digest(frame[-TAG_BYTES:], tag(key, frame[:-TAG_BYTES])):
+        return None
+    version, opcode, status, _, client_id, sequence, nonce, index, state = struct.unpack(">BBBBIIIHh", frame[:20])
+    if version != VERSION or not opcode & ACK_BIT:
+        return None
+    return {"opcode": opcode & ~ACK_BIT, "status": status, "clientId": client_id, "sequence": sequence,
+            "nonce": nonce, "index": index, "state": state}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("operation", choices=sorted(OPCODES))
+    parser.add_argument("argument", nargs="?", type=int, default=0, help="level 0/1 or fan speed 0-100")
+    parser.add_argument("--port", type=int, default=2827)
+    parser.add_argument("--key", default=os.environ.get("UDP_CONTROL_KEY"), help="shared secret (or $UDP_CONTROL_KEY)")
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--index", type=int, help="device index in config/devices.json order")
+    target.add_argument("--uuid", help="deviceId of the device")
+    parser.add_argument("--client-id", type=lambda v: int(v, 0), default=0x7F000001)
+    parser.add_argument("--count", type=int, default=1, help="commands to send, one after the other")
+    parser.add_argument("--interval", type=float, default=0.0, help="pause between commands, seconds")
+    parser.add_argument("--timeout", type=float, default=0.25, help="retransmit after this long, seconds")
+    parser.add_argument("--retries", type=int, default=3)
+    args = parser.parse_args()
+    if not args.key:
+        parser.error("--key is required")
+
+    key = args.key.encode()
+    device_uuid = uuidlib.UUID(args.uuid) if args.uuid else None
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.connect((args.host, args.port))
+    sock.settimeout(args.timeout)
+
+    sequence = int(time.time() * 1000) & 0xFFFFFFFF
+    nonce = 0  # Unknown until the first ack
+    rtts = []
+    lost = 0
+    for n in range(args.count):
+        sequence = (sequence + 1) & 0xFFFFFFFF
+        ack = None
+        start = time.perf_counter()
+        attempts = args.retries + 1
+        resyncs = 0
+        while attempts > 0:
+            attempts -= 1
+            sock.send(encode_request(key, OPCODES[args.operation], args.argument, args.client_id, sequence, nonce,
+                                     args.index, device_uuid))
+            try:
+                while ack is None:
+                    ack = decode_ack(key, sock.recv(64))
+                    if ack is not None and (ack["sequence"] != sequence or
+                                            (ack["status"] == STATUS_RESYNC and ack["nonce"] == nonce)):
+                        ack = None  # Late ack of an earlier retransmit, or of this one before the resync
+            except socket.timeout:
+                continue
+            if ack["status"] == STATUS_RESYNC and resyncs < 2:
+                nonce = ack["nonce"]  # Not run; send it again in the new session
+                ack = None
+                resyncs += 1
+                attempts += 1
+                continue
+            break
+        if ack is None:
+            lost += 1
+            print(f"#{n} seq {sequence}: no ack", file=sys.stderr)
+            continue
+        rtt = (time.perf_counter() - start) * 1000
+        rtts.append(rtt)
+        status = STATUSES[ack["status"]] if ack["status"] < len(STATUSES) else str(ack["status"])
+        if args.count == 1 or ack["status"] != 0:
+            device = "-" if ack["index"] == NO_DEVICE else ack["index"]
+            print(f"#{n} seq {sequence}: {status}, device {device}, state {ack['state']}, {rtt:.2f} ms")
+        if args.interval:
+            time.sleep(args.interval)
+
+    if args.count > 1 and rtts:
+        rtts.sort()
+        print(f"{len(rtts)} acked, {lost} lost; round trip ms: min {rtts[0]:.2f}, "
+              f"median {statistics.median(rtts):.2f}, p99 {rtts[min(len(rtts) - 1, int(len(rtts) * 0.99))]:.2f}, "
+              f"max {rtts[-1]:.2f}")
+    return 1 if lost else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,135 @@
+'use strict';
+// Device cards from /api/state, kept current by the /api/events stream.
+// Controls send the same JSON as any other client to /api/command/send.
+
+const devices = new Map(); // "areaId/deviceId" -> { state, element }
+const areas = document.getElementById('areas');
+const link = document.getElementById('link');
+const notice = document.getElementById('notice');
+let noticeTimer = 0;
+
+function key(state) {
+  return state.areaId + '/' + state.deviceId;
+}
+
+function notify(text) {
+  notice.textContent = text;
+  notice.hidden = false;
+  clearTimeout(noticeTimer);
+  noticeTimer = setTimeout(() => { notice.hidden = true; }, 4000);
+}
+
+async function send(areaId, deviceId, fn, parameters) {
+  try {
+    const response = await fetch('/api/command/send', {
+      method: 'POST',
+      headers: { 'Content-Type': 'application/json' },
+      body: JSON.stringify({ areaId, devices: [{ deviceId, function: fn, parameters }] }),
+    });
+    if (response.status === 503) {
+      notify('Device busy, retry in ' + (response.headers.get('Retry-After') || '1') + ' s');
+      return;
+    }
+    const result = await response.json();
+    const device = result.devices && result.devices[0];
+    if (!response.ok || !device || device.status !== 'success') {
+      notify((device && device.message) || result.message || 'Command failed');
+    }
+    // The new state arrives through the event stream, like changes made by anyone else
+  } catch (e) {
+    notify('Command failed: ' + e.message);
+  }
+}
+
+function area(areaId) {
+  let section = document.getElementById('area-' + areaId);
+  if (!section) {
+    section = document.createElement('section');
+    section.id = 'area-' + areaId;
+    const title = document.createElement('h2');
+    title.textContent = areaId;
+    section.appendChild(title);
+    areas.appendChild(section);
+  }
+  return section;
+}
+
+function control(state) {
+  const on = state.power_state === 'on';
+  if (state.type === 'LED') {
+    const button = document.createElement('button');
+    button.textContent = on ? 'On' : 'Off';
+    button.className = on ? 'on' : '';
+    button.onclick = () => send(state.areaId, state.deviceId, 'toggle', { state: !on });
+    return button;
+  }
+  if (state.type === 'FAN') {
+    const wrap = document.createElement('span');
+    const slider = document.createElement('input');
+    slider.type = 'range';
+    slider.min = 0;
+    slider.max = 100;
+    slider.step = 10;
+    slider.value = state.fan_speed || 0;
+    slider.onchange = () => send(state.areaId, state.deviceId, 'setspeed', { speed: Number(slider.value) });
+    const value = document.createElement('span');
+    value.className = state.stalled ? 'value error' : 'value';
+    value.textContent = ' ' + (state.fan_speed || 0) + '%' + (state.rpm !== undefined ? ' ' + state.rpm + ' rpm' : '');
+    wrap.append(slider, value);
+    return wrap;
+  }
+  const value = document.createElement('span');
+  value.className = 'value';
+  if (state.type === 'DHT11') {
+    if (state.status === 'error') {
+      value.className = 'value error';
+      value.textContent = 'sensor error';
+    } else {
+      value.textContent = state.temperature_celsius.toFixed(1) + ' °C  ' + state.humidity_percent.toFixed(0) + ' %';
+    }
+  } else if (state.type === 'PIR') {
+    value.className = state.motion_detected ? 'value motion' : 'value';
+    value.textContent = state.motion_detected ? 'motion' : 'clear';
+  }
+  return value;
+}
+
+function render(state) {
+  let entry = devices.get(key(state));
+  if (!entry) {
+    const element = document.createElement('div');
+    element.className = 'device';
+    area(state.areaId).appendChild(element);
+    entry = { element };
+    devices.set(key(state), entry);
+  }
+  entry.state = state;
+  const name = document.createElement('span');
+  name.textContent = state.deviceId;
+  entry.element.replaceChildren(name, control(state));
+}
+
+async function loadSnapshot() {
+  const response = await fetch('/api/state', { cache: 'no-cache' });
+  if (!response.ok) {
+    throw new Error('/api/state answered ' + response.status);
+  }
+  (await response.json()).devices.forEach(render);
+}
+
+function connect() {
+  const events = new EventSource('/api/events');
+  events.addEventListener('hello', () => {
+    link.textContent = 'live';
+    link.className = 'link';
+    // Changes missed while disconnected are not replayed: resync from the snapshot
+    loadSnapshot().catch((e) => notify(e.message));
+  });
+  events.addEventListener('device', (event) => render(JSON.parse(event.data)));
+  events.onerror = () => {
+    link.textContent = 'offline';
+    link.className = 'link down'; // EventSource reconnects by itself
+  };
+}
+
+connect();